@@ -1,10 +1,19 @@
 #include <CUsage.h>
+#include <CUsageHistory.h>
+#include <CUsagePartial.h>
+#include <CUsageProcScan.h>
+#include <CUsageProfile.h>
+#include <CUsageThrottle.h>
 #include <CFileUtil.h>
 
 #include <cstring>
 #include <cstdio>
 #include <algorithm>
 #include <iostream>
+#include <csignal>
+#include <cstdint>
+#include <unistd.h>
+#include <pwd.h>
 
 /*------------------------------------------------------------------
  *
@@ -12,24 +21,41 @@
  * usage, for each of a list of directories.
  *
  * Usage:
- *   CUsage [-h] [-o <l|s|o|n|d|c>] [-n <num_files>] [-nl <num_files>] [-ns <num_files>]
+ *   CUsage [-h] [-o <l|s|o|n|d|t|i|D|c>] [-n <num_files>] [-nl <num_files>] [-ns <num_files>]
  *          [-no <num_files>] [-nn <num_files>] [-da] [-dc] [-dm] [-tg] [-tm] [-tk] [-tb]
- *          [-s] [-sl] [-S] [-L] [-H] [-mp <pattern>] [-mn <pattern>]
- *          [-p <days>][<dir> ...]
+ *          [-s] [-sl] [-S] [-L] [-x] [-H] [-mp <pattern>] [-mn <pattern>]
+ *          [-p <days>] [-where <expr>] [-j <num_threads>] [--dev-threads <n>]
+ *          [-depth <n>] [--progress] [--progress-file <file>] [--max-ops <n>]
+ *          [--max-read-bytes <n>]
+ *          [--throttle-file <file>] [--background] [--checkpoint <file>]
+ *          [--checkpoint-interval <secs>] [--resume <file>] [--sample <fraction>]
+ *          [--sample-dirs <fraction>] [--seed <n>] [--cold <days>] [--save <file>]
+ *          [--merge] [--procs <n>] [--proc-timeout <secs>] [--pipeline <depth>]
+ *          [--pipeline-stats] [--rank <range>] [--rank-by <l|s|o|n>]
+ *          [--rank-mem <MB>] [--history <file>] [--history-depth <n>]
+ *          [--from0 <file|->] [--from0-sort] [--inode-order] [--leaf-nlink]
+ *          [--profile] [<dir> ...]
+ *   CUsage --history-query <file> [--history-days <n>] [-n <num>] [<dir> ...]
  *
  *   -h               Displays this help text.
- *   -o <l|s|o|n|d|c> Display the selected lists :-
+ *   -o <l|s|o|n|d|t|i|D|c>
+ *                    Display the selected lists :-
  *                      l - Display Largest Files
  *                      s - Display Smallest Files
  *                      o - Display Oldest Files
  *                      n - Display Newest Files
  *                      d - Display Directories (largest first)
+ *                      t - Display Slowest Directories (readdir + stat time)
+ *                          and Directories with Most Entries
+ *                      i - Display Total Entries and Directories with Most Entries
+ *                          (directly in them and below them)
+ *                      D - Display Duplicate Files (most wasted space first)
  *                      c - Display Count
  *                    These options can be used in combination e.g. '-o lo' would
  *                    display the largest and oldest files.
  *                    By default none of these lists will be displayed.
- *   -n  <num_files>  Sets the number of the files displayed for all lists <num_files>
- *                    instead of the default 40.
+ *   -n  <num_files>  Sets the number of the files (or directories) displayed for all
+ *                    lists to <num_files> instead of the default 40.
  *   -nl <num_files>  Sets the number of the largest files displayed to <num_files>
  *                    instead of the the default 40.
  *   -ns <num_files>  Sets the number of the smallest files displayed to <num_files>
@@ -48,7 +74,8 @@
  *   -s               Display Output in short form for easy batch processing.
  *   -sl              Display Output in short line form for easy batch processing.
  *   -S               Display Output in stream form for feeding into other commands
- *   -L               Follow links
+ *   -L               Follow links (each directory is read once, link loops are listed)
+ *   -x               Stay on the directory's file system (skip and list mount points)
  *   -H               Ignore hidden (dot files)
  *   -mp <pattern>    Only display files matching pattern
  *   -mn <pattern>    Only display files not matching pattern
@@ -59,6 +86,80 @@
  *                      core  - core files
  *                      image - image files
  *   -p <days>        Number of days in the past to check
+ *   -where <expr>    Only display files matching expression e.g.
+ *                      'size > 1G && mtime < -30d && name ~ "*.log" && uid != 0'
+ *                    (see CUsageFilter.h for fields and values)
+ *   -j <num_threads> Scan each directory with <num_threads> threads (default 1)
+ *   --dev-threads <n>
+ *                    Read directories of any one device with at most <n> threads
+ *   -depth <n>       Display total size, file count and entry count of each
+ *                    directory up to <n> levels below the directory (as du --max-depth)
+ *   --progress       Display scan progress on stderr once a second
+ *   --progress-file <file>
+ *                    Write scan progress as JSON to <file> once a second
+ *   --max-ops <n>    Limit metadata operations (opendir, lstat, stat) to <n> per second
+ *   --max-read-bytes <n>
+ *                    Limit directory entry bytes read to <n> per second
+ *   --throttle-file <file>
+ *                    Re-read limits once a second from <file> ('<ops> [<bytes>]').
+ *                    SIGUSR1 halves and SIGUSR2 doubles the limits (with --procs
+ *                    signal the parent, which passes them on to the workers).
+ *   --background     Scan with idle I/O priority and lowest CPU priority
+ *   --checkpoint <file>
+ *                    Write scan state to <file> periodically (removed when the scan
+ *                    completes)
+ *   --checkpoint-interval <secs>
+ *                    Seconds between checkpoints (default 60)
+ *   --resume <file>  Resume scan of the checkpoint's directory from <file> (only
+ *                    directories not already read are read)
+ *   --sample <fraction>
+ *                    Estimate totals (with 95% confidence intervals) by stat'ing only
+ *                    <fraction> of the files of each directory
+ *   --sample-dirs <fraction>
+ *                    Sample mode reading only <fraction> of the sub directories
+ *   --seed <n>       Seed of sample selection (default random)
+ *   --cold <days>    Display largest files with date type time (-da, -dc, -dm) more
+ *                    than <days> days ago, with cold bytes per directory and owner
+ *   --save <file>    Save results of all directories to partial result file <file>
+ *   --merge          Merge partial result files (the arguments) and output the
+ *                    results of a single scan of all their directories (files must
+ *                    have been scanned with the same filter options)
+ *   --procs <n>      Scan the directories in <n> worker processes
+ *   --proc-timeout <secs>
+ *                    Kill a worker whose directory has scanned for more than <secs>
+ *                    seconds (the directory is output as incomplete)
+ *   --pipeline <depth>
+ *                    Pass entries read by the scan threads, through a queue of
+ *                    <depth> batches, to a separate thread which totals them
+ *   --pipeline-stats Display batch count, queue depth and thread waits of the
+ *                    pipeline on stderr after each directory
+ *   --rank <range>   Display the files of rank range <range> (ranks or percentages,
+ *                    e.g. '10000-20000' or '-1%') of all files ranked in --rank-by order
+ *   --rank-by <l|s|o|n>
+ *                    Rank files largest, smallest, oldest or newest first (default l)
+ *   --rank-mem <MB>  Memory used for ranking before records are spilled to temporary
+ *                    files (default 256)
+ *   --history <file> Append totals of the directories down to --history-depth (default
+ *                    1) to history file <file> (incomplete scans aren't added)
+ *   --history-depth <n>
+ *                    Depth of directories added to history
+ *   --history-query <file>
+ *                    Display directories with most growth over the time window (or
+ *                    totals of each listed directory in each run of the window)
+ *   --history-days <n>
+ *                    Days of history query time window (default 90)
+ *   --from0 <file|->
+ *                    Scan the NUL separated paths of <file> (or stdin), e.g. from
+ *                    'find -print0', instead of directories (they are not walked)
+ *   --from0-sort     Stat the listed paths grouped by directory (in name order)
+ *   --inode-order    Read all entries of each directory then stat them in inode
+ *                    number order (fewer seeks with cold caches on ext4/XFS)
+ *   --leaf-nlink     Use directory link counts to skip stats of files (sample mode)
+ *                    once all sub directories have been found (file systems which
+ *                    don't return entry types)
+ *   --profile        Display time spent in each scan phase, system call counts,
+ *                    peak RSS and allocation counts on exit (requires build with
+ *                    'make PROFILE=1')
  *   -r               Reverse comparison
  *   <dir> ...        List of directories to process instead of the default current directory.
  *
@@ -68,16 +169,198 @@
  *
  *------------------------------------------------------------------*/
 
-int
-main(int argc, char **argv)
-{
-  CUsage usage;
-
-  usage.processOptions(argc, argv);
-
-  usage.process();
+namespace {
+
+const char *
+usage_str[] = {
+  "Description :-",
+  "  Displays a list of the largest/smallest and/or oldest/newest files, and total space",
+  "  usage, for each of a list of directories.",
+  "",
+  "Usage :-",
+  "  CUsage [-h] [-o <l|s|o|n>] [-n <num_files>] [-nl <num_files>] [-ns <num_files>]",
+  "         [-no <num_files>] [-nn <num_files>] [-da] [-dc] [-dm] [-tg] [-tm] [-tk] [-tb]",
+  "         [-s] [-sl] [-S] [-L] [-x] [-H] [-mp <pattern>] [-mn <pattern>]",
+  "         [-p <days>] [-where <expr>] [-j <num_threads>] [--dev-threads <n>]",
+  "         [-depth <n>] [--progress] [--progress-file <file>] [--max-ops <n>]",
+  "         [--max-read-bytes <n>]",
+  "         [--throttle-file <file>] [--background] [--checkpoint <file>]",
+  "         [--checkpoint-interval <secs>] [--resume <file>] [--sample <fraction>]",
+  "         [--sample-dirs <fraction>] [--seed <n>] [--cold <days>] [--save <file>]",
+  "         [--merge] [--procs <n>] [--proc-timeout <secs>] [--pipeline <depth>]",
+  "         [--pipeline-stats] [--rank <range>] [--rank-by <l|s|o|n>]",
+  "         [--rank-mem <MB>] [--history <file>] [--history-depth <n>]",
+  "         [--from0 <file|->] [--from0-sort] [--inode-order] [--leaf-nlink]",
+  "         [--profile] [<dir> ...]",
+  "  CUsage --merge [<options>] <file> ...",
+  "  CUsage --history-query <file> [--history-days <n>] [-n <num>] [<dir> ...]",
+  "",
+  "    -h               Displays this help text.",
+  "    -o <l|s|o|n|d|t|i|D|c>",
+  "                     Display the selected lists :-",
+  "                       l - Display Largest Files",
+  "                       s - Display Smallest Files",
+  "                       o - Display Oldest Files",
+  "                       n - Display Newest Files",
+  "                       d - Display Directories",
+  "                       t - Display Slowest Directories (readdir + stat time)",
+  "                           and Directories with Most Entries",
+  "                       i - Display Total Entries and Directories with Most",
+  "                           Entries directly in them and below them",
+  "                       D - Display Duplicate Files (same size and contents, hard",
+  "                           links excluded) with the space wasted by each group",
+  "                       c - Display Count",
+  "                     These options can be used in combination e.g. \'-o lo\' would",
+  "                     display the largest and oldest files.",
+  "                     By default none of these lists will be displayed.",
+  "    -n  <num_files>  Sets the number of the files (or directories) displayed for all",
+  "                     lists to <num_files> instead of the default 40.",
+  "    -nl <num_files>  Sets the number of the largest files displayed to <num_files>",
+  "                     instead of the the default 40.",
+  "    -ns <num_files>  Sets the number of the smallest files displayed to <num_files>",
+  "                     instead of the the default 40.",
+  "    -no <num_files>  Sets the number of the oldest files displayed to <num_files>",
+  "                     instead of the the default 40.",
+  "    -nn <num_files>  Sets the number of the newest files displayed to <num_files>",
+  "                     instead of the the default 40.",
+  "    -da              Uses the Last Access Time for date comparison.",
+  "    -dc              Uses the Last Change Time for date comparison.",
+  "    -dm              Uses the Last Modify Time for date comparison. (Default)",
+  "    -tg              Output the Total as Gigabytes.",
+  "    -tm              Output the Total as Megabytes.",
+  "    -tk              Output the Total as Kilobytes.",
+  "    -tb              Output the Total as bytes.",
+  "    -s               Display Output in short form for easy batch processing.",
+  "    -sl              Display Output in short line form for easy batch processing.",
+  "    -S               Display Output in stream form for easy feeding to other commands.",
+  "    -L               Follow links (each directory is only read once and links to a",
+  "                     directory containing them are listed as loops)",
+  "    -x               Stay on the directory's file system (skip and list mount points).",
+  "    -H               Ignore hidden (dot files)",
+  "    -mp <pattern>    Only display files matching pattern",
+  "    -mn <pattern>    Only display files not matching pattern",
+  "    -mt <type>       Only display files matching type :=",
+  "                       exe   - executable files",
+  "                       elf   - ELF files",
+  "                       obj   - object files",
+  "                       core  - core files",
+  "                       image - image files",
+  "    -p <days>        Number of days in the past to check",
+  "    -where <expr>    Only display files matching expression of comparisons of fields",
+  "                     combined with &&, || and ! and grouped with (), e.g.",
+  "                       'size > 1G && mtime < -30d && name ~ \"*.log\" && uid != 0'",
+  "                     Fields :-",
+  "                       size, blocks, nlink, ino, depth - numbers (size can have",
+  "                                                         K, M, G, T or P suffix)",
+  "                       atime, mtime, ctime - seconds, YYYY-MM-DD[THH:MM[:SS]] or",
+  "                                             offset from now (e.g. -30d, -2h, -1y)",
+  "                       uid, gid            - number or name",
+  "                       perm                - octal permissions",
+  "                       type                - f, d, l, b, c, p or s",
+  "                       name, path          - base name or path (== or glob ~ match)",
+  "                     Comparisons are ==, !=, <, <=, >, >=, ~ and !~.",
+  "    -j <num_threads> Scan each directory with <num_threads> threads (default 1).",
+  "    --dev-threads <n>",
+  "                     Read directories of any one device with at most <n> threads, so",
+  "                     slow file systems don't hold up the others (default no limit).",
+  "    -depth <n>       Display total size, file count and entry count of each directory",
+  "                     up to <n> levels below the directory (as du --max-depth).",
+  "    --progress       Display scan progress (entries, rate, bytes, pending directories",
+  "                     and current directory) on stderr once a second.",
+  "    --progress-file <file>",
+  "                     Write scan progress as JSON to <file> once a second.",
+  "    --max-ops <n>    Limit metadata operations (opendir, lstat, stat) to <n> per second.",
+  "    --max-read-bytes <n>",
+  "                     Limit directory entry bytes read to <n> per second.",
+  "    --throttle-file <file>",
+  "                     Re-read limits once a second from <file> ('<ops> [<bytes>]').",
+  "                     SIGUSR1 halves and SIGUSR2 doubles the limits while scanning",
+  "                     (with --procs signal the parent, which passes them on to the",
+  "                     workers). With --procs the limits are shared by the workers.",
+  "    --background     Scan with idle I/O priority and lowest CPU priority.",
+  "    --checkpoint <file>",
+  "                     Write scan state (totals, lists and unread directories) to <file>",
+  "                     periodically. The file is removed when the scan completes.",
+  "    --checkpoint-interval <secs>",
+  "                     Seconds between checkpoints (default 60).",
+  "    --resume <file>  Resume the scan of the checkpoint's directory from <file> (only",
+  "                     directories not already read are read, options must match).",
+  "    --sample <fraction>",
+  "                     Estimate totals by stat'ing only <fraction> of the files of each",
+  "                     directory. Outputs estimated usage, file and directory counts",
+  "                     and file size distribution with 95% confidence intervals.",
+  "    --sample-dirs <fraction>",
+  "                     Sample mode reading only <fraction> of the sub directories.",
+  "    --seed <n>       Seed of sample selection (default random, output with estimates).",
+  "    --cold <days>    Display largest cold files, whose date type time (-da, -dc, -dm) is",
+  "                     more than <days> days ago, and the cold bytes of the directories",
+  "                     with most cold bytes and of each owner.",
+  "    --save <file>    Save the results of all directories to partial result file <file>",
+  "                     (binary) so they can be merged with those of other runs.",
+  "    --merge          Merge partial result files (given instead of directories) and",
+  "                     output the results a single scan of all their directories would",
+  "                     have output. The partial results must have been saved with the",
+  "                     selected lists (at least as long), the same date type and the",
+  "                     same filter options (-where, -mp, -mn, -mt, -H, -p), which",
+  "                     can't be given with --merge.",
+  "    --procs <n>      Scan the directories in <n> worker processes (so a hung mount",
+  "                     only holds up its own directory).",
+  "    --proc-timeout <secs>",
+  "                     Kill a worker whose directory has been scanning for more than",
+  "                     <secs> seconds and output the directory as incomplete.",
+  "    --pipeline <depth>",
+  "                     Only read directories in the scan threads and pass the entries, in",
+  "                     batches of 256 through a queue of <depth> batches, to a separate",
+  "                     thread which totals them and updates the lists.",
+  "    --pipeline-stats Display batch count, queue depth and the waits of the scan and",
+  "                     totalling threads (for tuning <depth>) on stderr after each",
+  "                     directory.",
+  "    --rank <range>   Display the files of rank range <range> of all (matching) files",
+  "                     ranked by --rank-by order. Each end of '<from>-<to>' (either",
+  "                     can be left out) is a rank or a percentage of the files, e.g.",
+  "                     '10000-20000', '-1%' (the first 1%) or '50%-' (the second half).",
+  "    --rank-by <l|s|o|n>",
+  "                     Rank the files largest, smallest, oldest or newest first",
+  "                     (default l).",
+  "    --rank-mem <MB>  Memory used for ranking before file records are sorted and",
+  "                     spilled to temporary files in $TMPDIR (default 256).",
+  "    --history <file> Append the totals of each directory down to --history-depth",
+  "                     levels below the directories (default 1) to history file <file>.",
+  "                     The totals of incomplete scans aren't added.",
+  "    --history-depth <n>",
+  "                     Depth of the directories whose totals are added to the history.",
+  "    --history-query <file>",
+  "                     Display the directories of history file <file> with most growth",
+  "                     over the runs in the time window or, if directories are given,",
+  "                     their totals in each run of the window.",
+  "    --history-days <n>",
+  "                     Days (back from now) of history query time window (default 90).",
+  "    --from0 <file|->",
+  "                     Scan the NUL separated paths of <file> ('-' for stdin), e.g. from",
+  "                     'find -print0' or a backup catalog, instead of directories. The",
+  "                     paths are stat'ed (directories are not walked) and totalled below",
+  "                     their parent directories.",
+  "    --from0-sort     Stat the listed paths grouped by directory, in name order, rather",
+  "                     than in list order.",
+  "    --inode-order    Read all entries of each directory before stat'ing them and",
+  "                     stat them in inode number order, so the inode tables of file",
+  "                     systems like ext4 and XFS are read in disk order (faster on",
+  "                     spinning disks with cold caches).",
+  "    --leaf-nlink     Use directory link counts to find directories with no more sub",
+  "                     directories (only used to skip stats in sample mode). For file",
+  "                     systems which don't return entry types but whose directory link",
+  "                     counts are 2 + sub directories.",
+  "    --profile        Display time spent in each scan phase, system call counts,",
+  "                     peak RSS and allocation counts on exit (requires build with",
+  "                     'make PROFILE=1').",
+  "    <dir> ...        List of directories to process instead of the default current directory.",
+  "",
+  "Notes :-",
+  "  The '-tg', '-tm', '-tk' and '-tb' options can be combined to select any combination of",
+  "  totals, by default all sizes are shown which is the same as specifying '-tg -tm -tk -tb'.",
+  "",
+};
 
-  exit(0);
 }
 
 CUsage::
@@ -85,6 +368,13 @@ CUsage()
 {
 }
 
+CUsage::
+~CUsage()
+{
+  delete progress;
+  delete throttle;
+}
+
 bool
 CUsage::
 processOptions(int argc, char **argv)
@@ -102,17 +392,20 @@ processOptions(int argc, char **argv)
 
           break;
         }
-        // -o <l|s|o|n|d|c>
+        // -o <l|s|o|n|d|t|i|D|c>
         case 'o': {
           if (i < argc - 1) {
             for (int j = 0; j < int(strlen(argv[i + 1])); j++) {
               switch (argv[i + 1][j]) {
-                case 'l': display_largest  = true; break;
-                case 's': display_smallest = true; break;
-                case 'o': display_oldest   = true; break;
-                case 'n': display_newest   = true; break;
-                case 'd': display_dirs     = true; break;
-                case 'c': display_count    = true; break;
+                case 'l': options.display_largest   = true; break;
+                case 's': options.display_smallest  = true; break;
+                case 'o': options.display_oldest    = true; break;
+                case 'n': options.display_newest    = true; break;
+                case 'd': options.display_dirs      = true; break;
+                case 't': options.display_dir_times = true; break;
+                case 'i': options.display_inodes    = true; break;
+                case 'D': options.display_dups      = true; break;
+                case 'c': display_count             = true; break;
                 default:
                   error("Invalid Output List Specifier \'%c\'", argv[i + 1][j]);
                   break;
@@ -135,15 +428,20 @@ processOptions(int argc, char **argv)
               int num_files1 = atoi(argv[i + 1]);
 
               if      (argv[i][2] == '\0') {
-                num_largest  = uint(num_files1);
-                num_smallest = uint(num_files1);
-                num_oldest   = uint(num_files1);
-                num_newest   = uint(num_files1);
+                options.num_largest    = uint(num_files1);
+                options.num_smallest   = uint(num_files1);
+                options.num_oldest     = uint(num_files1);
+                options.num_newest     = uint(num_files1);
+                options.num_dir_times  = uint(num_files1);
+                options.num_inode_dirs = uint(num_files1);
+                options.num_dups       = uint(num_files1);
+                options.num_cold       = uint(num_files1);
+                num_history_dirs       = uint(num_files1);
               }
-              else if (argv[i][2] == 'l') num_largest  = uint(num_files1);
-              else if (argv[i][2] == 's') num_smallest = uint(num_files1);
-              else if (argv[i][2] == 'o') num_oldest   = uint(num_files1);
-              else if (argv[i][2] == 'n') num_newest   = uint(num_files1);
+              else if (argv[i][2] == 'l') options.num_largest  = uint(num_files1);
+              else if (argv[i][2] == 's') options.num_smallest = uint(num_files1);
+              else if (argv[i][2] == 'o') options.num_oldest   = uint(num_files1);
+              else if (argv[i][2] == 'n') options.num_newest   = uint(num_files1);
 
               ++i;
             }
@@ -155,11 +453,17 @@ processOptions(int argc, char **argv)
 
           break;
         }
-        // da, dc, dm
+        // da, dc, dm, depth
         case 'd': {
-          if      (argv[i][2] == 'a') date_type = CUsageDateType::LAST_ACCESSED;
-          else if (argv[i][2] == 'c') date_type = CUsageDateType::LAST_CHANGED;
-          else if (argv[i][2] == 'm') date_type = CUsageDateType::LAST_MODIFIED;
+          if      (strcmp(&argv[i][1], "depth") == 0) {
+            if (i < argc - 1)
+              options.max_depth = std::max(atoi(argv[++i]), 0);
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (argv[i][2] == 'a') options.date_type = CUsageDateType::LAST_ACCESSED;
+          else if (argv[i][2] == 'c') options.date_type = CUsageDateType::LAST_CHANGED;
+          else if (argv[i][2] == 'm') options.date_type = CUsageDateType::LAST_MODIFIED;
           else
             error("Invalid Date Specifier for \'%s\' Option", "-d[a|c|m]");
 
@@ -184,27 +488,28 @@ processOptions(int argc, char **argv)
             short_form = true;
 
           break;
-        case 'S': stream_form   = true; break;
-        case 'L': follow_links  = true; break;
-        case 'H': ignore_hidden = true; break;
-        case 'r': reverse       = true; break;
+        case 'S': stream_form             = true; break;
+        case 'L': options.follow_links    = true; break;
+        case 'x': options.one_file_system = true; break;
+        case 'H': options.ignore_hidden   = true; break;
+        case 'r': options.reverse         = true; break;
         // mp, mn
         case 'm': {
           if      (argv[i][2] == 'p') {
             if (i < argc - 1)
-              match_pattern = argv[++i];
+              options.match_pattern = argv[++i];
             else
               error("Missing pattern for \'%s\' Option", argv[i]);
           }
           else if (argv[i][2] == 'n') {
             if (i < argc - 1)
-              no_match_pattern = argv[++i];
+              options.no_match_pattern = argv[++i];
             else
               error("Missing pattern for \'%s\' Option", argv[i]);
           }
           else if (argv[i][2] == 't') {
             if (i < argc - 1)
-              match_type = argv[++i];
+              options.match_type = argv[++i];
             else
               error("Missing pattern for \'%s\' Option", argv[i]);
           }
@@ -216,12 +521,225 @@ processOptions(int argc, char **argv)
         // p
         case 'p': {
           if (i < argc - 1)
-            num_days = atoi(argv[++i]);
+            options.num_days = atoi(argv[++i]);
+          else
+            error("Missing value for \'%s\' Option", argv[i]);
+
+          break;
+        }
+        // where
+        case 'w': {
+          if (strcmp(&argv[i][1], "where") == 0) {
+            if (i < argc - 1)
+              options.where = argv[++i];
+            else
+              error("Missing expression for \'%s\' Option", argv[i]);
+          }
+          else
+            error("Invalid Option \'%s\'", argv[i]);
+
+          break;
+        }
+        // j
+        case 'j': {
+          if (i < argc - 1)
+            options.num_threads = uint(std::max(atoi(argv[++i]), 0));
           else
             error("Missing value for \'%s\' Option", argv[i]);
 
           break;
         }
+        // --progress, --progress-file, --profile, --dev-threads, --max-ops,
+        // --max-read-bytes, --throttle-file, --background, --checkpoint,
+        // --checkpoint-interval, --resume, --sample, --sample-dirs, --seed, --cold,
+        // --save, --merge, --procs, --proc-timeout, --pipeline, --pipeline-stats,
+        // --rank, --rank-by, --rank-mem, --history, --history-depth, --history-query,
+        // --history-days, --from0, --from0-sort, --inode-order, --leaf-nlink
+        case '-': {
+          if      (strcmp(&argv[i][2], "progress") == 0)
+            show_progress = true;
+          else if (strcmp(&argv[i][2], "progress-file") == 0) {
+            if (i < argc - 1)
+              progress_file = argv[++i];
+            else
+              error("Missing filename for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "profile") == 0) {
+            if (CUSAGE_PROFILE_ENABLED)
+              profile = true;
+            else
+              error("Profiling not available (build with \'make PROFILE=1\')");
+          }
+          else if (strcmp(&argv[i][2], "dev-threads") == 0) {
+            if (i < argc - 1)
+              options.dev_threads = uint(std::max(atoi(argv[++i]), 0));
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "max-ops") == 0) {
+            if (i < argc - 1)
+              max_ops = std::max(atof(argv[++i]), 0.0);
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "max-read-bytes") == 0) {
+            if (i < argc - 1)
+              max_read_bytes = std::max(atof(argv[++i]), 0.0);
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "throttle-file") == 0) {
+            if (i < argc - 1)
+              throttle_file = argv[++i];
+            else
+              error("Missing filename for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "background") == 0)
+            options.background = true;
+          else if (strcmp(&argv[i][2], "checkpoint") == 0) {
+            if (i < argc - 1)
+              options.checkpoint_file = argv[++i];
+            else
+              error("Missing filename for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "checkpoint-interval") == 0) {
+            if (i < argc - 1)
+              options.checkpoint_interval = atoi(argv[++i]);
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "resume") == 0) {
+            if (i < argc - 1)
+              options.resume_file = argv[++i];
+            else
+              error("Missing filename for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "sample") == 0) {
+            if (i < argc - 1)
+              options.sample_fraction = atof(argv[++i]);
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "sample-dirs") == 0) {
+            if (i < argc - 1)
+              options.sample_dir_fraction = atof(argv[++i]);
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "seed") == 0) {
+            if (i < argc - 1) {
+              options.sample_seed = strtoull(argv[++i], nullptr, 10);
+
+              sample_seed_set = true;
+            }
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "save") == 0) {
+            if (i < argc - 1)
+              save_file = argv[++i];
+            else
+              error("Missing filename for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "merge") == 0)
+            merge_partials = true;
+          else if (strcmp(&argv[i][2], "procs") == 0) {
+            if (i < argc - 1)
+              num_procs = uint(std::max(atoi(argv[++i]), 1));
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "proc-timeout") == 0) {
+            if (i < argc - 1)
+              proc_timeout = std::max(atoi(argv[++i]), 0);
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "pipeline") == 0) {
+            if (i < argc - 1)
+              options.pipeline_depth = uint(std::max(atoi(argv[++i]), 0));
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "pipeline-stats") == 0)
+            pipeline_stats = true;
+          else if (strcmp(&argv[i][2], "rank") == 0) {
+            if (i < argc - 1)
+              options.rank_range = argv[++i];
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "rank-by") == 0) {
+            if (i < argc - 1) {
+              ++i;
+
+              if      (strcmp(argv[i], "l") == 0)
+                options.rank_key = CUsageRankKey::LARGEST;
+              else if (strcmp(argv[i], "s") == 0)
+                options.rank_key = CUsageRankKey::SMALLEST;
+              else if (strcmp(argv[i], "o") == 0)
+                options.rank_key = CUsageRankKey::OLDEST;
+              else if (strcmp(argv[i], "n") == 0)
+                options.rank_key = CUsageRankKey::NEWEST;
+              else
+                error("Invalid Rank Order \'%s\'", argv[i]);
+            }
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "rank-mem") == 0) {
+            if (i < argc - 1)
+              options.rank_mem_limit = size_t(std::max(atol(argv[++i]), 0L)) << 20;
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "history") == 0) {
+            if (i < argc - 1)
+              history_file = argv[++i];
+            else
+              error("Missing filename for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "history-depth") == 0) {
+            if (i < argc - 1)
+              history_depth = std::max(atoi(argv[++i]), 0);
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "history-query") == 0) {
+            if (i < argc - 1)
+              history_query_file = argv[++i];
+            else
+              error("Missing filename for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "history-days") == 0) {
+            if (i < argc - 1)
+              history_days = std::max(atoi(argv[++i]), 0);
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "from0") == 0) {
+            if (i < argc - 1)
+              options.from_list = argv[++i];
+            else
+              error("Missing filename for \'%s\' Option", argv[i]);
+          }
+          else if (strcmp(&argv[i][2], "from0-sort") == 0)
+            options.from_list_sort = true;
+          else if (strcmp(&argv[i][2], "inode-order") == 0)
+            options.inode_order = true;
+          else if (strcmp(&argv[i][2], "leaf-nlink") == 0)
+            options.leaf_nlink = true;
+          else if (strcmp(&argv[i][2], "cold") == 0) {
+            if (i < argc - 1)
+              options.cold_days = std::max(atoi(argv[++i]), 0);
+            else
+              error("Missing value for \'%s\' Option", argv[i]);
+          }
+          else
+            error("Invalid Option \'%s\'", argv[i]);
+
+          break;
+        }
         default:
           error("Invalid Option \'%s\'", argv[i]);
 
@@ -242,869 +760,1385 @@ void
 CUsage::
 process()
 {
-  uint num_directories = uint(directory_list.size());
-
-  if (num_directories == 0)
-    directory_list.push_back(DEFAULT_DIRECTORY);
-
-  if (num_largest <= 0 || num_largest > 1000) {
-    error("Invalid value for number of largest files - %d", num_largest);
-    exit(1);
-  }
-
-  if (num_smallest <= 0 || num_smallest > 1000) {
-    error("Invalid value for number of smallest files - %d", num_smallest);
-    exit(1);
-  }
+  init();
 
-  if (num_oldest <= 0 || num_oldest > 1000) {
-    error("Invalid value for number of oldest files - %d", num_oldest);
-    exit(1);
+  if (history_query_file != "") {
+    queryHistory();
+    return;
   }
 
-  if (num_newest <= 0 || num_newest > 1000) {
-    error("Invalid value for number of newest files - %d", num_newest);
-    exit(1);
-  }
+  //------------
 
-  if (match_pattern != "") {
-    match_regex = new CRegExp(match_pattern);
+  /* Start Progress Reporting if Requested */
 
-    match_regex->setExtended(true);
-    match_regex->setMatchBOL(false);
-    match_regex->setMatchEOL(false);
-  }
-  else
-    match_regex = nullptr;
+  if (show_progress || progress_file != "") {
+    progress = new CUsageProgress;
 
-  if (no_match_pattern != "") {
-    no_match_regex = new CRegExp(no_match_pattern);
+    progress->setShow(show_progress);
+    progress->setFilename(progress_file);
 
-    no_match_regex->setExtended(true);
-    no_match_regex->setMatchBOL(false);
-    no_match_regex->setMatchEOL(false);
+    progress->start();
   }
-  else
-    no_match_regex = nullptr;
 
   //------------
 
-  /* Get Max Directory Length */
+  /* Create Throttle if Requested (SIGUSR1/SIGUSR2 halve/double the limits) */
 
-  max_directory_length = 1;
+  if (max_ops > 0.0 || max_read_bytes > 0.0 || throttle_file != "") {
+    throttle = new CUsageThrottle;
 
-  num_directories = uint(directory_list.size());
+    // worker processes (--procs) each get a share of the limits when started
+    throttle->setOpsRate    (max_ops);
+    throttle->setBytesRate  (max_read_bytes);
+    throttle->setControlFile(throttle_file);
 
-  for (uint i = 0; i < num_directories; ++i)
-    max_directory_length = std::max(max_directory_length, uint(directory_list[i].size()));
+    struct sigaction action;
 
-  //------------
+    memset(&action, 0, sizeof(action));
 
-  /* Get Current Time */
+    action.sa_flags = SA_RESTART;
 
-  current_time = time(nullptr);
+    action.sa_handler = [](int) { CUsageThrottle::slower(); };
+    sigaction(SIGUSR1, &action, nullptr);
 
-  //------------
+    action.sa_handler = [](int) { CUsageThrottle::faster(); };
+    sigaction(SIGUSR2, &action, nullptr);
+  }
 
-  /* Process List of Directories */
+  //------------
 
-  for (uint i = 0; i < num_directories; ++i)
-    processDirectory(directory_list[i], int(i));
-}
+  /* Open Partial Result File if Requested (results of all directories are saved) */
 
-// Process all files in the specified directory and produce a total space usage
-// and update list of oldest, newest, largest and smallest files (if requested
-// by the user).
-void
-CUsage::
-processDirectory(const std::string &directory, int num_directories)
-{
-  // Initalise Total Usage
-  total_usage = 0;
+  if (save_file != "") {
+    partial_writer = new CUsagePartialWriter(options);
 
-  //------------
+    std::string msg;
 
-  // Output Directory Header if more than one directory is being processed
-  if (num_directories > 1) {
-    if (! short_form && ! short_line_form && ! stream_form) {
-      std::cout << "\n";
-      std::cout << "--------------- Directory \'" << directory << "\' ---------------\n";
-      std::cout << "\n";
+    if (! partial_writer->open(save_file, msg)) {
+      error("%s", msg.c_str());
+      exit(1);
     }
-    else {
-      if (display_largest || display_smallest || display_oldest  || display_newest) {
-        std::cout << directory;
+  }
 
-        if (! short_line_form)
-          std::cout << "\n";
-      }
-      else {
-        CStrUtil::sprintf(format_string, "%%-%ds", max_directory_length);
+  //------------
 
-        std::cout << CStrUtil::strprintf(format_string.c_str(), directory.c_str());
+  /* Process List of Directories (or Merge List of Partial Results) */
 
-        if (! short_line_form)
-          std::cout << "\n";
-      }
+  uint num_directories = uint(directory_list.size());
+
+  {
+  CUSAGE_PROFILE_PHASE(TOTAL);
+
+  if      (merge_partials)
+    mergePartials();
+  else if (num_procs > 1)
+    processProcs();
+  else {
+    for (uint i = 0; i < num_directories; ++i) {
+      if (! processDirectory(directory_list[i], int(i)))
+        exit(1);
     }
   }
+  }
 
   //------------
 
-  // Process all Files in the Directory
-  CUsageDirWalk walk(this, directory);
-
-  walk.walk();
+  if (partial_writer) {
+    std::string msg;
 
-  //------------
+    if (! partial_writer->close(msg))
+      error("%s", msg.c_str());
 
-  /* Display Largest File List if Requested */
+    delete partial_writer;
 
-  if (display_largest) {
-    max_name_length = 0;
+    partial_writer = nullptr;
+  }
 
-    for (const auto &largest_file : largest_file_list)
-      setFileSpecLength(largest_file);
+  //------------
 
-    if      (! short_form && ! short_line_form && ! stream_form)
-      CStrUtil::sprintf(format_string, "%%-%ds %%8d", max_name_length);
-    else if (! stream_form)
-      CStrUtil::sprintf(format_string, "  %%-%ds %%8d", max_name_length);
-    else
-      CStrUtil::sprintf(format_string, "%%-%ds", max_name_length);
+  /* Append Directory Totals of all Directories to History if Requested */
 
-    if      (! short_form && ! short_line_form && ! stream_form) {
-      std::cout << "List of Top " << largest_file_list.size() << " Largest Files\n";
-      std::cout << "\n";
-    }
-    else if (! stream_form)
-      std::cout << "Largest " << largest_file_list.size() << "\n";
+  // (no run if no directory was completely scanned)
+  if (history_file != "" && ! history_dirs.empty()) {
+    CUsageHistory history;
 
-    for (const auto &largest_file : largest_file_list)
-      printLargestFile(largest_file);
+    std::string msg;
 
-    if (! short_form && ! short_line_form && ! stream_form)
-      std::cout << "\n";
+    if (! history.append(history_file, options.current_time, history_dirs, msg))
+      error("%s", msg.c_str());
   }
 
   //------------
 
-  /* Display Smallest File List if Requested */
+  if (progress) {
+    progress->stop();
 
-  if (display_smallest) {
-    max_name_length = 0;
+    delete progress;
 
-    for (const auto &smallest_file : smallest_file_list)
-      setFileSpecLength(smallest_file);
+    progress = nullptr;
+  }
 
-    if      (! short_form && ! short_line_form && ! stream_form)
-      CStrUtil::sprintf(format_string, "%%-%ds %%8d", max_name_length);
-    else if (! stream_form)
-      CStrUtil::sprintf(format_string, "  %%-%ds %%8d", max_name_length);
-    else
-      CStrUtil::sprintf(format_string, "%%-%ds", max_name_length);
+  delete throttle;
 
-    if      (! short_form && ! short_line_form && ! stream_form) {
-      std::cout << "List of Top " << smallest_file_list.size() << " Smallest Files\n";
-      std::cout << "\n";
+  throttle = nullptr;
+
+  if (profile)
+    CUsageProfilePrint();
+}
+
+// Check options and initialize state for processing directories
+void
+CUsage::
+init()
+{
+  // history query reads the history file instead of scanning (the directories are
+  // those whose totals are displayed)
+  if (history_query_file != "") {
+    if (merge_partials || save_file != "" || history_file != "") {
+      error("History query can't be used with --merge, --save or --history");
+      exit(1);
     }
-    else if (! stream_form)
-      std::cout << "Smallest " << smallest_file_list.size() << "\n";
 
-    for (const auto &smallest_file : smallest_file_list)
-      printSmallestFile(smallest_file);
+    return;
+  }
 
-    if (! short_form && ! short_line_form && ! stream_form)
-      std::cout << "\n";
+  // path list is scanned as the only directory (named by the list)
+  if (options.from_list != "") {
+    if (! directory_list.empty() || merge_partials || num_procs > 1) {
+      error("File list can't be used with directories, --merge or --procs");
+      exit(1);
+    }
+
+    directory_list.push_back(options.from_list);
+  }
+  else if (options.from_list_sort) {
+    error("File list sort needs the \'--from0\' Option");
+    exit(1);
   }
 
-  //------------
+  uint num_directories = uint(directory_list.size());
 
-  /* Display Oldest File List if Requested */
+  if (num_directories == 0) {
+    if (merge_partials) {
+      error("No partial result files to merge");
+      exit(1);
+    }
 
-  if (display_oldest) {
-    max_name_length = 0;
+    directory_list.push_back(DEFAULT_DIRECTORY);
+  }
 
-    for (const auto &oldest_file : oldest_file_list)
-      setFileSpecLength(oldest_file);
+  std::string msg;
 
-    if      (! short_form && ! short_line_form && ! stream_form)
-      CStrUtil::sprintf(format_string, "%%-%ds %%s", max_name_length);
-    else if (! stream_form)
-      CStrUtil::sprintf(format_string, "  %%-%ds %%s", max_name_length);
-    else
-      CStrUtil::sprintf(format_string, "%%-%ds", max_name_length);
+  if (! CUsageScan(options).checkOptions(msg)) {
+    error("%s", msg.c_str());
+    exit(1);
+  }
 
-    if (! short_form && ! short_line_form && ! stream_form) {
-      std::cout << "List of Top " << oldest_file_list.size() << " Oldest Files\n";
-      std::cout << "\n";
+  if (save_file != "") {
+    if (merge_partials) {
+      error("Merged results can't be saved");
+      exit(1);
     }
-    else if (! stream_form)
-      std::cout << "Oldest " << oldest_file_list.size() << "\n";
-
-    for (const auto &oldest_file : oldest_file_list)
-      printOldestFile(oldest_file);
 
-    if (! short_form && ! short_line_form && ! stream_form)
-      std::cout << "\n";
+    if (! CUsagePartialWriter(options).checkOptions(msg)) {
+      error("%s", msg.c_str());
+      exit(1);
+    }
   }
 
-  //------------
+  // merged results were filtered when scanned (and can't be filtered again)
+  if (merge_partials && CUsageScan(options).filterSignature() != "") {
+    error("Filter options can't be used with --merge (partial results are filtered "
+          "when scanned)");
+    exit(1);
+  }
 
-  /* Display Newest File List if Requested */
+  if (options.rank_range != "" && merge_partials) {
+    error("Ranked listings can't be used with merged results");
+    exit(1);
+  }
 
-  if (display_newest) {
-    max_name_length = 0;
+  if (num_procs > 1) {
+    if (merge_partials) {
+      error("Merged results can't be scanned with worker processes");
+      exit(1);
+    }
 
-    for (const auto &newest_file : newest_file_list)
-      setFileSpecLength(newest_file);
+    if (! CUsageProcScan(options).checkOptions(msg)) {
+      error("%s", msg.c_str());
+      exit(1);
+    }
+  }
 
-    if      (! short_form && ! short_line_form && ! stream_form)
-      CStrUtil::sprintf(format_string, "%%-%ds %%s", max_name_length);
-    else if (! stream_form)
-      CStrUtil::sprintf(format_string, "  %%-%ds %%s", max_name_length);
-    else
-      CStrUtil::sprintf(format_string, "%%-%ds", max_name_length);
+  if (pipeline_stats) {
+    if (options.pipeline_depth == 0) {
+      error("Pipeline counters need the \'--pipeline\' Option");
+      exit(1);
+    }
 
-    if (! short_form && ! short_line_form && ! stream_form) {
-      std::cout << "List of Top " << newest_file_list.size() << " Newest Files\n";
-      std::cout << "\n";
+    // counters aren't passed back by workers
+    if (num_procs > 1 || merge_partials) {
+      error("Pipeline counters can't be displayed with worker processes or merged results");
+      exit(1);
     }
-    else if (! stream_form)
-      std::cout << "Newest " << newest_file_list.size() << "\n";
+  }
 
-    for (const auto &newest_file : newest_file_list)
-      printNewestFile(newest_file);
+  // totals are also needed to history depth (only displayed to max depth)
+  display_depth = options.max_depth;
 
-    if (! short_form && ! short_line_form && ! stream_form)
-      printf("\n");
-  }
+  if (history_file != "")
+    options.max_depth = std::max(options.max_depth, history_depth);
 
   //------------
 
-  /* Display Directories if Requested */
+  /* Get Max Directory Length */
 
-  if (display_dirs)
-    printDirUsages();
+  max_directory_length = 1;
 
-  //------------
+  num_directories = uint(directory_list.size());
 
-  if (display_count) {
-    std::cout << "  " << CStrUtil::strprintf("%12d", num_files) << " Files\n";
-    std::cout << "  " << CStrUtil::strprintf("%12d", num_dirs ) << " Dirs\n";
-  }
+  for (uint i = 0; i < num_directories; ++i)
+    max_directory_length = std::max(max_directory_length, uint(directory_list[i].size()));
 
   //------------
 
-  // Display Total Usage in Bytes, Kilobytes, Megabytes and Gigabytes
-  auto unitsTotal = UnitsNum(size_t(total_usage));
-
-  if      (! short_form && ! short_line_form && ! stream_form) {
-    if (display_largest || display_smallest || display_oldest  || display_newest)
-      std::cout << "Total :-\n";
-
-    if (total_output & TOTAL_G)
-      std::cout << "  " << CStrUtil::strprintf("%12.2lf", unitsTotal.g()) << " Gigabytes\n";
+  /* Get Current Time (same for all directories) */
 
-    if (total_output & TOTAL_M)
-      std::cout << "  " << CStrUtil::strprintf("%12.2lf", unitsTotal.m()) << " Megabytes\n";
+  options.current_time = time(nullptr);
 
-    if (total_output & TOTAL_K)
-      std::cout << "  " << CStrUtil::strprintf("%12.2lf", unitsTotal.k()) << " Kilobytes\n";
+  /* Pick Sample Seed if not specified (output with estimates to repeat run) */
 
-    if (total_output & TOTAL_B)
-      std::cout << "  " << CStrUtil::strprintf("%12.2ld", total_usage) << " Bytes\n";
-  }
-  else if (! stream_form) {
-    if (display_largest || display_smallest || display_oldest  || display_newest)
-      std::cout << "Total\n";
+  if (! sample_seed_set)
+    options.sample_seed = (uint64_t(options.current_time) << 20) ^ uint64_t(getpid());
+}
 
-    if (total_output & TOTAL_G) {
-      std::cout << "  " << CStrUtil::strprintf("%12.2lfMb", unitsTotal.g());
-      if (! short_line_form) std::cout << "\n";
-    }
+// Scan all files in the specified directory and output the total space usage and
+// the lists of oldest, newest, largest and smallest files (if requested by the user).
+// Returns false (nothing output) if the scan failed before walking the directory.
+bool
+CUsage::
+processDirectory(const std::string &directory, int num_directories)
+{
+  // Scan all Files in the Directory
+  CUsageScan scan(options);
 
-    if (total_output & TOTAL_M) {
-      std::cout << "  " << CStrUtil::strprintf("%12.2lfMb", unitsTotal.m());
-      if (! short_line_form) std::cout << "\n";
-    }
+  scan.setProgress(progress);
+  scan.setThrottle(throttle);
 
-    if (total_output & TOTAL_K) {
-      std::cout << "  " << CStrUtil::strprintf("%12.2lfKb", unitsTotal.k());
-      if (! short_line_form) std::cout << "\n";
-    }
+  CUsageScanResults results;
 
-    if (total_output & TOTAL_B) {
-      std::cout << "  " << CStrUtil::strprintf("%12ld", total_usage);
-      if (! short_line_form) std::cout << "\n";
-    }
+  bool rc = scan.scan(directory, results);
 
-    std::cout << "\n";
+  // no results if scan failed before walking (e.g. checkpoint couldn't be read)
+  if (! rc && ! scan.isScanned()) {
+    error("%s", scan.errorMsg().c_str());
+    return false;
   }
-  else
-    std::cout << " ";
 
-  /*------*/
+  printDirectoryHeader(directory, num_directories);
 
-  for (auto &file : largest_file_list ) delete file;
-  for (auto &file : smallest_file_list) delete file;
-  for (auto &file : oldest_file_list  ) delete file;
-  for (auto &file : newest_file_list  ) delete file;
+  if (! rc)
+    error("%s", scan.errorMsg().c_str());
 
-  largest_file_list .clear();
-  smallest_file_list.clear();
-  oldest_file_list  .clear();
-  newest_file_list  .clear();
-}
+  processResults(results);
 
-bool
-CUsageDirWalk::
-process()
-{
-  unix_usage_->updateFileLists(getFileName(), getStat(), getType());
+  if (pipeline_stats)
+    printPipelineStats(results);
 
   return true;
 }
 
-// Process each file updating the total usage and the largest, smallest, newest
-// and oldest file lists.
+// Scan the list of directories in worker processes and output the results of each
+// directory in order (a directory whose worker failed or timed out is incomplete)
 void
 CUsage::
-updateFileLists(const std::string &filename, const struct stat *ftw_stat, CFileType type)
+processProcs()
 {
-  if (   match_regex != nullptr &&  ! match_regex->find(filename))
-    return;
+  CUsageProcScan proc_scan(options);
 
-  if (no_match_regex != nullptr && no_match_regex->find(filename))
-    return;
+  proc_scan.setNumProcs(num_procs);
+  proc_scan.setTimeout (proc_timeout);
+  proc_scan.setThrottle(throttle);
+  proc_scan.setProgress(progress);
 
-  if (match_type != "" && type != CFILE_TYPE_INODE_DIR) {
-    bool match = false;
+  CUsageProcScan::Results results;
 
-    std::string filename1 = filename;
+  std::string msg;
 
-    auto pos = filename1.rfind('/');
+  if (! proc_scan.scan(directory_list, results, msg)) {
+    error("%s", msg.c_str());
+    exit(1);
+  }
+
+  uint num_directories = uint(directory_list.size());
 
-    if (pos != std::string::npos)
-      filename1 = filename1.substr(pos + 1);
+  for (uint i = 0; i < num_directories; ++i) {
+    printDirectoryHeader(directory_list[i], int(i));
 
-    CFileType file_type = CFileUtil::getType(filename1);
+    if (results[i].error != "")
+      error("%s", results[i].error.c_str());
 
-    if (! match && match_type == "exe") {
-      if (file_type & CFILE_TYPE_APP_EXEC)
-        match = true;
-    }
+    processResults(results[i].results);
+  }
+}
 
-    if (! match && match_type == "elf") {
-      if (file_type & CFILE_TYPE_BIN && file_type & CFILE_TYPE_EXEC)
-        match = true;
+// Output Directory Header if more than one directory is being processed
+void
+CUsage::
+printDirectoryHeader(const std::string &directory, int num_directories)
+{
+  if (num_directories > 1) {
+    if (! short_form && ! short_line_form && ! stream_form) {
+      output << "\n";
+      output << "--------------- Directory \'" << directory << "\' ---------------\n";
+      output << "\n";
     }
+    else {
+      if (options.display_largest || options.display_smallest ||
+          options.display_oldest  || options.display_newest) {
+        output << directory;
+
+        if (! short_line_form)
+          output << "\n";
+      }
+      else {
+        output.addPadded(directory, max_directory_length);
 
-    if (! match && match_type == "image") {
-      if (file_type & CFILE_TYPE_IMAGE)
-        match = true;
+        if (! short_line_form)
+          output << "\n";
+      }
     }
+  }
+}
+
+// Save (if requested) and output results of directory scan
+void
+CUsage::
+processResults(const CUsageScanResults &results)
+{
+  if (partial_writer) {
+    std::string msg;
+
+    if (! partial_writer->write(results, msg))
+      error("%s", msg.c_str());
+  }
+
+  // totals of incomplete scan are only partial (would show as shrinkage in history)
+  if (history_file != "") {
+    if (results.complete)
+      addHistory(results);
+    else
+      error("Incomplete scan of \'%s\' not added to history", results.directory.c_str());
+  }
+
+  printResults(results);
+}
+
+// Merge the partial results of the directory list (written by --save) and output the
+// results of a single scan of all their directories
+void
+CUsage::
+mergePartials()
+{
+  CUsagePartialMerge merge(options);
 
-    if (! match && match_type == "core") {
-      if (file_type == CFILE_TYPE_APP_CORE)
-        match = true;
+  for (const auto &filename : directory_list) {
+    std::string msg;
+
+    if (! merge.add(filename, msg)) {
+      error("%s", msg.c_str());
+      exit(1);
     }
+  }
+
+  CUsageScanResults results;
 
-    if (! match)
-      return;
+  merge.getResults(results);
+
+  if      (! results.complete) {
+    if (history_file != "")
+      error("Merged results include incomplete scans (not added to history)");
+    else
+      error("Merged results include incomplete scans");
   }
+  else if (history_file != "")
+    addHistory(results);
 
-  //------------
+  printResults(results);
+}
 
-  if (ignore_hidden) {
-    std::string filename1 = filename;
+// Add directory totals of results (to history depth) to history run
+void
+CUsage::
+addHistory(const CUsageScanResults &results)
+{
+  for (const auto &dir_total : results.dir_totals)
+    if (dir_total.depth <= history_depth)
+      history_dirs.push_back(dir_total);
+}
 
-    auto pos = filename1.rfind('/');
+// Output the directories of the history file with most growth over the time window or
+// the totals of each of the directory list in each run of the window
+void
+CUsage::
+queryHistory()
+{
+  CUsageHistory history;
+
+  std::string msg;
+
+  if (! history.open(history_query_file, msg)) {
+    error("%s", msg.c_str());
+    exit(1);
+  }
 
-    while (pos != std::string::npos) {
-      if (filename1[pos + 1] == '.')
-        return;
+  time_t from = time(nullptr) - time_t(history_days)*86400;
 
-      filename1 = filename1.substr(0, pos);
+  long num_runs = history.numRuns(from);
 
-      pos = filename1.rfind('/');
+  bool long_form = (! short_form && ! short_line_form && ! stream_form);
+
+  /* Growth of All Directories */
+
+  if (directory_list.empty()) {
+    CUsageHistory::Growths growths;
+
+    if (! history.getGrowth(from, growths, msg)) {
+      error("%s", msg.c_str());
+      exit(1);
     }
-  }
 
-  //------------
+    if (growths.size() > num_history_dirs)
+      growths.resize(num_history_dirs);
 
-  // Process Directory
-  if (type == CFILE_TYPE_INODE_DIR) {
-    // If link add link size and set link directory ...
-    if (CFile::isLink(filename)) {
-      struct stat my_stat;
+    max_name_length = 0;
 
-      lstat(filename.c_str(), &my_stat);
+    for (const auto &growth : growths)
+      max_name_length = std::max(max_name_length,
+        uint(CUsageOutput::stripDotPrefix(growth.name).size()));
 
-      addFileUsage(filename, size_t(my_stat.st_size));
+    if      (long_form) {
+      output << "List of Top " << growths.size() << " Growing Directories (" << num_runs;
+      output << " runs in last " << history_days << " days)\n";
+      output << "\n";
     }
+    else if (! stream_form)
+      output << "Growth " << growths.size() << "\n";
 
-    // ... otherwise add directory node list size
-    else {
-      addDirFileUsage(filename, size_t(ftw_stat->st_size));
+    for (const auto &growth : growths) {
+      printFileName(CUsageOutput::stripDotPrefix(growth.name));
+
+      if (! stream_form) {
+        output << " "; output.addInteger (growth.growth(), 14); output << " bytes";
+        output << " "; output.addUInteger(growth.first_size, 14);
+        output << " ->"; output.addUInteger(growth.last_size, 14);
+        output << " "; output.addReal(growth.rate(), 14, 1); output << " bytes/day";
+      }
+
+      output << "\n";
     }
 
-    ++num_dirs;
+    if (long_form)
+      output << "\n";
+
+    output.flush();
 
     return;
   }
 
-  //------------
+  /* Totals of each Directory in each Run */
 
-  // If link add link size but don't include in file lists
-  if (CFile::isLink(filename)) {
-    struct stat my_stat;
+  for (const auto &directory : directory_list) {
+    CUsageHistory::Series series;
 
-    lstat(filename.c_str(), &my_stat);
+    if (! history.getSeries(directory, from, series, msg)) {
+      error("%s", msg.c_str());
+      continue;
+    }
 
-    addFileUsage(filename, size_t(my_stat.st_size));
+    if      (long_form) {
+      output << "History of '" << directory << "' (" << series.size();
+      output << " runs in last " << history_days << " days)\n";
+      output << "\n";
+    }
+    else if (! stream_form)
+      output << "History " << directory << " " << series.size() << "\n";
 
-    ++num_files;
+    for (const auto &point : series) {
+      output.addTime(point.time);
 
-    return;
+      if (! stream_form) {
+        output << " "; output.addUInteger(point.size, 14);
+        output << " "; output.addInteger(point.num_files  , 10); output << " Files";
+        output << " "; output.addInteger(point.num_entries, 10); output << " Entries";
+      }
+
+      output << "\n";
+    }
+
+    if (long_form)
+      output << "\n";
   }
 
+  output.flush();
+}
+
+// Output results of directory scan
+void
+CUsage::
+printResults(const CUsageScanResults &results)
+{
+  CUSAGE_PROFILE_PHASE(OUTPUT);
+
   //------------
 
-  // Ignore if older than specified days
-  if (num_days >= 0) {
-    double cmp = difftime(current_time, ftw_stat->st_ctime);
+  /* Display Largest File List if Requested */
 
-    int num_days1 = int(cmp/86400);
+  if (options.display_largest) {
+    setFileSpecsLength(results.largest_files);
 
-    if (! reverse) {
-      if (num_days1 > num_days)
-        return;
-    }
-    else {
-      if (num_days1 < num_days)
-        return;
+    if      (! short_form && ! short_line_form && ! stream_form) {
+      output << "List of Top " << results.largest_files.size() << " Largest Files\n";
+      output << "\n";
     }
+    else if (! stream_form)
+      output << "Largest " << results.largest_files.size() << "\n";
+
+    for (const auto &largest_file : results.largest_files)
+      printLargestFile(largest_file);
+
+    if (! short_form && ! short_line_form && ! stream_form)
+      output << "\n";
   }
 
   //------------
 
-  // Update Total for Ordinary File
-  addFileUsage(filename, size_t(ftw_stat->st_size));
+  /* Display Smallest File List if Requested */
 
-  ++num_files;
+  if (options.display_smallest) {
+    setFileSpecsLength(results.smallest_files);
 
-  // Update Largest Files
-  if (display_largest) {
-    if (largest_file_list.size() < num_largest) {
-      auto *file_spec = new CUsageFileSpec;
+    if      (! short_form && ! short_line_form && ! stream_form) {
+      output << "List of Top " << results.smallest_files.size() << " Smallest Files\n";
+      output << "\n";
+    }
+    else if (! stream_form)
+      output << "Smallest " << results.smallest_files.size() << "\n";
 
-      file_spec->name = filename;
-      file_spec->size = size_t(ftw_stat->st_size);
-      file_spec->time = statTime(ftw_stat);
+    for (const auto &smallest_file : results.smallest_files)
+      printSmallestFile(smallest_file);
 
-      addLargestFileSpec(file_spec);
-    }
-    else {
-      CUsageFileSpec *file_spec = largest_file_list.back();
+    if (! short_form && ! short_line_form && ! stream_form)
+      output << "\n";
+  }
 
-      if (size_t(ftw_stat->st_size) > file_spec->size) {
-        largest_file_list.remove(file_spec);
+  //------------
 
-        auto *file_spec1 = new CUsageFileSpec;
+  /* Display Oldest File List if Requested */
 
-        file_spec1->name = filename;
-        file_spec1->size = size_t(ftw_stat->st_size);
-        file_spec1->time = statTime(ftw_stat);
+  if (options.display_oldest) {
+    setFileSpecsLength(results.oldest_files);
 
-        addLargestFileSpec(file_spec1);
-      }
+    if      (! short_form && ! short_line_form && ! stream_form) {
+      output << "List of Top " << results.oldest_files.size() << " Oldest Files\n";
+      output << "\n";
     }
+    else if (! stream_form)
+      output << "Oldest " << results.oldest_files.size() << "\n";
+
+    for (const auto &oldest_file : results.oldest_files)
+      printOldestFile(oldest_file);
+
+    if (! short_form && ! short_line_form && ! stream_form)
+      output << "\n";
   }
 
-  // Update Smallest Files
-  if (display_smallest) {
-    if (smallest_file_list.size() < num_smallest) {
-      auto *file_spec = new CUsageFileSpec;
+  //------------
+
+  /* Display Newest File List if Requested */
 
-      file_spec->name = filename;
-      file_spec->size = size_t(ftw_stat->st_size);
-      file_spec->time = statTime(ftw_stat);
+  if (options.display_newest) {
+    setFileSpecsLength(results.newest_files);
 
-      addSmallestFileSpec(file_spec);
+    if      (! short_form && ! short_line_form && ! stream_form) {
+      output << "List of Top " << results.newest_files.size() << " Newest Files\n";
+      output << "\n";
     }
-    else {
-      CUsageFileSpec *file_spec = smallest_file_list.back();
+    else if (! stream_form)
+      output << "Newest " << results.newest_files.size() << "\n";
 
-      if (size_t(ftw_stat->st_size) < file_spec->size) {
-        smallest_file_list.remove(file_spec);
+    for (const auto &newest_file : results.newest_files)
+      printNewestFile(newest_file);
 
-        auto *file_spec1 = new CUsageFileSpec;
+    if (! short_form && ! short_line_form && ! stream_form)
+      output << "\n";
+  }
 
-        file_spec1->name = filename;
-        file_spec1->size = size_t(ftw_stat->st_size);
-        file_spec1->time = statTime(ftw_stat);
+  //------------
 
-        addSmallestFileSpec(file_spec1);
-      }
-    }
-  }
+  /* Display Directories if Requested */
 
-  // Update Oldest Files
-  if (display_oldest) {
-    if (oldest_file_list.size() < num_oldest) {
-      auto *file_spec = new CUsageFileSpec;
+  if (options.display_dirs)
+    printDirUsages(results);
 
-      file_spec->name = filename;
-      file_spec->size = size_t(ftw_stat->st_size);
-      file_spec->time = statTime(ftw_stat);
+  //------------
 
-      addOldestFileSpec(file_spec);
-    }
-    else {
-      CUsageFileSpec *file_spec = oldest_file_list.back();
+  /* Display Directory Totals to Depth if Requested */
 
-      if (statTime(ftw_stat) < file_spec->time) {
-        oldest_file_list.remove(file_spec);
+  if (display_depth >= 0)
+    printDirTotals(results);
 
-        auto *file_spec1 = new CUsageFileSpec;
+  //------------
 
-        file_spec1->name = filename;
-        file_spec1->size = size_t(ftw_stat->st_size);
-        file_spec1->time = statTime(ftw_stat);
+  /* Display Slowest and Most Entries Directories if Requested */
 
-        addOldestFileSpec(file_spec1);
-      }
-    }
-  }
+  if (options.display_dir_times)
+    printDirTimes(results);
 
-  // Update Newest Files
-  if (display_newest) {
-    if (newest_file_list.size() < num_newest) {
-      auto *file_spec = new CUsageFileSpec;
+  //------------
 
-      file_spec->name = filename;
-      file_spec->size = size_t(ftw_stat->st_size);
-      file_spec->time = statTime(ftw_stat);
+  /* Display Total Entries and Directories with Most Entries if Requested */
 
-      addNewestFileSpec(file_spec);
-    }
-    else {
-      auto *file_spec = newest_file_list.back();
+  if (options.display_inodes)
+    printDirInodes(results);
 
-      if (statTime(ftw_stat) > file_spec->time) {
-        newest_file_list.remove(file_spec);
+  //------------
 
-        auto *file_spec1 = new CUsageFileSpec;
+  /* Display Duplicate Files if Requested */
 
-        file_spec1->name = filename;
-        file_spec1->size = size_t(ftw_stat->st_size);
-        file_spec1->time = statTime(ftw_stat);
+  if (options.display_dups)
+    printDupGroups(results);
 
-        addNewestFileSpec(file_spec1);
-      }
+  //------------
+
+  /* Display Cold Files, Directories and Owners if Requested */
+
+  if (options.cold_days >= 0)
+    printColdFiles(results);
+
+  //------------
+
+  /* Display Ranked Files if Requested */
+
+  if (options.rank_range != "")
+    printRankedFiles(results);
+
+  //------------
+
+  /* Display Mount Points skipped by One File System */
+
+  if (! results.skipped_mounts.empty() && ! stream_form) {
+    if (! short_form && ! short_line_form) {
+      output << "Skipped Mount Points :-\n";
+      output << "\n";
     }
-  }
-}
+    else
+      output << "Skipped " << results.skipped_mounts.size() << "\n";
 
-struct IsLargerFileSpec {
-  CUsageFileSpec *spec_;
+    for (const auto &mount : results.skipped_mounts) {
+      if (short_form || short_line_form)
+        output << "  ";
 
-  IsLargerFileSpec(CUsageFileSpec *spec) :
-   spec_(spec) {
-  }
+      output << CUsageOutput::stripDotPrefix(mount) << "\n";
+    }
 
-  bool operator()(CUsageFileSpec *spec) {
-    return (spec_->size > spec->size);
+    if (! short_form && ! short_line_form)
+      output << "\n";
   }
-};
 
-struct IsSmallerFileSpec {
-  CUsageFileSpec *spec_;
+  //------------
 
-  IsSmallerFileSpec(CUsageFileSpec *spec) :
-   spec_(spec) {
-  }
+  /* Display Links to Directories containing them (Following Links) */
+
+  if (! results.link_loops.empty() && ! stream_form) {
+    if (! short_form && ! short_line_form) {
+      output << "Symbolic Link Loops :-\n";
+      output << "\n";
+    }
+    else
+      output << "Loops " << results.link_loops.size() << "\n";
+
+    for (const auto &link : results.link_loops) {
+      if (short_form || short_line_form)
+        output << "  ";
 
-  bool operator()(CUsageFileSpec *spec) {
-    return (spec_->size < spec->size);
+      output << CUsageOutput::stripDotPrefix(link) << "\n";
+    }
+
+    if (! short_form && ! short_line_form)
+      output << "\n";
   }
-};
 
-struct IsOlderFileSpec {
-  CUsageFileSpec *spec_;
+  //------------
+
+  /* Display Estimates instead of Count and Totals for Sample */
+
+  if (results.sampled) {
+    printSample(results);
 
-  IsOlderFileSpec(CUsageFileSpec *spec) :
-   spec_(spec) {
+    output.flush();
+
+    return;
   }
 
-  bool operator()(CUsageFileSpec *spec) {
-    return (spec_->time < spec->time);
+  //------------
+
+  if (display_count) {
+    output << "  "; output.addInteger(results.num_files, 12); output << " Files\n";
+    output << "  "; output.addInteger(results.num_dirs , 12); output << " Dirs\n";
   }
-};
 
-struct IsNewerFileSpec {
-  CUsageFileSpec *spec_;
+  //------------
+
+  // Totals of incomplete scan (stopped or worker timed out) are only partial
+  if (! results.complete && ! short_form && ! short_line_form && ! stream_form)
+    output << "Incomplete Scan\n";
+
+  //------------
+
+  bool display_lists = (options.display_largest || options.display_smallest ||
+                        options.display_oldest  || options.display_newest);
+
+  // Display Total Usage in Bytes, Kilobytes, Megabytes and Gigabytes
+  auto total_usage = results.total_usage;
+
+  auto unitsTotal = UnitsNum(total_usage);
 
-  IsNewerFileSpec(CUsageFileSpec *spec) :
-   spec_(spec) {
+  if      (! short_form && ! short_line_form && ! stream_form) {
+    if (display_lists)
+      output << "Total :-\n";
+
+    if (total_output & TOTAL_G) {
+      output << "  "; output.addReal(unitsTotal.g(), 12, 2); output << " Gigabytes\n";
+    }
+
+    if (total_output & TOTAL_M) {
+      output << "  "; output.addReal(unitsTotal.m(), 12, 2); output << " Megabytes\n";
+    }
+
+    if (total_output & TOTAL_K) {
+      output << "  "; output.addReal(unitsTotal.k(), 12, 2); output << " Kilobytes\n";
+    }
+
+    if (total_output & TOTAL_B) {
+      output << "  "; output.addInteger(long(total_usage), 12, false, 2); output << " Bytes\n";
+    }
   }
+  else if (! stream_form) {
+    if (display_lists)
+      output << "Total\n";
+
+    if (total_output & TOTAL_G) {
+      output << "  "; output.addReal(unitsTotal.g(), 12, 2); output << "Mb";
+      if (! short_line_form) output << "\n";
+    }
+
+    if (total_output & TOTAL_M) {
+      output << "  "; output.addReal(unitsTotal.m(), 12, 2); output << "Mb";
+      if (! short_line_form) output << "\n";
+    }
+
+    if (total_output & TOTAL_K) {
+      output << "  "; output.addReal(unitsTotal.k(), 12, 2); output << "Kb";
+      if (! short_line_form) output << "\n";
+    }
+
+    if (total_output & TOTAL_B) {
+      output << "  "; output.addInteger(long(total_usage), 12);
+      if (! short_line_form) output << "\n";
+    }
 
-  bool operator()(CUsageFileSpec *spec) {
-    return (spec_->time > spec->time);
+    output << "\n";
   }
-};
+  else
+    output << " ";
+
+  output.flush();
+}
 
+// Routine used to Output a Largest File.
 void
 CUsage::
-addLargestFileSpec(CUsageFileSpec *file_spec)
+printLargestFile(const CUsageFileSpec &file_spec)
 {
-  auto p = find_if(largest_file_list.begin(), largest_file_list.end(),
-                   IsLargerFileSpec(file_spec));
+  auto file_name = CUsageOutput::stripDotPrefix(file_spec.name);
 
-  if (p != largest_file_list.end())
-    largest_file_list.insert(p, file_spec);
-  else
-    largest_file_list.push_back(file_spec);
+  printFileName(file_name);
+
+  if (! stream_form) {
+    output << " "; output.addUInteger(file_spec.size, 8);
+  }
+
+  if (! short_form && ! short_line_form && ! stream_form) {
+    auto type = CFileUtil::getType(std::string(file_name));
+
+    output << " " << CFileUtil::getTypeMime(type);
+  }
+
+  output << "\n";
 }
 
+// Routine used to Output a Smallest File.
 void
 CUsage::
-addSmallestFileSpec(CUsageFileSpec *file_spec)
+printSmallestFile(const CUsageFileSpec &file_spec)
 {
-  auto p = find_if(smallest_file_list.begin(), smallest_file_list.end(),
-                   IsSmallerFileSpec(file_spec));
+  auto file_name = CUsageOutput::stripDotPrefix(file_spec.name);
 
-  if (p != smallest_file_list.end())
-    smallest_file_list.insert(p, file_spec);
-  else
-    smallest_file_list.push_back(file_spec);
+  printFileName(file_name);
+
+  if (! stream_form) {
+    output << " "; output.addUInteger(file_spec.size, 8);
+  }
+
+  // Small files don't often have type
+
+  output << "\n";
 }
 
+// Routine used to Output an Oldest File.
 void
 CUsage::
-addOldestFileSpec(CUsageFileSpec *file_spec)
+printOldestFile(const CUsageFileSpec &file_spec)
 {
-  auto p = find_if(oldest_file_list.begin(), oldest_file_list.end(),
-                   IsOlderFileSpec(file_spec));
+  auto file_name = CUsageOutput::stripDotPrefix(file_spec.name);
 
-  if (p != oldest_file_list.end())
-    oldest_file_list.insert(p, file_spec);
-  else
-    oldest_file_list.push_back(file_spec);
+  printFileName(file_name);
+
+  if (! stream_form) {
+    output << " "; output.addTime(file_spec.time);
+  }
+
+  output << "\n";
 }
 
+// Routine used to Output an Newest File.
 void
 CUsage::
-addNewestFileSpec(CUsageFileSpec *file_spec)
+printNewestFile(const CUsageFileSpec &file_spec)
 {
-  auto p = find_if(newest_file_list.begin(), newest_file_list.end(),
-                   IsNewerFileSpec(file_spec));
+  auto file_name = CUsageOutput::stripDotPrefix(file_spec.name);
 
-  if (p != newest_file_list.end())
-    newest_file_list.insert(p, file_spec);
-  else
-    newest_file_list.push_back(file_spec);
+  printFileName(file_name);
+
+  if (! stream_form) {
+    output << " "; output.addTime(file_spec.time);
+  }
+
+  output << "\n";
 }
 
+// Routine used to Output a file name padded to the maximum name length (with indent
+// for short form)
 void
 CUsage::
-addDirFileUsage(const std::string &, size_t size)
+printFileName(std::string_view file_name)
 {
-  // don't add dir node size
-  total_usage += size;
+  if (! stream_form && (short_form || short_line_form))
+    output << "  ";
+
+  output.addPadded(file_name, max_name_length);
 }
 
 void
 CUsage::
-addFileUsage(const std::string &filename, size_t size)
+printDirUsages(const CUsageScanResults &results)
 {
-  if (display_dirs) {
-    auto pos = filename.rfind('/');
+  // get largest name length (dir usages are sorted by usage, largest first)
+  uint max_len = 0;
+
+  for (const auto &dir_usage : results.dir_usages)
+    if (dir_usage.name.size() > max_len)
+      max_len = uint(dir_usage.name.size());
+
+  //---
 
-    if (pos != std::string::npos)
-      addDirUsage(filename.substr(0, pos), size, 0);
+  output << "\n";
+  output << "Directory Usages :-\n";
+  output << "\n";
+
+  for (const auto &dir_usage : results.dir_usages) {
+    if (! dir_usage.leaf) continue;
+
+    uint len1 = max_len - uint(dir_usage.len);
+
+    UnitsNum unitsSize(dir_usage.size);
+
+    output << dir_usage.name;
+
+    output.addSpaces(len1);
+
+    output << "  ";
+
+    if      (total_output & TOTAL_G) {
+      output.addReal(unitsSize.g(), 12, 2); output << "G";
+    }
+    else if (total_output & TOTAL_M) {
+      output.addReal(unitsSize.m(), 12, 2); output << "M";
+    }
+    else if (total_output & TOTAL_K) {
+      output.addReal(unitsSize.k(), 12, 2); output << "K";
+    }
+    else if (total_output & TOTAL_B)
+      output.addUInteger(dir_usage.size, 10, /*left*/true);
+
+    output << "\n";
   }
 
-  total_usage += size;
+  output << "\n";
 }
 
+// Output total size, file count and entry count of each directory to the max depth
+// (sub directories before their parent, as du)
 void
 CUsage::
-addDirUsage(const std::string &dirname, size_t size, int depth)
+printDirTotals(const CUsageScanResults &results)
 {
-  auto pdir = dir_usage_list.find(dirname);
+  uint max_len = 0;
 
-  CUsageDirUsage *dir_usage = nullptr;
+  // totals can go deeper than displayed (for history)
+  for (const auto &dir_total : results.dir_totals)
+    if (dir_total.depth <= display_depth && dir_total.name.size() > max_len)
+      max_len = uint(dir_total.name.size());
 
-  if (pdir == dir_usage_list.end()) {
-    dir_usage = new CUsageDirUsage;
+  //---
 
-    dir_usage->name = dirname;
-    dir_usage->len  = int(dirname.size());
-    dir_usage->size = 0;
+  output << "\n";
+  output << "Directory Totals :-\n";
+  output << "\n";
 
-    dir_usage_list[dirname] = dir_usage;
-  }
-  else
-    dir_usage = (*pdir).second;
+  for (const auto &dir_total : results.dir_totals) {
+    if (dir_total.depth > display_depth)
+      continue;
+
+    output.addPadded(dir_total.name, max_len);
+
+    output << "  ";
 
-  if (depth > 0)
-    dir_usage->leaf = false;
+    UnitsNum unitsSize(dir_total.size);
 
-  dir_usage->size += size;
+    if      (total_output & TOTAL_G) {
+      output.addReal(unitsSize.g(), 12, 2); output << "G";
+    }
+    else if (total_output & TOTAL_M) {
+      output.addReal(unitsSize.m(), 12, 2); output << "M";
+    }
+    else if (total_output & TOTAL_K) {
+      output.addReal(unitsSize.k(), 12, 2); output << "K";
+    }
+    else if (total_output & TOTAL_B)
+      output.addUInteger(dir_total.size, 12);
 
-  auto pos = dirname.rfind('/');
+    output << " "; output.addInteger(dir_total.num_files  , 10); output << " Files";
+    output << " "; output.addInteger(dir_total.num_entries, 10); output << " Entries\n";
+  }
 
-  if (pos != std::string::npos)
-    addDirUsage(dirname.substr(0, pos), size, depth + 1);
+  output << "\n";
 }
 
-// Routine used to Output a Largest File.
+// Output directories with the largest opendir/readdir + stat time and the most entries
 void
 CUsage::
-printLargestFile(CUsageFileSpec *file_spec)
+printDirTimes(const CUsageScanResults &results)
 {
-  auto file_name = file_spec->name;
+  auto printDirTime = [&](const CUsageDirTime &dir_time) {
+    auto dir_name = CUsageOutput::stripDotPrefix(dir_time.name);
 
-  while (file_name.find("./") != std::string::npos)
-    file_name = file_name.substr(2);
+    printFileName(dir_name);
 
-  std::cout << CStrUtil::strprintf(format_string.c_str(), file_name.c_str(), file_spec->size);
+    if (! stream_form) {
+      output << " "; output.addReal(double(dir_time.totalNs  ())/1e6, 10, 3); output << " ms";
+      output << " "; output.addReal(double(dir_time.readdir_ns )/1e6, 10, 3); output << " ms readdir";
+      output << " "; output.addReal(double(dir_time.stat_ns    )/1e6, 10, 3); output << " ms stat";
+      output << " "; output.addInteger(dir_time.num_entries, 10); output << " entries";
+    }
 
-  auto type = CFileUtil::getType(file_name);
+    output << "\n";
+  };
 
-  if (! short_form && ! short_line_form && ! stream_form)
-    std::cout << " " << CFileUtil::getTypeMime(type);
+  auto printDirTimeList = [&](const CUsageScanResults::DirTimes &dir_times,
+                              const char *long_title, const char *short_title) {
+    max_name_length = 0;
+
+    for (const auto &dir_time : dir_times)
+      max_name_length = std::max(max_name_length,
+        uint(CUsageOutput::stripDotPrefix(dir_time.name).size()));
+
+    if      (! short_form && ! short_line_form && ! stream_form) {
+      output << "List of Top " << dir_times.size() << " " << long_title << "\n";
+      output << "\n";
+    }
+    else if (! stream_form)
+      output << short_title << " " << dir_times.size() << "\n";
+
+    for (const auto &dir_time : dir_times)
+      printDirTime(dir_time);
 
-  std::cout << "\n";
+    if (! short_form && ! short_line_form && ! stream_form)
+      output << "\n";
+  };
+
+  printDirTimeList(results.slowest_dirs     , "Slowest Directories", "Slowest");
+  printDirTimeList(results.most_entries_dirs, "Directories with Most Entries", "Entries");
 }
 
-// Routine used to Output a Smallest File.
+// Output total entries (including the root, so one more than the root's entries below
+// it) and the directories with most entries directly in them and with most entries below
+// them
 void
 CUsage::
-printSmallestFile(CUsageFileSpec *file_spec)
+printDirInodes(const CUsageScanResults &results)
 {
-  auto file_name = file_spec->name;
+  bool long_form = (! short_form && ! short_line_form && ! stream_form);
 
-  while (file_name.find("./") != std::string::npos)
-    file_name = file_name.substr(2);
+  if      (long_form) {
+    output << "Total Entries "; output.addInteger(results.total_entries); output << "\n";
+    output << "\n";
+  }
+  else if (! stream_form) {
+    output << "TotalEntries "; output.addInteger(results.total_entries); output << "\n";
+  }
 
-  std::cout << CStrUtil::strprintf(format_string.c_str(), file_name.c_str(), file_spec->size);
+  auto printDirInodesList = [&](const CUsageScanResults::DirInodes &dir_inodes,
+                                const char *long_title, const char *short_title) {
+    max_name_length = 0;
 
-  // Small files don't often have type
+    for (const auto &dir_inodes1 : dir_inodes)
+      max_name_length = std::max(max_name_length,
+        uint(CUsageOutput::stripDotPrefix(dir_inodes1.name).size()));
+
+    if      (long_form) {
+      output << "List of Top " << dir_inodes.size() << " " << long_title << "\n";
+      output << "\n";
+    }
+    else if (! stream_form)
+      output << short_title << " " << dir_inodes.size() << "\n";
+
+    for (const auto &dir_inodes1 : dir_inodes) {
+      printFileName(CUsageOutput::stripDotPrefix(dir_inodes1.name));
+
+      if (! stream_form) {
+        output << " "; output.addInteger(dir_inodes1.num_entries, 10); output << " entries";
+        output << " "; output.addInteger(dir_inodes1.total_num_entries, 12); output << " total";
+      }
 
-  std::cout << "\n";
+      output << "\n";
+    }
+
+    if (long_form)
+      output << "\n";
+  };
+
+  printDirInodesList(results.inode_dirs,
+                     "Directories with Most Entries Directly in Them", "InodeDirs");
+  printDirInodesList(results.inode_total_dirs,
+                     "Directories with Most Entries Below Them", "InodeTotalDirs");
 }
 
-// Routine used to Output an Oldest File.
+// Output size in the largest selected total units
+void
+CUsage::
+printSize(size_t size)
+{
+  UnitsNum unitsSize(size);
+
+  if      (total_output & TOTAL_G) {
+    output.addReal(unitsSize.g(), 12, 2); output << "G";
+  }
+  else if (total_output & TOTAL_M) {
+    output.addReal(unitsSize.m(), 12, 2); output << "M";
+  }
+  else if (total_output & TOTAL_K) {
+    output.addReal(unitsSize.k(), 12, 2); output << "K";
+  }
+  else if (total_output & TOTAL_B)
+    output.addUInteger(size, 12);
+}
+
+// Output duplicate file groups (most wasted space first) with size, number of copies
+// and wasted bytes of each group followed by its files
 void
 CUsage::
-printOldestFile(CUsageFileSpec *file_spec)
+printDupGroups(const CUsageScanResults &results)
 {
-  auto file_name = file_spec->name;
+  if      (! short_form && ! short_line_form && ! stream_form) {
+    output << "List of Top " << results.dup_groups.size() << " Duplicate Files (";
+    output << results.num_dup_groups << " groups, ";
+    output.addUInteger(results.dup_wasted); output << " bytes wasted)\n";
+    output << "\n";
+  }
+  else if (! stream_form)
+    output << "Duplicates " << results.dup_groups.size() << "\n";
 
-  while (file_name.find("./") != std::string::npos)
-    file_name = file_name.substr(2);
+  for (const auto &group : results.dup_groups) {
+    if (! stream_form) {
+      printSize(group.size);
 
-  auto *tm = localtime(&file_spec->time);
+      output << " x "; output.addInteger(long(group.names.size()), 4, /*left*/true);
 
-  char time_string[256];
+      printSize(group.wasted()); output << " wasted\n";
+    }
+
+    for (const auto &name : group.names) {
+      if (! stream_form)
+        output << "    ";
 
-  strftime(time_string, 256, "%a %h %e %H:%M:%S %Z %Y", tm);
+      output << CUsageOutput::stripDotPrefix(name) << "\n";
+    }
+  }
 
-  std::cout << CStrUtil::strprintf(format_string.c_str(), file_name.c_str(), time_string) << "\n";
+  if (! short_form && ! short_line_form && ! stream_form)
+    output << "\n";
 }
 
-// Routine used to Output an Newest File.
+// Output cold files (largest first) with size and time, then the directories with
+// most cold bytes and the cold bytes of each owner
 void
 CUsage::
-printNewestFile(CUsageFileSpec *file_spec)
+printColdFiles(const CUsageScanResults &results)
 {
-  auto file_name = file_spec->name;
+  bool long_form = (! short_form && ! short_line_form && ! stream_form);
+
+  /* Files */
+
+  setFileSpecsLength(results.cold_files);
+
+  if      (long_form) {
+    output << "List of Top " << results.cold_files.size() << " Largest Cold Files (";
+    output << results.num_cold_files << " files, ";
+    output.addUInteger(results.cold_usage); output << " bytes older than ";
+    output << options.cold_days << " days)\n";
+    output << "\n";
+  }
+  else if (! stream_form)
+    output << "Cold " << results.cold_files.size() << "\n";
+
+  for (const auto &cold_file : results.cold_files) {
+    printFileName(CUsageOutput::stripDotPrefix(cold_file.name));
+
+    if (! stream_form) {
+      output << " "; output.addUInteger(cold_file.size, 12);
+      output << " "; output.addTime(cold_file.time);
+    }
+
+    output << "\n";
+  }
+
+  if (long_form)
+    output << "\n";
+
+  // only file names are output in stream form
+  if (stream_form)
+    return;
+
+  /* Directories */
+
+  max_name_length = 0;
+
+  for (const auto &cold_dir : results.cold_dirs)
+    max_name_length = std::max(max_name_length,
+      uint(CUsageOutput::stripDotPrefix(cold_dir.name).size()));
+
+  if (long_form) {
+    output << "List of Top " << results.cold_dirs.size() << " Cold Directories\n";
+    output << "\n";
+  }
+  else
+    output << "ColdDirs " << results.cold_dirs.size() << "\n";
+
+  for (const auto &cold_dir : results.cold_dirs) {
+    printFileName(CUsageOutput::stripDotPrefix(cold_dir.name));
+
+    output << " "; printSize(cold_dir.size);
+    output << " "; output.addInteger(cold_dir.num_files, 8); output << " files";
+    output << " "; printSize(cold_dir.total_size); output << " total\n";
+  }
+
+  if (long_form)
+    output << "\n";
+
+  /* Owners */
+
+  std::vector<std::string> owner_names;
+
+  max_name_length = 0;
+
+  for (const auto &cold_owner : results.cold_owners) {
+    auto *pw = getpwuid(cold_owner.uid);
 
-  while (file_name.find("./") != std::string::npos)
-    file_name = file_name.substr(2);
+    owner_names.push_back(pw ? std::string(pw->pw_name) : std::to_string(cold_owner.uid));
 
-  char time_string[256];
+    max_name_length = std::max(max_name_length, uint(owner_names.back().size()));
+  }
+
+  if (long_form) {
+    output << "List of Cold Owners\n";
+    output << "\n";
+  }
+  else
+    output << "ColdOwners " << results.cold_owners.size() << "\n";
+
+  for (size_t i = 0; i < results.cold_owners.size(); ++i) {
+    const auto &cold_owner = results.cold_owners[i];
 
-  auto *tm = localtime(&file_spec->time);
+    printFileName(owner_names[i]);
 
-  strftime(time_string, 256, "%a %h %e %H:%M:%S %Z %Y", tm);
+    output << " "; printSize(cold_owner.size);
+    output << " "; output.addInteger(cold_owner.num_files, 8); output << " files\n";
+  }
 
-  std::cout << CStrUtil::strprintf(format_string.c_str(), file_name.c_str(), time_string) << "\n";
+  if (long_form)
+    output << "\n";
 }
 
+// Output sample estimates (value +/- 95% confidence interval) and estimated file size
+// distribution
 void
 CUsage::
-printDirUsages()
+printSample(const CUsageScanResults &results)
 {
-  // sort by usage (largest frst)
-  auto pdir1 = dir_usage_list.begin();
-  auto pdir2 = dir_usage_list.end  ();
+  const auto &sample = results.sample;
 
-  DirUsageList dir_usage_list1;
+  auto printEstimate = [&](const CUsageSampleEstimate &estimate, double scale,
+                           uint precision, const char *name) {
+    output << "  "; output.addReal(estimate.value/scale, 14, precision);
+    output << " +/- "; output.addReal(estimate.error/scale, 12, precision);
+    output << " " << name << "\n";
+  };
 
-  for ( ; pdir1 != pdir2; ++pdir1)
-    dir_usage_list1.push_back((*pdir1).second);
+  // size as power of 2 with units (e.g. 512, 4K, 1M)
+  auto sizeName = [](size_t size) {
+    static const char *units[] = { "", "K", "M", "G", "T", "P", "E" };
 
-  dir_usage_list1.sort(CUsageDirUsageCmp());
+    uint iu = 0;
 
-  //---
+    while (size >= 1024 && size % 1024 == 0 && iu < 6) {
+      size /= 1024;
 
-  // get largest name length
-  auto psdir1 = dir_usage_list1.begin();
-  auto psdir2 = dir_usage_list1.end  ();
+      ++iu;
+    }
 
-  uint max_len = 0;
+    return std::to_string(size) + units[iu];
+  };
 
-  for ( ; psdir1 != psdir2; ++psdir1)
-    if ((*psdir1)->name.size() > max_len)
-      max_len = uint((*psdir1)->name.size());
+  output << "Sample Estimate (seed " << std::to_string(sample.seed) << ") :-\n";
+  output << "\n";
 
-  //---
+  output << "  Files stat'ed "; output.addInteger(sample.num_stats, 12);
+  output << " (";               output.addReal(sample.fraction*100.0, 0, 2);
+  output << "%), Directories read "; output.addInteger(sample.num_dirs, 0);
+  output << " (";               output.addReal(sample.dir_fraction*100.0, 0, 2);
+  output << "%)\n";
+  output << "\n";
 
-  std::cout << "\n";
-  std::cout << "Directory Usages :-\n";
-  std::cout << "\n";
+  printEstimate(sample.num_files , 1.0, 0, "Files");
+  printEstimate(sample.total_dirs, 1.0, 0, "Dirs");
 
-  psdir1 = dir_usage_list1.begin();
+  if (total_output & TOTAL_G)
+    printEstimate(sample.total_usage, 1024.0*1024.0*1024.0, 2, "Gigabytes");
 
-  for ( ; psdir1 != psdir2; ++psdir1) {
-    if (! (*psdir1)->leaf) continue;
+  if (total_output & TOTAL_M)
+    printEstimate(sample.total_usage, 1024.0*1024.0, 2, "Megabytes");
 
-    uint len1 = max_len - uint((*psdir1)->len);
+  if (total_output & TOTAL_K)
+    printEstimate(sample.total_usage, 1024.0, 2, "Kilobytes");
 
-    UnitsNum unitsSize((*psdir1)->size);
+  if (total_output & TOTAL_B)
+    printEstimate(sample.total_usage, 1.0, 0, "Bytes");
 
-    std::string fmt;
+  output << "\n";
 
-    if      (total_output & TOTAL_G)
-      fmt = CStrUtil::strprintf("%s%*.*s  %12.2lfG", (*psdir1)->name.c_str(),
-                                len1, len1, "", unitsSize.g());
-    else if (total_output & TOTAL_M)
-      fmt = CStrUtil::strprintf("%s%*.*s  %12.2lfM", (*psdir1)->name.c_str(),
-                                len1, len1, "", unitsSize.m());
-    else if (total_output & TOTAL_K)
-      fmt = CStrUtil::strprintf("%s%*.*s  %12.2lfK", (*psdir1)->name.c_str(),
-                                len1, len1, "", unitsSize.k());
-    else if (total_output & TOTAL_B)
-      fmt = CStrUtil::strprintf("%s%*.*s  %-10d", (*psdir1)->name.c_str(),
-                                len1, len1, "", (*psdir1)->size);
+  //---
 
-    std::cout << fmt << "\n";
+  output << "File Size Distribution :-\n";
+  output << "\n";
+
+  for (const auto &bucket : sample.size_buckets) {
+    output << "  ";
+
+    output.addPadded(sizeName(bucket.min_size), 6); output << " - ";
+
+    if (bucket.max_size == SIZE_MAX)
+      output.addPadded("", 6);
+    else
+      output.addPadded(sizeName(bucket.max_size), 6);
+
+    printEstimate(bucket.num_files, 1.0, 0, "Files");
   }
 
-  std::cout << "\n";
+  output << "\n";
 }
 
-//---
+// Output files of rank range (with rank, size and time)
+void
+CUsage::
+printRankedFiles(const CUsageScanResults &results)
+{
+  static const char *key_names[] = { "Largest", "Smallest", "Oldest", "Newest" };
 
-bool
-CUsageDirUsageCmp::
-operator()(CUsageDirUsage *dir_usage1, CUsageDirUsage *dir_usage2)
+  bool long_form = (! short_form && ! short_line_form && ! stream_form);
+
+  setFileSpecsLength(results.ranked_files);
+
+  long num = long(results.ranked_files.size());
+
+  if      (long_form) {
+    output << "List of Files Ranked ";
+
+    if (num > 0)
+      output << results.first_rank << " to " << results.first_rank + num - 1;
+    else
+      output << "(none)";
+
+    output << " of " << results.num_ranked << " (";
+    output << key_names[int(options.rank_key)] << " First)\n";
+    output << "\n";
+  }
+  else if (! stream_form)
+    output << "Ranked " << num << "\n";
+
+  long rank = results.first_rank;
+
+  for (const auto &ranked_file : results.ranked_files) {
+    if (! stream_form) {
+      output.addInteger(rank, 10); output << " ";
+    }
+
+    printFileName(CUsageOutput::stripDotPrefix(ranked_file.name));
+
+    if (! stream_form) {
+      output << " "; output.addUInteger(ranked_file.size, 12);
+      output << " "; output.addTime(ranked_file.time);
+    }
+
+    output << "\n";
+
+    ++rank;
+  }
+
+  if (long_form)
+    output << "\n";
+}
+
+// Output pipeline counters of directory scan (on stderr). Walker stalls mean the
+// aggregator is behind (more walker threads won't help), aggregator waits that the
+// walkers are (a deeper queue only helps if the queue is often full).
+void
+CUsage::
+printPipelineStats(const CUsageScanResults &results)
 {
-  return (dir_usage1->size > dir_usage2->size);
+  const auto &stats = results.pipeline;
+
+  fprintf(stderr, "Pipeline :-\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "  %-18s %12ld\n", "Batches", stats.num_batches);
+  fprintf(stderr, "  %-18s %12ld\n", "Entries", stats.num_entries);
+  fprintf(stderr, "  %-18s %12u\n", "Queue Size", options.pipeline_depth);
+  fprintf(stderr, "  %-18s %12lu\n", "Max Queue Depth", (unsigned long) stats.max_depth);
+  fprintf(stderr, "  %-18s %12.1f\n", "Mean Queue Depth", stats.mean_depth);
+  fprintf(stderr, "  %-18s %12ld\n", "Walker Stalls", stats.walker_stalls);
+  fprintf(stderr, "  %-18s %12ld\n", "Aggregator Waits", stats.aggregator_waits);
+  fprintf(stderr, "\n");
 }
 
 //---
@@ -1112,30 +2146,23 @@ operator()(CUsageDirUsage *dir_usage1, CUsageDirUsage *dir_usage2)
 // Routine used to update the maximum length of the filenames in a list to be output.
 void
 CUsage::
-setFileSpecLength(CUsageFileSpec *file_spec)
+setFileSpecLength(const CUsageFileSpec &file_spec)
 {
-  uint name_length = uint(file_spec->name.size());
+  uint name_length = uint(file_spec.name.size());
 
   if (name_length > max_name_length)
     max_name_length = name_length;
 }
 
-// Get the required file date dependant on whether the user wishes to see Access,
-// Modified or Changed time.
-//
-// Uses the global variable 'date_type' to determine which time to return.
-time_t
+// Set the maximum length of the filenames to that of a list to be output.
+void
 CUsage::
-statTime(const struct stat *stat)
+setFileSpecsLength(const CUsageScanResults::FileSpecs &file_specs)
 {
-  if      (date_type == CUsageDateType::LAST_ACCESSED)
-    return stat->st_atime;
-  else if (date_type == CUsageDateType::LAST_MODIFIED)
-    return stat->st_mtime;
-  else if (date_type == CUsageDateType::LAST_CHANGED)
-    return stat->st_ctime;
-  else
-    return stat->st_atime;
+  max_name_length = 0;
+
+  for (const auto &file_spec : file_specs)
+    setFileSpecLength(file_spec);
 }
 
 // Output an error Message.
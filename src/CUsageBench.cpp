@@ -0,0 +1,600 @@
+// CUsage end-to-end benchmark.
+//
+// Generates a parameterised synthetic tree (wide flat directories, deep chains, many
+// tiny files, hard links, symbolic links, sparse files and hidden subtrees) below a
+// temporary directory and runs CUsage over each part of it with a matrix of option
+// sets. For each run the best wall time, entries/sec and peak RSS are reported as tab
+// separated values so results can be compared across commits.
+//
+// With -cold the page, dentry and inode caches are dropped before every run (needs
+// root), e.g. to compare readdir and inode order stats ('-o c' and '-o c --inode-order')
+// with the tree on a spinning disk or a loop device file system (-dir).
+//
+// Usage:
+//   CUsageBench [-bin <CUsage>] [-dir <tmpdir>] [-scale <n>] [-reps <n>]
+//               [-label <label>] [-keep] [-cold]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct BenchCase {
+  std::string name;
+  std::string dir;
+  long        entries { 0 };
+};
+
+struct BenchResult {
+  double wall    { 0.0 };
+  long   max_rss { 0 };
+  bool   ok      { false };
+};
+
+class CUsageBench {
+ public:
+  CUsageBench() { }
+
+  bool processOptions(int argc, char **argv);
+
+  int exec();
+
+ private:
+  bool generate();
+
+  long genWide    (const std::string &dir);
+  long genDeep    (const std::string &dir);
+  long genTiny    (const std::string &dir);
+  long genHardLink(const std::string &dir);
+  long genSymLink (const std::string &dir);
+  long genSparse  (const std::string &dir);
+  long genHidden  (const std::string &dir);
+
+  bool makeDir(const std::string &dir);
+  bool makeFile(const std::string &filename, off_t size, bool write_data=false);
+
+  BenchResult run(const std::string &options, const std::string &dir);
+
+  bool dropCaches();
+
+  void removeTree();
+
+ private:
+  using Cases = std::vector<BenchCase>;
+
+  std::string bin_     { "../bin/CUsage" };
+  std::string tmp_dir_ { "/tmp" };
+  std::string root_;
+  std::string label_   { "-" };
+  long        scale_   { 1 };
+  int         reps_    { 3 };
+  bool        keep_    { false };
+  bool        cold_    { false };
+  Cases       cases_;
+  long        num_created_ { 0 };
+  time_t      base_time_   { 0 };
+};
+
+}
+
+int
+main(int argc, char **argv)
+{
+  CUsageBench bench;
+
+  if (! bench.processOptions(argc, argv))
+    exit(1);
+
+  exit(bench.exec());
+}
+
+namespace {
+
+bool
+CUsageBench::
+processOptions(int argc, char **argv)
+{
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+
+    bool has_value = (i < argc - 1);
+
+    if      (arg == "-bin"   && has_value) bin_     = argv[++i];
+    else if (arg == "-dir"   && has_value) tmp_dir_ = argv[++i];
+    else if (arg == "-scale" && has_value) scale_   = std::max(atol(argv[++i]), 1L);
+    else if (arg == "-reps"  && has_value) reps_    = std::max(atoi(argv[++i]), 1);
+    else if (arg == "-label" && has_value) label_   = argv[++i];
+    else if (arg == "-keep")               keep_    = true;
+    else if (arg == "-cold")               cold_    = true;
+    else {
+      fprintf(stderr, "Usage: CUsageBench [-bin <CUsage>] [-dir <tmpdir>] [-scale <n>] "
+                      "[-reps <n>] [-label <label>] [-keep] [-cold]\n");
+      return false;
+    }
+  }
+
+  if (access(bin_.c_str(), X_OK) != 0) {
+    fprintf(stderr, "CUsageBench : '%s' is not executable\n", bin_.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+int
+CUsageBench::
+exec()
+{
+  std::string templ = tmp_dir_ + "/CUsageBench.XXXXXX";
+
+  std::vector<char> templ1(templ.begin(), templ.end());
+
+  templ1.push_back('\0');
+
+  if (! mkdtemp(&templ1[0])) {
+    fprintf(stderr, "CUsageBench : Failed to create directory in '%s'\n", tmp_dir_.c_str());
+    return 1;
+  }
+
+  root_ = &templ1[0];
+
+  fprintf(stderr, "Generating tree in '%s' ...\n", root_.c_str());
+
+  bool rc = generate();
+
+  if (rc) {
+    static const char *option_sets[] = {
+      "-o c", "-o c --inode-order", "-o lsond", "-o lsond -mp [0-9]7", "-o l -mt exe",
+      "-o lsond -H"
+    };
+
+    printf("# CUsageBench label=%s scale=%ld reps=%d cold=%d\n", label_.c_str(), scale_,
+           reps_, int(cold_));
+    printf("%s\t%s\t%s\t%s\t%s\t%s\t%s\n", "label", "case", "options", "entries",
+           "wall_s", "entries_per_s", "max_rss_kb");
+
+    for (const auto &bench_case : cases_) {
+      for (const auto &options : option_sets) {
+        auto result = run(options, bench_case.dir);
+
+        if (! result.ok) {
+          rc = false;
+          continue;
+        }
+
+        double rate = (result.wall > 0.0 ? double(bench_case.entries)/result.wall : 0.0);
+
+        printf("%s\t%s\t%s\t%ld\t%.4f\t%.0f\t%ld\n", label_.c_str(), bench_case.name.c_str(),
+               options, bench_case.entries, result.wall, rate, result.max_rss);
+
+        fflush(stdout);
+      }
+    }
+  }
+
+  if (! keep_)
+    removeTree();
+  else
+    fprintf(stderr, "Tree kept in '%s'\n", root_.c_str());
+
+  return (rc ? 0 : 1);
+}
+
+// Generate each part of the tree in its own sub directory (the whole tree is also
+// benchmarked as case 'all')
+bool
+CUsageBench::
+generate()
+{
+  using GenProc = long (CUsageBench::*)(const std::string &);
+
+  struct GenData {
+    const char *name;
+    GenProc     proc;
+  };
+
+  static GenData gen_data[] = {
+    { "wide"    , &CUsageBench::genWide     },
+    { "deep"    , &CUsageBench::genDeep     },
+    { "tiny"    , &CUsageBench::genTiny     },
+    { "hardlink", &CUsageBench::genHardLink },
+    { "symlink" , &CUsageBench::genSymLink  },
+    { "sparse"  , &CUsageBench::genSparse   },
+    { "hidden"  , &CUsageBench::genHidden   },
+  };
+
+  base_time_ = time(nullptr);
+
+  long total = 0;
+
+  for (const auto &data : gen_data) {
+    BenchCase bench_case;
+
+    bench_case.name = data.name;
+    bench_case.dir  = root_ + "/" + data.name;
+
+    if (! makeDir(bench_case.dir))
+      return false;
+
+    bench_case.entries = (this->*data.proc)(bench_case.dir);
+
+    if (bench_case.entries < 0)
+      return false;
+
+    total += bench_case.entries + 1;
+
+    cases_.push_back(bench_case);
+  }
+
+  BenchCase all_case;
+
+  all_case.name    = "all";
+  all_case.dir     = root_;
+  all_case.entries = total;
+
+  cases_.push_back(all_case);
+
+  return true;
+}
+
+// one directory with many files
+long
+CUsageBench::
+genWide(const std::string &dir)
+{
+  long n = 20000*scale_;
+
+  for (long i = 0; i < n; ++i)
+    if (! makeFile(dir + "/f" + std::to_string(i), off_t((i*7919) % 65536)))
+      return -1;
+
+  return n;
+}
+
+// chain of nested directories with a few files in each
+long
+CUsageBench::
+genDeep(const std::string &dir)
+{
+  long depth = std::min(200*scale_, 1000L);
+
+  long n = 0;
+
+  std::string dir1 = dir;
+
+  for (long i = 0; i < depth; ++i) {
+    dir1 += "/d";
+
+    if (! makeDir(dir1))
+      return -1;
+
+    ++n;
+
+    for (int j = 0; j < 5; ++j) {
+      if (! makeFile(dir1 + "/f" + std::to_string(j), off_t(i*100 + j)))
+        return -1;
+
+      ++n;
+    }
+  }
+
+  return n;
+}
+
+// many directories of tiny (written) files
+long
+CUsageBench::
+genTiny(const std::string &dir)
+{
+  long num_dirs = 200*scale_;
+
+  long n = 0;
+
+  for (long i = 0; i < num_dirs; ++i) {
+    std::string dir1 = dir + "/t" + std::to_string(i);
+
+    if (! makeDir(dir1))
+      return -1;
+
+    ++n;
+
+    for (int j = 0; j < 100; ++j) {
+      if (! makeFile(dir1 + "/x" + std::to_string(j), off_t((i + j) % 64), true))
+        return -1;
+
+      ++n;
+    }
+  }
+
+  return n;
+}
+
+// files with three links each in different directories
+long
+CUsageBench::
+genHardLink(const std::string &dir)
+{
+  long num_files = 2000*scale_;
+
+  std::string dirs[3] = { dir + "/a", dir + "/b", dir + "/c" };
+
+  for (const auto &dir1 : dirs)
+    if (! makeDir(dir1))
+      return -1;
+
+  long n = 3;
+
+  for (long i = 0; i < num_files; ++i) {
+    std::string name = "/h" + std::to_string(i);
+
+    if (! makeFile(dirs[0] + name, off_t(1000 + i)))
+      return -1;
+
+    for (int j = 1; j < 3; ++j)
+      if (link((dirs[0] + name).c_str(), (dirs[j] + name).c_str()) != 0)
+        return -1;
+
+    n += 3;
+  }
+
+  return n;
+}
+
+// symbolic links to files and directories
+long
+CUsageBench::
+genSymLink(const std::string &dir)
+{
+  long num_files = 2000*scale_;
+
+  std::string target_dir = dir + "/targets";
+
+  if (! makeDir(target_dir))
+    return -1;
+
+  long n = 1;
+
+  for (long i = 0; i < num_files; ++i) {
+    std::string name = "s" + std::to_string(i);
+
+    if (! makeFile(target_dir + "/" + name, off_t(i)))
+      return -1;
+
+    if (symlink(("targets/" + name).c_str(), (dir + "/l" + name).c_str()) != 0)
+      return -1;
+
+    n += 2;
+  }
+
+  for (int i = 0; i < 50; ++i) {
+    if (symlink("targets", (dir + "/ld" + std::to_string(i)).c_str()) != 0)
+      return -1;
+
+    ++n;
+  }
+
+  return n;
+}
+
+// large sparse files
+long
+CUsageBench::
+genSparse(const std::string &dir)
+{
+  long num_files = 500*scale_;
+
+  for (long i = 0; i < num_files; ++i)
+    if (! makeFile(dir + "/p" + std::to_string(i), off_t(i + 1)*1024*1024))
+      return -1;
+
+  return num_files;
+}
+
+// hidden directories and dot files
+long
+CUsageBench::
+genHidden(const std::string &dir)
+{
+  long num_dirs = 100*scale_;
+
+  long n = 0;
+
+  for (long i = 0; i < num_dirs; ++i) {
+    std::string dir1 = dir + (i % 2 ? "/.h" : "/v") + std::to_string(i);
+
+    if (! makeDir(dir1))
+      return -1;
+
+    ++n;
+
+    for (int j = 0; j < 50; ++j) {
+      if (! makeFile(dir1 + (j % 5 ? "/y" : "/.y") + std::to_string(j), off_t(j*10)))
+        return -1;
+
+      ++n;
+    }
+  }
+
+  return n;
+}
+
+bool
+CUsageBench::
+makeDir(const std::string &dir)
+{
+  if (mkdir(dir.c_str(), 0755) != 0) {
+    fprintf(stderr, "CUsageBench : Failed to create '%s'\n", dir.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+// Create file of specified size (written or sparse) with a spread of modify times
+bool
+CUsageBench::
+makeFile(const std::string &filename, off_t size, bool write_data)
+{
+  int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0) {
+    fprintf(stderr, "CUsageBench : Failed to create '%s'\n", filename.c_str());
+    return false;
+  }
+
+  bool rc = true;
+
+  if      (write_data) {
+    char buffer[64];
+
+    memset(buffer, 'x', sizeof(buffer));
+
+    rc = (write(fd, buffer, size_t(size)) == ssize_t(size));
+  }
+  else if (size > 0)
+    rc = (ftruncate(fd, size) == 0);
+
+  struct timespec times[2];
+
+  times[0].tv_sec  = base_time_ - (num_created_ % 1000)*86400;
+  times[0].tv_nsec = 0;
+  times[1].tv_sec  = base_time_ - ((num_created_*7919) % 100000)*3607;
+  times[1].tv_nsec = 0;
+
+  (void) futimens(fd, times);
+
+  close(fd);
+
+  ++num_created_;
+
+  return rc;
+}
+
+// Run CUsage with options on directory (best of reps) and get wall time and peak RSS
+BenchResult
+CUsageBench::
+run(const std::string &options, const std::string &dir)
+{
+  BenchResult result;
+
+  std::vector<std::string> args;
+
+  args.push_back(bin_);
+
+  std::string::size_type pos = 0;
+
+  while (pos < options.size()) {
+    auto pos1 = options.find(' ', pos);
+
+    if (pos1 == std::string::npos)
+      pos1 = options.size();
+
+    if (pos1 > pos)
+      args.push_back(options.substr(pos, pos1 - pos));
+
+    pos = pos1 + 1;
+  }
+
+  args.push_back(dir);
+
+  std::vector<char *> argv;
+
+  for (auto &arg : args)
+    argv.push_back(&arg[0]);
+
+  argv.push_back(nullptr);
+
+  for (int rep = 0; rep < reps_; ++rep) {
+    if (cold_ && ! dropCaches())
+      return result;
+
+    auto start = std::chrono::steady_clock::now();
+
+    pid_t pid = fork();
+
+    if (pid < 0)
+      return result;
+
+    if (pid == 0) {
+      int fd = open("/dev/null", O_WRONLY);
+
+      if (fd >= 0) {
+        dup2(fd, 1);
+        dup2(fd, 2);
+      }
+
+      execv(argv[0], &argv[0]);
+
+      _exit(127);
+    }
+
+    int           status = 0;
+    struct rusage usage;
+
+    if (wait4(pid, &status, 0, &usage) != pid || ! WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "CUsageBench : '%s %s' failed\n", bin_.c_str(), options.c_str());
+      return result;
+    }
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (rep == 0 || wall < result.wall)
+      result.wall = wall;
+
+    result.max_rss = std::max(result.max_rss, long(usage.ru_maxrss));
+  }
+
+  result.ok = true;
+
+  return result;
+}
+
+// Write back dirty data and drop clean page, dentry and inode caches (so the next run
+// reads all metadata from disk)
+bool
+CUsageBench::
+dropCaches()
+{
+  sync();
+
+  int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+
+  bool rc = (fd >= 0 && write(fd, "3\n", 2) == 2);
+
+  if (fd >= 0)
+    close(fd);
+
+  if (! rc)
+    fprintf(stderr, "CUsageBench : Failed to drop caches (-cold needs root)\n");
+
+  return rc;
+}
+
+int
+removeEntry(const char *path, const struct stat *, int, struct FTW *)
+{
+  return remove(path);
+}
+
+void
+CUsageBench::
+removeTree()
+{
+  (void) nftw(root_.c_str(), removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+}
@@ -0,0 +1,107 @@
+#ifndef CUsageBinaryIO_H
+#define CUsageBinaryIO_H
+
+#include <CUsageScan.h>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Writer of 64 bit values and length prefixed strings (native byte order) to a
+// buffered file. Any failed write sets the error state.
+class CUsageBinaryWriter {
+ public:
+  CUsageBinaryWriter(FILE *fp) : fp_(fp) { }
+
+  void put(uint64_t i) {
+    ok_ = ok_ && fwrite(&i, sizeof(i), 1, fp_) == 1;
+  }
+
+  void put(const std::string &str) {
+    put(uint64_t(str.size()));
+
+    ok_ = ok_ && (str.empty() || fwrite(str.data(), str.size(), 1, fp_) == 1);
+  }
+
+  void put(const CUsageScanResults::FileSpecs &files) {
+    put(uint64_t(files.size()));
+
+    for (const auto &file : files) {
+      put(file.name);
+      put(uint64_t(file.size));
+      put(uint64_t(file.time));
+    }
+  }
+
+  void put(const CUsageScanResults::DirNames &names) {
+    put(uint64_t(names.size()));
+
+    for (const auto &name : names)
+      put(name);
+  }
+
+  bool isOk() const { return ok_; }
+
+ private:
+  FILE *fp_ { nullptr };
+  bool  ok_ { true };
+};
+
+// Reader matching CUsageBinaryWriter. Any short read sets the error state and returns
+// zero/empty.
+class CUsageBinaryReader {
+ public:
+  CUsageBinaryReader(FILE *fp) : fp_(fp) { }
+
+  uint64_t getInt() {
+    uint64_t i = 0;
+
+    ok_ = ok_ && fread(&i, sizeof(i), 1, fp_) == 1;
+
+    return (ok_ ? i : 0);
+  }
+
+  std::string getString() {
+    uint64_t len = getInt();
+
+    // sanity check length (names are paths)
+    if (! ok_ || len > (1U << 20)) {
+      ok_ = false;
+      return "";
+    }
+
+    std::string str(len, '\0');
+
+    ok_ = ok_ && (len == 0 || fread(&str[0], len, 1, fp_) == 1);
+
+    return (ok_ ? str : "");
+  }
+
+  void getFileSpecs(CUsageScanResults::FileSpecs &files) {
+    uint64_t n = getInt();
+
+    for (uint64_t i = 0; i < n && ok_; ++i) {
+      CUsageFileSpec file;
+
+      file.name = getString();
+      file.size = size_t(getInt());
+      file.time = time_t(getInt());
+
+      files.push_back(file);
+    }
+  }
+
+  void getDirNames(CUsageScanResults::DirNames &names) {
+    uint64_t n = getInt();
+
+    for (uint64_t i = 0; i < n && ok_; ++i)
+      names.push_back(getString());
+  }
+
+  bool isOk() const { return ok_; }
+
+ private:
+  FILE *fp_ { nullptr };
+  bool  ok_ { true };
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include <CUsageCheckpoint.h>
+#include <CUsageBinaryIO.h>
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+
+const char     *checkpoint_magic   = "CUSAGECP";
+const uint64_t  checkpoint_version = 2;
+
+}
+
+//------------
+
+// Write checkpoint to temporary file, sync it and rename it over the checkpoint file
+bool
+CUsageCheckpoint::
+write(const std::string &filename, std::string &msg) const
+{
+  std::string tmpname = filename + ".tmp";
+
+  FILE *fp = fopen(tmpname.c_str(), "wb");
+
+  if (! fp) {
+    msg = "Failed to write checkpoint \'" + tmpname + "\'";
+    return false;
+  }
+
+  CUsageBinaryWriter writer(fp);
+
+  /* Header */
+
+  writer.put(std::string(checkpoint_magic));
+  writer.put(checkpoint_version);
+  writer.put(directory);
+  writer.put(options);
+  writer.put(uint64_t(current_time));
+
+  /* Totals and File Lists */
+
+  writer.put(uint64_t(results.total_usage));
+  writer.put(uint64_t(results.num_files));
+  writer.put(uint64_t(results.num_dirs));
+
+  writer.put(results.largest_files );
+  writer.put(results.smallest_files);
+  writer.put(results.oldest_files  );
+  writer.put(results.newest_files  );
+
+  writer.put(results.skipped_mounts);
+  writer.put(results.link_loops    );
+
+  /* Directories */
+
+  writer.put(uint64_t(dirs.size()));
+
+  for (const auto &dir : dirs) {
+    writer.put(dir.name);
+    writer.put(uint64_t(dir.parent));
+    writer.put(uint64_t(dir.depth));
+    writer.put(uint64_t(dir.dev));
+    writer.put(uint64_t(dir.pending));
+    writer.put(uint64_t(dir.size));
+    writer.put(uint64_t(dir.dir_size));
+    writer.put(uint64_t(dir.num_usages));
+    writer.put(uint64_t(dir.num_files));
+    writer.put(uint64_t(dir.num_dirs));
+    writer.put(uint64_t(dir.num_entries));
+    writer.put(dir.readdir_ns);
+    writer.put(dir.stat_ns);
+  }
+
+  bool ok = writer.isOk() && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+
+  if (fclose(fp) != 0)
+    ok = false;
+
+  if (! ok || rename(tmpname.c_str(), filename.c_str()) != 0) {
+    (void) remove(tmpname.c_str());
+
+    msg = "Failed to write checkpoint \'" + filename + "\'";
+
+    return false;
+  }
+
+  return true;
+}
+
+bool
+CUsageCheckpoint::
+read(const std::string &filename, std::string &msg)
+{
+  *this = CUsageCheckpoint();
+
+  FILE *fp = fopen(filename.c_str(), "rb");
+
+  if (! fp) {
+    msg = "Failed to read checkpoint \'" + filename + "\'";
+    return false;
+  }
+
+  CUsageBinaryReader reader(fp);
+
+  /* Header */
+
+  std::string magic   = reader.getString();
+  uint64_t    version = reader.getInt();
+
+  if (! reader.isOk() || magic != checkpoint_magic || version != checkpoint_version) {
+    fclose(fp);
+
+    msg = "Invalid checkpoint file \'" + filename + "\'";
+
+    return false;
+  }
+
+  directory    = reader.getString();
+  options      = reader.getString();
+  current_time = time_t(reader.getInt());
+
+  /* Totals and File Lists */
+
+  results.directory   = directory;
+  results.total_usage = size_t(reader.getInt());
+  results.num_files   = long  (reader.getInt());
+  results.num_dirs    = long  (reader.getInt());
+
+  reader.getFileSpecs(results.largest_files );
+  reader.getFileSpecs(results.smallest_files);
+  reader.getFileSpecs(results.oldest_files  );
+  reader.getFileSpecs(results.newest_files  );
+
+  reader.getDirNames(results.skipped_mounts);
+  reader.getDirNames(results.link_loops    );
+
+  /* Directories */
+
+  uint64_t num_dirs = reader.getInt();
+
+  for (uint64_t i = 0; i < num_dirs && reader.isOk(); ++i) {
+    CUsageCheckpointDir dir;
+
+    dir.name        = reader.getString();
+    dir.parent      = long    (reader.getInt());
+    dir.depth       = int     (reader.getInt());
+    dir.dev         = dev_t   (reader.getInt());
+    dir.pending     = bool    (reader.getInt());
+    dir.size        = size_t  (reader.getInt());
+    dir.dir_size    = size_t  (reader.getInt());
+    dir.num_usages  = long    (reader.getInt());
+    dir.num_files   = long    (reader.getInt());
+    dir.num_dirs    = long    (reader.getInt());
+    dir.num_entries = long    (reader.getInt());
+    dir.readdir_ns  = uint64_t(reader.getInt());
+    dir.stat_ns     = uint64_t(reader.getInt());
+
+    // parent must already have been read (root has none)
+    if ((i == 0 && dir.parent != -1) || (i > 0 && (dir.parent < 0 || dir.parent >= long(i))))
+      break;
+
+    dirs.push_back(dir);
+  }
+
+  fclose(fp);
+
+  if (! reader.isOk() || dirs.size() != num_dirs || dirs.empty()) {
+    msg = "Invalid checkpoint file \'" + filename + "\'";
+    return false;
+  }
+
+  return true;
+}
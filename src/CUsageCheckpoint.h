@@ -0,0 +1,51 @@
+#ifndef CUsageCheckpoint_H
+#define CUsageCheckpoint_H
+
+#include <CUsageScan.h>
+#include <string>
+#include <vector>
+
+// Checkpoint directory.
+//
+// Read directory (with its direct counts) or pending (unread) directory of a partial
+// scan. Only the name, depth, device and own size of a pending directory are used.
+struct CUsageCheckpointDir {
+  std::string name;
+  long        parent      { -1 };    // index of parent (-1 for root)
+  int         depth       { 0 };
+  dev_t       dev         { 0 };
+  bool        pending     { false }; // not yet read
+  size_t      size        { 0 };
+  size_t      dir_size    { 0 };
+  long        num_usages  { 0 };
+  long        num_files   { 0 };
+  long        num_dirs    { 0 };
+  long        num_entries { 0 };
+  uint64_t    readdir_ns  { 0 };
+  uint64_t    stat_ns     { 0 };
+};
+
+// Scan checkpoint.
+//
+// State of a partial scan : the totals and file lists of the directories read so far,
+// the mounts skipped and link loops found, the read directories (only the root,
+// holding the sum of all read directories, if no per directory results are needed)
+// and the pending directories still to be read.
+//
+// The file is binary (native byte order, so only for resuming on the same machine)
+// and is written to a temporary file which is renamed so it is replaced atomically.
+struct CUsageCheckpoint {
+  using Dirs = std::vector<CUsageCheckpointDir>;
+
+  std::string       directory;        // scanned directory
+  std::string       options;          // options signature (must match on resume)
+  time_t            current_time { 0 };
+  CUsageScanResults results;          // totals, file lists, skipped mounts and link
+                                      // loops
+  Dirs              dirs;             // parents before children, root first
+
+  bool write(const std::string &filename, std::string &msg) const;
+  bool read (const std::string &filename, std::string &msg);
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include <CUsageDirTree.h>
+
+#include <algorithm>
+
+CUsageDirTree::
+~CUsageDirTree()
+{
+  clear();
+}
+
+CUsageDirNode *
+CUsageDirTree::
+setRoot(const std::string &name)
+{
+  clear();
+
+  root_ = new CUsageDirNode;
+
+  root_->name = name;
+
+  return root_;
+}
+
+CUsageDirNode *
+CUsageDirTree::
+addChild(CUsageDirNode *parent, const std::string &name)
+{
+  auto *node = new CUsageDirNode;
+
+  node->name   = name;
+  node->parent = parent;
+  node->depth  = parent->depth + 1;
+
+  parent->children.push_back(node);
+
+  return node;
+}
+
+// Sum direct counts of each node into the totals of the node and all its parents.
+//
+// Nodes are visited children first (reverse of pre-order) so each node's totals are
+// complete before they are added to its parent. No recursion so deep trees are safe.
+void
+CUsageDirTree::
+rollUp()
+{
+  std::vector<CUsageDirNode *> nodes;
+
+  getNodes(nodes);
+
+  for (auto &node : nodes) {
+    node->total_size        = node->size + node->dir_size;
+    node->total_usage       = node->size;
+    node->total_num_usages  = node->num_usages;
+    node->total_num_files   = node->num_files;
+    node->total_num_entries = node->num_entries;
+    node->total_cold_size   = node->cold_size;
+  }
+
+  for (auto p = nodes.rbegin(); p != nodes.rend(); ++p) {
+    auto *node   = *p;
+    auto *parent = node->parent;
+
+    if (! parent)
+      continue;
+
+    parent->total_size        += node->total_size;
+    parent->total_usage       += node->total_usage;
+    parent->total_num_usages  += node->total_num_usages;
+    parent->total_num_files   += node->total_num_files;
+    parent->total_num_entries += node->total_num_entries;
+    parent->total_cold_size   += node->total_cold_size;
+  }
+}
+
+// Children first order is the reverse of a pre-order walk which visits the children
+// in reverse order.
+void
+CUsageDirTree::
+getNodes(std::vector<CUsageDirNode *> &nodes, int max_depth, bool children_first) const
+{
+  if (! root_)
+    return;
+
+  auto start = nodes.size();
+
+  std::vector<CUsageDirNode *> stack;
+
+  stack.push_back(root_);
+
+  while (! stack.empty()) {
+    auto *node = stack.back();
+
+    stack.pop_back();
+
+    nodes.push_back(node);
+
+    if (max_depth >= 0 && node->depth >= max_depth)
+      continue;
+
+    if (children_first) {
+      for (auto p = node->children.begin(); p != node->children.end(); ++p)
+        stack.push_back(*p);
+    }
+    else {
+      for (auto p = node->children.rbegin(); p != node->children.rend(); ++p)
+        stack.push_back(*p);
+    }
+  }
+
+  if (children_first)
+    std::reverse(nodes.begin() + long(start), nodes.end());
+}
+
+void
+CUsageDirTree::
+clear()
+{
+  std::vector<CUsageDirNode *> nodes;
+
+  getNodes(nodes);
+
+  for (auto &node : nodes)
+    delete node;
+
+  root_ = nullptr;
+}
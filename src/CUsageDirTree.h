@@ -0,0 +1,95 @@
+#ifndef CUsageDirTree_H
+#define CUsageDirTree_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Directory node.
+//
+// One node is created for each directory read by the walker. The direct counts are
+// only updated by the thread reading the directory (or its parent, for the directory's
+// own entry) so need no locking. The totals are filled in by CUsageDirTree::rollUp()
+// once the walk is complete.
+//
+// The walker sets read_seq when the directory has been completely read. Once it is set
+// the direct counts (apart from dir_size, which is set while the parent is read) and
+// children no longer change, so they can be read by another thread (e.g. a checkpoint).
+struct CUsageDirNode {
+  using Children = std::vector<CUsageDirNode *>;
+
+  std::string    name;
+  CUsageDirNode* parent      { nullptr };
+  Children       children;               // in read order
+  int            depth       { 0 };
+  dev_t          dev         { 0 };      // device of directory
+  ino_t          ino         { 0 };      // inode of directory
+  long           nlink       { 0 };      // link count of directory (2 + sub directories
+                                         // on most file systems)
+
+  std::atomic<uint64_t> read_seq { 0 }; // walk sequence number when read (0 = not read)
+
+  // direct (entries of this directory)
+  size_t         size        { 0 };      // bytes added to usage (files and links)
+  size_t         dir_size    { 0 };      // bytes added for directory's own entry
+  long           num_usages  { 0 };      // number of files and links added to usage
+  long           num_files   { 0 };      // number of files counted
+  long           num_dirs    { 0 };      // number of sub directories counted
+  long           num_entries { 0 };      // number of entries read
+  uint64_t       readdir_ns  { 0 };      // time in opendir/readdir (if timed)
+  uint64_t       stat_ns     { 0 };      // time in lstat/stat (if timed)
+  size_t         cold_size   { 0 };      // bytes of cold files (cold report)
+  long           num_cold_files { 0 };   // number of cold files
+
+  // sample mode (num_files is the number of files sampled)
+  long           num_unsampled { 0 };    // number of files not sampled (not stat'ed)
+  double         sample_size   { 0.0 };  // estimated usage of files
+  double         sample_var    { 0.0 };  // variance of estimated usage
+
+  // totals (this directory and all directories below it)
+  size_t         total_size        { 0 };   // usage and own sizes of directories
+  size_t         total_usage       { 0 };   // usage (files and links)
+  long           total_num_usages  { 0 };
+  long           total_num_files   { 0 };
+  long           total_num_entries { 0 };
+  size_t         total_cold_size   { 0 };
+};
+
+// Directory tree.
+//
+// Tree of directory nodes built by a single walk. Per directory counts are added to the
+// directory's node as its entries are read, and summed into the parent directories in
+// one bottom up pass at the end (rather than updating every ancestor per entry).
+class CUsageDirTree {
+ public:
+  CUsageDirTree() { }
+ ~CUsageDirTree();
+
+  CUsageDirTree(const CUsageDirTree &) = delete;
+  CUsageDirTree &operator=(const CUsageDirTree &) = delete;
+
+  CUsageDirNode *root() const { return root_; }
+
+  // set root directory (clears existing tree)
+  CUsageDirNode *setRoot(const std::string &name);
+
+  // add child directory (must only be called by the thread which owns the parent)
+  CUsageDirNode *addChild(CUsageDirNode *parent, const std::string &name);
+
+  // sum direct counts into totals
+  void rollUp();
+
+  // get nodes to max depth (-1 = all), parents before children or children before
+  // parents (as du)
+  void getNodes(std::vector<CUsageDirNode *> &nodes, int max_depth=-1,
+                bool children_first=false) const;
+
+  void clear();
+
+ private:
+  CUsageDirNode *root_ { nullptr };
+};
+
+#endif
@@ -0,0 +1,1108 @@
+#include <CUsageDirWalk.h>
+#include <CUsagePathList.h>
+#include <CUsageProfile.h>
+#include <CUsageProgress.h>
+#include <CUsageScan.h>
+#include <CUsageThrottle.h>
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <numeric>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+uint64_t monotonicNs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return uint64_t(ts.tv_sec)*1000000000ULL + uint64_t(ts.tv_nsec);
+}
+
+// Hash name and seed (FNV-1a then splitmix64 finalizer) to a uniform value in [0, 1)
+double sampleValue(uint64_t seed, const std::string &name) {
+  uint64_t h = 14695981039346656037ULL ^ seed;
+
+  for (auto c : name) {
+    h ^= uint64_t((unsigned char) c);
+    h *= 1099511628211ULL;
+  }
+
+  h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+
+  return double(h >> 11)*(1.0/9007199254740992.0);
+}
+
+// Check for '.' or '..' entry
+bool isDotName(const char *name) {
+  return (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')));
+}
+
+// Path without trailing separators (apart from a root '/')
+std::string_view trimPath(std::string_view path) {
+  while (path.size() > 1 && path.back() == '/')
+    path.remove_suffix(1);
+
+  return path;
+}
+
+// Parent directory of trimmed path. A name without a separator is in '.', and '.' and
+// '/' have no parent (false returned).
+bool parentPath(std::string_view path, std::string_view &parent) {
+  auto pos = path.rfind('/');
+
+  if (pos == std::string_view::npos) {
+    if (path == ".")
+      return false;
+
+    parent = ".";
+  }
+  else if (pos == 0) {
+    if (path.size() == 1)
+      return false;
+
+    parent = path.substr(0, 1);
+  }
+  else
+    parent = trimPath(path.substr(0, pos));
+
+  return true;
+}
+
+}
+
+//------------
+
+// Path list walk state. The parent directories of all paths are added to the tree
+// (below the root) before the paths are stat'ed, so the tree is only changed by the
+// thread handling a directory's paths (for directories which are only listed).
+struct CUsageDirWalk::ListWalk {
+  using DirMap = std::unordered_map<std::string_view, uint32_t>;
+  using Inds   = std::vector<uint32_t>;
+
+  const CUsagePathList* list      { nullptr };
+  bool                  sort_dirs { false };
+  DirNodeList           dirs;                // root and parent directories
+  DirMap                dir_map;             // path of directory to index in dirs
+  Inds                  path_dirs;           // index of each path's parent in dirs
+  Inds                  group_dirs;          // dirs in name order (sorted)
+  std::vector<size_t>   group_starts;        // start of group's paths in order (sorted)
+  Inds                  order;               // paths grouped by directory (sorted)
+  std::atomic<size_t>   next_group { 0 };    // next group to stat (sorted)
+
+  // index of directory (added with its parents if new)
+  uint32_t addDir(CUsageDirTree &tree, std::string_view path) {
+    auto p = dir_map.find(path);
+
+    if (p != dir_map.end())
+      return (*p).second;
+
+    std::string_view parent;
+
+    uint32_t parent_ind = (parentPath(path, parent) ? addDir(tree, parent) : 0);
+
+    auto *node = tree.addChild(dirs[parent_ind], std::string(path));
+
+    uint32_t ind = uint32_t(dirs.size());
+
+    dirs.push_back(node);
+
+    dir_map[path] = ind;
+
+    return ind;
+  }
+};
+
+CUsageDirWalk::
+CUsageDirWalk(CUsageScan *scan, const std::string &dirname) :
+ scan_(scan), root_(dirname), thread_locks_(1)
+{
+  // root node is created here so the tree can be restored before resume()
+  auto *root = tree_.setRoot(root_);
+
+  struct stat root_stat;
+
+  if (stat(root_.c_str(), &root_stat) == 0) {
+    root->dev   = root_stat.st_dev;
+    root->ino   = root_stat.st_ino;
+    root->nlink = long(root_stat.st_nlink);
+  }
+}
+
+void
+CUsageDirWalk::
+setNumThreads(uint n)
+{
+  num_threads_ = std::max(n, 1U);
+
+  thread_locks_ = ThreadLocks(num_threads_);
+}
+
+// Walk all directories below the root. Returns false if the root could not be read.
+//
+// The root is read on the calling thread, then the calling thread and (num_threads - 1)
+// additional threads process the pending directories until none are left. In
+// background mode the calling thread's work is done on a separate thread so the
+// caller's priority is not changed.
+bool
+CUsageDirWalk::
+walk()
+{
+  read_seq_ = 0;
+
+  skipped_mounts_.clear();
+  link_loops_    .clear();
+
+  return run(/*read_root*/true);
+}
+
+// Walk the pending directories (and all directories below them) of a tree restored
+// from a checkpoint. The restored read nodes must have a non zero read sequence.
+//
+// The skipped mounts and link loops found before the checkpoint are kept. Those found
+// in directories read after the checkpoint's cut are found again when the directories
+// are re-read so the lists can contain duplicates.
+bool
+CUsageDirWalk::
+resume(const std::vector<CUsageDirNode *> &pending,
+       const std::vector<std::string> &skipped_mounts,
+       const std::vector<std::string> &link_loops)
+{
+  read_seq_ = 1;
+
+  // pushed in reverse so they are popped in the original order
+  pending_dirs_.assign(pending.rbegin(), pending.rend());
+
+  skipped_mounts_ = skipped_mounts;
+  link_loops_     = link_loops;
+
+  return run(/*read_root*/false);
+}
+
+// Stat the paths of a list (instead of reading directories) and process them in
+// batches as if they had been read from their parent directories.
+//
+// Each path's parent directory is added to the tree (with its parents) and each
+// directory's paths are stat'ed by one thread. The root stands for the current
+// directory, so the directories of relative paths (e.g. from 'find . -print0') are
+// below it as in a walk of '.', and '/' is a child of the root.
+//
+// If sort_dirs is set the paths are grouped by directory and the directories are
+// stat'ed in name order, taken by the threads in turn (so the entries of a directory,
+// and of neighbouring directories, are stat'ed together). Otherwise the paths are
+// stat'ed in list order, each thread taking the directories whose index modulo the
+// number of threads is its own. The listed paths are not walked (a listed directory
+// only adds its own size).
+bool
+CUsageDirWalk::
+walkList(const CUsagePathList &list, bool sort_dirs)
+{
+  read_seq_ = 0;
+
+  ListWalk list_walk;
+
+  list_walk.list      = &list;
+  list_walk.sort_dirs = sort_dirs;
+
+  // relative paths are below the root (the root is the current directory '.')
+  list_walk.dirs.push_back(tree_.root());
+
+  list_walk.dir_map["."] = 0;
+
+  size_t num_paths = list.size();
+
+  list_walk.path_dirs.resize(num_paths);
+
+  for (size_t i = 0; i < num_paths; ++i) {
+    std::string_view path =
+      trimPath(std::string_view(list.pathData(i), list.path(i).len));
+
+    std::string_view parent;
+
+    list_walk.path_dirs[i] =
+      (parentPath(path, parent) ? list_walk.addDir(tree_, parent) : 0);
+  }
+
+  // group paths by directory (counting sort, list order kept in each group)
+  if (sort_dirs) {
+    size_t num_dirs = list_walk.dirs.size();
+
+    auto &group_dirs = list_walk.group_dirs;
+
+    group_dirs.resize(num_dirs);
+
+    std::iota(group_dirs.begin(), group_dirs.end(), 0);
+
+    std::sort(group_dirs.begin(), group_dirs.end(), [&](uint32_t i1, uint32_t i2) {
+      return list_walk.dirs[i1]->name < list_walk.dirs[i2]->name;
+    });
+
+    // number of paths of each dir, then next position of its paths in order
+    std::vector<size_t> dir_pos(num_dirs, 0);
+
+    for (auto ind : list_walk.path_dirs)
+      ++dir_pos[ind];
+
+    auto &group_starts = list_walk.group_starts;
+
+    group_starts.resize(num_dirs + 1);
+
+    size_t start = 0;
+
+    for (size_t g = 0; g < num_dirs; ++g) {
+      size_t n = dir_pos[group_dirs[g]];
+
+      group_starts[g] = start;
+
+      dir_pos[group_dirs[g]] = start;
+
+      start += n;
+    }
+
+    group_starts[num_dirs] = start;
+
+    list_walk.order.resize(num_paths);
+
+    for (size_t i = 0; i < num_paths; ++i)
+      list_walk.order[dir_pos[list_walk.path_dirs[i]]++] = uint32_t(i);
+  }
+
+  //------------
+
+  pending_dirs_  .clear();
+  skipped_mounts_.clear();
+  link_loops_    .clear();
+
+  list_walk_ = &list_walk;
+
+  bool rc = run(/*read_root*/false);
+
+  list_walk_ = nullptr;
+
+  return rc;
+}
+
+bool
+CUsageDirWalk::
+run(bool read_root)
+{
+  if (read_root)
+    pending_dirs_.clear();
+
+  dev_active_  .clear();
+  visited_dirs_.clear();
+
+  // root is walked (a link back to it is a loop)
+  if (follow_links_)
+    visited_dirs_.insert(std::make_pair(tree_.root()->dev, tree_.root()->ino));
+
+  batches_       = Batches(num_threads_);
+  inode_entries_ = InodeLists(num_threads_);
+
+  for (auto &batch : batches_)
+    batch.time_field = time_field_;
+
+  num_active_ = 0;
+  stopped_    = false;
+
+  if (background_) {
+    bool rc = false;
+
+    std::thread thread([&]() { setBackgroundPriority(); rc = walkRoot(read_root); });
+
+    thread.join();
+
+    return rc;
+  }
+
+  return walkRoot(read_root);
+}
+
+bool
+CUsageDirWalk::
+walkRoot(bool read_root)
+{
+  if (read_root && ! walkDir(0, tree_.root()))
+    return false;
+
+  auto threadProc =
+    (list_walk_ ? &CUsageDirWalk::runListThread : &CUsageDirWalk::runThread);
+
+  std::vector<std::thread> threads;
+
+  for (uint i = 1; i < num_threads_; ++i)
+    threads.emplace_back(threadProc, this, i);
+
+  (this->*threadProc)(0);
+
+  for (auto &thread : threads)
+    thread.join();
+
+  if (progress_)
+    progress_->setPendingDirs(0);
+
+  return true;
+}
+
+// Threads are flagged first so each stops at its next directory boundary, then each
+// thread's lock is taken (polling) as soon as it is free so no thread waits for
+// another to finish its directory.
+void
+CUsageDirWalk::
+syncThreads(const std::function<void(uint thread)> &proc)
+{
+  for (auto &thread_lock : thread_locks_)
+    ++thread_lock.waiters;
+
+  std::vector<bool> done(thread_locks_.size(), false);
+
+  size_t num_done = 0;
+
+  while (true) {
+    for (size_t i = 0; i < thread_locks_.size(); ++i) {
+      auto &thread_lock = thread_locks_[i];
+
+      if (done[i] || ! thread_lock.mutex.try_lock())
+        continue;
+
+      proc(uint(i));
+
+      done[i] = true;
+
+      --thread_lock.waiters;
+
+      thread_lock.mutex.unlock();
+
+      ++num_done;
+    }
+
+    if (num_done >= thread_locks_.size())
+      break;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void
+CUsageDirWalk::
+setSample(double fraction, double dir_fraction, uint64_t seed)
+{
+  sample_          = (fraction < 1.0 || dir_fraction < 1.0);
+  sample_fraction_ = fraction;
+  sample_dirs_     = dir_fraction;
+  sample_seed_     = seed;
+}
+
+uint64_t
+CUsageDirWalk::
+readSeq()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  return read_seq_;
+}
+
+void
+CUsageDirWalk::
+copyFound(std::vector<std::string> &skipped_mounts, std::vector<std::string> &link_loops)
+{
+  {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  skipped_mounts = skipped_mounts_;
+  }
+
+  {
+  std::unique_lock<std::mutex> lock(visited_mutex_);
+
+  link_loops = link_loops_;
+  }
+}
+
+// Pop and read pending directories until there are none left and no other thread is
+// reading a directory (which could add more)
+void
+CUsageDirWalk::
+runThread(uint thread)
+{
+  if (background_ && thread > 0)
+    setBackgroundPriority();
+
+  while (true) {
+    CUsageDirNode *dir = nullptr;
+
+    {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    long i = findPendingDir();
+
+    while (i < 0 && num_active_ > 0 && ! stopped_) {
+      cond_.wait(lock);
+
+      i = findPendingDir();
+    }
+
+    // no pending dirs left (a pending dir's device can only be at its limit if another
+    // thread is active)
+    if (stopped_ || i < 0) {
+      cond_.notify_all();
+      return;
+    }
+
+    dir = pending_dirs_[size_t(i)];
+
+    pending_dirs_.erase(pending_dirs_.begin() + i);
+
+    ++num_active_;
+
+    if (dev_threads_ > 0)
+      ++dev_active_[dir->dev];
+    }
+
+    (void) walkDir(thread, dir);
+
+    {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    --num_active_;
+
+    if (dev_threads_ > 0) {
+      --dev_active_[dir->dev];
+
+      // waiting threads may now be able to read a dir on this device
+      cond_.notify_all();
+    }
+    else if (pending_dirs_.empty() && num_active_ == 0)
+      cond_.notify_all();
+    }
+  }
+}
+
+// Stat the paths of the list directories handled by the thread (see walkList())
+void
+CUsageDirWalk::
+runListThread(uint thread)
+{
+  if (background_ && thread > 0)
+    setBackgroundPriority();
+
+  const auto &list_walk = *list_walk_;
+
+  if (list_walk.sort_dirs) {
+    while (! stopped_) {
+      size_t g = list_walk_->next_group++;
+
+      if (g >= list_walk.group_dirs.size())
+        break;
+
+      size_t begin = list_walk.group_starts[g];
+      size_t end   = list_walk.group_starts[g + 1];
+
+      if (begin < end)
+        statPaths(thread, list_walk.dirs[list_walk.group_dirs[g]],
+                  &list_walk.order[begin], end - begin);
+    }
+
+    return;
+  }
+
+  // runs of consecutive paths (of the thread's directories) in the same directory
+  std::vector<uint32_t> inds;
+
+  uint32_t dir_ind = 0;
+
+  size_t num_paths = list_walk.path_dirs.size();
+
+  for (size_t i = 0; i < num_paths && ! stopped_; ++i) {
+    uint32_t dir_ind1 = list_walk.path_dirs[i];
+
+    if (dir_ind1 % num_threads_ != thread)
+      continue;
+
+    if (! inds.empty() && dir_ind1 != dir_ind) {
+      statPaths(thread, list_walk.dirs[dir_ind], inds.data(), inds.size());
+
+      inds.clear();
+    }
+
+    dir_ind = dir_ind1;
+
+    inds.push_back(uint32_t(i));
+  }
+
+  if (! inds.empty() && ! stopped_)
+    statPaths(thread, list_walk.dirs[dir_ind], inds.data(), inds.size());
+}
+
+// Stat paths of list (all in directory dir) and process them in batches
+void
+CUsageDirWalk::
+statPaths(uint thread, CUsageDirNode *dir, const uint32_t *inds, size_t num_inds)
+{
+  const auto &list_walk = *list_walk_;
+  const auto &list      = *list_walk.list;
+
+  if (progress_)
+    progress_->startDir(dir->name);
+
+  auto &batch = batches_[thread];
+
+  batch.clear();
+
+  batch.parent = dir;
+
+  for (size_t k = 0; k < num_inds && ! stopped_; ++k) {
+    uint32_t i = inds[k];
+
+    auto &dir_entry = batch.next();
+
+    dir_entry.parent = dir;
+
+    dir_entry.filename.assign(list.pathData(i), list.path(i).len);
+
+    if (throttle_)
+      throttle_->acquireOps();
+
+    uint64_t t1 = (time_dirs_ ? monotonicNs() : 0);
+
+    {
+    CUSAGE_PROFILE_PHASE(STAT);
+
+    bool ok = statEntry(dir_entry);
+
+    if (time_dirs_)
+      dir->stat_ns += monotonicNs() - t1;
+
+    if (! ok)
+      continue;
+    }
+
+    std::string_view path = trimPath(dir_entry.filename);
+
+    // listed directory uses node of parent directory with same path (if any)
+    if (dir_entry.type == CUsageEntryType::DIR) {
+      auto p = list_walk.dir_map.find(path);
+
+      if (p != list_walk.dir_map.end())
+        dir_entry.node = list_walk.dirs[(*p).second];
+      else
+        dir_entry.node = tree_.addChild(dir, dir_entry.filename);
+
+      dir_entry.node->dev = dir_entry.stat.st_dev;
+    }
+    else
+      dir_entry.node = nullptr;
+
+    auto pos = path.rfind('/');
+
+    batch.add(pos != std::string_view::npos && path.size() > 1 ? uint(pos + 1) : 0);
+
+    if (batch.isFull()) {
+      if (! processBatch(thread, batch)) {
+        stop();
+        break;
+      }
+
+      batch.clear();
+    }
+  }
+
+  if (batch.size() > 0 && ! stopped_) {
+    if (! processBatch(thread, batch))
+      stop();
+  }
+
+  batch.clear();
+
+  if (progress_)
+    progress_->endDir(thread, 0);
+}
+
+// Set idle io priority class and lowest cpu priority for the current thread (Linux
+// applies both per thread)
+void
+CUsageDirWalk::
+setBackgroundPriority()
+{
+#ifdef __linux__
+  static const int IOPRIO_CLASS_SHIFT = 13;
+  static const int IOPRIO_CLASS_IDLE  = 3;
+  static const int IOPRIO_WHO_PROCESS = 1;
+
+  pid_t tid = pid_t(syscall(SYS_gettid));
+
+  (void) syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+                 IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+  (void) setpriority(PRIO_PROCESS, id_t(tid), 19);
+#endif
+}
+
+// Find index of pending dir to read next (-1 if none). This is the last pushed unless
+// its device has reached the per device thread limit. Called with mutex locked.
+long
+CUsageDirWalk::
+findPendingDir() const
+{
+  for (long i = long(pending_dirs_.size()) - 1; i >= 0; --i) {
+    if (dev_threads_ == 0)
+      return i;
+
+    auto p = dev_active_.find(pending_dirs_[size_t(i)]->dev);
+
+    if (p == dev_active_.end() || (*p).second < dev_threads_)
+      return i;
+  }
+
+  return -1;
+}
+
+// Read all entries of a directory, process each one and push sub directories onto
+// the pending list (in reverse so they are popped in read order).
+bool
+CUsageDirWalk::
+walkDir(uint thread, CUsageDirNode *dir)
+{
+  const std::string &dirname = dir->name;
+
+  // let a waiting syncThreads() take the thread lock first
+  while (thread_locks_[thread].waiters > 0)
+    std::this_thread::yield();
+
+  std::unique_lock<std::mutex> thread_lock(thread_locks_[thread].mutex);
+
+  if (progress_)
+    progress_->startDir(dirname);
+
+  DIR *dirp = nullptr;
+
+  if (throttle_)
+    throttle_->acquireOps();
+
+  uint64_t t1 = (time_dirs_ ? monotonicNs() : 0);
+
+  {
+  CUSAGE_PROFILE_PHASE(OPENDIR);
+  CUSAGE_PROFILE_CALL (OPENDIR);
+
+  dirp = opendir(dirname.c_str());
+  }
+
+  if (time_dirs_)
+    dir->readdir_ns += monotonicNs() - t1;
+
+  if (! dirp) {
+    // unreadable directory is complete (nothing to retry on resume)
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    setRead(dir);
+
+    return false;
+  }
+
+  bool add_sep = (dirname.empty() || dirname.back() != '/');
+
+  uint name_offset = uint(dirname.size() + (add_sep ? 1 : 0));
+
+  DirNodeList sub_dirs;
+
+  // sub directories not yet found (from directory's link count, -1 if unknown). When
+  // none are left the remaining entries are known not to be directories, so in sample
+  // mode entries of unknown type need no stat to be skipped (e.g. in leaf directories).
+  // Links to directories aren't counted so this isn't used when following links.
+  long dirs_left = -1;
+
+  if (sample_ && leaf_nlink_ && ! follow_links_ && dir->nlink >= 2)
+    dirs_left = dir->nlink - 2;
+
+  // in inode order mode all entries are read first and sorted by inode number
+  auto &inode_entries = inode_entries_[thread];
+
+  if (inode_order_)
+    readInodeOrder(dirp, dir, inode_entries);
+
+  size_t inode_ind = 0;
+
+  auto &batch = batches_[thread];
+
+  batch.clear();
+
+  batch.parent = dir;
+
+  while (! stopped_) {
+    // entry is filled in batch's next slot (reused if the entry is skipped)
+    auto &dir_entry = batch.next();
+
+    dir_entry.parent = dir;
+
+    const char    *name   = nullptr;
+    unsigned char  d_type = DT_UNKNOWN;
+
+    if (inode_order_) {
+      if (inode_ind >= inode_entries.entries.size())
+        break;
+
+      const auto &inode_entry = inode_entries.entries[inode_ind++];
+
+      name   = &inode_entries.names[inode_entry.name_offset];
+      d_type = inode_entry.type;
+
+      if (time_dirs_)
+        t1 = monotonicNs();
+    }
+    else {
+      struct dirent *entry = nullptr;
+
+      if (time_dirs_)
+        t1 = monotonicNs();
+
+      {
+      CUSAGE_PROFILE_PHASE(READDIR);
+      CUSAGE_PROFILE_CALL (READDIR);
+
+      entry = readdir(dirp);
+      }
+
+      if (time_dirs_) {
+        uint64_t t2 = monotonicNs();
+
+        dir->readdir_ns += t2 - t1;
+
+        t1 = t2;
+      }
+
+      if (! entry)
+        break;
+
+      name   = entry->d_name;
+      d_type = entry->d_type;
+
+      if (isDotName(name))
+        continue;
+
+      // take token for entry bytes (not counted in dir times)
+      if (throttle_) {
+        throttle_->acquireBytes(entry->d_reclen);
+
+        if (time_dirs_)
+          t1 = monotonicNs();
+      }
+    }
+
+    dir_entry.filename = dirname;
+
+    if (add_sep)
+      dir_entry.filename += '/';
+
+    dir_entry.filename += name;
+
+    // skip file or directory not in sample before it is stat'ed (if type is known)
+    if (sample_ && (d_type != DT_UNKNOWN || dirs_left == 0)) {
+      bool is_dir = (d_type == DT_DIR);
+
+      if (! isSampled(dir_entry.filename, is_dir)) {
+        if (! is_dir)
+          ++dir->num_unsampled;
+        else if (dirs_left > 0)
+          --dirs_left;
+
+        continue;
+      }
+    }
+
+    // take token for lstat of entry (not counted in dir times)
+    if (throttle_) {
+      throttle_->acquireOps();
+
+      if (time_dirs_)
+        t1 = monotonicNs();
+    }
+
+    {
+    CUSAGE_PROFILE_PHASE(STAT);
+
+    bool ok = statEntry(dir_entry);
+
+    if (time_dirs_)
+      dir->stat_ns += monotonicNs() - t1;
+
+    // failed entry could be a sub directory
+    if (! ok) {
+      dirs_left = -1;
+      continue;
+    }
+    }
+
+    // type was unknown so sample check needed stat
+    if (sample_ && d_type == DT_UNKNOWN && dirs_left != 0) {
+      bool is_dir = S_ISDIR(dir_entry.stat.st_mode);
+
+      if (! isSampled(dir_entry.filename, is_dir)) {
+        if (! is_dir)
+          ++dir->num_unsampled;
+        else if (dirs_left > 0)
+          --dirs_left;
+
+        continue;
+      }
+    }
+
+    dir_entry.node = nullptr;
+
+    if (dir_entry.type == CUsageEntryType::DIR) {
+      if (dirs_left > 0)
+        --dirs_left;
+
+      // skip mount point (before it is opened) if staying on root's file system
+      if (one_file_system_ && dir_entry.stat.st_dev != dir->dev) {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        skipped_mounts_.push_back(dir_entry.filename);
+
+        continue;
+      }
+
+      // directory already walked (reached through another link) is not walked again,
+      // a link to it is counted as a link
+      bool walk_dir = (! follow_links_ || visitDir(dir, dir_entry));
+
+      if (! walk_dir && dir_entry.is_link) {
+        dir_entry.stat = dir_entry.link_stat;
+        dir_entry.type = CUsageEntryType::LINK;
+      }
+      else {
+        dir_entry.node = tree_.addChild(dir, dir_entry.filename);
+
+        dir_entry.node->dev   = dir_entry.stat.st_dev;
+        dir_entry.node->ino   = dir_entry.stat.st_ino;
+        dir_entry.node->nlink = long(dir_entry.stat.st_nlink);
+
+        if (walk_dir)
+          sub_dirs.push_back(dir_entry.node);
+        else {
+          std::unique_lock<std::mutex> lock(mutex_);
+
+          setRead(dir_entry.node);
+        }
+      }
+    }
+
+    batch.add(name_offset);
+
+    if (batch.isFull()) {
+      if (! processBatch(thread, batch)) {
+        stop();
+        break;
+      }
+
+      batch.clear();
+    }
+  }
+
+  CUSAGE_PROFILE_CALL(CLOSEDIR);
+
+  closedir(dirp);
+
+  // process directory's last batch before it is marked read
+  if (batch.size() > 0 && ! stopped_) {
+    if (! processBatch(thread, batch))
+      stop();
+  }
+
+  batch.clear();
+
+  size_t num_pending = 0;
+
+  {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  for (auto p = sub_dirs.rbegin(); p != sub_dirs.rend(); ++p)
+    pending_dirs_.push_back(*p);
+
+  num_pending = pending_dirs_.size();
+
+  // a stopped directory was not completely read
+  if (! stopped_)
+    setRead(dir);
+  }
+
+  if      (sub_dirs.size() > 1)
+    cond_.notify_all();
+  else if (sub_dirs.size() == 1)
+    cond_.notify_one();
+
+  if (progress_)
+    progress_->endDir(thread, num_pending);
+
+  return true;
+}
+
+// Read all entries of directory (apart from '.' and '..') and sort them by inode number,
+// so the inodes are stat'ed in the order they are stored in the file system's inode
+// tables rather than in (e.g. hashed) directory order.
+void
+CUsageDirWalk::
+readInodeOrder(DIR *dirp, CUsageDirNode *dir, InodeEntries &inode_entries)
+{
+  auto &entries = inode_entries.entries;
+  auto &names   = inode_entries.names;
+
+  entries.clear();
+  names  .clear();
+
+  uint64_t t1 = (time_dirs_ ? monotonicNs() : 0);
+
+  while (! stopped_) {
+    struct dirent *entry = nullptr;
+
+    {
+    CUSAGE_PROFILE_PHASE(READDIR);
+    CUSAGE_PROFILE_CALL (READDIR);
+
+    entry = readdir(dirp);
+    }
+
+    if (! entry)
+      break;
+
+    const char *name = entry->d_name;
+
+    if (isDotName(name))
+      continue;
+
+    // take token for entry bytes (not counted in dir times)
+    if (throttle_) {
+      if (time_dirs_)
+        dir->readdir_ns += monotonicNs() - t1;
+
+      throttle_->acquireBytes(entry->d_reclen);
+
+      if (time_dirs_)
+        t1 = monotonicNs();
+    }
+
+    InodeEntry inode_entry;
+
+    inode_entry.ino         = entry->d_ino;
+    inode_entry.name_offset = uint32_t(names.size());
+    inode_entry.type        = entry->d_type;
+
+    names.insert(names.end(), name, name + strlen(name) + 1);
+
+    entries.push_back(inode_entry);
+  }
+
+  if (time_dirs_)
+    dir->readdir_ns += monotonicNs() - t1;
+
+  std::sort(entries.begin(), entries.end(),
+    [](const InodeEntry &e1, const InodeEntry &e2) { return e1.ino < e2.ino; });
+}
+
+// Add followed directory to the set of walked directories. Returns false if it has
+// already been walked (through another link), in which case a link to one of the
+// directories containing it (dir or its parents) is recorded as a link loop.
+bool
+CUsageDirWalk::
+visitDir(CUsageDirNode *dir, const CUsageDirEntry &dir_entry)
+{
+  auto key = std::make_pair(dir_entry.stat.st_dev, dir_entry.stat.st_ino);
+
+  std::unique_lock<std::mutex> lock(visited_mutex_);
+
+  if (visited_dirs_.insert(key).second)
+    return true;
+
+  if (dir_entry.is_link) {
+    for (auto *node = dir; node; node = node->parent) {
+      if (node->dev == key.first && node->ino == key.second) {
+        link_loops_.push_back(dir_entry.filename);
+        break;
+      }
+    }
+  }
+
+  return false;
+}
+
+// Stat entry (lstat, and stat of the target of a link if following links) and set its
+// type from the stat. Returns false if the entry could not be stat'ed.
+bool
+CUsageDirWalk::
+statEntry(CUsageDirEntry &dir_entry)
+{
+  CUSAGE_PROFILE_CALL(LSTAT);
+
+  if (lstat(dir_entry.filename.c_str(), &dir_entry.stat) != 0)
+    return false;
+
+  dir_entry.is_link = S_ISLNK(dir_entry.stat.st_mode);
+
+  if (dir_entry.is_link) {
+    dir_entry.link_stat = dir_entry.stat;
+
+    if (follow_links_) {
+      CUSAGE_PROFILE_PHASE(LINK);
+      CUSAGE_PROFILE_CALL (STAT);
+
+      if (throttle_)
+        throttle_->acquireOps();
+
+      struct stat stat1;
+
+      if (stat(dir_entry.filename.c_str(), &stat1) == 0)
+        dir_entry.stat = stat1;
+    }
+  }
+
+  if      (S_ISDIR(dir_entry.stat.st_mode))
+    dir_entry.type = CUsageEntryType::DIR;
+  else if (S_ISLNK(dir_entry.stat.st_mode))
+    dir_entry.type = CUsageEntryType::LINK;
+  else
+    dir_entry.type = CUsageEntryType::FILE;
+
+  return true;
+}
+
+// Give directory next read sequence number (called with mutex locked). The release
+// store makes the node's counts and children visible to a thread which sees it.
+void
+CUsageDirWalk::
+setRead(CUsageDirNode *dir)
+{
+  dir->read_seq.store(++read_seq_, std::memory_order_release);
+}
+
+// Check if file or sub directory is in sample
+bool
+CUsageDirWalk::
+isSampled(const std::string &filename, bool is_dir) const
+{
+  double fraction = (is_dir ? sample_dirs_ : sample_fraction_);
+
+  if (fraction >= 1.0)
+    return true;
+
+  return (sampleValue(sample_seed_, filename) < fraction);
+}
+
+bool
+CUsageDirWalk::
+processBatch(uint thread, CUsageEntryBatch &batch)
+{
+  return scan_->processBatch(thread, batch);
+}
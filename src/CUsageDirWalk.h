@@ -0,0 +1,336 @@
+#ifndef CUsageDirWalk_H
+#define CUsageDirWalk_H
+
+#include <CUsageDirTree.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+
+class CUsagePathList;
+class CUsageScan;
+class CUsageProgress;
+class CUsageThrottle;
+
+// Type of directory entry (a symbolic link is LINK unless it is followed)
+enum class CUsageEntryType { NONE, FILE, DIR, LINK };
+
+// Directory entry read by the walker for each file
+struct CUsageDirEntry {
+  std::string     filename;
+  struct stat     stat;
+  struct stat     link_stat;
+  bool            is_link { false };
+  CUsageEntryType type    { CUsageEntryType::NONE };
+  CUsageDirNode*  parent  { nullptr }; // node of directory containing entry
+  CUsageDirNode*  node    { nullptr }; // node of entry if it is a directory (else null)
+
+  // link's own stat if entry is a symbolic link (else null)
+  const struct stat *getLinkStat() const { return (is_link ? &link_stat : nullptr); }
+};
+
+// Batch of directory entries (all from one directory) passed to the walker's
+// processBatch(). As each entry is added the fields tested for every file are also
+// stored in structure of arrays form (size, date type time, mode, link flag and offset
+// of the name in the path) so the scan can filter and total a batch in tight loops
+// over the arrays and only use the full entries of the few files which need them.
+struct CUsageEntryBatch {
+  enum { MAX_ENTRIES = 256 };
+
+  // stat time stored in times
+  enum class TimeField { ACCESS, MODIFY, CHANGE };
+
+  using Entries = std::vector<CUsageDirEntry>;
+
+  CUsageEntryBatch() : entries(MAX_ENTRIES) { }
+
+  uint size() const { return num; }
+
+  bool isFull() const { return num >= MAX_ENTRIES; }
+
+  void clear() { num = 0; }
+
+  // next free entry (filled in then added)
+  CUsageDirEntry &next() { return entries[num]; }
+
+  // add next entry (name starts at name_offset of its filename)
+  void add(uint name_offset) {
+    const auto &stat = entries[num].stat;
+
+    sizes       [num] = size_t(stat.st_size);
+    times       [num] = (time_field == TimeField::MODIFY ? stat.st_mtime :
+                         time_field == TimeField::CHANGE ? stat.st_ctime : stat.st_atime);
+    modes       [num] = stat.st_mode;
+    is_links    [num] = entries[num].is_link;
+    name_offsets[num] = name_offset;
+
+    ++num;
+  }
+
+  // swap entries and their arrays with batch (parent and time field are kept)
+  void swapEntries(CUsageEntryBatch &batch) {
+    uint n = std::max(num, batch.num);
+
+    entries.swap(batch.entries);
+
+    std::swap_ranges(sizes       , sizes        + n, batch.sizes       );
+    std::swap_ranges(times       , times        + n, batch.times       );
+    std::swap_ranges(modes       , modes        + n, batch.modes       );
+    std::swap_ranges(is_links    , is_links     + n, batch.is_links    );
+    std::swap_ranges(name_offsets, name_offsets + n, batch.name_offsets);
+
+    std::swap(num, batch.num);
+  }
+
+  uint           num        { 0 };
+  TimeField      time_field { TimeField::MODIFY };
+  CUsageDirNode* parent     { nullptr }; // directory containing entries
+  Entries        entries;
+  size_t         sizes       [MAX_ENTRIES];
+  time_t         times       [MAX_ENTRIES];
+  mode_t         modes       [MAX_ENTRIES];
+  uint8_t        is_links    [MAX_ENTRIES];
+  uint           name_offsets[MAX_ENTRIES];
+};
+
+// Directory tree walker.
+//
+// Walks the tree below a directory with an explicit stack of pending directories
+// (rather than recursion) so the frontier of unvisited directories is always known.
+// Each directory is read completely before its sub directories are pushed, and
+// processBatch() is called for batches of its entries (with each entry's name, stat
+// and type). A directory's last batch is processed before it is marked read.
+//
+// The pending stack is shared by one or more worker threads. Each directory is read
+// by exactly one thread and processBatch() is called on that thread with its index.
+//
+// A node is added to the directory tree for each directory found, so per directory
+// counts can be kept without looking up directory names.
+//
+// In one file system mode directories on a different device to the root (mount points)
+// are skipped before they are opened and are recorded in the skipped mounts list. The
+// number of threads reading directories of the same device at once can be limited so
+// a slow (e.g. network) file system cannot occupy every thread.
+//
+// When following symbolic links the device and inode of each directory walked is kept
+// so a directory reached through more than one link is only walked once, and links
+// to a directory containing them (which would loop) are recorded.
+//
+// In inode order mode all of a directory's entries are read before any are stat'ed
+// and they are stat'ed in inode number order, so on file systems with inode tables
+// (e.g. ext4, XFS) the inodes are read in disk order instead of jumping between table
+// blocks in (hashed) directory order, which matters with cold caches on slow disks.
+//
+// Optionally the time spent in opendir/readdir and in stat is recorded in each
+// directory's node (from CLOCK_MONOTONIC) to find slow directories.
+//
+// Metadata operations can be rate limited by a throttle, and the walk can be run on
+// threads with idle I/O priority and lowest CPU priority (background mode) so it
+// competes less with other users of the file system.
+//
+// In sample mode only a random subset of the files of each directory is stat'ed (and
+// passed to processBatch()) and only a random subset of its sub directories is read. The
+// choice is made from the entry's name, type (from readdir, if known) and a seed so
+// a run can be repeated. Files not sampled are counted in the directory's node. On file
+// systems which don't return entry types (DT_UNKNOWN) but count sub directories in a
+// directory's link count (2 + sub directories) the link count can optionally be used to
+// find when all of a directory's sub directories have been found. Its remaining entries
+// are then known to be files, so entries of unknown type are skipped without a stat
+// (all of a leaf directory's entries).
+//
+// Each directory's node is given an increasing sequence number when it has been read
+// (and its sub directories pushed). All nodes with a sequence number up to readSeq()
+// are complete, which gives a consistent cut of the walk for checkpoints without
+// stopping it. A walk can be resumed from a restored tree and list of unread
+// directories.
+//
+// Instead of reading directories the walker can stat the paths of a list (see
+// walkList()), adding their parent directories to the tree, and process them in
+// batches (of one directory's paths) just as if they had been read.
+class CUsageDirWalk {
+ public:
+  CUsageDirWalk(CUsageScan *scan, const std::string &dirname);
+
+  virtual ~CUsageDirWalk() { }
+
+  // follow symbolic links (each directory is walked once)
+  bool getFollowLinks() const { return follow_links_; }
+  void setFollowLinks(bool b) { follow_links_ = b; }
+
+  uint numThreads() const { return num_threads_; }
+  void setNumThreads(uint n);
+
+  bool getOneFileSystem() const { return one_file_system_; }
+  void setOneFileSystem(bool b) { one_file_system_ = b; }
+
+  // time opendir/readdir and stat calls of each directory
+  bool getTimeDirs() const { return time_dirs_; }
+  void setTimeDirs(bool b) { time_dirs_ = b; }
+
+  // max threads reading directories of one device (0 = no limit)
+  uint devThreads() const { return dev_threads_; }
+  void setDevThreads(uint n) { dev_threads_ = n; }
+
+  // read each directory's entries then stat them in inode number order
+  bool getInodeOrder() const { return inode_order_; }
+  void setInodeOrder(bool b) { inode_order_ = b; }
+
+  // use directory link counts to find when all sub directories have been read
+  bool getLeafNlink() const { return leaf_nlink_; }
+  void setLeafNlink(bool b) { leaf_nlink_ = b; }
+
+  // run walk threads with idle io priority and nice 19
+  bool isBackground() const { return background_; }
+  void setBackground(bool b) { background_ = b; }
+
+  // stat fraction of files and read fraction of sub directories (1 = all)
+  void setSample(double fraction, double dir_fraction, uint64_t seed);
+
+  void setProgress(CUsageProgress *progress) { progress_ = progress; }
+
+  void setThrottle(CUsageThrottle *throttle) { throttle_ = throttle; }
+
+  // stat time stored in batch times
+  void setBatchTimeField(CUsageEntryBatch::TimeField field) { time_field_ = field; }
+
+  CUsageDirTree &tree() { return tree_; }
+
+  // directories skipped in one file system mode (in no particular order)
+  const std::vector<std::string> &skippedMounts() const { return skipped_mounts_; }
+
+  // symbolic links to a directory containing them (in no particular order)
+  const std::vector<std::string> &linkLoops() const { return link_loops_; }
+
+  // copy skipped mounts and link loops found so far (while walking)
+  void copyFound(std::vector<std::string> &skipped_mounts,
+                 std::vector<std::string> &link_loops);
+
+  // walk from root
+  bool walk();
+
+  // walk from pending (unread) directories of tree restored from a checkpoint (with
+  // the mounts skipped and link loops found before the checkpoint)
+  bool resume(const std::vector<CUsageDirNode *> &pending,
+              const std::vector<std::string> &skipped_mounts,
+              const std::vector<std::string> &link_loops);
+
+  // stat paths of list (grouped and sorted by directory if sort_dirs is set)
+  bool walkList(const CUsagePathList &list, bool sort_dirs);
+
+  // sequence number of last directory read
+  uint64_t readSeq();
+
+  // call proc for each thread while it is between directories (threads are held only
+  // while their own proc runs)
+  void syncThreads(const std::function<void(uint thread)> &proc);
+
+  // stop walk (from any thread)
+  void stop() { stopped_ = true; }
+
+  bool isStopped() const { return stopped_; }
+
+  virtual bool processBatch(uint thread, CUsageEntryBatch &batch);
+
+ private:
+  // entry read in inode order mode (name is at name offset of names)
+  struct InodeEntry {
+    ino_t         ino         { 0 };
+    uint32_t      name_offset { 0 };
+    unsigned char type        { 0 };   // d_type
+  };
+
+  // sorted entries of a directory (one per thread)
+  struct InodeEntries {
+    std::vector<InodeEntry> entries;
+    std::vector<char>       names;
+  };
+
+  bool run(bool read_root);
+
+  bool walkRoot(bool read_root);
+
+  void runThread(uint thread);
+
+  void setBackgroundPriority();
+
+  long findPendingDir() const;
+
+  bool walkDir(uint thread, CUsageDirNode *dir);
+
+  void readInodeOrder(DIR *dirp, CUsageDirNode *dir, InodeEntries &inode_entries);
+
+  bool statEntry(CUsageDirEntry &dir_entry);
+
+  bool visitDir(CUsageDirNode *dir, const CUsageDirEntry &dir_entry);
+
+  void runListThread(uint thread);
+
+  void statPaths(uint thread, CUsageDirNode *dir, const uint32_t *inds, size_t num_inds);
+
+  void setRead(CUsageDirNode *dir);
+
+  bool isSampled(const std::string &filename, bool is_dir) const;
+
+ private:
+  struct ListWalk;
+
+  using DirNodeList = std::vector<CUsageDirNode *>;
+  using DirNameList = std::vector<std::string>;
+  using DevActive   = std::map<dev_t,uint>;
+  using DirIds      = std::set<std::pair<dev_t,ino_t>>;
+
+  // lock held by thread while it reads a directory. Waiters are counted so the thread
+  // lets them in before its next directory (the mutex is not fair).
+  struct ThreadLock {
+    std::mutex       mutex;
+    std::atomic<int> waiters { 0 };
+  };
+
+  using ThreadLocks = std::vector<ThreadLock>;
+  using Batches     = std::vector<CUsageEntryBatch>;
+  using InodeLists  = std::vector<InodeEntries>;
+  using TimeField   = CUsageEntryBatch::TimeField;
+
+  CUsageScan*             scan_            { nullptr };
+  CUsageProgress*         progress_        { nullptr };
+  CUsageThrottle*         throttle_        { nullptr };
+  std::string             root_;
+  CUsageDirTree           tree_;
+  bool                    follow_links_    { false };
+  uint                    num_threads_     { 1 };
+  bool                    one_file_system_ { false };
+  uint                    dev_threads_     { 0 };
+  bool                    time_dirs_       { false };
+  bool                    background_      { false };
+  bool                    inode_order_     { false };
+  bool                    leaf_nlink_      { false };
+  bool                    sample_          { false };
+  double                  sample_fraction_ { 1.0 }; // fraction of files
+  double                  sample_dirs_     { 1.0 }; // fraction of sub directories
+  uint64_t                sample_seed_     { 0 };
+  std::mutex              mutex_;
+  std::condition_variable cond_;
+  DirNodeList             pending_dirs_;
+  uint                    num_active_      { 0 };
+  DevActive               dev_active_;
+  DirNameList             skipped_mounts_;
+  DirNameList             link_loops_;
+  std::mutex              visited_mutex_;
+  DirIds                  visited_dirs_;    // devices and inodes of followed directories
+  std::atomic<bool>       stopped_         { false };
+  uint64_t                read_seq_        { 0 };
+  ThreadLocks             thread_locks_;
+  TimeField               time_field_      { TimeField::MODIFY };
+  Batches                 batches_;         // one per thread
+  InodeLists              inode_entries_;   // one per thread (inode order)
+  ListWalk*               list_walk_       { nullptr }; // path list state (list walk)
+};
+
+#endif
@@ -0,0 +1,416 @@
+#include <CUsageDupFinder.h>
+#include <CUsageProfile.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// Streaming XXH64
+class Hash64 {
+ public:
+  Hash64(uint64_t seed=0) {
+    v_[0] = seed + P1 + P2;
+    v_[1] = seed + P2;
+    v_[2] = seed;
+    v_[3] = seed - P1;
+
+    seed_ = seed;
+  }
+
+  void add(const char *data, size_t len) {
+    const auto *p = reinterpret_cast<const unsigned char *>(data);
+
+    total_len_ += len;
+
+    // fill pending 32 byte block
+    if (mem_len_ > 0) {
+      size_t n = std::min(len, size_t(32) - mem_len_);
+
+      memcpy(mem_ + mem_len_, p, n);
+
+      mem_len_ += n; p += n; len -= n;
+
+      if (mem_len_ < 32)
+        return;
+
+      addBlock(mem_);
+
+      mem_len_ = 0;
+    }
+
+    for ( ; len >= 32; p += 32, len -= 32)
+      addBlock(p);
+
+    memcpy(mem_, p, len);
+
+    mem_len_ = len;
+  }
+
+  uint64_t digest() const {
+    uint64_t h;
+
+    if (total_len_ >= 32) {
+      h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+
+      for (int i = 0; i < 4; ++i) {
+        h ^= round(0, v_[i]);
+        h  = h*P1 + P4;
+      }
+    }
+    else
+      h = seed_ + P5;
+
+    h += total_len_;
+
+    const unsigned char *p = mem_;
+
+    size_t len = mem_len_;
+
+    for ( ; len >= 8; p += 8, len -= 8) {
+      h ^= round(0, read64(p));
+      h  = rotl(h, 27)*P1 + P4;
+    }
+
+    if (len >= 4) {
+      h ^= uint64_t(read32(p))*P1;
+      h  = rotl(h, 23)*P2 + P3;
+
+      p += 4; len -= 4;
+    }
+
+    for ( ; len > 0; ++p, --len) {
+      h ^= (*p)*P5;
+      h  = rotl(h, 11)*P1;
+    }
+
+    h ^= h >> 33; h *= P2;
+    h ^= h >> 29; h *= P3;
+    h ^= h >> 32;
+
+    return h;
+  }
+
+ private:
+  static constexpr uint64_t P1 = 11400714785074694791ULL;
+  static constexpr uint64_t P2 = 14029467366897019727ULL;
+  static constexpr uint64_t P3 =  1609587929392839161ULL;
+  static constexpr uint64_t P4 =  9650029242287828579ULL;
+  static constexpr uint64_t P5 =  2870177450012600261ULL;
+
+  static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+  static uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input*P2;
+
+    return rotl(acc, 31)*P1;
+  }
+
+  static uint64_t read64(const unsigned char *p) { uint64_t i; memcpy(&i, p, 8); return i; }
+  static uint32_t read32(const unsigned char *p) { uint32_t i; memcpy(&i, p, 4); return i; }
+
+  void addBlock(const unsigned char *p) {
+    for (int i = 0; i < 4; ++i)
+      v_[i] = round(v_[i], read64(p + 8*i));
+  }
+
+ private:
+  uint64_t      v_[4];
+  uint64_t      seed_      { 0 };
+  uint64_t      total_len_ { 0 };
+  unsigned char mem_[32];
+  size_t        mem_len_   { 0 };
+};
+
+// Read exactly len bytes at offset (false on error or short file)
+bool readAt(int fd, char *buffer, size_t len, off_t offset) {
+  while (len > 0) {
+    ssize_t n = pread(fd, buffer, len, offset);
+
+    if (n <= 0)
+      return false;
+
+    buffer += n; len -= size_t(n); offset += n;
+  }
+
+  return true;
+}
+
+const size_t full_buffer_size = 1024*1024;
+
+}
+
+//------------
+
+CUsageDupFinder::
+CUsageDupFinder(uint num_threads) :
+ num_threads_(std::max(num_threads, 1U))
+{
+}
+
+void
+CUsageDupFinder::
+find(Files &files, Groups &groups)
+{
+  CUSAGE_PROFILE_PHASE(DUPLICATES);
+
+  groups.clear();
+
+  num_partial_ = 0;
+  num_full_    = 0;
+  bytes_read_  = 0;
+
+  /* Sort by size, inode and name (so links to one inode are together) */
+
+  std::sort(files.begin(), files.end(),
+            [](const CUsageDupFile &file1, const CUsageDupFile &file2) {
+              if (file1.size != file2.size) return (file1.size < file2.size);
+              if (file1.dev  != file2.dev ) return (file1.dev  < file2.dev );
+              if (file1.ino  != file2.ino ) return (file1.ino  < file2.ino );
+              return (file1.name < file2.name);
+            });
+
+  /* Add first name of each inode of sizes with more than one inode */
+
+  Items items;
+
+  for (size_t i = 0; i < files.size(); ) {
+    size_t j = i + 1;
+
+    while (j < files.size() && files[j].size == files[i].size)
+      ++j;
+
+    if (files[i].size > 0) {
+      Items size_items;
+
+      for (size_t k = i; k < j; ++k) {
+        if (k > i && files[k].dev == files[k - 1].dev && files[k].ino == files[k - 1].ino)
+          continue;
+
+        Item item;
+
+        item.file = &files[k];
+
+        size_items.push_back(item);
+      }
+
+      if (size_items.size() > 1)
+        items.insert(items.end(), size_items.begin(), size_items.end());
+    }
+
+    i = j;
+  }
+
+  //---
+
+  // call proc for each run of items (at least two) with same size and hash
+  auto processRuns = [](Items &items, auto proc) {
+    sortItems(items);
+
+    for (size_t i = 0; i < items.size(); ) {
+      size_t j = i + 1;
+
+      while (j < items.size() && items[j].file->size == items[i].file->size &&
+             items[j].hash == items[i].hash)
+        ++j;
+
+      if (j - i > 1)
+        proc(i, j);
+
+      i = j;
+    }
+  };
+
+  auto addGroup = [&](Items &items, size_t i, size_t j) {
+    CUsageDupGroup group;
+
+    group.size = items[i].file->size;
+    group.hash = items[i].hash;
+
+    for (size_t k = i; k < j; ++k)
+      group.names.push_back(items[k].file->name);
+
+    std::sort(group.names.begin(), group.names.end());
+
+    groups.push_back(group);
+  };
+
+  /* Hash first and last blocks. Files no larger than both blocks are complete. */
+
+  hashItems(items, /*full*/false);
+
+  items.erase(std::remove_if(items.begin(), items.end(),
+                             [](const Item &item) { return ! item.ok; }), items.end());
+
+  Items full_items;
+
+  processRuns(items, [&](size_t i, size_t j) {
+    if (items[i].file->size <= 2*PARTIAL_SIZE)
+      addGroup(items, i, j);
+    else
+      full_items.insert(full_items.end(), items.begin() + long(i), items.begin() + long(j));
+  });
+
+  /* Hash whole of files with matching first and last blocks */
+
+  hashItems(full_items, /*full*/true);
+
+  full_items.erase(std::remove_if(full_items.begin(), full_items.end(),
+                     [](const Item &item) { return ! item.ok; }), full_items.end());
+
+  processRuns(full_items, [&](size_t i, size_t j) { addGroup(full_items, i, j); });
+
+  //---
+
+  // most wasted first (then name)
+  std::sort(groups.begin(), groups.end(),
+            [](const CUsageDupGroup &group1, const CUsageDupGroup &group2) {
+              if (group1.wasted() != group2.wasted())
+                return (group1.wasted() > group2.wasted());
+
+              return (group1.names[0] < group2.names[0]);
+            });
+}
+
+// Hash items on pool of threads (each takes the next unhashed item)
+void
+CUsageDupFinder::
+hashItems(Items &items, bool full)
+{
+  std::atomic<size_t> next       { 0 };
+  std::atomic<long>   bytes_read { 0 };
+
+  auto run = [&]() {
+    std::vector<char> buffer(full ? full_buffer_size : size_t(2*PARTIAL_SIZE));
+
+    long bytes = 0;
+
+    while (true) {
+      size_t i = next.fetch_add(1, std::memory_order_relaxed);
+
+      if (i >= items.size())
+        break;
+
+      auto &item = items[i];
+
+      item.ok = (full ? hashFull(item, buffer) : hashPartial(item, buffer));
+
+      if (item.ok)
+        bytes += long(full ? item.file->size :
+                             std::min(item.file->size, size_t(2*PARTIAL_SIZE)));
+    }
+
+    bytes_read += bytes;
+  };
+
+  uint num_threads = uint(std::min(size_t(num_threads_), std::max(items.size(), size_t(1))));
+
+  std::vector<std::thread> threads;
+
+  for (uint i = 1; i < num_threads; ++i)
+    threads.emplace_back(run);
+
+  run();
+
+  for (auto &thread : threads)
+    thread.join();
+
+  if (full)
+    num_full_ += long(items.size());
+  else
+    num_partial_ += long(items.size());
+
+  bytes_read_ += bytes_read;
+}
+
+// Hash first and last PARTIAL_SIZE bytes (whole file if smaller than both)
+bool
+CUsageDupFinder::
+hashPartial(Item &item, std::vector<char> &buffer) const
+{
+  int fd = open(item.file->name.c_str(), O_RDONLY);
+
+  if (fd < 0)
+    return false;
+
+  size_t size = item.file->size;
+
+  bool ok = true;
+
+  Hash64 hash;
+
+  if (size <= 2*PARTIAL_SIZE) {
+    ok = readAt(fd, &buffer[0], size, 0);
+
+    hash.add(&buffer[0], size);
+  }
+  else {
+    ok = readAt(fd, &buffer[0], PARTIAL_SIZE, 0) &&
+         readAt(fd, &buffer[PARTIAL_SIZE], PARTIAL_SIZE, off_t(size - PARTIAL_SIZE));
+
+    hash.add(&buffer[0], 2*PARTIAL_SIZE);
+  }
+
+  close(fd);
+
+  item.hash = hash.digest();
+
+  return ok;
+}
+
+// Hash whole file with large sequential reads (fails if size has changed)
+bool
+CUsageDupFinder::
+hashFull(Item &item, std::vector<char> &buffer) const
+{
+  int fd = open(item.file->name.c_str(), O_RDONLY);
+
+  if (fd < 0)
+    return false;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  (void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  Hash64 hash;
+
+  size_t total = 0;
+
+  while (true) {
+    ssize_t n = read(fd, &buffer[0], buffer.size());
+
+    if (n < 0) {
+      total = size_t(-1);
+      break;
+    }
+
+    if (n == 0)
+      break;
+
+    hash.add(&buffer[0], size_t(n));
+
+    total += size_t(n);
+  }
+
+  close(fd);
+
+  item.hash = hash.digest();
+
+  return (total == item.file->size);
+}
+
+void
+CUsageDupFinder::
+sortItems(Items &items)
+{
+  std::sort(items.begin(), items.end(), [](const Item &item1, const Item &item2) {
+    if (item1.file->size != item2.file->size)
+      return (item1.file->size < item2.file->size);
+
+    return (item1.hash < item2.hash);
+  });
+}
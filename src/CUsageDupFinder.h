@@ -0,0 +1,80 @@
+#ifndef CUsageDupFinder_H
+#define CUsageDupFinder_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Duplicate candidate (regular file found by the scan)
+struct CUsageDupFile {
+  std::string name;
+  size_t      size { 0 };
+  dev_t       dev  { 0 };
+  ino_t       ino  { 0 };
+};
+
+// Files (distinct inodes) with the same size and contents
+struct CUsageDupGroup {
+  using Names = std::vector<std::string>;
+
+  size_t   size { 0 };
+  uint64_t hash { 0 };
+  Names    names;     // sorted
+
+  // bytes used by all but one copy
+  size_t wasted() const { return (names.empty() ? 0 : size*(names.size() - 1)); }
+};
+
+// Duplicate file finder.
+//
+// Files are grouped by size and sizes with only one file (or only hard links to one
+// inode) are dropped. The remaining files are hashed in two passes, each reading a
+// file at most once: the first hashes the first and last 4K (the whole file if it is
+// no larger than that) and the second hashes the whole of files which still have a
+// matching size and hash with large sequential reads. Files are hashed by a pool of
+// threads with 64 bit XXH64.
+//
+// Hard links to the same inode are not duplicates, only the first name (sorted) of
+// each inode is used.
+class CUsageDupFinder {
+ public:
+  using Files  = std::vector<CUsageDupFile>;
+  using Groups = std::vector<CUsageDupGroup>;
+
+  enum { PARTIAL_SIZE = 4096 };
+
+ public:
+  CUsageDupFinder(uint num_threads=1);
+
+  // find duplicate groups of files (most wasted first). Files are reordered.
+  void find(Files &files, Groups &groups);
+
+  long numPartialHashed() const { return num_partial_; }
+  long numFullHashed   () const { return num_full_; }
+  long bytesRead       () const { return bytes_read_; }
+
+ private:
+  struct Item {
+    const CUsageDupFile *file { nullptr };
+    uint64_t             hash { 0 };
+    bool                 ok   { false }; // read ok
+  };
+
+  using Items = std::vector<Item>;
+
+  void hashItems(Items &items, bool full);
+
+  bool hashPartial(Item &item, std::vector<char> &buffer) const;
+  bool hashFull   (Item &item, std::vector<char> &buffer) const;
+
+  static void sortItems(Items &items);
+
+ private:
+  uint num_threads_ { 1 };
+  long num_partial_ { 0 };
+  long num_full_    { 0 };
+  long bytes_read_  { 0 };
+};
+
+#endif
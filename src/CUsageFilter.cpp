@@ -0,0 +1,867 @@
+#include <CUsageFilter.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fnmatch.h>
+#include <grp.h>
+#include <numeric>
+#include <pwd.h>
+
+namespace {
+
+struct FieldData {
+  const char *name;
+  int         cost;  // cost of comparison (name and path matches are more expensive)
+};
+
+// indexed by CUsageFilter::Field
+const FieldData field_data[] = {
+  { "size"  , 1 }, { "blocks", 1 }, { "atime", 1 }, { "mtime", 1 }, { "ctime", 1 },
+  { "uid"   , 1 }, { "gid"   , 1 }, { "nlink", 1 }, { "ino"  , 1 }, { "perm" , 1 },
+  { "depth" , 1 }, { "type"  , 1 }, { "name" , 4 }, { "path" , 6 },
+};
+
+// indexed by CUsageFilter::Cmp
+const char *cmp_names[] = { "==", "!=", "<", "<=", ">", ">=", "~", "!~" };
+
+// type character of entry (as find -type)
+char entryType(const CUsageDirEntry &entry) {
+  if (entry.is_link) return 'l';
+
+  auto mode = entry.stat.st_mode;
+
+  if      (S_ISREG (mode)) return 'f';
+  else if (S_ISDIR (mode)) return 'd';
+  else if (S_ISLNK (mode)) return 'l';
+  else if (S_ISBLK (mode)) return 'b';
+  else if (S_ISCHR (mode)) return 'c';
+  else if (S_ISFIFO(mode)) return 'p';
+  else if (S_ISSOCK(mode)) return 's';
+
+  return '?';
+}
+
+// base name of entry (no copy)
+const char *entryName(const CUsageDirEntry &entry) {
+  auto pos = entry.filename.rfind('/');
+
+  return (pos != std::string::npos ? entry.filename.c_str() + pos + 1 :
+                                     entry.filename.c_str());
+}
+
+// size with optional K, M, G, T or P (1024 based) suffix
+bool parseSize(const std::string &str, int64_t &value) {
+  const char *s = str.c_str();
+
+  char *end = nullptr;
+
+  double d = strtod(s, &end);
+
+  if (end == s)
+    return false;
+
+  static const char *units = "KMGTP";
+
+  if (*end != '\0') {
+    const char *p = strchr(units, toupper(*end));
+
+    if (! p)
+      return false;
+
+    d *= std::pow(1024.0, double(p - units + 1));
+
+    ++end;
+
+    if (*end == 'B' || *end == 'b')
+      ++end;
+  }
+
+  if (*end != '\0')
+    return false;
+
+  value = int64_t(d);
+
+  return true;
+}
+
+// time as seconds since epoch, offset from current time (e.g. -30d) or local date
+bool parseTime(const std::string &str, time_t current_time, int64_t &value) {
+  const char *s = str.c_str();
+
+  char *end = nullptr;
+
+  double d = strtod(s, &end);
+
+  if (end != s) {
+    if (*end == '\0') {
+      value = int64_t(d);
+      return true;
+    }
+
+    static const char   *units        = "smhdwy";
+    static const int64_t unit_secs[] = { 1, 60, 3600, 86400, 7*86400, 365*86400 };
+
+    const char *p = (end[1] == '\0' ? strchr(units, *end) : nullptr);
+
+    if (p) {
+      value = int64_t(current_time) + int64_t(d*double(unit_secs[p - units]));
+      return true;
+    }
+  }
+
+  static const char *formats[] = { "%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d" };
+
+  for (const auto &format : formats) {
+    struct tm tm;
+
+    memset(&tm, 0, sizeof(tm));
+
+    const char *p = strptime(s, format, &tm);
+
+    if (p && *p == '\0') {
+      tm.tm_isdst = -1;
+
+      value = int64_t(mktime(&tm));
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool parseInt(const std::string &str, int base, int64_t &value) {
+  const char *s = str.c_str();
+
+  char *end = nullptr;
+
+  long long i = strtoll(s, &end, base);
+
+  if (end == s || *end != '\0')
+    return false;
+
+  value = int64_t(i);
+
+  return true;
+}
+
+}
+
+//------------
+
+// Recursive descent parser building expression tree which is then compiled (flattened
+// and reordered) into the filter's node array
+class CUsageFilter::Parser {
+ public:
+  Parser(CUsageFilter &filter, const std::string &str, time_t current_time) :
+   filter_(filter), str_(str), current_time_(current_time) {
+  }
+
+  bool parse(std::string &msg) {
+    nextToken();
+
+    Expr expr;
+
+    bool ok = parseOr(expr);
+
+    if (ok && token_type_ != TokenType::END)
+      ok = setError("unexpected \'" + token_ + "\'");
+
+    if (ok && token_type_ == TokenType::ERROR)
+      ok = false;
+
+    if (! ok) {
+      msg = "Invalid where expression - " + error_;
+      return false;
+    }
+
+    (void) compile(expr);
+
+    return true;
+  }
+
+ private:
+  enum class TokenType { END, ERROR, WORD, STRING, AND, OR, NOT, OPEN, CLOSE, CMP };
+
+  struct Expr {
+    NodeType          type { NodeType::CMP };
+    Node              cmp;
+    std::vector<Expr> args;
+  };
+
+  //---
+
+  bool parseOr(Expr &expr) {
+    return parseList(expr, NodeType::OR, TokenType::OR, &Parser::parseAnd);
+  }
+
+  bool parseAnd(Expr &expr) {
+    return parseList(expr, NodeType::AND, TokenType::AND, &Parser::parseUnary);
+  }
+
+  // operands separated by operator (nested lists of the same operator are flattened)
+  bool parseList(Expr &expr, NodeType type, TokenType op, bool (Parser::*parseArg)(Expr &)) {
+    if (! (this->*parseArg)(expr))
+      return false;
+
+    if (token_type_ != op)
+      return true;
+
+    Expr list;
+
+    list.type = type;
+
+    auto addArg = [&](Expr &arg) {
+      if (arg.type == type) {
+        for (auto &arg1 : arg.args)
+          list.args.push_back(std::move(arg1));
+      }
+      else
+        list.args.push_back(std::move(arg));
+    };
+
+    addArg(expr);
+
+    while (token_type_ == op) {
+      nextToken();
+
+      Expr arg;
+
+      if (! (this->*parseArg)(arg))
+        return false;
+
+      addArg(arg);
+    }
+
+    expr = std::move(list);
+
+    return true;
+  }
+
+  bool parseUnary(Expr &expr) {
+    if (token_type_ == TokenType::NOT) {
+      nextToken();
+
+      Expr arg;
+
+      if (! parseUnary(arg))
+        return false;
+
+      // remove double negation
+      if (arg.type == NodeType::NOT) {
+        expr = std::move(arg.args[0]);
+        return true;
+      }
+
+      expr.type = NodeType::NOT;
+
+      expr.args.push_back(std::move(arg));
+
+      return true;
+    }
+
+    if (token_type_ == TokenType::OPEN) {
+      nextToken();
+
+      if (! parseOr(expr))
+        return false;
+
+      if (token_type_ != TokenType::CLOSE)
+        return setError("missing \')\'");
+
+      nextToken();
+
+      return true;
+    }
+
+    return parseCmp(expr);
+  }
+
+  // <field> <cmp> <value>
+  bool parseCmp(Expr &expr) {
+    if (token_type_ != TokenType::WORD)
+      return setError(token_type_ == TokenType::END ? "missing field" :
+                      "expected field at \'" + token_ + "\'");
+
+    auto &node = expr.cmp;
+
+    auto nf = sizeof(field_data)/sizeof(field_data[0]);
+
+    uint i = 0;
+
+    for ( ; i < nf; ++i)
+      if (token_ == field_data[i].name)
+        break;
+
+    if (i >= nf)
+      return setError("unknown field \'" + token_ + "\'");
+
+    node.field = Field(i);
+
+    nextToken();
+
+    if (token_type_ != TokenType::CMP)
+      return setError("expected comparison after \'" + std::string(field_data[i].name) + "\'");
+
+    auto nc = sizeof(cmp_names)/sizeof(cmp_names[0]);
+
+    for (i = 0; i < nc; ++i)
+      if (token_ == cmp_names[i])
+        break;
+
+    node.cmp = (token_ == "=" ? Cmp::EQ : Cmp(i));
+
+    nextToken();
+
+    if (token_type_ != TokenType::WORD && token_type_ != TokenType::STRING)
+      return setError("missing value for \'" + std::string(field_data[int(node.field)].name) +
+                      "\'");
+
+    if (! setValue(node, token_))
+      return false;
+
+    nextToken();
+
+    return true;
+  }
+
+  // check comparison is valid for field and set value
+  bool setValue(Node &node, const std::string &str) {
+    std::string name = field_data[int(node.field)].name;
+
+    bool is_match = (node.cmp == Cmp::MATCH || node.cmp == Cmp::NO_MATCH);
+
+    bool is_eq = (node.cmp == Cmp::EQ || node.cmp == Cmp::NE);
+
+    bool ok = true;
+
+    switch (node.field) {
+      case Field::NAME:
+      case Field::PATH:
+        if (! is_eq && ! is_match)
+          return setError("invalid comparison for \'" + name + "\'");
+
+        node.pattern = str;
+
+        break;
+      case Field::TYPE:
+        if (! is_eq)
+          return setError("invalid comparison for \'" + name + "\'");
+
+        ok = (str.size() == 1 && strchr("fdlbcps", str[0]));
+
+        node.value = (ok ? str[0] : 0);
+
+        break;
+      default: {
+        if (is_match)
+          return setError("invalid comparison for \'" + name + "\'");
+
+        if      (node.field == Field::SIZE)
+          ok = parseSize(str, node.value);
+        else if (node.field == Field::ATIME || node.field == Field::MTIME ||
+                 node.field == Field::CTIME)
+          ok = parseTime(str, current_time_, node.value);
+        else if (node.field == Field::PERM)
+          ok = parseInt(str, 8, node.value);
+        else if (node.field == Field::UID && ! parseInt(str, 10, node.value)) {
+          auto *pw = getpwnam(str.c_str());
+
+          ok = (pw != nullptr);
+
+          node.value = (ok ? int64_t(pw->pw_uid) : 0);
+        }
+        else if (node.field == Field::GID && ! parseInt(str, 10, node.value)) {
+          auto *gr = getgrnam(str.c_str());
+
+          ok = (gr != nullptr);
+
+          node.value = (ok ? int64_t(gr->gr_gid) : 0);
+        }
+        else if (node.field != Field::UID && node.field != Field::GID)
+          ok = parseInt(str, 10, node.value);
+
+        break;
+      }
+    }
+
+    if (! ok)
+      return setError("invalid value \'" + str + "\' for \'" + name + "\'");
+
+    return true;
+  }
+
+  //---
+
+  void nextToken() {
+    if (token_type_ == TokenType::ERROR)
+      return;
+
+    while (pos_ < str_.size() && isspace(str_[pos_]))
+      ++pos_;
+
+    token_ = "";
+
+    if (pos_ >= str_.size()) {
+      token_type_ = TokenType::END;
+      return;
+    }
+
+    auto isOp = [&](const char *op) {
+      size_t len = strlen(op);
+
+      if (str_.compare(pos_, len, op) != 0)
+        return false;
+
+      token_ = op;
+
+      pos_ += len;
+
+      return true;
+    };
+
+    if      (isOp("&&")) token_type_ = TokenType::AND;
+    else if (isOp("||")) token_type_ = TokenType::OR;
+    else if (isOp("==") || isOp("!=") || isOp("!~") || isOp("<=") || isOp(">=") ||
+             isOp("<" ) || isOp(">" ) || isOp("=" ) || isOp("~" ))
+      token_type_ = TokenType::CMP;
+    else if (isOp("!"))  token_type_ = TokenType::NOT;
+    else if (isOp("("))  token_type_ = TokenType::OPEN;
+    else if (isOp(")"))  token_type_ = TokenType::CLOSE;
+    else if (str_[pos_] == '\"' || str_[pos_] == '\'') {
+      char quote = str_[pos_++];
+
+      while (pos_ < str_.size() && str_[pos_] != quote) {
+        if (str_[pos_] == '\\' && pos_ + 1 < str_.size())
+          ++pos_;
+
+        token_ += str_[pos_++];
+      }
+
+      if (pos_ >= str_.size()) {
+        (void) setError("unterminated string");
+        return;
+      }
+
+      ++pos_;
+
+      token_type_ = TokenType::STRING;
+    }
+    else {
+      while (pos_ < str_.size() && ! isspace(str_[pos_]) &&
+             ! strchr("()!<>=~&|\"\'", str_[pos_]))
+        token_ += str_[pos_++];
+
+      if (token_ == "") {
+        (void) setError("unexpected \'" + std::string(1, str_[pos_]) + "\'");
+        return;
+      }
+
+      token_type_ = TokenType::WORD;
+    }
+  }
+
+  bool setError(const std::string &msg) {
+    if (token_type_ != TokenType::ERROR)
+      error_ = msg;
+
+    token_type_ = TokenType::ERROR;
+
+    return false;
+  }
+
+  //---
+
+  // add expression's nodes (operands first) and return index of its node. Operands
+  // of AND and OR are ordered cheapest first.
+  uint compile(Expr &expr) {
+    Node node;
+
+    if (expr.type == NodeType::CMP) {
+      node = std::move(expr.cmp);
+
+      node.cost = field_data[int(node.field)].cost;
+
+      // glob matches cost more than compares
+      if (node.cmp == Cmp::MATCH || node.cmp == Cmp::NO_MATCH)
+        ++node.cost;
+    }
+    else {
+      node.type = expr.type;
+
+      Indices args;
+
+      for (auto &arg : expr.args)
+        args.push_back(compile(arg));
+
+      std::stable_sort(args.begin(), args.end(), [&](uint ind1, uint ind2) {
+        return (filter_.nodes_[ind1].cost < filter_.nodes_[ind2].cost);
+      });
+
+      node.first_child = uint(filter_.children_.size());
+      node.num_childs  = uint(args.size());
+
+      for (auto &ind : args) {
+        filter_.children_.push_back(ind);
+
+        node.cost += filter_.nodes_[ind].cost;
+      }
+    }
+
+    filter_.nodes_.push_back(std::move(node));
+
+    return uint(filter_.nodes_.size() - 1);
+  }
+
+ private:
+  CUsageFilter&     filter_;
+  const std::string str_;
+  time_t            current_time_ { 0 };
+  size_t            pos_          { 0 };
+  TokenType         token_type_   { TokenType::END };
+  std::string       token_;
+  std::string       error_;
+};
+
+//------------
+
+bool
+CUsageFilter::
+parse(const std::string &str, time_t current_time, std::string &msg)
+{
+  nodes_   .clear();
+  children_.clear();
+
+  Parser parser(*this, str, current_time);
+
+  if (! parser.parse(msg)) {
+    nodes_   .clear();
+    children_.clear();
+
+    return false;
+  }
+
+  return true;
+}
+
+bool
+CUsageFilter::
+match(const CUsageDirEntry &entry) const
+{
+  if (nodes_.empty())
+    return true;
+
+  return matchNode(uint(nodes_.size() - 1), entry);
+}
+
+bool
+CUsageFilter::
+matchNode(uint ind, const CUsageDirEntry &entry) const
+{
+  const auto &node = nodes_[ind];
+
+  switch (node.type) {
+    case NodeType::AND:
+      for (uint i = 0; i < node.num_childs; ++i)
+        if (! matchNode(children_[node.first_child + i], entry))
+          return false;
+
+      return true;
+    case NodeType::OR:
+      for (uint i = 0; i < node.num_childs; ++i)
+        if (matchNode(children_[node.first_child + i], entry))
+          return true;
+
+      return false;
+    case NodeType::NOT:
+      return ! matchNode(children_[node.first_child], entry);
+    default:
+      return matchCmp(node, entry);
+  }
+}
+
+bool
+CUsageFilter::
+matchCmp(const Node &node, const CUsageDirEntry &entry) const
+{
+  switch (node.field) {
+    case Field::NAME:
+    case Field::PATH: {
+      const char *str = (node.field == Field::NAME ? entryName(entry) :
+                                                     entry.filename.c_str());
+
+      bool match;
+
+      if (node.cmp == Cmp::EQ || node.cmp == Cmp::NE)
+        match = (node.pattern == str);
+      else
+        match = (fnmatch(node.pattern.c_str(), str, 0) == 0);
+
+      return (node.cmp == Cmp::EQ || node.cmp == Cmp::MATCH ? match : ! match);
+    }
+    default:
+      return compare(node.cmp, fieldValue(node.field, entry), node.value);
+  }
+}
+
+// Match batch of entries.
+//
+// The indices of all entries are filtered by the expression : each comparison keeps
+// the indices of the entries it matches, so the operands of an AND are only evaluated
+// for the entries matched by the previous operands and those of an OR only for the
+// entries not yet matched.
+void
+CUsageFilter::
+matchBatch(const CUsageDirEntry *entries, size_t n, Matches &matches) const
+{
+  if (nodes_.empty()) {
+    matches.assign(n, 1);
+    return;
+  }
+
+  matches.assign(n, 0);
+
+  Indices sel(n);
+
+  std::iota(sel.begin(), sel.end(), 0U);
+
+  // scratch flags (zero for all entries between nodes)
+  Matches flags(n, 0);
+
+  filterBatch(uint(nodes_.size() - 1), entries, sel, flags);
+
+  for (auto i : sel)
+    matches[i] = 1;
+}
+
+// Reduce sel to the entries matched by the node (in the same order)
+void
+CUsageFilter::
+filterBatch(uint ind, const CUsageDirEntry *entries, Indices &sel, Matches &flags) const
+{
+  const auto &node = nodes_[ind];
+
+  // remove flagged entries from sel (keep = false) or keep only them, and clear flags
+  auto select = [&](Indices &sel1, bool keep) {
+    size_t k = 0;
+
+    for (auto i : sel1) {
+      if (bool(flags[i]) == keep)
+        sel1[k++] = i;
+
+      flags[i] = 0;
+    }
+
+    sel1.resize(k);
+  };
+
+  switch (node.type) {
+    case NodeType::AND: {
+      for (uint i = 0; i < node.num_childs && ! sel.empty(); ++i)
+        filterBatch(children_[node.first_child + i], entries, sel, flags);
+
+      break;
+    }
+    case NodeType::OR: {
+      Indices rest = sel;
+
+      for (uint i = 0; i < node.num_childs && ! rest.empty(); ++i) {
+        Indices sel1 = rest;
+
+        filterBatch(children_[node.first_child + i], entries, sel1, flags);
+
+        if (sel1.empty())
+          continue;
+
+        // flag matched entries (kept until all operands are done) and only
+        // evaluate the remaining ones for the next operand
+        for (auto j : sel1)
+          flags[j] = 1;
+
+        size_t k = 0;
+
+        for (auto j : rest)
+          if (! flags[j])
+            rest[k++] = j;
+
+        rest.resize(k);
+      }
+
+      select(sel, /*keep*/true);
+
+      break;
+    }
+    case NodeType::NOT: {
+      Indices sel1 = sel;
+
+      filterBatch(children_[node.first_child], entries, sel1, flags);
+
+      for (auto j : sel1)
+        flags[j] = 1;
+
+      select(sel, /*keep*/false);
+
+      break;
+    }
+    default:
+      filterCmpBatch(node, entries, sel);
+
+      break;
+  }
+}
+
+// Reduce sel to the entries matching comparison. Number fields are gathered into an
+// array first so the comparison is a simple loop over the values.
+void
+CUsageFilter::
+filterCmpBatch(const Node &node, const CUsageDirEntry *entries, Indices &sel) const
+{
+  size_t k = 0;
+
+  if (node.field == Field::NAME || node.field == Field::PATH) {
+    for (auto i : sel)
+      if (matchCmp(node, entries[i]))
+        sel[k++] = i;
+
+    sel.resize(k);
+
+    return;
+  }
+
+  size_t n = sel.size();
+
+  std::vector<int64_t> values(n);
+
+  for (size_t j = 0; j < n; ++j)
+    values[j] = fieldValue(node.field, entries[sel[j]]);
+
+  Matches keep(n);
+
+  int64_t value = node.value;
+
+  switch (node.cmp) {
+    case Cmp::EQ: for (size_t j = 0; j < n; ++j) keep[j] = (values[j] == value); break;
+    case Cmp::NE: for (size_t j = 0; j < n; ++j) keep[j] = (values[j] != value); break;
+    case Cmp::LT: for (size_t j = 0; j < n; ++j) keep[j] = (values[j] <  value); break;
+    case Cmp::LE: for (size_t j = 0; j < n; ++j) keep[j] = (values[j] <= value); break;
+    case Cmp::GT: for (size_t j = 0; j < n; ++j) keep[j] = (values[j] >  value); break;
+    case Cmp::GE: for (size_t j = 0; j < n; ++j) keep[j] = (values[j] >= value); break;
+    default     : break;
+  }
+
+  for (size_t j = 0; j < n; ++j)
+    if (keep[j])
+      sel[k++] = sel[j];
+
+  sel.resize(k);
+}
+
+int64_t
+CUsageFilter::
+fieldValue(Field field, const CUsageDirEntry &entry)
+{
+  const auto &stat = entry.stat;
+
+  switch (field) {
+    case Field::SIZE  : return int64_t(stat.st_size);
+    case Field::BLOCKS: return int64_t(stat.st_blocks);
+    case Field::ATIME : return int64_t(stat.st_atime);
+    case Field::MTIME : return int64_t(stat.st_mtime);
+    case Field::CTIME : return int64_t(stat.st_ctime);
+    case Field::UID   : return int64_t(stat.st_uid);
+    case Field::GID   : return int64_t(stat.st_gid);
+    case Field::NLINK : return int64_t(stat.st_nlink);
+    case Field::INO   : return int64_t(stat.st_ino);
+    case Field::PERM  : return int64_t(stat.st_mode & 07777);
+    case Field::DEPTH : return (entry.parent ? entry.parent->depth + 1 : 0);
+    case Field::TYPE  : return entryType(entry);
+    default           : return 0;
+  }
+}
+
+bool
+CUsageFilter::
+compare(Cmp cmp, int64_t value1, int64_t value2)
+{
+  switch (cmp) {
+    case Cmp::EQ: return (value1 == value2);
+    case Cmp::NE: return (value1 != value2);
+    case Cmp::LT: return (value1 <  value2);
+    case Cmp::LE: return (value1 <= value2);
+    case Cmp::GT: return (value1 >  value2);
+    case Cmp::GE: return (value1 >= value2);
+    default     : return false;
+  }
+}
+
+std::string
+CUsageFilter::
+toString() const
+{
+  if (nodes_.empty())
+    return "";
+
+  return nodeString(uint(nodes_.size() - 1));
+}
+
+std::string
+CUsageFilter::
+canonicalString() const
+{
+  if (nodes_.empty())
+    return "";
+
+  return nodeString(uint(nodes_.size() - 1), true);
+}
+
+std::string
+CUsageFilter::
+nodeString(uint ind, bool sorted) const
+{
+  const auto &node = nodes_[ind];
+
+  if (node.type == NodeType::CMP) {
+    std::string str = std::string(field_data[int(node.field)].name) + " " +
+                      cmp_names[int(node.cmp)] + " ";
+
+    if      (node.field == Field::NAME || node.field == Field::PATH)
+      str += "\"" + node.pattern + "\"";
+    else if (node.field == Field::TYPE)
+      str += char(node.value);
+    else if (node.field == Field::PERM) {
+      char buffer[32];
+
+      snprintf(buffer, sizeof(buffer), "0%llo", (unsigned long long) node.value);
+
+      str += buffer;
+    }
+    else
+      str += std::to_string(node.value);
+
+    return str;
+  }
+
+  if (node.type == NodeType::NOT)
+    return "!" + nodeString(children_[node.first_child], sorted);
+
+  std::vector<std::string> strs;
+
+  for (uint i = 0; i < node.num_childs; ++i)
+    strs.push_back(nodeString(children_[node.first_child + i], sorted));
+
+  if (sorted)
+    std::sort(strs.begin(), strs.end());
+
+  std::string str = "(";
+
+  for (uint i = 0; i < node.num_childs; ++i) {
+    if (i > 0)
+      str += (node.type == NodeType::AND ? " && " : " || ");
+
+    str += strs[i];
+  }
+
+  return str + ")";
+}
@@ -0,0 +1,106 @@
+#ifndef CUsageFilter_H
+#define CUsageFilter_H
+
+#include <CUsageDirWalk.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Filter expression.
+//
+// Boolean expression over the fields of a directory entry, e.g.
+//
+//   size > 1G && mtime < -30d && name ~ "*.log" && uid != 0
+//
+// Fields are size, blocks, atime, mtime, ctime, uid, gid, nlink, ino, perm, depth
+// (numbers compared with ==, !=, <, <=, > and >=), type (f, d, l, b, c, p or s
+// compared with == and !=) and name (base name) and path (compared with == and !=
+// or glob matched with ~ and !~). Comparisons are combined with &&, || and ! and
+// grouped with parentheses.
+//
+// Sizes can have a K, M, G, T or P (1024 based) suffix. Times are seconds since the
+// epoch, a date (YYYY-MM-DD[THH:MM[:SS]], local time) or an offset from the current
+// time with an s, m, h, d, w or y suffix (so 'mtime < -30d' is more than 30 days
+// ago). Users and groups can be given by name and perm is octal.
+//
+// The expression is parsed once into a flat array of nodes. Nested && and || are
+// flattened and the operands of each are reordered so cheap stat field comparisons
+// are done before name and path matches (all comparisons are free of side effects
+// so this doesn't change the result). An expression is immutable once parsed so one
+// filter can be used by any number of threads.
+//
+// Entries can be matched one at a time or in batches, where each comparison is done
+// for all entries of the batch still undecided by the previous operands (a tight
+// loop over one field rather than interpreting the expression per entry).
+class CUsageFilter {
+ public:
+  using Matches = std::vector<uint8_t>;
+
+ public:
+  CUsageFilter() { }
+
+  // parse expression (times relative to current time). Returns false with error
+  // message if invalid.
+  bool parse(const std::string &str, time_t current_time, std::string &msg);
+
+  bool isEmpty() const { return nodes_.empty(); }
+
+  // match entry (an empty filter matches everything)
+  bool match(const CUsageDirEntry &entry) const;
+
+  // match array of n entries (matches[i] set to 1 or 0)
+  void matchBatch(const CUsageDirEntry *entries, size_t n, Matches &matches) const;
+
+  // parsed expression (after reordering)
+  std::string toString() const;
+
+  // parsed expression with the operands of each && and || sorted (same for expressions
+  // which only differ in operand order)
+  std::string canonicalString() const;
+
+ private:
+  enum class NodeType { AND, OR, NOT, CMP };
+
+  enum class Field {
+    SIZE, BLOCKS, ATIME, MTIME, CTIME, UID, GID, NLINK, INO, PERM, DEPTH, TYPE, NAME, PATH
+  };
+
+  enum class Cmp { EQ, NE, LT, LE, GT, GE, MATCH, NO_MATCH };
+
+  struct Node {
+    NodeType    type        { NodeType::CMP };
+    Field       field       { Field::SIZE };
+    Cmp         cmp         { Cmp::EQ };
+    int64_t     value       { 0 };   // number or type character
+    std::string pattern;             // name or path pattern
+    uint        first_child { 0 };   // index of first operand in children_
+    uint        num_childs  { 0 };
+    int         cost        { 0 };   // relative cost of evaluating node
+  };
+
+  using Nodes   = std::vector<Node>;
+  using Indices = std::vector<uint>;
+
+  class Parser;
+
+  bool matchNode(uint ind, const CUsageDirEntry &entry) const;
+
+  bool matchCmp(const Node &node, const CUsageDirEntry &entry) const;
+
+  void filterBatch(uint ind, const CUsageDirEntry *entries, Indices &sel,
+                   Matches &flags) const;
+
+  void filterCmpBatch(const Node &node, const CUsageDirEntry *entries, Indices &sel) const;
+
+  static int64_t fieldValue(Field field, const CUsageDirEntry &entry);
+
+  static bool compare(Cmp cmp, int64_t value1, int64_t value2);
+
+  std::string nodeString(uint ind, bool sorted=false) const;
+
+ private:
+  Nodes   nodes_;    // root is last
+  Indices children_; // operands of each AND, OR and NOT node
+};
+
+#endif
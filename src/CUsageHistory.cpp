@@ -0,0 +1,702 @@
+#include <CUsageHistory.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char     *history_magic     = "CUSAGEHI";
+const size_t    history_magic_len = 8;
+const uint64_t  history_version   = 1;
+
+// block tags
+const uint8_t history_dict_tag = 'D';
+const uint8_t history_run_tag  = 'R';
+
+// every nth run stores absolute values
+const size_t history_key_frame_runs = 16;
+
+// run flags
+const uint8_t history_key_frame_flag = 1;
+
+// Varint (7 bits per byte, low first) and zigzag signed value encoder
+class Encoder {
+ public:
+  void putByte(uint8_t b) { buf_.push_back(char(b)); }
+
+  void putVarint(uint64_t v) {
+    while (v >= 0x80) {
+      putByte(uint8_t(v | 0x80));
+
+      v >>= 7;
+    }
+
+    putByte(uint8_t(v));
+  }
+
+  void putSigned(int64_t v) { putVarint((uint64_t(v) << 1) ^ uint64_t(v >> 63)); }
+
+  void putBytes(const std::string &str) { buf_ += str; }
+
+  const std::string &str() const { return buf_; }
+
+  size_t size() const { return buf_.size(); }
+
+ private:
+  std::string buf_;
+};
+
+// Decoder of range of mapped file (any read past the end sets the error state)
+class Decoder {
+ public:
+  Decoder(const uint8_t *data, size_t pos, size_t end) :
+   data_(data), pos_(pos), end_(end) {
+  }
+
+  size_t pos() const { return pos_; }
+
+  bool atEnd() const { return pos_ >= end_; }
+
+  bool isOk() const { return ok_; }
+
+  uint8_t getByte() {
+    if (pos_ >= end_) { ok_ = false; return 0; }
+
+    return data_[pos_++];
+  }
+
+  uint64_t getVarint() {
+    uint64_t v = 0;
+
+    for (uint shift = 0; shift < 64; shift += 7) {
+      uint8_t b = getByte();
+
+      if (! ok_) return 0;
+
+      v |= uint64_t(b & 0x7f) << shift;
+
+      if (! (b & 0x80))
+        return v;
+    }
+
+    ok_ = false;
+
+    return 0;
+  }
+
+  int64_t getSigned() {
+    uint64_t v = getVarint();
+
+    return int64_t(v >> 1) ^ -int64_t(v & 1);
+  }
+
+  bool skip(uint64_t n) {
+    if (n > end_ - pos_) { ok_ = false; return false; }
+
+    pos_ += size_t(n);
+
+    return true;
+  }
+
+  std::string getString(uint64_t n) {
+    size_t pos = pos_;
+
+    if (! skip(n))
+      return "";
+
+    return std::string(reinterpret_cast<const char *>(data_ + pos), size_t(n));
+  }
+
+ private:
+  const uint8_t *data_ { nullptr };
+  size_t         pos_  { 0 };
+  size_t         end_  { 0 };
+  bool           ok_   { true };
+};
+
+// Write all of buffer at offset
+bool writeAll(int fd, const std::string &buf, off_t offset) {
+  size_t pos = 0;
+
+  while (pos < buf.size()) {
+    ssize_t n = pwrite(fd, buf.data() + pos, buf.size() - pos, offset + off_t(pos));
+
+    if (n <= 0)
+      return false;
+
+    pos += size_t(n);
+  }
+
+  return true;
+}
+
+}
+
+//------------
+
+CUsageHistory::
+CUsageHistory()
+{
+}
+
+CUsageHistory::
+~CUsageHistory()
+{
+  close();
+}
+
+// Append run to history file. The file is locked while the existing blocks are read
+// (to get the dictionary and the last values the deltas are taken from) and the new
+// dictionary names and run are written.
+bool
+CUsageHistory::
+append(const std::string &filename, time_t time, const DirTotals &dir_totals,
+       std::string &msg)
+{
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+
+  if (fd < 0) {
+    msg = "Failed to open history file \'" + filename + "\'";
+    return false;
+  }
+
+  auto fail = [&](const std::string &msg1) {
+    close();
+
+    ::close(fd);
+
+    msg = msg1;
+
+    return false;
+  };
+
+  // one writer at a time (e.g. overlapping cron runs)
+  if (flock(fd, LOCK_EX) != 0)
+    return fail("Failed to lock history file \'" + filename + "\'");
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0)
+    return fail("Failed to open history file \'" + filename + "\'");
+
+  if (st.st_size > 0) {
+    void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (p == MAP_FAILED)
+      return fail("Failed to map history file \'" + filename + "\'");
+
+    data_ = static_cast<const uint8_t *>(p);
+    size_ = size_t(st.st_size);
+  }
+
+  if (! load(data_, size_, msg))
+    return fail("History file \'" + filename + "\' " + msg);
+
+  //------------
+
+  /* Last values of each directory (from last key frame) */
+
+  bool key_frame = (runs_.size() % history_key_frame_runs == 0);
+
+  std::vector<Values> values(names_.size());
+
+  if (! key_frame && ! decode(keyFrameRun(runs_.back().time), (1U << NUM_COLUMNS) - 1,
+                              values, nullptr))
+    return fail("Invalid history file \'" + filename + "\'");
+
+  //------------
+
+  /* Add new names to dictionary (prefix compressed) */
+
+  Encoder dict;
+
+  uint64_t first_id = names_.size();
+  uint64_t num_new  = 0;
+
+  std::vector<std::pair<uint64_t, const CUsageDirTotal *>> entries;
+
+  for (const auto &dir_total : dir_totals) {
+    auto p = name_ids_.find(dir_total.name);
+
+    uint64_t id = 0;
+
+    if (p == name_ids_.end()) {
+      const std::string &prev = (names_.empty() ? std::string() : names_.back());
+
+      size_t len = 0;
+
+      while (len < prev.size() && len < dir_total.name.size() &&
+             prev[len] == dir_total.name[len])
+        ++len;
+
+      dict.putVarint(len);
+      dict.putVarint(dir_total.name.size() - len);
+      dict.putBytes (dir_total.name.substr(len));
+
+      id = names_.size();
+
+      names_.push_back(dir_total.name);
+
+      name_ids_[dir_total.name] = id;
+
+      values.emplace_back();
+
+      ++num_new;
+    }
+    else
+      id = p->second;
+
+    entries.emplace_back(id, &dir_total);
+  }
+
+  // ascending ids (last totals of a directory listed twice)
+  std::stable_sort(entries.begin(), entries.end(),
+    [](const auto &e1, const auto &e2) { return (e1.first < e2.first); });
+
+  std::vector<std::pair<uint64_t, const CUsageDirTotal *>> entries1;
+
+  for (const auto &entry : entries) {
+    if (! entries1.empty() && entries1.back().first == entry.first)
+      entries1.back() = entry;
+    else
+      entries1.push_back(entry);
+  }
+
+  //------------
+
+  /* Encode run (ids and value columns) */
+
+  Encoder columns[NUM_COLUMNS];
+
+  uint64_t last_id = 0;
+
+  for (const auto &entry : entries1) {
+    uint64_t id = entry.first;
+
+    const auto *dir_total = entry.second;
+
+    Values &last = values[id];
+
+    Values v;
+
+    v.size        = int64_t(dir_total->size);
+    v.num_files   = int64_t(dir_total->num_files);
+    v.num_entries = int64_t(dir_total->num_entries);
+
+    columns[IDS    ].putVarint(id - last_id);
+    columns[SIZES  ].putSigned(v.size        - last.size);
+    columns[FILES  ].putSigned(v.num_files   - last.num_files);
+    columns[ENTRIES].putSigned(v.num_entries - last.num_entries);
+
+    last_id = id;
+  }
+
+  Encoder run;
+
+  run.putSigned(int64_t(time));
+  run.putByte  (key_frame ? history_key_frame_flag : 0);
+  run.putVarint(entries1.size());
+
+  for (uint c = 0; c < NUM_COLUMNS; ++c) {
+    run.putVarint(columns[c].size());
+    run.putBytes (columns[c].str());
+  }
+
+  //------------
+
+  /* Write header (new file), dictionary block and run block */
+
+  Encoder buf;
+
+  if (valid_size_ == 0) {
+    buf.putBytes (history_magic);
+    buf.putVarint(history_version);
+  }
+
+  if (num_new > 0) {
+    Encoder dict_block;
+
+    dict_block.putVarint(first_id);
+    dict_block.putVarint(num_new);
+    dict_block.putBytes (dict.str());
+
+    buf.putByte  (history_dict_tag);
+    buf.putVarint(dict_block.size());
+    buf.putBytes (dict_block.str());
+  }
+
+  buf.putByte  (history_run_tag);
+  buf.putVarint(run.size());
+  buf.putBytes (run.str());
+
+  off_t offset = off_t(valid_size_);
+
+  close();
+
+  // drop block cut short by an interrupted append
+  if (off_t(st.st_size) > offset && ftruncate(fd, offset) != 0)
+    return fail("Failed to write history file \'" + filename + "\'");
+
+  if (! writeAll(fd, buf.str(), offset))
+    return fail("Failed to write history file \'" + filename + "\'");
+
+  if (::close(fd) != 0) {
+    msg = "Failed to write history file \'" + filename + "\'";
+    return false;
+  }
+
+  return true;
+}
+
+// Map history file (read only) and read its dictionary and run headers
+bool
+CUsageHistory::
+open(const std::string &filename, std::string &msg)
+{
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+
+  if (fd < 0) {
+    msg = "Failed to open history file \'" + filename + "\'";
+    return false;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+
+    msg = "Invalid history file \'" + filename + "\'";
+
+    return false;
+  }
+
+  void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+  ::close(fd);
+
+  if (p == MAP_FAILED) {
+    msg = "Failed to map history file \'" + filename + "\'";
+    return false;
+  }
+
+  data_ = static_cast<const uint8_t *>(p);
+  size_ = size_t(st.st_size);
+
+  if (! load(data_, size_, msg)) {
+    close();
+
+    msg = "History file \'" + filename + "\' " + msg;
+
+    return false;
+  }
+
+  return true;
+}
+
+void
+CUsageHistory::
+close()
+{
+  if (data_)
+    munmap(const_cast<uint8_t *>(data_), size_);
+
+  data_       = nullptr;
+  size_       = 0;
+  valid_size_ = 0;
+
+  runs_    .clear();
+  names_   .clear();
+  name_ids_.clear();
+}
+
+// Read header, dictionary blocks and run block headers (the columns are skipped). Reading
+// stops at the first incomplete block.
+bool
+CUsageHistory::
+load(const uint8_t *data, size_t size, std::string &msg)
+{
+  if (size == 0)
+    return true;
+
+  Decoder decoder(data, 0, size);
+
+  std::string magic   = decoder.getString(history_magic_len);
+  uint64_t    version = decoder.getVarint();
+
+  if (! decoder.isOk() || magic != history_magic) {
+    msg = "is not a history file";
+    return false;
+  }
+
+  if (version != history_version) {
+    msg = "has unsupported version " + std::to_string(version);
+    return false;
+  }
+
+  valid_size_ = decoder.pos();
+
+  while (! decoder.atEnd()) {
+    uint8_t  tag = decoder.getByte();
+    uint64_t len = decoder.getVarint();
+
+    size_t start = decoder.pos();
+
+    if (! decoder.skip(len))
+      break;
+
+    Decoder block(data, start, start + size_t(len));
+
+    if      (tag == history_dict_tag) {
+      uint64_t first_id = block.getVarint();
+      uint64_t num      = block.getVarint();
+
+      if (first_id != names_.size())
+        break;
+
+      Names names;
+
+      std::string prev = (names_.empty() ? std::string() : names_.back());
+
+      for (uint64_t i = 0; i < num && block.isOk(); ++i) {
+        uint64_t prefix = block.getVarint();
+        uint64_t suffix = block.getVarint();
+
+        if (prefix > prev.size()) {
+          names.clear();
+          break;
+        }
+
+        std::string name = prev.substr(0, size_t(prefix)) + block.getString(suffix);
+
+        names.push_back(name);
+
+        prev = name;
+      }
+
+      if (! block.isOk() || names.size() != num)
+        break;
+
+      for (const auto &name : names) {
+        name_ids_[name] = names_.size();
+
+        names_.push_back(name);
+      }
+    }
+    else if (tag == history_run_tag) {
+      Run run;
+
+      run.time      = time_t(block.getSigned());
+      run.key_frame = (block.getByte() & history_key_frame_flag);
+      run.num       = block.getVarint();
+
+      for (uint c = 0; c < NUM_COLUMNS; ++c) {
+        run.lengths[c] = size_t(block.getVarint());
+        run.offsets[c] = block.pos();
+
+        (void) block.skip(run.lengths[c]);
+      }
+
+      if (! block.isOk())
+        break;
+
+      // first run must be key frame
+      if (runs_.empty() && ! run.key_frame)
+        break;
+
+      runs_.push_back(run);
+    }
+    else
+      break;
+
+    valid_size_ = decoder.pos();
+  }
+
+  return true;
+}
+
+// Decode runs from first run (a key frame) calling visitor for each directory of each
+// run with its values. Only the selected columns are read (other values are not set).
+bool
+CUsageHistory::
+decode(size_t first_run, uint columns, std::vector<Values> &values,
+       const Visitor &visitor) const
+{
+  values.assign(names_.size(), Values());
+
+  for (size_t r = first_run; r < runs_.size(); ++r) {
+    const auto &run = runs_[r];
+
+    if (run.key_frame)
+      values.assign(names_.size(), Values());
+
+    auto columnDecoder = [&](Column c) {
+      return Decoder(data_, run.offsets[c], run.offsets[c] + run.lengths[c]);
+    };
+
+    Decoder ids     = columnDecoder(IDS    );
+    Decoder sizes   = columnDecoder(SIZES  );
+    Decoder files   = columnDecoder(FILES  );
+    Decoder entries = columnDecoder(ENTRIES);
+
+    bool read_sizes   = (columns & (1U << SIZES  ));
+    bool read_files   = (columns & (1U << FILES  ));
+    bool read_entries = (columns & (1U << ENTRIES));
+
+    uint64_t id = 0;
+
+    for (uint64_t i = 0; i < run.num; ++i) {
+      id += ids.getVarint();
+
+      if (! ids.isOk() || id >= values.size())
+        return false;
+
+      auto &v = values[id];
+
+      if (read_sizes  ) v.size        += sizes  .getSigned();
+      if (read_files  ) v.num_files   += files  .getSigned();
+      if (read_entries) v.num_entries += entries.getSigned();
+
+      if (visitor)
+        visitor(run, id, v);
+    }
+
+    if (! sizes.isOk() || ! files.isOk() || ! entries.isOk())
+      return false;
+  }
+
+  return true;
+}
+
+// Index of key frame run at or before the first run at or after time
+size_t
+CUsageHistory::
+keyFrameRun(time_t from) const
+{
+  size_t r = 0;
+
+  while (r < runs_.size() && runs_[r].time < from)
+    ++r;
+
+  if (r >= runs_.size() && r > 0)
+    r = runs_.size() - 1;
+
+  while (r > 0 && ! runs_[r].key_frame)
+    --r;
+
+  return r;
+}
+
+long
+CUsageHistory::
+numRuns(time_t from) const
+{
+  return long(std::count_if(runs_.begin(), runs_.end(),
+                            [&](const Run &run) { return (run.time >= from); }));
+}
+
+// Growth of each directory between the first and last runs it is in (at or after
+// time). Only the id and size columns are read.
+bool
+CUsageHistory::
+getGrowth(time_t from, Growths &growths, std::string &msg) const
+{
+  growths.clear();
+
+  if (runs_.empty())
+    return true;
+
+  std::vector<Growth> dir_growths(names_.size());
+
+  std::vector<Values> values;
+
+  bool rc = decode(keyFrameRun(from), (1U << IDS) | (1U << SIZES), values,
+    [&](const Run &run, uint64_t id, const Values &v) {
+      if (run.time < from)
+        return;
+
+      auto &growth = dir_growths[id];
+
+      if (growth.num_runs == 0) {
+        growth.first_time = run.time;
+        growth.first_size = size_t(v.size);
+      }
+
+      growth.last_time = run.time;
+      growth.last_size = size_t(v.size);
+
+      ++growth.num_runs;
+    });
+
+  if (! rc) {
+    msg = "Invalid history data";
+    return false;
+  }
+
+  for (size_t id = 0; id < dir_growths.size(); ++id) {
+    if (dir_growths[id].num_runs == 0)
+      continue;
+
+    dir_growths[id].name = names_[id];
+
+    growths.push_back(dir_growths[id]);
+  }
+
+  // most growth first (then name)
+  std::sort(growths.begin(), growths.end(), [](const Growth &g1, const Growth &g2) {
+    if (g1.growth() != g2.growth())
+      return (g1.growth() > g2.growth());
+
+    return (g1.name < g2.name);
+  });
+
+  return true;
+}
+
+bool
+CUsageHistory::
+getSeries(const std::string &name, time_t from, Series &series, std::string &msg) const
+{
+  series.clear();
+
+  auto p = name_ids_.find(name);
+
+  if (p == name_ids_.end()) {
+    msg = "Directory \'" + name + "\' not in history";
+    return false;
+  }
+
+  uint64_t id1 = p->second;
+
+  std::vector<Values> values;
+
+  bool rc = decode(keyFrameRun(from), (1U << NUM_COLUMNS) - 1, values,
+    [&](const Run &run, uint64_t id, const Values &v) {
+      if (id != id1 || run.time < from)
+        return;
+
+      Point point;
+
+      point.time        = run.time;
+      point.size        = size_t(v.size);
+      point.num_files   = long(v.num_files);
+      point.num_entries = long(v.num_entries);
+
+      series.push_back(point);
+    });
+
+  if (! rc) {
+    msg = "Invalid history data";
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,131 @@
+#ifndef CUsageHistory_H
+#define CUsageHistory_H
+
+#include <CUsageScan.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Usage history file.
+//
+// Append only time series of directory totals (size, file count and entry count),
+// one run (e.g. a cron scan) per block. Directory names are stored once in dictionary
+// blocks (each name prefix compressed against the previous one) and runs refer to
+// them by id. A run's ids (ascending) and each value are stored as separate columns
+// of varints : ids as the difference from the previous id and values as the
+// (zigzag) difference from the directory's value in the last run which had it, with
+// every 16th run a key frame of absolute values.
+//
+// Queries map the file read only, walk the block headers to find the runs in the time
+// window and decode from the key frame before the window, reading only the columns
+// needed (the size column for growth rankings). A block cut short by an interrupted
+// append is ignored and overwritten by the next append.
+class CUsageHistory {
+ public:
+  // directory totals of a run
+  struct Point {
+    time_t time        { 0 };
+    size_t size        { 0 };
+    long   num_files   { 0 };
+    long   num_entries { 0 };
+  };
+
+  // growth of a directory over time window (first and last run it is in)
+  struct Growth {
+    std::string name;
+    time_t      first_time { 0 };
+    time_t      last_time  { 0 };
+    size_t      first_size { 0 };
+    size_t      last_size  { 0 };
+    long        num_runs   { 0 };
+
+    long growth() const { return long(last_size) - long(first_size); }
+
+    // bytes per day (0 if only one run)
+    double rate() const {
+      return (last_time > first_time ?
+              double(growth())*86400.0/double(last_time - first_time) : 0.0);
+    }
+  };
+
+  using DirTotals = CUsageScanResults::DirTotals;
+  using Series    = std::vector<Point>;
+  using Growths   = std::vector<Growth>;
+
+ public:
+  CUsageHistory();
+ ~CUsageHistory();
+
+  CUsageHistory(const CUsageHistory &) = delete;
+  CUsageHistory &operator=(const CUsageHistory &) = delete;
+
+  // append run of directory totals to file (created if missing)
+  bool append(const std::string &filename, time_t time, const DirTotals &dir_totals,
+              std::string &msg);
+
+  // map file for queries
+  bool open(const std::string &filename, std::string &msg);
+
+  void close();
+
+  long numRuns() const { return long(runs_.size()); }
+
+  // number of runs at or after time
+  long numRuns(time_t from) const;
+
+  // growth of each directory in runs at or after time (most growth first)
+  bool getGrowth(time_t from, Growths &growths, std::string &msg) const;
+
+  // totals of directory in runs at or after time (oldest first)
+  bool getSeries(const std::string &name, time_t from, Series &series,
+                 std::string &msg) const;
+
+ private:
+  // column of run block
+  enum Column {
+    IDS,
+    SIZES,
+    FILES,
+    ENTRIES,
+    NUM_COLUMNS
+  };
+
+  // run block header with column positions
+  struct Run {
+    time_t   time           { 0 };
+    bool     key_frame      { false };
+    uint64_t num            { 0 };
+    size_t   offsets[NUM_COLUMNS] { };
+    size_t   lengths[NUM_COLUMNS] { };
+  };
+
+  // last values of each directory (decode state)
+  struct Values {
+    int64_t size        { 0 };
+    int64_t num_files   { 0 };
+    int64_t num_entries { 0 };
+  };
+
+  using Runs    = std::vector<Run>;
+  using Names   = std::vector<std::string>;
+  using NameIds = std::unordered_map<std::string, uint64_t>;
+  using Visitor = std::function<void(const Run &run, uint64_t id, const Values &values)>;
+
+  bool load(const uint8_t *data, size_t size, std::string &msg);
+
+  bool decode(size_t first_run, uint columns, std::vector<Values> &values,
+              const Visitor &visitor) const;
+
+  size_t keyFrameRun(time_t from) const;
+
+  const uint8_t* data_       { nullptr };
+  size_t         size_       { 0 };      // mapped size
+  size_t         valid_size_ { 0 };      // size of complete blocks
+  Runs           runs_;
+  Names          names_;
+  NameIds        name_ids_;
+};
+
+#endif
@@ -0,0 +1,13 @@
+#include <CUsage.h>
+
+int
+main(int argc, char **argv)
+{
+  CUsage usage;
+
+  usage.processOptions(argc, argv);
+
+  usage.process();
+
+  exit(0);
+}
@@ -0,0 +1,702 @@
+// CUsage aggregation microbenchmark.
+//
+// Drives the aggregation hot paths (CUsageScanData updateBatch for one entry and full
+// batches, the add*FileSpec list insertions, directory usage roll up, -where filter
+// matching (per entry and batched) and the CUsage print*File formatters) with in-memory
+// synthetic stat records so no file system is involved. Each benchmark is run for every
+// combination of display flags, list size (-n) and number of entries and reported as
+// ns/entry in tab separated lines which can be compared across commits.
+//
+// Usage:
+//   CUsageMicroBench [-entries <n>[,<n>...]] [-n <n>[,<n>...]] [-reps <n>] [-label <label>]
+
+#include <CUsage.h>
+#include <CUsageFilter.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+class CUsageMicroBench {
+ public:
+  CUsageMicroBench() { }
+
+  bool processOptions(int argc, char **argv);
+
+  void exec();
+
+ private:
+  using Records     = std::vector<CUsageDirEntry>;
+  using NameOffsets = std::vector<uint>;
+  using Sizes       = std::vector<long>;
+  using DirNodes    = std::map<std::string,CUsageDirNode *>;
+
+  void genRecords(long num_entries);
+
+  CUsageDirNode *getDirNode(const std::string &dirname);
+
+  CUsage *createUsage(const std::string &flags, long n);
+
+  CUsageScanData *createData(CUsage *usage);
+
+  size_t fillBatch(CUsageEntryBatch &batch, size_t i) const;
+
+  void updateEntries(CUsageScanData *data, CUsageEntryBatch &batch) const;
+
+  void benchUpdate  (const std::string &flags, long n);
+  void benchBatch   (const std::string &flags, long n);
+  void benchInsert  (long n);
+  void benchDirUsage();
+  void benchFilter  ();
+  void benchPrint   (long n);
+
+  void report(const char *bench, const std::string &flags, long n, long count, double secs);
+
+  static Sizes parseSizes(const char *str);
+
+  uint64_t rand() {
+    // xorshift64
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 7;
+    seed_ ^= seed_ << 17;
+
+    return seed_;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  Sizes         entries_ { 10000, 100000 };
+  Sizes         sizes_   { 40, 1000 };
+  int           reps_    { 3 };
+  std::string   label_   { "-" };
+  Records       records_;
+  NameOffsets   name_offsets_;       // offset of each record's name (known to walker)
+  CUsageDirTree tree_;
+  DirNodes      dir_nodes_;
+  uint64_t      seed_    { 88172645463325252ULL };
+  int           null_fd_ { -1 };
+};
+
+int
+main(int argc, char **argv)
+{
+  CUsageMicroBench bench;
+
+  if (! bench.processOptions(argc, argv))
+    exit(1);
+
+  bench.exec();
+
+  exit(0);
+}
+
+bool
+CUsageMicroBench::
+processOptions(int argc, char **argv)
+{
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+
+    bool has_value = (i < argc - 1);
+
+    if      (arg == "-entries" && has_value) entries_ = parseSizes(argv[++i]);
+    else if (arg == "-n"       && has_value) sizes_   = parseSizes(argv[++i]);
+    else if (arg == "-reps"    && has_value) reps_    = std::max(atoi(argv[++i]), 1);
+    else if (arg == "-label"   && has_value) label_   = argv[++i];
+    else {
+      fprintf(stderr, "Usage: CUsageMicroBench [-entries <n>[,<n>...]] [-n <n>[,<n>...]] "
+                      "[-reps <n>] [-label <label>]\n");
+      return false;
+    }
+  }
+
+  if (entries_.empty() || sizes_.empty())
+    return false;
+
+  return true;
+}
+
+void
+CUsageMicroBench::
+exec()
+{
+  static const char *flag_sets[] = { "", "l", "s", "o", "n", "d", "lson", "lsond" };
+
+  null_fd_ = open("/dev/null", O_WRONLY);
+
+  printf("# CUsageMicroBench label=%s reps=%d\n", label_.c_str(), reps_);
+  printf("%s\t%s\t%s\t%s\t%s\t%s\n", "label", "bench", "flags", "n", "entries", "ns_per_entry");
+
+  for (auto num_entries : entries_) {
+    genRecords(num_entries);
+
+    for (auto n : sizes_)
+      for (const auto &flags : flag_sets)
+        benchUpdate(flags, n);
+
+    for (auto n : sizes_)
+      for (const auto &flags : flag_sets)
+        benchBatch(flags, n);
+
+    for (auto n : sizes_)
+      benchInsert(n);
+
+    benchDirUsage();
+
+    benchFilter();
+
+    for (auto n : sizes_)
+      benchPrint(n);
+  }
+
+  if (null_fd_ >= 0)
+    close(null_fd_);
+}
+
+// Generate synthetic entries in a tree of directories (about one in fifty entries is
+// a directory) with random sizes and times
+void
+CUsageMicroBench::
+genRecords(long num_entries)
+{
+  records_.clear();
+
+  dir_nodes_.clear();
+
+  dir_nodes_["."] = tree_.setRoot(".");
+
+  records_.resize(size_t(num_entries));
+
+  time_t now = time(nullptr);
+
+  for (long i = 0; i < num_entries; ++i) {
+    auto &record = records_[size_t(i)];
+
+    long d = i/50;
+
+    std::string dirname = "./t" + std::to_string(d % 10) + "/s" + std::to_string((d/10) % 10) +
+                          "/u" + std::to_string(d/100);
+
+    memset(&record.stat, 0, sizeof(record.stat));
+
+    if (i % 50 == 0) {
+      record.filename = dirname;
+      record.parent   = getDirNode(dirname.substr(0, dirname.rfind('/')));
+      record.node     = getDirNode(dirname);
+      record.type     = CUsageEntryType::DIR;
+
+      record.stat.st_mode = S_IFDIR | 0755;
+      record.stat.st_size = 4096;
+    }
+    else {
+      record.filename = dirname + "/f" + std::to_string(i) + ".dat";
+      record.parent   = getDirNode(dirname);
+      record.node     = nullptr;
+      record.type     = CUsageEntryType::FILE;
+
+      record.stat.st_mode = S_IFREG | 0644;
+      record.stat.st_size = off_t(rand() % (1U << (rand() % 30)));
+    }
+
+    record.stat.st_nlink = 1;
+    record.stat.st_mtime = now - time_t(rand() % (3650*86400));
+    record.stat.st_atime = record.stat.st_mtime;
+    record.stat.st_ctime = record.stat.st_mtime;
+  }
+
+  name_offsets_.clear();
+
+  for (const auto &record : records_)
+    name_offsets_.push_back(uint(record.filename.rfind('/') + 1));
+}
+
+// Get (or create) node for directory and its parents
+CUsageDirNode *
+CUsageMicroBench::
+getDirNode(const std::string &dirname)
+{
+  auto p = dir_nodes_.find(dirname);
+
+  if (p != dir_nodes_.end())
+    return (*p).second;
+
+  auto *parent = getDirNode(dirname.substr(0, dirname.rfind('/')));
+
+  auto *node = tree_.addChild(parent, dirname);
+
+  dir_nodes_[dirname] = node;
+
+  return node;
+}
+
+CUsage *
+CUsageMicroBench::
+createUsage(const std::string &flags, long n)
+{
+  std::vector<std::string> args = { "CUsageMicroBench", "-n", std::to_string(n) };
+
+  if (flags != "") {
+    args.push_back("-o");
+    args.push_back(flags);
+  }
+
+  std::vector<char *> argv;
+
+  for (auto &arg : args)
+    argv.push_back(&arg[0]);
+
+  argv.push_back(nullptr);
+
+  auto *usage = new CUsage;
+
+  usage->processOptions(int(args.size()), &argv[0]);
+
+  usage->init();
+
+  usage->setOutputFd(null_fd_);
+
+  return usage;
+}
+
+CUsageScanData *
+CUsageMicroBench::
+createData(CUsage *usage)
+{
+  const auto &options = usage->getOptions();
+
+  return new CUsageScanData(options, options.current_time);
+}
+
+// Copy the entries of one directory from record i (up to the batch size) into batch,
+// as the walker fills them, and return the index of the record after them
+size_t
+CUsageMicroBench::
+fillBatch(CUsageEntryBatch &batch, size_t i) const
+{
+  size_t num_records = records_.size();
+
+  auto *parent = records_[i].parent;
+
+  size_t j = i;
+
+  for ( ; j < num_records && j - i < CUsageEntryBatch::MAX_ENTRIES &&
+          records_[j].parent == parent; ++j)
+    batch.entries[j - i] = records_[j];
+
+  return j;
+}
+
+// Update data with each record as a one entry batch
+void
+CUsageMicroBench::
+updateEntries(CUsageScanData *data, CUsageEntryBatch &batch) const
+{
+  for (size_t i = 0; i < records_.size(); ++i) {
+    batch.clear();
+
+    batch.parent     = records_[i].parent;
+    batch.entries[0] = records_[i];
+
+    batch.add(name_offsets_[i]);
+
+    data->updateBatch(batch);
+  }
+}
+
+// updateBatch for one entry batches (per entry update) of the entries of batches
+// filled as for benchBatch. Only moving each entry into the one entry batch and the
+// updates are timed.
+void
+CUsageMicroBench::
+benchUpdate(const std::string &flags, long n)
+{
+  auto batch  = std::make_unique<CUsageEntryBatch>();
+  auto batch1 = std::make_unique<CUsageEntryBatch>();
+
+  double best = 0.0;
+
+  for (int rep = 0; rep < reps_; ++rep) {
+    auto *usage = createUsage(flags, n);
+    auto *data  = createData(usage);
+
+    double secs = 0.0;
+
+    for (size_t i = 0, j = 0; i < records_.size(); i = j) {
+      j = fillBatch(*batch, i);
+
+      auto start = Clock::now();
+
+      batch1->parent = records_[i].parent;
+
+      for (size_t k = 0; k < j - i; ++k) {
+        batch1->clear();
+
+        batch1->entries[0] = std::move(batch->entries[k]);
+
+        batch1->add(name_offsets_[i + k]);
+
+        data->updateBatch(*batch1);
+      }
+
+      secs += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    if (rep == 0 || secs < best)
+      best = secs;
+
+    delete data;
+    delete usage;
+  }
+
+  report("update", (flags != "" ? flags : "-"), n, long(records_.size()), best);
+}
+
+// updateBatch for batches of entries (one directory's entries, up to the batch size),
+// checked against one entry batches. Only adding the entries to the batch's arrays and
+// updateBatch are timed : copying the entries into the batch (fillBatch) stands for the
+// walker filling them, which it does for both update paths.
+void
+CUsageMicroBench::
+benchBatch(const std::string &flags, long n)
+{
+  auto batch = std::make_unique<CUsageEntryBatch>();
+
+  auto getResults = [&](CUsageScanData *data) {
+    CUsageScanResults results;
+
+    data->getResults(results);
+
+    return results;
+  };
+
+  auto sameFiles = [](const CUsageScanResults::FileSpecs &files1,
+                      const CUsageScanResults::FileSpecs &files2) {
+    if (files1.size() != files2.size())
+      return false;
+
+    for (size_t i = 0; i < files1.size(); ++i)
+      if (files1[i].name != files2[i].name)
+        return false;
+
+    return true;
+  };
+
+  double best = 0.0;
+
+  CUsageScanResults batch_results;
+
+  for (int rep = 0; rep < reps_; ++rep) {
+    auto *usage = createUsage(flags, n);
+    auto *data  = createData(usage);
+
+    double secs = 0.0;
+
+    for (size_t i = 0, j = 0; i < records_.size(); i = j) {
+      j = fillBatch(*batch, i);
+
+      auto start = Clock::now();
+
+      batch->clear();
+
+      batch->parent = records_[i].parent;
+
+      for (size_t k = i; k < j; ++k)
+        batch->add(name_offsets_[k]);
+
+      data->updateBatch(*batch);
+
+      secs += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    if (rep == 0 || secs < best)
+      best = secs;
+
+    if (rep == 0)
+      batch_results = getResults(data);
+
+    delete data;
+    delete usage;
+  }
+
+  // check against per entry update
+  auto *usage = createUsage(flags, n);
+  auto *data  = createData(usage);
+
+  updateEntries(data, *batch);
+
+  auto results = getResults(data);
+
+  if (results.total_usage != batch_results.total_usage ||
+      results.num_files   != batch_results.num_files   ||
+      results.num_dirs    != batch_results.num_dirs    ||
+      ! sameFiles(results.largest_files , batch_results.largest_files ) ||
+      ! sameFiles(results.smallest_files, batch_results.smallest_files) ||
+      ! sameFiles(results.oldest_files  , batch_results.oldest_files  ) ||
+      ! sameFiles(results.newest_files  , batch_results.newest_files  ))
+    fprintf(stderr, "update batch mismatch (flags '%s', n %ld)\n", flags.c_str(), n);
+
+  delete data;
+  delete usage;
+
+  report("batch", (flags != "" ? flags : "-"), n, long(records_.size()), best);
+}
+
+// add*FileSpec insertions into lists capped at n entries
+void
+CUsageMicroBench::
+benchInsert(long n)
+{
+  struct InsertData {
+    const char    *name;
+    CUsageRankKey  key;
+  };
+
+  static InsertData insert_data[] = {
+    { "l", CUsageRankKey::LARGEST  },
+    { "s", CUsageRankKey::SMALLEST },
+    { "o", CUsageRankKey::OLDEST   },
+    { "n", CUsageRankKey::NEWEST   },
+  };
+
+  for (const auto &data : insert_data) {
+    double best = 0.0;
+
+    for (int rep = 0; rep < reps_; ++rep) {
+      auto *usage      = createUsage("", n);
+      auto *usage_data = createData(usage);
+
+      auto start = Clock::now();
+
+      for (const auto &record : records_)
+        usage_data->addListFile(data.key, record.filename, size_t(record.stat.st_size),
+                                record.stat.st_mtime);
+
+      double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+      if (rep == 0 || secs < best)
+        best = secs;
+
+      delete usage_data;
+      delete usage;
+    }
+
+    report("insert", data.name, n, long(records_.size()), best);
+  }
+}
+
+// addFileUsage for all entries and roll up of directory tree
+void
+CUsageMicroBench::
+benchDirUsage()
+{
+  double best = 0.0;
+
+  for (int rep = 0; rep < reps_; ++rep) {
+    auto *usage = createUsage("d", DEFAULT_NUM_FILES);
+    auto *data  = createData(usage);
+
+    auto start = Clock::now();
+
+    for (const auto &record : records_)
+      data->addFileUsage(record.parent, size_t(record.stat.st_size));
+
+    tree_.rollUp();
+
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (rep == 0 || secs < best)
+      best = secs;
+
+    delete data;
+    delete usage;
+  }
+
+  report("dirusage", "d", 0, long(records_.size()), best);
+}
+
+// -where expression matched per entry and in batches (flags are the batch size)
+void
+CUsageMicroBench::
+benchFilter()
+{
+  static const char *expr =
+    "name ~ \"*7.dat\" && size > 64K && mtime < -365d && uid == 0";
+
+  CUsageFilter filter;
+
+  std::string msg;
+
+  if (! filter.parse(expr, time(nullptr), msg)) {
+    fprintf(stderr, "%s\n", msg.c_str());
+    return;
+  }
+
+  long num_entries = long(records_.size());
+
+  //---
+
+  long   num_matched = 0;
+  double best        = 0.0;
+
+  for (int rep = 0; rep < reps_; ++rep) {
+    num_matched = 0;
+
+    auto start = Clock::now();
+
+    for (const auto &record : records_)
+      if (filter.match(record))
+        ++num_matched;
+
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (rep == 0 || secs < best)
+      best = secs;
+  }
+
+  report("filter", "entry", 0, num_entries, best);
+
+  //---
+
+  static const long batch_sizes[] = { 64, 1024 };
+
+  CUsageFilter::Matches matches;
+
+  for (auto batch_size : batch_sizes) {
+    long num_matched1 = 0;
+
+    for (int rep = 0; rep < reps_; ++rep) {
+      num_matched1 = 0;
+
+      auto start = Clock::now();
+
+      for (long i = 0; i < num_entries; i += batch_size) {
+        long n = std::min(batch_size, num_entries - i);
+
+        filter.matchBatch(&records_[size_t(i)], size_t(n), matches);
+
+        for (long j = 0; j < n; ++j)
+          num_matched1 += matches[size_t(j)];
+      }
+
+      double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+      if (rep == 0 || secs < best)
+        best = secs;
+    }
+
+    if (num_matched1 != num_matched)
+      fprintf(stderr, "filter batch mismatch %ld != %ld\n", num_matched1, num_matched);
+
+    report("filter", "batch" + std::to_string(batch_size), 0, num_entries, best);
+  }
+}
+
+// print*File for full lists of n entries (output to /dev/null)
+void
+CUsageMicroBench::
+benchPrint(long n)
+{
+  using PrintProc = void (CUsage::*)(const CUsageFileSpec &);
+
+  struct PrintData {
+    const char *name;
+    PrintProc   proc;
+    CUsageScanResults::FileSpecs CUsageScanResults::*list;
+  };
+
+  static PrintData print_data[] = {
+    { "l", &CUsage::printLargestFile , &CUsageScanResults::largest_files  },
+    { "s", &CUsage::printSmallestFile, &CUsageScanResults::smallest_files },
+    { "o", &CUsage::printOldestFile  , &CUsageScanResults::oldest_files   },
+    { "n", &CUsage::printNewestFile  , &CUsageScanResults::newest_files   },
+  };
+
+  auto *usage      = createUsage("lson", n);
+  auto *usage_data = createData(usage);
+
+  auto batch = std::make_unique<CUsageEntryBatch>();
+
+  updateEntries(usage_data, *batch);
+
+  CUsageScanResults results;
+
+  usage_data->getResults(results);
+
+  delete usage_data;
+
+  for (const auto &data : print_data) {
+    auto &list = results.*data.list;
+
+    usage->setFileSpecsLength(list);
+
+    // repeat to print (about) as many lines as there are entries
+    long loops = std::max(long(records_.size())/std::max(long(list.size()), 1L), 1L);
+
+    double best = 0.0;
+
+    for (int rep = 0; rep < reps_; ++rep) {
+      auto start = Clock::now();
+
+      for (long i = 0; i < loops; ++i)
+        for (const auto &file_spec : list)
+          (usage->*data.proc)(file_spec);
+
+      usage->flushOutput();
+
+      double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+      if (rep == 0 || secs < best)
+        best = secs;
+    }
+
+    report("print", data.name, n, loops*long(list.size()), best);
+  }
+
+  delete usage;
+}
+
+void
+CUsageMicroBench::
+report(const char *bench, const std::string &flags, long n, long count, double secs)
+{
+  double ns = (count > 0 ? 1e9*secs/double(count) : 0.0);
+
+  printf("%s\t%s\t%s\t%ld\t%ld\t%.1f\n", label_.c_str(), bench, flags.c_str(), n, count, ns);
+
+  fflush(stdout);
+}
+
+CUsageMicroBench::Sizes
+CUsageMicroBench::
+parseSizes(const char *str)
+{
+  Sizes sizes;
+
+  while (*str) {
+    char *end = nullptr;
+
+    long n = strtol(str, &end, 10);
+
+    if (end == str)
+      break;
+
+    if (n > 0)
+      sizes.push_back(n);
+
+    str = end;
+
+    if (*str == ',')
+      ++str;
+  }
+
+  return sizes;
+}
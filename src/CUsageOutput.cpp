@@ -0,0 +1,314 @@
+#include <CUsageOutput.h>
+#include <CUsageProfile.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+CUsageOutput::
+CUsageOutput(int fd, size_t size) :
+ fd_(fd), size_(std::max(size, size_t(256)))
+{
+  buffer_ = new char [size_];
+}
+
+CUsageOutput::
+~CUsageOutput()
+{
+  flush();
+
+  delete [] buffer_;
+}
+
+void
+CUsageOutput::
+setFd(int fd)
+{
+  flush();
+
+  fd_ = fd;
+}
+
+CUsageOutput &
+CUsageOutput::
+operator<<(const char *str)
+{
+  addString(std::string_view(str));
+
+  return *this;
+}
+
+void
+CUsageOutput::
+addString(std::string_view str)
+{
+  const char *data = str.data();
+  size_t      len  = str.size();
+
+  while (len > 0) {
+    if (pos_ >= size_) flush();
+
+    size_t n = std::min(len, size_ - pos_);
+
+    memcpy(&buffer_[pos_], data, n);
+
+    pos_ += n;
+    data += n;
+    len  -= n;
+  }
+}
+
+void
+CUsageOutput::
+addPadded(std::string_view str, uint width)
+{
+  addString(str);
+
+  if (str.size() < width)
+    addSpaces(uint(width - str.size()));
+}
+
+void
+CUsageOutput::
+addSpaces(uint n)
+{
+  while (n > 0) {
+    if (pos_ >= size_) flush();
+
+    size_t n1 = std::min(size_t(n), size_ - pos_);
+
+    memset(&buffer_[pos_], ' ', n1);
+
+    pos_ += n1;
+    n    -= uint(n1);
+  }
+}
+
+void
+CUsageOutput::
+addInteger(long i, uint width, bool left, uint digits)
+{
+  if (i < 0)
+    addDigits(0UL - (unsigned long) i, true, width, left, digits);
+  else
+    addDigits((unsigned long) i, false, width, left, digits);
+}
+
+void
+CUsageOutput::
+addUInteger(unsigned long i, uint width, bool left, uint digits)
+{
+  addDigits(i, false, width, left, digits);
+}
+
+void
+CUsageOutput::
+addDigits(unsigned long i, bool neg, uint width, bool left, uint digits)
+{
+  // digits are written backwards from the end of a scratch buffer
+  char  buffer[64];
+  char *e = &buffer[sizeof(buffer)];
+  char *p = e;
+
+  uint num_digits = 0;
+
+  do {
+    *--p = char('0' + (i % 10));
+
+    i /= 10;
+
+    ++num_digits;
+  } while (i != 0);
+
+  for ( ; num_digits < digits && p > &buffer[1]; ++num_digits)
+    *--p = '0';
+
+  if (neg)
+    *--p = '-';
+
+  uint len = uint(e - p);
+
+  if (! left && len < width)
+    addSpaces(width - len);
+
+  addString(std::string_view(p, len));
+
+  if (left && len < width)
+    addSpaces(width - len);
+}
+
+void
+CUsageOutput::
+addReal(double r, uint width, uint precision)
+{
+  static const unsigned long scales[] = {
+    1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL
+  };
+
+  if (precision < sizeof(scales)/sizeof(scales[0]) && std::isfinite(r)) {
+    unsigned long scale = scales[precision];
+
+    double v = std::fabs(r)*double(scale);
+
+    if (v < 1e15) {
+      double f = std::floor(v);
+      double d = v - f;
+
+      // values (nearly) half way between two outputs are left to printf which rounds
+      // using the exact binary value
+      if (std::fabs(d - 0.5) > 1e-6) {
+        auto n = (unsigned long) (d > 0.5 ? f + 1 : f);
+
+        char  buffer[64];
+        char *e = &buffer[sizeof(buffer)];
+        char *p = e;
+
+        unsigned long ipart = n/scale;
+        unsigned long fpart = n%scale;
+
+        if (precision > 0) {
+          for (uint j = 0; j < precision; ++j) {
+            *--p = char('0' + (fpart % 10));
+
+            fpart /= 10;
+          }
+
+          *--p = '.';
+        }
+
+        do {
+          *--p = char('0' + (ipart % 10));
+
+          ipart /= 10;
+        } while (ipart != 0);
+
+        if (std::signbit(r))
+          *--p = '-';
+
+        uint len = uint(e - p);
+
+        if (len < width)
+          addSpaces(width - len);
+
+        addString(std::string_view(p, len));
+
+        return;
+      }
+    }
+  }
+
+  char buffer[512];
+
+  int len = snprintf(buffer, sizeof(buffer), "%*.*f", int(width), int(precision), r);
+
+  if (len > 0)
+    addString(std::string_view(buffer, std::min(size_t(len), sizeof(buffer) - 1)));
+}
+
+void
+CUsageOutput::
+addTime(time_t t)
+{
+  if (t < time_cache_.lo || t >= time_cache_.hi)
+    updateTimeCache(t);
+
+  auto secs = long(t - time_cache_.base);
+
+  char hms[8];
+
+  int h = int(secs/3600);
+  int m = int((secs/60) % 60);
+  int s = int(secs % 60);
+
+  hms[0] = char('0' + h/10); hms[1] = char('0' + h%10); hms[2] = ':';
+  hms[3] = char('0' + m/10); hms[4] = char('0' + m%10); hms[5] = ':';
+  hms[6] = char('0' + s/10); hms[7] = char('0' + s%10);
+
+  addString(std::string_view(time_cache_.prefix, time_cache_.prefix_len));
+  addString(std::string_view(hms, sizeof(hms)));
+  addString(std::string_view(time_cache_.suffix, time_cache_.suffix_len));
+}
+
+void
+CUsageOutput::
+updateTimeCache(time_t t)
+{
+  struct tm tm;
+
+  if (! localtime_r(&t, &tm)) {
+    memset(&tm, 0, sizeof(tm));
+
+    tm.tm_year = 70;
+    tm.tm_mday = 1;
+  }
+
+  time_cache_.base = t - (tm.tm_hour*3600 + tm.tm_min*60 + tm.tm_sec);
+
+  time_cache_.prefix_len = strftime(time_cache_.prefix, sizeof(time_cache_.prefix),
+                                    "%a %h %e ", &tm);
+  time_cache_.suffix_len = strftime(time_cache_.suffix, sizeof(time_cache_.suffix),
+                                    " %Z %Y", &tm);
+
+  // whole day can be cached if the start and end of the day have the same date and
+  // UTC offset as the requested time (i.e. no daylight saving change in the day) ...
+  time_t lo = time_cache_.base;
+  time_t hi = lo + 86400;
+
+  time_t hi1 = hi - 1;
+
+  struct tm tm_lo, tm_hi;
+
+  if (localtime_r(&lo , &tm_lo) && localtime_r(&hi1, &tm_hi) &&
+      tm_lo.tm_gmtoff == tm.tm_gmtoff && tm_hi.tm_gmtoff == tm.tm_gmtoff &&
+      tm_lo.tm_isdst  == tm.tm_isdst  && tm_hi.tm_isdst  == tm.tm_isdst  &&
+      tm_lo.tm_mday   == tm.tm_mday   && tm_hi.tm_mday   == tm.tm_mday) {
+    time_cache_.lo = lo;
+    time_cache_.hi = hi;
+  }
+  // ... otherwise only cache this second
+  else {
+    time_cache_.lo = t;
+    time_cache_.hi = t + 1;
+  }
+}
+
+void
+CUsageOutput::
+flush()
+{
+  const char *data = buffer_;
+  size_t      len  = pos_;
+
+  while (len > 0) {
+    CUSAGE_PROFILE_CALL(WRITE);
+
+    ssize_t n = write(fd_, data, len);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      break;
+    }
+
+    data += n;
+    len  -= size_t(n);
+  }
+
+  pos_ = 0;
+}
+
+std::string_view
+CUsageOutput::
+stripDotPrefix(const std::string &name)
+{
+  std::string_view name1(name);
+
+  while (name1.size() >= 2 && name1[0] == '.' && name1[1] == '/')
+    name1.remove_prefix(2);
+
+  return name1;
+}
@@ -0,0 +1,95 @@
+#ifndef CUsageOutput_H
+#define CUsageOutput_H
+
+#include <string>
+#include <string_view>
+#include <ctime>
+#include <sys/types.h>
+
+// Buffered output writer.
+//
+// Names, integers, reals and times are formatted straight into one large buffer
+// which is written with a single write(2) each time it fills (or is flushed).
+class CUsageOutput {
+ public:
+  enum { DEFAULT_BUFFER_SIZE = 256*1024 };
+
+ public:
+  CUsageOutput(int fd=1, size_t size=DEFAULT_BUFFER_SIZE);
+ ~CUsageOutput();
+
+  CUsageOutput(const CUsageOutput &) = delete;
+  CUsageOutput &operator=(const CUsageOutput &) = delete;
+
+  int fd() const { return fd_; }
+  void setFd(int fd);
+
+  CUsageOutput &operator<<(char c) { addChar(c); return *this; }
+
+  CUsageOutput &operator<<(const char *str);
+  CUsageOutput &operator<<(const std::string &str) { addString(str); return *this; }
+  CUsageOutput &operator<<(std::string_view str) { addString(str); return *this; }
+
+  CUsageOutput &operator<<(int           i) { addInteger(long(i)); return *this; }
+  CUsageOutput &operator<<(uint          i) { addInteger(long(i)); return *this; }
+  CUsageOutput &operator<<(long          i) { addInteger(i); return *this; }
+  CUsageOutput &operator<<(unsigned long i) { addUInteger(i); return *this; }
+
+  void addChar(char c) {
+    if (pos_ >= size_) flush();
+
+    buffer_[pos_++] = c;
+  }
+
+  void addString(std::string_view str);
+
+  // add string left justified in a field of the specified width
+  void addPadded(std::string_view str, uint width);
+
+  void addSpaces(uint n);
+
+  // add integer right (or left) justified in a field of the specified width with at
+  // least the specified number of digits (printf "%<width>.<digits>ld")
+  void addInteger (long          i, uint width=0, bool left=false, uint digits=1);
+  void addUInteger(unsigned long i, uint width=0, bool left=false, uint digits=1);
+
+  // add fixed point real right justified in a field of the specified width
+  // (printf "%<width>.<precision>lf")
+  void addReal(double r, uint width, uint precision);
+
+  // add time in the format "%a %h %e %H:%M:%S %Z %Y"
+  void addTime(time_t t);
+
+  void flush();
+
+  // name with any leading "./" removed (no copy)
+  static std::string_view stripDotPrefix(const std::string &name);
+
+ private:
+  void addDigits(unsigned long i, bool neg, uint width, bool left, uint digits);
+
+  void updateTimeCache(time_t t);
+
+ private:
+  // Broken down time cache.
+  //
+  // Times in the range [lo, hi) share the same local day (and UTC offset) so only
+  // the hours, minutes and seconds (relative to base) need to be recalculated.
+  struct TimeCache {
+    time_t lo         { 0 };
+    time_t hi         { 0 };
+    time_t base       { 0 };
+    char   prefix[64] { };
+    size_t prefix_len { 0 };
+    char   suffix[64] { };
+    size_t suffix_len { 0 };
+  };
+
+  int       fd_     { 1 };
+  char*     buffer_ { nullptr };
+  size_t    size_   { 0 };
+  size_t    pos_    { 0 };
+  TimeCache time_cache_;
+};
+
+#endif
@@ -0,0 +1,726 @@
+#include <CUsagePartial.h>
+#include <CUsageBinaryIO.h>
+
+#include <algorithm>
+#include <iterator>
+#include <unistd.h>
+
+namespace {
+
+const char     *partial_magic   = "CUSAGEPR";
+const uint64_t  partial_version = 4;
+
+// tags before each scan and at end of file
+const uint64_t partial_scan_tag = 1;
+const uint64_t partial_end_tag  = 0;
+
+// Merge sorted list1 into sorted list (equal entries of list first) and keep num
+template<typename T, typename Cmp>
+void mergeList(std::vector<T> &list, const std::vector<T> &list1, size_t num, Cmp cmp) {
+  std::vector<T> list2;
+
+  list2.reserve(list.size() + list1.size());
+
+  std::merge(list.begin(), list.end(), list1.begin(), list1.end(),
+             std::back_inserter(list2), cmp);
+
+  if (list2.size() > num)
+    list2.resize(num);
+
+  list.swap(list2);
+}
+
+}
+
+//------------
+
+// Options limiting saved results (0 list size = list not saved) and filter options
+// of the scans
+struct CUsagePartialMerge::Limits {
+  int         date_type      { 0 };
+  uint        num_largest    { 0 };
+  uint        num_smallest   { 0 };
+  uint        num_oldest     { 0 };
+  uint        num_newest     { 0 };
+  bool        dirs           { false };
+  int         max_depth      { -1 };
+  uint        num_dir_times  { 0 };
+  uint        num_inode_dirs { 0 };
+  int         cold_days      { -1 };
+  uint        num_cold       { 0 };
+  std::string filters;                // CUsageScan::filterSignature
+};
+
+//------------
+
+CUsagePartialWriter::
+CUsagePartialWriter(const CUsageScanOptions &options) :
+ options_(options)
+{
+}
+
+CUsagePartialWriter::
+~CUsagePartialWriter()
+{
+  // not closed (remove partial file)
+  if (fp_) {
+    fclose(fp_);
+
+    (void) remove((filename_ + ".tmp").c_str());
+  }
+}
+
+bool
+CUsagePartialWriter::
+checkOptions(std::string &msg) const
+{
+  // duplicates need all files (and hashes) of every scan
+  if (options_.display_dups) {
+    msg = "Duplicate files can't be saved in partial results";
+    return false;
+  }
+
+  if (options_.sample_fraction < 1.0 || options_.sample_dir_fraction < 1.0) {
+    msg = "Sample mode results can't be saved in partial results";
+    return false;
+  }
+
+  // ranks need the records of every file of every scan
+  if (options_.rank_range != "") {
+    msg = "Ranked listings can't be saved in partial results";
+    return false;
+  }
+
+  return true;
+}
+
+bool
+CUsagePartialWriter::
+open(const std::string &filename, std::string &msg)
+{
+  if (! checkOptions(msg))
+    return false;
+
+  filename_ = filename;
+
+  fp_ = fopen((filename_ + ".tmp").c_str(), "wb");
+
+  if (! fp_) {
+    msg = "Failed to write partial result \'" + filename_ + ".tmp\'";
+    return false;
+  }
+
+  CUsageBinaryWriter writer(fp_);
+
+  /* Header and Limits */
+
+  writer.put(std::string(partial_magic));
+  writer.put(partial_version);
+
+  auto putNum = [&](bool display, uint num) { writer.put(uint64_t(display ? num : 0)); };
+
+  writer.put(uint64_t(options_.date_type));
+
+  putNum(options_.display_largest  , options_.num_largest  );
+  putNum(options_.display_smallest , options_.num_smallest );
+  putNum(options_.display_oldest   , options_.num_oldest   );
+  putNum(options_.display_newest   , options_.num_newest   );
+  putNum(true                      , options_.display_dirs );
+  writer.put(uint64_t(int64_t(options_.max_depth)));
+  putNum(options_.display_dir_times, options_.num_dir_times);
+  putNum(options_.display_inodes   , options_.num_inode_dirs);
+  writer.put(uint64_t(int64_t(options_.cold_days)));
+  putNum(options_.cold_days >= 0   , options_.num_cold     );
+  writer.put(CUsageScan(options_).filterSignature());
+
+  if (! writer.isOk()) {
+    msg = "Failed to write partial result \'" + filename_ + ".tmp\'";
+    return false;
+  }
+
+  return true;
+}
+
+bool
+CUsagePartialWriter::
+write(const CUsageScanResults &results, std::string &msg)
+{
+  CUsageBinaryWriter writer(fp_);
+
+  writer.put(partial_scan_tag);
+
+  writeResults(writer, results);
+
+  if (! writer.isOk()) {
+    msg = "Failed to write partial result \'" + filename_ + ".tmp\'";
+    return false;
+  }
+
+  return true;
+}
+
+// Write one scan's results (the scan record of the partial result file)
+void
+CUsagePartialWriter::
+writeResults(CUsageBinaryWriter &writer, const CUsageScanResults &results)
+{
+  /* Totals */
+
+  writer.put(results.directory);
+  writer.put(uint64_t(results.complete));
+  writer.put(uint64_t(results.total_usage));
+  writer.put(uint64_t(results.num_files));
+  writer.put(uint64_t(results.num_dirs));
+
+  /* File Lists */
+
+  writer.put(results.largest_files );
+  writer.put(results.smallest_files);
+  writer.put(results.oldest_files  );
+  writer.put(results.newest_files  );
+
+  /* Directory Results */
+
+  writer.put(uint64_t(results.dir_usages.size()));
+
+  for (const auto &dir_usage : results.dir_usages) {
+    writer.put(dir_usage.name);
+    writer.put(uint64_t(dir_usage.size));
+    writer.put(uint64_t(dir_usage.leaf));
+  }
+
+  writer.put(uint64_t(results.dir_totals.size()));
+
+  for (const auto &dir_total : results.dir_totals) {
+    writer.put(dir_total.name);
+    writer.put(uint64_t(dir_total.depth));
+    writer.put(uint64_t(dir_total.size));
+    writer.put(uint64_t(dir_total.num_files));
+    writer.put(uint64_t(dir_total.num_entries));
+  }
+
+  auto putDirTimes = [&](const CUsageScanResults::DirTimes &dir_times) {
+    writer.put(uint64_t(dir_times.size()));
+
+    for (const auto &dir_time : dir_times) {
+      writer.put(dir_time.name);
+      writer.put(dir_time.readdir_ns);
+      writer.put(dir_time.stat_ns);
+      writer.put(uint64_t(dir_time.num_entries));
+    }
+  };
+
+  putDirTimes(results.slowest_dirs);
+  putDirTimes(results.most_entries_dirs);
+
+  auto putDirInodes = [&](const CUsageScanResults::DirInodes &dir_inodes) {
+    writer.put(uint64_t(dir_inodes.size()));
+
+    for (const auto &dir_inodes1 : dir_inodes) {
+      writer.put(dir_inodes1.name);
+      writer.put(uint64_t(dir_inodes1.num_entries));
+      writer.put(uint64_t(dir_inodes1.total_num_entries));
+    }
+  };
+
+  writer.put(uint64_t(results.total_entries));
+
+  putDirInodes(results.inode_dirs);
+  putDirInodes(results.inode_total_dirs);
+
+  writer.put(uint64_t(results.skipped_mounts.size()));
+
+  for (const auto &name : results.skipped_mounts)
+    writer.put(name);
+
+  writer.put(uint64_t(results.link_loops.size()));
+
+  for (const auto &name : results.link_loops)
+    writer.put(name);
+
+  /* Cold Files */
+
+  writer.put(results.cold_files);
+
+  writer.put(uint64_t(results.cold_dirs.size()));
+
+  for (const auto &cold_dir : results.cold_dirs) {
+    writer.put(cold_dir.name);
+    writer.put(uint64_t(cold_dir.size));
+    writer.put(uint64_t(cold_dir.num_files));
+    writer.put(uint64_t(cold_dir.total_size));
+  }
+
+  writer.put(uint64_t(results.cold_owners.size()));
+
+  for (const auto &cold_owner : results.cold_owners) {
+    writer.put(uint64_t(cold_owner.uid));
+    writer.put(uint64_t(cold_owner.size));
+    writer.put(uint64_t(cold_owner.num_files));
+  }
+
+  writer.put(uint64_t(results.cold_usage));
+  writer.put(uint64_t(results.num_cold_files));
+}
+
+// Write end tag, sync file and rename it to the partial result file
+bool
+CUsagePartialWriter::
+close(std::string &msg)
+{
+  if (! fp_)
+    return false;
+
+  CUsageBinaryWriter writer(fp_);
+
+  writer.put(partial_end_tag);
+
+  bool ok = writer.isOk() && fflush(fp_) == 0 && fsync(fileno(fp_)) == 0;
+
+  if (fclose(fp_) != 0)
+    ok = false;
+
+  fp_ = nullptr;
+
+  std::string tmpname = filename_ + ".tmp";
+
+  if (! ok || rename(tmpname.c_str(), filename_.c_str()) != 0) {
+    (void) remove(tmpname.c_str());
+
+    msg = "Failed to write partial result \'" + filename_ + "\'";
+
+    return false;
+  }
+
+  return true;
+}
+
+//------------
+
+CUsagePartialMerge::
+CUsagePartialMerge(const CUsageScanOptions &options) :
+ options_(options)
+{
+}
+
+bool
+CUsagePartialMerge::
+add(const std::string &filename, std::string &msg)
+{
+  FILE *fp = fopen(filename.c_str(), "rb");
+
+  if (! fp) {
+    msg = "Failed to read partial result \'" + filename + "\'";
+    return false;
+  }
+
+  CUsageBinaryReader reader(fp);
+
+  auto invalid = [&]() {
+    fclose(fp);
+
+    msg = "Invalid partial result file \'" + filename + "\'";
+
+    return false;
+  };
+
+  /* Header and Limits */
+
+  std::string magic   = reader.getString();
+  uint64_t    version = reader.getInt();
+
+  if (! reader.isOk() || magic != partial_magic || version != partial_version)
+    return invalid();
+
+  Limits limits;
+
+  limits.date_type      = int (reader.getInt());
+  limits.num_largest    = uint(reader.getInt());
+  limits.num_smallest   = uint(reader.getInt());
+  limits.num_oldest     = uint(reader.getInt());
+  limits.num_newest     = uint(reader.getInt());
+  limits.dirs           = bool(reader.getInt());
+  limits.max_depth      = int (int64_t(reader.getInt()));
+  limits.num_dir_times  = uint(reader.getInt());
+  limits.num_inode_dirs = uint(reader.getInt());
+  limits.cold_days      = int (int64_t(reader.getInt()));
+  limits.num_cold       = uint(reader.getInt());
+  limits.filters        = reader.getString();
+
+  if (! reader.isOk())
+    return invalid();
+
+  // all files must have been scanned with the same filter options
+  if (num_files_ == 0)
+    filters_ = limits.filters;
+  else if (limits.filters != filters_) {
+    fclose(fp);
+
+    msg = "Partial result \'" + filename + "\' was scanned with different filter " +
+          "options (" + (limits.filters != "" ? limits.filters : "none") + " not " +
+          (filters_ != "" ? filters_ : "none") + ")";
+
+    return false;
+  }
+
+  ++num_files_;
+
+  /* Scans (each merged when read) */
+
+  while (true) {
+    uint64_t tag = reader.getInt();
+
+    if (! reader.isOk() || tag == partial_end_tag)
+      break;
+
+    if (tag != partial_scan_tag)
+      return invalid();
+
+    CUsageScanResults results;
+
+    if (! readResults(reader, results))
+      return invalid();
+
+    if (! checkLimits(limits, results, msg)) {
+      fclose(fp);
+
+      msg = "Partial result \'" + filename + "\' " + msg;
+
+      return false;
+    }
+
+    merge(results);
+  }
+
+  // missing end tag (truncated file)
+  if (! reader.isOk())
+    return invalid();
+
+  fclose(fp);
+
+  return true;
+}
+
+// Read one scan's results (written by CUsagePartialWriter::writeResults)
+bool
+CUsagePartialMerge::
+readResults(CUsageBinaryReader &reader, CUsageScanResults &results)
+{
+  results.directory   = reader.getString();
+  results.complete    = bool  (reader.getInt());
+  results.total_usage = size_t(reader.getInt());
+  results.num_files   = long  (reader.getInt());
+  results.num_dirs    = long  (reader.getInt());
+
+  reader.getFileSpecs(results.largest_files );
+  reader.getFileSpecs(results.smallest_files);
+  reader.getFileSpecs(results.oldest_files  );
+  reader.getFileSpecs(results.newest_files  );
+
+  uint64_t n = reader.getInt();
+
+  for (uint64_t i = 0; i < n && reader.isOk(); ++i) {
+    CUsageDirUsage dir_usage;
+
+    dir_usage.name = reader.getString();
+    dir_usage.len  = int(dir_usage.name.size());
+    dir_usage.size = size_t(reader.getInt());
+    dir_usage.leaf = bool  (reader.getInt());
+
+    results.dir_usages.push_back(dir_usage);
+  }
+
+  n = reader.getInt();
+
+  for (uint64_t i = 0; i < n && reader.isOk(); ++i) {
+    CUsageDirTotal dir_total;
+
+    dir_total.name        = reader.getString();
+    dir_total.depth       = int   (reader.getInt());
+    dir_total.size        = size_t(reader.getInt());
+    dir_total.num_files   = long  (reader.getInt());
+    dir_total.num_entries = long  (reader.getInt());
+
+    results.dir_totals.push_back(dir_total);
+  }
+
+  auto getDirTimes = [&](CUsageScanResults::DirTimes &dir_times) {
+    uint64_t n1 = reader.getInt();
+
+    for (uint64_t i = 0; i < n1 && reader.isOk(); ++i) {
+      CUsageDirTime dir_time;
+
+      dir_time.name        = reader.getString();
+      dir_time.readdir_ns  = reader.getInt();
+      dir_time.stat_ns     = reader.getInt();
+      dir_time.num_entries = long(reader.getInt());
+
+      dir_times.push_back(dir_time);
+    }
+  };
+
+  getDirTimes(results.slowest_dirs);
+  getDirTimes(results.most_entries_dirs);
+
+  auto getDirInodes = [&](CUsageScanResults::DirInodes &dir_inodes) {
+    uint64_t n1 = reader.getInt();
+
+    for (uint64_t i = 0; i < n1 && reader.isOk(); ++i) {
+      CUsageDirInodes dir_inodes1;
+
+      dir_inodes1.name              = reader.getString();
+      dir_inodes1.num_entries       = long(reader.getInt());
+      dir_inodes1.total_num_entries = long(reader.getInt());
+
+      dir_inodes.push_back(dir_inodes1);
+    }
+  };
+
+  results.total_entries = long(reader.getInt());
+
+  getDirInodes(results.inode_dirs);
+  getDirInodes(results.inode_total_dirs);
+
+  n = reader.getInt();
+
+  for (uint64_t i = 0; i < n && reader.isOk(); ++i)
+    results.skipped_mounts.push_back(reader.getString());
+
+  n = reader.getInt();
+
+  for (uint64_t i = 0; i < n && reader.isOk(); ++i)
+    results.link_loops.push_back(reader.getString());
+
+  reader.getFileSpecs(results.cold_files);
+
+  n = reader.getInt();
+
+  for (uint64_t i = 0; i < n && reader.isOk(); ++i) {
+    CUsageColdDir cold_dir;
+
+    cold_dir.name       = reader.getString();
+    cold_dir.size       = size_t(reader.getInt());
+    cold_dir.num_files  = long  (reader.getInt());
+    cold_dir.total_size = size_t(reader.getInt());
+
+    results.cold_dirs.push_back(cold_dir);
+  }
+
+  n = reader.getInt();
+
+  for (uint64_t i = 0; i < n && reader.isOk(); ++i) {
+    CUsageColdOwner cold_owner;
+
+    cold_owner.uid       = uid_t (reader.getInt());
+    cold_owner.size      = size_t(reader.getInt());
+    cold_owner.num_files = long  (reader.getInt());
+
+    results.cold_owners.push_back(cold_owner);
+  }
+
+  results.cold_usage     = size_t(reader.getInt());
+  results.num_cold_files = long  (reader.getInt());
+
+  return reader.isOk();
+}
+
+// Check scan's saved lists have all entries needed by options
+bool
+CUsagePartialMerge::
+checkLimits(const Limits &limits, const CUsageScanResults &results, std::string &msg) const
+{
+  // list has enough entries if it saved num or it wasn't full (so has all entries)
+  auto checkNum = [&](bool display, uint num, uint saved_num, size_t size, const char *name) {
+    if (! display)
+      return true;
+
+    if (saved_num == 0) {
+      msg = "has no " + std::string(name);
+      return false;
+    }
+
+    if (num > saved_num && size >= saved_num) {
+      msg = "has only " + std::to_string(saved_num) + " " + name;
+      return false;
+    }
+
+    return true;
+  };
+
+  if (! checkNum(options_.display_largest, options_.num_largest, limits.num_largest,
+                 results.largest_files.size(), "largest files"))
+    return false;
+  if (! checkNum(options_.display_smallest, options_.num_smallest, limits.num_smallest,
+                 results.smallest_files.size(), "smallest files"))
+    return false;
+  if (! checkNum(options_.display_oldest, options_.num_oldest, limits.num_oldest,
+                 results.oldest_files.size(), "oldest files"))
+    return false;
+  if (! checkNum(options_.display_newest, options_.num_newest, limits.num_newest,
+                 results.newest_files.size(), "newest files"))
+    return false;
+  if (! checkNum(options_.display_dir_times, options_.num_dir_times, limits.num_dir_times,
+                 std::max(results.slowest_dirs.size(), results.most_entries_dirs.size()),
+                 "directory times"))
+    return false;
+  if (! checkNum(options_.display_inodes, options_.num_inode_dirs, limits.num_inode_dirs,
+                 std::max(results.inode_dirs.size(), results.inode_total_dirs.size()),
+                 "inode directories"))
+    return false;
+  if (! checkNum(options_.cold_days >= 0, options_.num_cold, limits.num_cold,
+                 std::max(results.cold_files.size(), results.cold_dirs.size()),
+                 "cold files"))
+    return false;
+
+  if (options_.display_dirs && ! limits.dirs) {
+    msg = "has no directories";
+    return false;
+  }
+
+  if (options_.max_depth > limits.max_depth) {
+    msg = "has no directory totals to depth " + std::to_string(options_.max_depth);
+    return false;
+  }
+
+  // file list and cold times must be the same type
+  bool use_times = (options_.display_largest || options_.display_smallest ||
+                    options_.display_oldest  || options_.display_newest   ||
+                    options_.cold_days >= 0);
+
+  if (use_times && limits.date_type != int(options_.date_type)) {
+    msg = "was saved with a different date type";
+    return false;
+  }
+
+  if (options_.cold_days >= 0 && limits.cold_days != options_.cold_days) {
+    msg = "was saved with different cold days";
+    return false;
+  }
+
+  return true;
+}
+
+// Merge scan into results (lists are kept sorted and trimmed to the option sizes)
+void
+CUsagePartialMerge::
+merge(const CUsageScanResults &results)
+{
+  if (num_scans_ == 0)
+    results_.directory = results.directory;
+  else
+    results_.directory += " " + results.directory;
+
+  ++num_scans_;
+
+  results_.total_usage += results.total_usage;
+  results_.num_files   += results.num_files;
+  results_.num_dirs    += results.num_dirs;
+  results_.complete     = results_.complete && results.complete;
+
+  /* File Lists */
+
+  mergeList(results_.largest_files, results.largest_files, options_.num_largest,
+    [](const CUsageFileSpec &f1, const CUsageFileSpec &f2) { return (f1.size > f2.size); });
+  mergeList(results_.smallest_files, results.smallest_files, options_.num_smallest,
+    [](const CUsageFileSpec &f1, const CUsageFileSpec &f2) { return (f1.size < f2.size); });
+  mergeList(results_.oldest_files, results.oldest_files, options_.num_oldest,
+    [](const CUsageFileSpec &f1, const CUsageFileSpec &f2) { return (f1.time < f2.time); });
+  mergeList(results_.newest_files, results.newest_files, options_.num_newest,
+    [](const CUsageFileSpec &f1, const CUsageFileSpec &f2) { return (f1.time > f2.time); });
+
+  /* Directory Results */
+
+  if (options_.display_dirs)
+    results_.dir_usages.insert(results_.dir_usages.end(),
+                               results.dir_usages.begin(), results.dir_usages.end());
+
+  for (const auto &dir_total : results.dir_totals)
+    if (dir_total.depth <= options_.max_depth)
+      results_.dir_totals.push_back(dir_total);
+
+  mergeList(results_.slowest_dirs, results.slowest_dirs, options_.num_dir_times,
+    [](const CUsageDirTime &d1, const CUsageDirTime &d2) {
+      return (d1.totalNs() > d2.totalNs());
+    });
+  mergeList(results_.most_entries_dirs, results.most_entries_dirs, options_.num_dir_times,
+    [](const CUsageDirTime &d1, const CUsageDirTime &d2) {
+      if (d1.num_entries != d2.num_entries)
+        return (d1.num_entries > d2.num_entries);
+
+      return (d1.name < d2.name);
+    });
+
+  results_.total_entries += results.total_entries;
+
+  mergeList(results_.inode_dirs, results.inode_dirs, options_.num_inode_dirs,
+    [](const CUsageDirInodes &d1, const CUsageDirInodes &d2) {
+      if (d1.num_entries != d2.num_entries)
+        return (d1.num_entries > d2.num_entries);
+
+      return (d1.name < d2.name);
+    });
+  mergeList(results_.inode_total_dirs, results.inode_total_dirs, options_.num_inode_dirs,
+    [](const CUsageDirInodes &d1, const CUsageDirInodes &d2) {
+      if (d1.total_num_entries != d2.total_num_entries)
+        return (d1.total_num_entries > d2.total_num_entries);
+
+      return (d1.name < d2.name);
+    });
+
+  results_.skipped_mounts.insert(results_.skipped_mounts.end(),
+                                 results.skipped_mounts.begin(), results.skipped_mounts.end());
+  results_.link_loops    .insert(results_.link_loops.end(),
+                                 results.link_loops.begin(), results.link_loops.end());
+
+  /* Cold Files */
+
+  mergeList(results_.cold_files, results.cold_files, options_.num_cold,
+    [](const CUsageFileSpec &f1, const CUsageFileSpec &f2) { return (f1.size > f2.size); });
+  mergeList(results_.cold_dirs, results.cold_dirs, options_.num_cold,
+    [](const CUsageColdDir &d1, const CUsageColdDir &d2) {
+      if (d1.size != d2.size)
+        return (d1.size > d2.size);
+
+      return (d1.name < d2.name);
+    });
+
+  for (const auto &cold_owner : results.cold_owners) {
+    auto &cold_owner1 = cold_owners_[cold_owner.uid];
+
+    cold_owner1.uid        = cold_owner.uid;
+    cold_owner1.size      += cold_owner.size;
+    cold_owner1.num_files += cold_owner.num_files;
+  }
+
+  results_.cold_usage     += results.cold_usage;
+  results_.num_cold_files += results.num_cold_files;
+}
+
+// Get merged results with directory usages and cold owners sorted as for a scan
+void
+CUsagePartialMerge::
+getResults(CUsageScanResults &results) const
+{
+  results = results_;
+
+  // sort by usage (largest first, then name)
+  std::sort(results.dir_usages.begin(), results.dir_usages.end(),
+            [](const CUsageDirUsage &dir_usage1, const CUsageDirUsage &dir_usage2) {
+              return (dir_usage1.name < dir_usage2.name);
+            });
+
+  std::stable_sort(results.dir_usages.begin(), results.dir_usages.end(),
+                   CUsageDirUsageCmp());
+
+  std::sort(results.skipped_mounts.begin(), results.skipped_mounts.end());
+  std::sort(results.link_loops    .begin(), results.link_loops    .end());
+
+  // most cold bytes first (then uid)
+  for (const auto &cold_owner : cold_owners_)
+    results.cold_owners.push_back(cold_owner.second);
+
+  std::stable_sort(results.cold_owners.begin(), results.cold_owners.end(),
+                   [](const CUsageColdOwner &owner1, const CUsageColdOwner &owner2) {
+                     return (owner1.size > owner2.size);
+                   });
+}
@@ -0,0 +1,98 @@
+#ifndef CUsagePartial_H
+#define CUsagePartial_H
+
+#include <CUsageScan.h>
+#include <cstdio>
+#include <map>
+#include <string>
+
+class CUsageBinaryWriter;
+class CUsageBinaryReader;
+
+// Partial result file writer.
+//
+// Writes the results of one or more directory scans (e.g. the shard of a name space
+// scanned by one host) to a compact binary file which can be merged with others by
+// CUsagePartialMerge. Each scan's totals, file lists (with full names, sizes and
+// times), directory usages, totals and times, cold directories and owners, skipped
+// mounts and link loops are saved with the options which limit them (list sizes, max
+// depth, date type and cold days) and the filter options which selected the files.
+//
+// The file is binary (native byte order) and is written to a temporary file which is
+// renamed when it is closed. Duplicate groups and sample estimates can't be merged so
+// can't be saved.
+class CUsagePartialWriter {
+ public:
+  CUsagePartialWriter(const CUsageScanOptions &options);
+ ~CUsagePartialWriter();
+
+  CUsagePartialWriter(const CUsagePartialWriter &) = delete;
+  CUsagePartialWriter &operator=(const CUsagePartialWriter &) = delete;
+
+  // check options can be saved
+  bool checkOptions(std::string &msg) const;
+
+  bool open(const std::string &filename, std::string &msg);
+
+  // add results of one directory scan
+  bool write(const CUsageScanResults &results, std::string &msg);
+
+  bool close(std::string &msg);
+
+  // write one scan's results (also used to pass results between processes)
+  static void writeResults(CUsageBinaryWriter &writer, const CUsageScanResults &results);
+
+ private:
+  CUsageScanOptions options_;
+  std::string       filename_;
+  FILE*             fp_ { nullptr };
+};
+
+// Partial result merge.
+//
+// Combines the scans of any number of partial result files into the results a single
+// scan of all of their directories would produce for the options : totals and counts
+// are summed, the file and directory lists are merged (keeping the top entries, which
+// are the top entries of the union as long as each scan saved at least as many) and the
+// directory usages and totals are combined. Files are read one scan at a time and only
+// the merged lists are kept.
+//
+// Scans must have saved every list selected by the options with at least as many
+// entries (or all of theirs) and have used the same date type and cold days. All
+// files must have been scanned with the same filter options.
+class CUsagePartialMerge {
+ public:
+  CUsagePartialMerge(const CUsageScanOptions &options);
+
+  // read and merge scans of partial result file
+  bool add(const std::string &filename, std::string &msg);
+
+  // get merged results
+  void getResults(CUsageScanResults &results) const;
+
+  int numScans() const { return num_scans_; }
+
+  // read one scan's results (written by CUsagePartialWriter::writeResults)
+  static bool readResults(CUsageBinaryReader &reader, CUsageScanResults &results);
+
+ private:
+  struct Limits;
+
+  bool checkLimits(const Limits &limits, const CUsageScanResults &results,
+                   std::string &msg) const;
+
+  void merge(const CUsageScanResults &results);
+
+ private:
+  using ColdOwners = std::map<uid_t, CUsageColdOwner>;
+
+  CUsageScanOptions options_;
+  CUsageScanResults results_;
+  ColdOwners        cold_owners_;
+  int               num_scans_ { 0 };
+  int               num_files_ { 0 };
+  std::string       filters_;          // filter options of files
+
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include <CUsagePathList.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// bytes read from non regular file at a time
+const size_t path_list_read_size = size_t(1) << 20;
+
+}
+
+CUsagePathList::
+~CUsagePathList()
+{
+  clear();
+}
+
+// Read NUL separated paths from file (stdin if '-'). Empty paths are skipped.
+bool
+CUsagePathList::
+read(const std::string &filename, std::string &msg)
+{
+  clear();
+
+  bool is_stdin = (filename == "-");
+
+  int fd = (is_stdin ? STDIN_FILENO : ::open(filename.c_str(), O_RDONLY));
+
+  if (fd < 0) {
+    msg = "Failed to open file list \'" + filename + "\'";
+    return false;
+  }
+
+  struct stat st;
+
+  bool ok = (fstat(fd, &st) == 0);
+
+  // map regular file (the paths are read once, in order)
+  if (ok && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (p != MAP_FAILED) {
+      (void) madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+
+      data_   = static_cast<const char *>(p);
+      size_   = size_t(st.st_size);
+      mapped_ = true;
+    }
+  }
+
+  if (ok && ! mapped_)
+    ok = readFd(fd);
+
+  if (! is_stdin)
+    ::close(fd);
+
+  if (! ok) {
+    clear();
+
+    msg = "Failed to read file list \'" + filename + "\'";
+
+    return false;
+  }
+
+  split();
+
+  return true;
+}
+
+// Read all of file (e.g. a pipe) into buffer
+bool
+CUsagePathList::
+readFd(int fd)
+{
+  size_t len = 0;
+
+  while (true) {
+    if (buffer_.size() < len + path_list_read_size)
+      buffer_.resize(std::max(2*buffer_.size(), len + path_list_read_size));
+
+    ssize_t n = ::read(fd, &buffer_[len], path_list_read_size);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      return false;
+    }
+
+    if (n == 0)
+      break;
+
+    len += size_t(n);
+  }
+
+  buffer_.resize(len);
+
+  data_ = buffer_.data();
+  size_ = len;
+
+  return true;
+}
+
+// Record offset and length of each path (the last path need not be NUL terminated)
+void
+CUsagePathList::
+split()
+{
+  size_t pos = 0;
+
+  while (pos < size_) {
+    const char *p = static_cast<const char *>(memchr(data_ + pos, '\0', size_ - pos));
+
+    size_t end = (p ? size_t(p - data_) : size_);
+
+    if (end > pos) {
+      Path path;
+
+      path.offset = pos;
+      path.len    = uint32_t(end - pos);
+
+      paths_.push_back(path);
+    }
+
+    pos = end + 1;
+  }
+}
+
+void
+CUsagePathList::
+clear()
+{
+  if (mapped_)
+    munmap(const_cast<char *>(data_), size_);
+
+  data_   = nullptr;
+  size_   = 0;
+  mapped_ = false;
+
+  buffer_.clear();
+  buffer_.shrink_to_fit();
+
+  paths_.clear();
+}
@@ -0,0 +1,57 @@
+#ifndef CUsagePathList_H
+#define CUsagePathList_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// List of paths to scan instead of walking a directory (e.g. from 'find -print0', a
+// backup catalog or a snapshot manifest).
+//
+// The paths are NUL separated. A regular file is mapped read only and any other input
+// (e.g. a pipe on stdin) is read into one buffer, and each path is only recorded as
+// its offset and length in the data (paths are not copied or NUL terminated).
+class CUsagePathList {
+ public:
+  // path in data
+  struct Path {
+    size_t   offset { 0 };
+    uint32_t len    { 0 };
+  };
+
+  using Paths = std::vector<Path>;
+
+ public:
+  CUsagePathList() { }
+ ~CUsagePathList();
+
+  CUsagePathList(const CUsagePathList &) = delete;
+  CUsagePathList &operator=(const CUsagePathList &) = delete;
+
+  // read list from file ('-' for stdin)
+  bool read(const std::string &filename, std::string &msg);
+
+  void clear();
+
+  const char *data() const { return data_; }
+
+  size_t size() const { return paths_.size(); }
+
+  const Path &path(size_t i) const { return paths_[i]; }
+
+  const char *pathData(size_t i) const { return data_ + paths_[i].offset; }
+
+ private:
+  bool readFd(int fd);
+
+  void split();
+
+  const char*       data_   { nullptr };
+  size_t            size_   { 0 };
+  bool              mapped_ { false };
+  std::vector<char> buffer_;           // data read from non regular file
+  Paths             paths_;
+};
+
+#endif
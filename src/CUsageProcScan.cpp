@@ -0,0 +1,489 @@
+#include <CUsageProcScan.h>
+#include <CUsageBinaryIO.h>
+#include <CUsagePartial.h>
+#include <CUsageProgress.h>
+#include <CUsageThrottle.h>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// size of each worker's result region (only the pages written are allocated)
+const size_t proc_region_size = size_t(1) << 30;
+
+// milliseconds to wait for a killed worker to exit before it is abandoned
+const int64_t proc_kill_wait_ms = 1000;
+
+// parent's poll interval
+const useconds_t proc_poll_us = 20000;
+
+int64_t monotonicMs() {
+  using namespace std::chrono;
+
+  return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// map memory shared with (later) forked processes
+void *mapShared(size_t size) {
+  void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  return (p != MAP_FAILED ? p : nullptr);
+}
+
+}
+
+//------------
+
+// Control block shared by parent and all workers
+struct CUsageProcScan::Control {
+  std::atomic<uint> next_directory  { 0 };
+  std::atomic<int>  throttle_adjust { 0 }; // sum of throttle signal adjustments
+};
+
+// Worker result region : the directory being scanned, the worker's progress counts
+// (published once a second when progress is reported) and size of the complete results
+// (a directory's results are only counted when all written) followed by the results
+struct CUsageProcScan::Region {
+  std::atomic<int>      directory    { -1 }; // directory being scanned (-1 = none)
+  std::atomic<int64_t>  start_ms     { 0 };  // start time of directory scan
+  std::atomic<int64_t>  entries      { 0 };  // progress counts
+  std::atomic<int64_t>  bytes        { 0 };
+  std::atomic<int64_t>  dirs         { 0 };
+  std::atomic<int64_t>  pending_dirs { 0 };
+  std::atomic<uint64_t> size         { 0 };  // size of complete results
+
+  char *data() { return reinterpret_cast<char *>(this + 1); }
+
+  static size_t dataSize() { return proc_region_size - sizeof(Region); }
+};
+
+static_assert(std::atomic<int>::is_always_lock_free &&
+              std::atomic<int64_t>::is_always_lock_free &&
+              std::atomic<uint64_t>::is_always_lock_free,
+              "shared memory atomics must be lock free");
+
+// Worker process (as seen by parent)
+struct CUsageProcScan::Worker {
+  pid_t       pid     { 0 };
+  Region*     region  { nullptr };
+  bool        running { false };
+  bool        killed  { false };
+  int64_t     kill_ms { 0 };
+  std::string reason;             // why worker stopped early (empty if it didn't)
+};
+
+//------------
+
+CUsageProcScan::
+CUsageProcScan(const CUsageScanOptions &options) :
+ options_(options)
+{
+}
+
+bool
+CUsageProcScan::
+checkOptions(std::string &msg) const
+{
+  if (! CUsageScan(options_).checkOptions(msg))
+    return false;
+
+  // only results in the partial result format are passed back
+  if (options_.display_dups) {
+    msg = "Duplicate files can't be used with worker processes";
+    return false;
+  }
+
+  if (options_.sample_fraction < 1.0 || options_.sample_dir_fraction < 1.0) {
+    msg = "Sample mode can't be used with worker processes";
+    return false;
+  }
+
+  if (options_.rank_range != "") {
+    msg = "Ranked listings can't be used with worker processes";
+    return false;
+  }
+
+  // workers would share the file
+  if (options_.checkpoint_file != "" || options_.resume_file != "") {
+    msg = "Checkpoints can't be used with worker processes";
+    return false;
+  }
+
+  return true;
+}
+
+bool
+CUsageProcScan::
+scan(const Directories &directories, Results &results, std::string &msg)
+{
+  if (! checkOptions(msg))
+    return false;
+
+  uint num_directories = uint(directories.size());
+
+  results.clear();
+  results.resize(num_directories);
+
+  for (uint i = 0; i < num_directories; ++i) {
+    results[i].results.directory = directories[i];
+    results[i].results.complete  = false;
+    results[i].error             = "No worker results for \'" + directories[i] + "\'";
+  }
+
+  if (num_directories == 0)
+    return true;
+
+  //------------
+
+  /* Create Control Block and Start Workers */
+
+  void *p = mapShared(sizeof(Control));
+
+  if (! p) {
+    msg = "Failed to create shared memory for worker processes";
+    return false;
+  }
+
+  control_ = new (p) Control;
+
+  stopped_counts_  = Counts();
+  progress_counts_ = Counts();
+
+  std::vector<Worker> workers(std::min(num_procs_, num_directories));
+
+  // each worker's copy of the throttle gets an equal share of the limits and follows
+  // the parent's signal adjustments (pending ones are passed on by the first poll)
+  if (throttle_) {
+    throttle_->setShare(1.0/double(workers.size()));
+
+    throttle_->setSharedAdjust(&control_->throttle_adjust);
+  }
+
+  bool started = false;
+
+  for (auto &worker : workers) {
+    if (startWorker(worker, directories))
+      started = true;
+  }
+
+  if (! started) {
+    munmap(control_, sizeof(Control));
+
+    control_ = nullptr;
+
+    msg = "Failed to start worker processes";
+
+    return false;
+  }
+
+  //------------
+
+  /* Wait for Workers (killing any over the timeout and replacing stopped ones) */
+
+  while (true) {
+    bool running = false;
+
+    // pass limit adjustments (SIGUSR1/SIGUSR2 to parent) to workers
+    if (throttle_) {
+      int adjust = CUsageThrottle::takeAdjust();
+
+      if (adjust != 0)
+        control_->throttle_adjust.fetch_add(adjust, std::memory_order_relaxed);
+    }
+
+    for (auto &worker : workers) {
+      if (worker.running) {
+        int status = 0;
+
+        pid_t pid = waitpid(worker.pid, &status, WNOHANG);
+
+        int64_t now = monotonicMs();
+
+        if      (pid == worker.pid || pid < 0) {
+          bool ok = (pid == worker.pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+          if (! ok && ! worker.killed)
+            worker.reason = "failed";
+
+          stopWorker(worker, directories, results);
+        }
+        else if (worker.killed) {
+          // abandon worker stuck in kernel (its published results are complete)
+          if (now - worker.kill_ms > proc_kill_wait_ms)
+            stopWorker(worker, directories, results);
+        }
+        else if (timeout_ > 0) {
+          int directory = worker.region->directory.load(std::memory_order_acquire);
+
+          if (directory >= 0 &&
+              now - worker.region->start_ms.load(std::memory_order_relaxed) > timeout_*1000L) {
+            kill(worker.pid, SIGKILL);
+
+            worker.killed  = true;
+            worker.kill_ms = now;
+            worker.reason  = "timed out after " + std::to_string(timeout_) + " secs";
+          }
+        }
+
+        // replace worker stopped early if directories remain
+        if (! worker.running && control_->next_directory.load() < num_directories)
+          (void) startWorker(worker, directories);
+      }
+
+      if (worker.running)
+        running = true;
+    }
+
+    updateProgress(workers, directories);
+
+    if (! running)
+      break;
+
+    usleep(proc_poll_us);
+  }
+
+  munmap(control_, sizeof(Control));
+
+  control_ = nullptr;
+
+  return true;
+}
+
+// Map worker's result region and fork worker
+bool
+CUsageProcScan::
+startWorker(Worker &worker, const Directories &directories)
+{
+  void *p = mapShared(proc_region_size);
+
+  if (! p)
+    return false;
+
+  worker = Worker();
+
+  worker.region = new (p) Region;
+
+  // don't duplicate buffered output in child
+  fflush(stdout);
+  fflush(stderr);
+
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    munmap(worker.region, proc_region_size);
+
+    worker.region = nullptr;
+
+    return false;
+  }
+
+  if (pid == 0)
+    runWorker(worker.region, directories);
+
+  worker.pid     = pid;
+  worker.running = true;
+
+  return true;
+}
+
+// Scan directories (taken from control block) and append results to region. Each
+// record is the directory index, scan error and results.
+void
+CUsageProcScan::
+runWorker(Region *region, const Directories &directories)
+{
+  FILE *fp = fmemopen(region->data(), Region::dataSize(), "w");
+
+  if (! fp)
+    _exit(1);
+
+  // unbuffered so a full region fails the write
+  setvbuf(fp, nullptr, _IONBF, 0);
+
+  // adjustments pending in parent when forked are passed on by the parent
+  (void) CUsageThrottle::takeAdjust();
+
+  // publish progress counts (of all directories scanned by worker) to region
+  std::unique_ptr<CUsageProgress> progress;
+
+  if (progress_) {
+    progress = std::make_unique<CUsageProgress>();
+
+    progress->setReportProc([region](long entries, long bytes, long dirs,
+                                     long pending_dirs) {
+      region->entries     .store(entries     , std::memory_order_relaxed);
+      region->bytes       .store(bytes       , std::memory_order_relaxed);
+      region->dirs        .store(dirs        , std::memory_order_relaxed);
+      region->pending_dirs.store(pending_dirs, std::memory_order_relaxed);
+    });
+
+    progress->start();
+  }
+
+  uint num_directories = uint(directories.size());
+
+  while (true) {
+    uint i = control_->next_directory.fetch_add(1);
+
+    if (i >= num_directories)
+      break;
+
+    region->start_ms .store(monotonicMs(), std::memory_order_relaxed);
+    region->directory.store(int(i), std::memory_order_release);
+
+    CUsageScan scan(options_);
+
+    scan.setThrottle(throttle_);
+    scan.setProgress(progress.get());
+
+    CUsageScanResults results;
+    std::string       error;
+
+    if (! scan.scan(directories[i], results))
+      error = scan.errorMsg();
+
+    uint64_t size = region->size.load(std::memory_order_relaxed);
+
+    CUsageBinaryWriter writer(fp);
+
+    writer.put(uint64_t(i));
+    writer.put(error);
+
+    CUsagePartialWriter::writeResults(writer, results);
+
+    // results don't fit (replace with error)
+    if (! writer.isOk()) {
+      clearerr(fp);
+
+      (void) fseek(fp, long(size), SEEK_SET);
+
+      CUsageScanResults results1;
+
+      results1.directory = directories[i];
+      results1.complete  = false;
+
+      CUsageBinaryWriter writer1(fp);
+
+      writer1.put(uint64_t(i));
+      writer1.put("Results of \'" + directories[i] + "\' too large for worker shared memory");
+
+      CUsagePartialWriter::writeResults(writer1, results1);
+
+      if (! writer1.isOk())
+        _exit(1);
+    }
+
+    region->size     .store(uint64_t(ftell(fp)), std::memory_order_release);
+    region->directory.store(-1, std::memory_order_release);
+  }
+
+  fclose(fp);
+
+  // publish final counts
+  if (progress)
+    progress->stop();
+
+  _exit(0);
+}
+
+// Read the complete results published by worker
+void
+CUsageProcScan::
+readWorker(Worker &worker, Results &results)
+{
+  uint64_t size = worker.region->size.load(std::memory_order_acquire);
+
+  if (size == 0)
+    return;
+
+  FILE *fp = fmemopen(worker.region->data(), size, "r");
+
+  if (! fp)
+    return;
+
+  CUsageBinaryReader reader(fp);
+
+  while (uint64_t(ftell(fp)) < size) {
+    uint64_t    i     = reader.getInt();
+    std::string error = reader.getString();
+
+    CUsageScanResults scan_results;
+
+    if (! CUsagePartialMerge::readResults(reader, scan_results) || i >= results.size())
+      break;
+
+    results[i].results = std::move(scan_results);
+    results[i].error   = error;
+    results[i].scanned = true;
+  }
+
+  fclose(fp);
+}
+
+// Read worker's results, mark directory it stopped in as incomplete and unmap region
+void
+CUsageProcScan::
+stopWorker(Worker &worker, const Directories &directories, Results &results)
+{
+  readWorker(worker, results);
+
+  int directory = worker.region->directory.load(std::memory_order_acquire);
+
+  if (directory >= 0 && ! results[directory].scanned && worker.reason != "")
+    results[directory].error = "Worker " + worker.reason + " scanning \'" +
+                               directories[directory] + "\' (incomplete)";
+
+  stopped_counts_.entries += worker.region->entries.load(std::memory_order_relaxed);
+  stopped_counts_.bytes   += worker.region->bytes  .load(std::memory_order_relaxed);
+  stopped_counts_.dirs    += worker.region->dirs   .load(std::memory_order_relaxed);
+
+  munmap(worker.region, proc_region_size);
+
+  worker.region  = nullptr;
+  worker.running = false;
+}
+
+// Add the change in the sum of the workers' published counts to progress
+void
+CUsageProcScan::
+updateProgress(const std::vector<Worker> &workers, const Directories &directories)
+{
+  if (! progress_)
+    return;
+
+  Counts counts = stopped_counts_;
+
+  for (const auto &worker : workers) {
+    if (! worker.running)
+      continue;
+
+    const Region *region = worker.region;
+
+    counts.entries      += region->entries     .load(std::memory_order_relaxed);
+    counts.bytes        += region->bytes       .load(std::memory_order_relaxed);
+    counts.dirs         += region->dirs        .load(std::memory_order_relaxed);
+    counts.pending_dirs += region->pending_dirs.load(std::memory_order_relaxed);
+
+    int directory = region->directory.load(std::memory_order_relaxed);
+
+    if (directory >= 0)
+      progress_->startDir(directories[directory]);
+  }
+
+  progress_->addEntries(0, counts.entries - progress_counts_.entries,
+                        size_t(counts.bytes - progress_counts_.bytes));
+  progress_->addDirs   (0, counts.dirs - progress_counts_.dirs);
+
+  progress_->setPendingDirs(size_t(counts.pending_dirs));
+
+  progress_counts_ = counts;
+}
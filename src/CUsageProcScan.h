@@ -0,0 +1,95 @@
+#ifndef CUsageProcScan_H
+#define CUsageProcScan_H
+
+#include <CUsageScan.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+class CUsageProgress;
+class CUsageThrottle;
+
+// Multi process scan.
+//
+// Scans a list of directories in forked worker processes so a scan blocked in the
+// kernel (e.g. a stat on a hung NFS mount) only holds up its own directory. Workers take
+// the next unscanned directory from a shared control block and publish the results of
+// each scanned directory (in the partial result scan format) to their own shared memory
+// region, which the parent reads when the worker exits.
+//
+// A worker whose current directory has been scanning for longer than the timeout is
+// killed, the directory is returned incomplete and a replacement worker is started for
+// the remaining directories. The parent never waits on a killed worker (one stuck in an
+// uninterruptible system call is left to exit on its own).
+class CUsageProcScan {
+ public:
+  // results of one directory (error is set if the scan failed or has no results)
+  struct Result {
+    CUsageScanResults results;
+    std::string       error;
+    bool              scanned { false }; // results read from worker
+  };
+
+  using Directories = std::vector<std::string>;
+  using Results     = std::vector<Result>;
+
+ public:
+  CUsageProcScan(const CUsageScanOptions &options);
+
+  CUsageProcScan(const CUsageProcScan &) = delete;
+  CUsageProcScan &operator=(const CUsageProcScan &) = delete;
+
+  uint numProcs() const { return num_procs_; }
+  void setNumProcs(uint n) { num_procs_ = std::max(n, 1U); }
+
+  // seconds one directory may scan before its worker is killed (0 = no limit)
+  int timeout() const { return timeout_; }
+  void setTimeout(int secs) { timeout_ = std::max(secs, 0); }
+
+  // throttle used by (a copy in) each worker, with an equal share of its limits
+  void setThrottle(CUsageThrottle *throttle) { throttle_ = throttle; }
+
+  // progress updated with the sum of the counts published by the workers
+  void setProgress(CUsageProgress *progress) { progress_ = progress; }
+
+  // check options can be scanned by worker processes
+  bool checkOptions(std::string &msg) const;
+
+  // scan directories (results in directory order)
+  bool scan(const Directories &directories, Results &results, std::string &msg);
+
+ private:
+  struct Control;
+  struct Region;
+  struct Worker;
+
+  // progress counts of all workers
+  struct Counts {
+    long entries      { 0 };
+    long bytes        { 0 };
+    long dirs         { 0 };
+    long pending_dirs { 0 };
+  };
+
+  bool startWorker(Worker &worker, const Directories &directories);
+
+  [[noreturn]] void runWorker(Region *region, const Directories &directories);
+
+  void readWorker(Worker &worker, Results &results);
+
+  void stopWorker(Worker &worker, const Directories &directories, Results &results);
+
+  void updateProgress(const std::vector<Worker> &workers, const Directories &directories);
+
+ private:
+  CUsageScanOptions options_;
+  uint              num_procs_ { 1 };
+  int               timeout_   { 0 };
+  CUsageThrottle*   throttle_  { nullptr };
+  CUsageProgress*   progress_  { nullptr };
+  Control*          control_   { nullptr };
+  Counts            stopped_counts_;       // final counts of stopped workers
+  Counts            progress_counts_;      // counts added to progress
+};
+
+#endif
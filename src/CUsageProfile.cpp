@@ -0,0 +1,87 @@
+#include <CUsageProfile.h>
+
+#ifdef CUSAGE_PROFILE
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sys/resource.h>
+
+CUsageProfile &
+CUsageProfile::
+instance()
+{
+  // never destroyed so it can be used by static destructors
+  static CUsageProfile *instance = new (malloc(sizeof(CUsageProfile))) CUsageProfile;
+
+  return *instance;
+}
+
+void
+CUsageProfile::
+print() const
+{
+  static const char *phase_names[] = {
+    "total", "opendir", "readdir", "stat/lstat", "link check", "where filter",
+    "regex match", "file type", "dir usage", "file lists", "duplicates", "output"
+  };
+
+  static const char *call_names[] = {
+    "opendir", "readdir(3)", "closedir", "stat", "lstat", "write"
+  };
+
+  double total_ns = double(phases_[int(CUsageProfilePhase::TOTAL)].ns.load());
+
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Profile :-\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "  %-12s %12s %7s %12s %10s\n", "Phase", "Time (s)", "%", "Count", "ns/Count");
+
+  for (int i = 0; i < int(CUsageProfilePhase::NUM_PHASES); ++i) {
+    double   ns    = double(phases_[i].ns.load());
+    uint64_t count = phases_[i].count.load();
+
+    if (i > 0 && count == 0) continue;
+
+    fprintf(stderr, "  %-12s %12.4f %6.1f%% %12lu %10.1f\n", phase_names[i], ns/1e9,
+            (total_ns > 0.0 ? 100.0*ns/total_ns : 0.0), (unsigned long) count,
+            (count > 0 ? ns/double(count) : 0.0));
+  }
+
+  fprintf(stderr, "\n");
+  fprintf(stderr, "  %-12s %12s\n", "System Call", "Count");
+
+  for (int i = 0; i < int(CUsageProfileCall::NUM_CALLS); ++i)
+    fprintf(stderr, "  %-12s %12lu\n", call_names[i], (unsigned long) calls_[i].load());
+
+  struct rusage usage;
+
+  long max_rss = 0;
+
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    max_rss = usage.ru_maxrss;
+
+  fprintf(stderr, "\n");
+  fprintf(stderr, "  %-12s %12ld KB\n", "Peak RSS", max_rss);
+  fprintf(stderr, "  %-12s %12lu (%lu bytes)\n", "Allocations",
+          (unsigned long) num_allocs_.load(), (unsigned long) alloc_bytes_.load());
+  fprintf(stderr, "  %-12s %12lu\n", "Frees", (unsigned long) num_frees_.load());
+}
+
+bool
+CUsageProfilePrint()
+{
+  CUsageProfile::instance().print();
+
+  return true;
+}
+
+#else
+
+bool
+CUsageProfilePrint()
+{
+  return false;
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef CUsageProfile_H
+#define CUsageProfile_H
+
+#include <string>
+
+// Scan phases timed by the profiler
+enum class CUsageProfilePhase {
+  TOTAL,
+  OPENDIR,
+  READDIR,
+  STAT,
+  LINK,
+  WHERE,
+  REGEX,
+  TYPE,
+  DIR_USAGE,
+  FILE_LISTS,
+  DUPLICATES,
+  OUTPUT,
+  NUM_PHASES
+};
+
+// System calls counted by the profiler
+enum class CUsageProfileCall {
+  OPENDIR,
+  READDIR,
+  CLOSEDIR,
+  STAT,
+  LSTAT,
+  WRITE,
+  NUM_CALLS
+};
+
+#ifdef CUSAGE_PROFILE
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+// Phase profiler.
+//
+// Only built when CUSAGE_PROFILE is defined (make PROFILE=1). Phase times are
+// accumulated from CLOCK_MONOTONIC timers, system calls are counted per kind and
+// allocations are counted by replacement global new/delete operators. The operators
+// are in the command line front end (CUsageProfileAlloc.cpp), not the library, so
+// allocations are only counted by programs which link them.
+class CUsageProfile {
+ public:
+  static CUsageProfile &instance();
+
+  static uint64_t now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return uint64_t(ts.tv_sec)*1000000000ULL + uint64_t(ts.tv_nsec);
+  }
+
+  void addTime(CUsageProfilePhase phase, uint64_t ns) {
+    auto &p = phases_[int(phase)];
+
+    p.ns   .fetch_add(ns, std::memory_order_relaxed);
+    p.count.fetch_add(1 , std::memory_order_relaxed);
+  }
+
+  void addCall(CUsageProfileCall call) {
+    calls_[int(call)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void addAlloc(size_t size) {
+    num_allocs_ .fetch_add(1   , std::memory_order_relaxed);
+    alloc_bytes_.fetch_add(size, std::memory_order_relaxed);
+  }
+
+  void addFree() {
+    num_frees_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void print() const;
+
+ private:
+  CUsageProfile() { }
+
+ private:
+  struct PhaseData {
+    std::atomic<uint64_t> ns    { 0 };
+    std::atomic<uint64_t> count { 0 };
+  };
+
+  PhaseData             phases_[int(CUsageProfilePhase::NUM_PHASES)];
+  std::atomic<uint64_t> calls_ [int(CUsageProfileCall ::NUM_CALLS )] { };
+  std::atomic<uint64_t> num_allocs_  { 0 };
+  std::atomic<uint64_t> alloc_bytes_ { 0 };
+  std::atomic<uint64_t> num_frees_   { 0 };
+};
+
+// Scoped phase timer
+class CUsageProfileTimer {
+ public:
+  CUsageProfileTimer(CUsageProfilePhase phase) :
+   phase_(phase), start_(CUsageProfile::now()) {
+  }
+
+ ~CUsageProfileTimer() {
+    CUsageProfile::instance().addTime(phase_, CUsageProfile::now() - start_);
+  }
+
+ private:
+  CUsageProfilePhase phase_;
+  uint64_t           start_ { 0 };
+};
+
+#define CUSAGE_PROFILE_CONCAT1(a, b) a##b
+#define CUSAGE_PROFILE_CONCAT(a, b) CUSAGE_PROFILE_CONCAT1(a, b)
+
+#define CUSAGE_PROFILE_PHASE(p) \
+  CUsageProfileTimer CUSAGE_PROFILE_CONCAT(profile_timer_, __LINE__)(CUsageProfilePhase::p)
+
+#define CUSAGE_PROFILE_CALL(c) \
+  CUsageProfile::instance().addCall(CUsageProfileCall::c)
+
+#define CUSAGE_PROFILE_ENABLED 1
+
+#else
+
+#define CUSAGE_PROFILE_PHASE(p)
+#define CUSAGE_PROFILE_CALL(c)
+
+#define CUSAGE_PROFILE_ENABLED 0
+
+#endif
+
+// Print profile report to stderr (returns false if not built with profiling)
+bool CUsageProfilePrint();
+
+#endif
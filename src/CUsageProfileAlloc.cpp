@@ -0,0 +1,59 @@
+#include <CUsageProfile.h>
+
+#ifdef CUSAGE_PROFILE
+
+#include <cstdlib>
+#include <new>
+
+// Replacement allocation functions counting allocations and frees for --profile. Only
+// linked into the command line programs (not libCUsage) so a profiling build of the
+// library never replaces the allocator of a program embedding it.
+
+void *
+operator new(size_t size)
+{
+  CUsageProfile::instance().addAlloc(size);
+
+  void *p = malloc(size ? size : 1);
+
+  if (! p)
+    throw std::bad_alloc();
+
+  return p;
+}
+
+void *
+operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void
+operator delete(void *p) noexcept
+{
+  if (! p) return;
+
+  CUsageProfile::instance().addFree();
+
+  free(p);
+}
+
+void
+operator delete[](void *p) noexcept
+{
+  operator delete(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+void
+operator delete[](void *p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+#endif
@@ -0,0 +1,236 @@
+#include <CUsageProgress.h>
+
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+
+CUsageProgress::
+CUsageProgress()
+{
+}
+
+CUsageProgress::
+~CUsageProgress()
+{
+  stop();
+}
+
+void
+CUsageProgress::
+start()
+{
+  if (running_)
+    return;
+
+  start_time_   = Clock::now();
+  last_time_    = start_time_;
+  last_entries_ = 0;
+  last_bytes_   = 0;
+
+  running_ = true;
+
+  thread_ = std::thread(&CUsageProgress::run, this);
+}
+
+// Stop ticker and output final counts.
+void
+CUsageProgress::
+stop()
+{
+  {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  if (! running_)
+    return;
+
+  running_ = false;
+  }
+
+  cond_.notify_all();
+
+  if (thread_.joinable())
+    thread_.join();
+
+  report(/*done*/true);
+}
+
+void
+CUsageProgress::
+startDir(const std::string &dirname)
+{
+  std::unique_lock<std::mutex> lock(dir_mutex_);
+
+  current_dir_ = dirname;
+}
+
+void
+CUsageProgress::
+endDir(uint thread, size_t num_pending)
+{
+  addDirs(thread, 1);
+
+  pending_dirs_.store(long(num_pending), std::memory_order_relaxed);
+}
+
+void
+CUsageProgress::
+run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (running_) {
+    cond_.wait_for(lock, std::chrono::seconds(interval_));
+
+    if (! running_)
+      break;
+
+    lock.unlock();
+
+    report(/*done*/false);
+
+    lock.lock();
+  }
+}
+
+void
+CUsageProgress::
+report(bool done)
+{
+  auto now = Clock::now();
+
+  Snapshot snapshot;
+
+  snapshot.elapsed      = std::chrono::duration<double>(now - start_time_).count();
+  snapshot.pending_dirs = pending_dirs_.load(std::memory_order_relaxed);
+  snapshot.done         = done;
+
+  // sum counters of all threads
+  for (const auto &counts : thread_counts_) {
+    snapshot.entries += counts.entries.load(std::memory_order_relaxed);
+    snapshot.bytes   += counts.bytes  .load(std::memory_order_relaxed);
+    snapshot.dirs    += counts.dirs   .load(std::memory_order_relaxed);
+  }
+
+  {
+  std::unique_lock<std::mutex> lock(dir_mutex_);
+
+  snapshot.current_dir = current_dir_;
+  }
+
+  // rate since last report (average over whole scan for final report)
+  double dt = std::chrono::duration<double>(now - last_time_).count();
+
+  if (done) {
+    dt            = snapshot.elapsed;
+    last_entries_ = 0;
+    last_bytes_   = 0;
+  }
+
+  if (dt > 0.0) {
+    snapshot.entry_rate = double(snapshot.entries - last_entries_)/dt;
+    snapshot.byte_rate  = double(snapshot.bytes   - last_bytes_  )/dt;
+  }
+
+  last_time_    = now;
+  last_entries_ = snapshot.entries;
+  last_bytes_   = snapshot.bytes;
+
+  if (show_)
+    printSnapshot(snapshot);
+
+  if (filename_ != "")
+    writeSnapshot(snapshot);
+
+  if (report_proc_)
+    report_proc_(snapshot.entries, snapshot.bytes, snapshot.dirs, snapshot.pending_dirs);
+}
+
+// Output progress line to stderr
+void
+CUsageProgress::
+printSnapshot(const Snapshot &snapshot) const
+{
+  static const char *units[] = { "B", "K", "M", "G", "T", "P" };
+
+  double bytes = double(snapshot.bytes);
+
+  uint iu = 0;
+
+  while (bytes >= 1024.0 && iu < 5) {
+    bytes /= 1024.0;
+
+    ++iu;
+  }
+
+  char buffer[256];
+
+  snprintf(buffer, sizeof(buffer),
+           "%s %8.1fs %12ld entries %10.0f/s %9.2f%s %8ld dirs %8ld pending  ",
+           (snapshot.done ? "Done    " : "Progress"), snapshot.elapsed, snapshot.entries,
+           snapshot.entry_rate, bytes, units[iu], snapshot.dirs, snapshot.pending_dirs);
+
+  std::cerr << buffer;
+
+  if (! snapshot.done)
+    std::cerr << snapshot.current_dir;
+
+  std::cerr << "\n";
+}
+
+// Write progress as JSON to stats file (via temporary file and rename so readers
+// never see a partial file)
+void
+CUsageProgress::
+writeSnapshot(const Snapshot &snapshot) const
+{
+  std::string tmpname = filename_ + ".tmp";
+
+  FILE *fp = fopen(tmpname.c_str(), "w");
+
+  if (! fp)
+    return;
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"time\": %ld,\n"             , long(time(nullptr)));
+  fprintf(fp, "  \"elapsed\": %.3f,\n"         , snapshot.elapsed);
+  fprintf(fp, "  \"entries\": %ld,\n"          , snapshot.entries);
+  fprintf(fp, "  \"entries_per_sec\": %.1f,\n" , snapshot.entry_rate);
+  fprintf(fp, "  \"bytes\": %ld,\n"            , snapshot.bytes);
+  fprintf(fp, "  \"bytes_per_sec\": %.1f,\n"   , snapshot.byte_rate);
+  fprintf(fp, "  \"dirs\": %ld,\n"             , snapshot.dirs);
+  fprintf(fp, "  \"dirs_pending\": %ld,\n"     , snapshot.pending_dirs);
+  fprintf(fp, "  \"current_dir\": %s,\n"       , jsonString(snapshot.current_dir).c_str());
+  fprintf(fp, "  \"done\": %s\n"               , (snapshot.done ? "true" : "false"));
+  fprintf(fp, "}\n");
+
+  fclose(fp);
+
+  (void) rename(tmpname.c_str(), filename_.c_str());
+}
+
+std::string
+CUsageProgress::
+jsonString(const std::string &str)
+{
+  std::string str1 = "\"";
+
+  for (auto c : str) {
+    if      (c == '"' ) str1 += "\\\"";
+    else if (c == '\\') str1 += "\\\\";
+    else if (c == '\n') str1 += "\\n";
+    else if (c == '\t') str1 += "\\t";
+    else if ((unsigned char) c < 0x20) {
+      char buffer[8];
+
+      snprintf(buffer, sizeof(buffer), "\\u%04x", uint((unsigned char) c));
+
+      str1 += buffer;
+    }
+    else
+      str1 += c;
+  }
+
+  str1 += "\"";
+
+  return str1;
+}
@@ -0,0 +1,126 @@
+#ifndef CUsageProgress_H
+#define CUsageProgress_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Live scan progress.
+//
+// Each scan thread updates its own counters (relaxed atomic adds once per batch of
+// entries and once per directory, in a cache line no other thread writes) plus a
+// locked update of the current directory once per directory. A background ticker
+// thread sums the counters of all threads and reports them once a second to stderr
+// and/or as JSON to a stats file and/or to a report proc (e.g. to publish the counts of
+// a worker process to its parent).
+class CUsageProgress {
+ public:
+  using ReportProc = std::function<void(long entries, long bytes, long dirs,
+                                        long pending_dirs)>;
+
+ public:
+  CUsageProgress();
+ ~CUsageProgress();
+
+  CUsageProgress(const CUsageProgress &) = delete;
+  CUsageProgress &operator=(const CUsageProgress &) = delete;
+
+  bool isShow() const { return show_; }
+  void setShow(bool b) { show_ = b; }
+
+  const std::string &filename() const { return filename_; }
+  void setFilename(const std::string &filename) { filename_ = filename; }
+
+  int interval() const { return interval_; }
+  void setInterval(int secs) { interval_ = std::max(secs, 1); }
+
+  void setReportProc(const ReportProc &proc) { report_proc_ = proc; }
+
+  void start();
+  void stop();
+
+  //---
+
+  // called by scan thread for each batch of entries (hot path)
+  void addEntries(uint thread, long num, size_t size) {
+    auto &counts = thread_counts_[thread % progress_max_threads];
+
+    counts.entries.fetch_add(num      , std::memory_order_relaxed);
+    counts.bytes  .fetch_add(long(size), std::memory_order_relaxed);
+  }
+
+  // called when the walker starts and finishes reading a directory
+  void startDir(const std::string &dirname);
+  void endDir(uint thread, size_t num_pending);
+
+  // add directories read (e.g. by worker processes)
+  void addDirs(uint thread, long num) {
+    auto &counts = thread_counts_[thread % progress_max_threads];
+
+    counts.dirs.fetch_add(num, std::memory_order_relaxed);
+  }
+
+  void setPendingDirs(size_t num_pending) {
+    pending_dirs_.store(long(num_pending), std::memory_order_relaxed);
+  }
+
+ private:
+  using Clock     = std::chrono::steady_clock;
+  using TimePoint = Clock::time_point;
+
+  // counter slots (threads beyond this share slots)
+  static const uint progress_max_threads = 64;
+
+  // counters of one thread (own cache line)
+  struct alignas(64) ThreadCounts {
+    std::atomic<long> entries { 0 };
+    std::atomic<long> bytes   { 0 };
+    std::atomic<long> dirs    { 0 };
+  };
+
+  struct Snapshot {
+    double      elapsed      { 0.0 };
+    long        entries      { 0 };
+    long        bytes        { 0 };
+    long        dirs         { 0 };
+    long        pending_dirs { 0 };
+    double      entry_rate   { 0.0 };
+    double      byte_rate    { 0.0 };
+    std::string current_dir;
+    bool        done         { false };
+  };
+
+  void run();
+
+  void report(bool done);
+
+  void printSnapshot(const Snapshot &snapshot) const;
+  void writeSnapshot(const Snapshot &snapshot) const;
+
+  static std::string jsonString(const std::string &str);
+
+ private:
+  bool              show_         { false };
+  std::string       filename_;
+  int               interval_     { 1 };
+  ReportProc        report_proc_;
+  ThreadCounts      thread_counts_[progress_max_threads];
+  std::atomic<long> pending_dirs_ { 0 };
+  std::mutex        dir_mutex_;
+  std::string       current_dir_;
+  std::thread       thread_;
+  std::mutex        mutex_;
+  std::condition_variable cond_;
+  bool              running_      { false };
+  TimePoint         start_time_;
+  TimePoint         last_time_;
+  long              last_entries_ { 0 };
+  long              last_bytes_   { 0 };
+};
+
+#endif
@@ -0,0 +1,678 @@
+#include <CUsageRank.h>
+#include <CUsageBinaryIO.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// records sorted with a comparison sort (radix passes cost more)
+const size_t rank_radix_min = 256;
+
+// records of smallest chunk sorted by its own thread
+const size_t rank_chunk_min = 65536;
+
+// bytes of a record's packed size, time and name length
+const size_t rank_data_header = sizeof(uint64_t) + sizeof(int64_t) + sizeof(uint32_t);
+
+// spilled runs of a level merged into one run of the next level
+const size_t rank_merge_fan_in = 16;
+
+}
+
+//------------
+
+// Parse range ('<from>-<to>', '<from>-', '-<to>' or '<rank>')
+bool
+CUsageRankRange::
+parse(const std::string &str, std::string &msg)
+{
+  from_ = Bound();
+  to_   = Bound();
+
+  auto pos = str.find('-');
+
+  bool ok = true;
+
+  // single rank number is that rank, single percentage the ranks up to it
+  if (pos == std::string::npos) {
+    ok = parseBound(str, to_);
+
+    if (ok && ! to_.percent)
+      from_ = to_;
+  }
+  else {
+    if (pos > 0)
+      ok = parseBound(str.substr(0, pos), from_);
+
+    if (ok && pos + 1 < str.size())
+      ok = parseBound(str.substr(pos + 1), to_);
+  }
+
+  if (! ok || (! from_.set && ! to_.set)) {
+    msg = "Invalid rank range \'" + str + "\'";
+    return false;
+  }
+
+  return true;
+}
+
+// Parse rank number (>= 1) or percentage (0-100 with '%' suffix)
+bool
+CUsageRankRange::
+parseBound(const std::string &str, Bound &bound)
+{
+  if (str == "")
+    return false;
+
+  char *end = nullptr;
+
+  double value = strtod(str.c_str(), &end);
+
+  bool percent = (*end == '%');
+
+  if (percent)
+    ++end;
+
+  if (*end != '\0')
+    return false;
+
+  if (percent) {
+    if (value < 0.0 || value > 100.0)
+      return false;
+  }
+  else {
+    if (value < 1.0 || value != std::floor(value))
+      return false;
+  }
+
+  bound.set     = true;
+  bound.value   = value;
+  bound.percent = percent;
+
+  return true;
+}
+
+// Rank of percentage bound (ranks below it) or rank number
+long
+CUsageRankRange::
+boundRank(const Bound &bound, long num)
+{
+  if (bound.percent)
+    return std::lround(double(num)*bound.value/100.0);
+
+  return long(bound.value);
+}
+
+void
+CUsageRankRange::
+getRanks(long num, long &first, long &last) const
+{
+  first = 1;
+  last  = num;
+
+  // percentage 'from' starts after the ranks below it so adjacent ranges don't overlap
+  if (from_.set)
+    first = (from_.percent ? boundRank(from_, num) + 1 : boundRank(from_, num));
+
+  if (to_.set)
+    last = std::min(boundRank(to_, num), num);
+}
+
+//------------
+
+// Cursor over sorted run (in memory or spilled) used by merge
+struct CUsageRankList::Cursor {
+  const Run*     run   { nullptr };
+  size_t         ind   { 0 };       // next record (memory run)
+  long           left  { 0 };       // records left (spilled run)
+  uint64_t       key   { 0 };
+  CUsageFileSpec file;              // current file (name only read when needed)
+  const Record*  record { nullptr }; // current record (memory run)
+  bool           failed { false };   // spilled run read failed
+
+  // advance to next record (false if none)
+  bool next() {
+    if (run->list) {
+      if (ind >= run->end)
+        return false;
+
+      record = &run->list->records_[ind++];
+
+      key = record->key;
+
+      return true;
+    }
+
+    if (left <= 0)
+      return false;
+
+    CUsageBinaryReader reader(run->fp);
+
+    key = reader.getInt();
+
+    file.size = size_t(reader.getInt());
+    file.time = time_t(reader.getInt());
+    file.name = reader.getString();
+
+    --left;
+
+    failed = ! reader.isOk();
+
+    return ! failed;
+  }
+
+  // get current file
+  void getFile(CUsageFileSpec &file1) const {
+    if (run->list)
+      run->list->getRecord(*record, file1);
+    else
+      file1 = file;
+  }
+};
+
+//------------
+
+CUsageRankList::
+CUsageRankList(CUsageRankKey key, size_t mem_limit, const std::string &tmp_dir) :
+ key_(key), mem_limit_(mem_limit), tmp_dir_(tmp_dir)
+{
+}
+
+CUsageRankList::
+~CUsageRankList()
+{
+  for (auto &run : spills_)
+    fclose(run.fp);
+}
+
+// Ascending key of rank order
+uint64_t
+CUsageRankList::
+makeKey(size_t size, time_t time) const
+{
+  // time with sign bit flipped sorts as unsigned
+  uint64_t time_key = uint64_t(int64_t(time)) ^ (uint64_t(1) << 63);
+
+  switch (key_) {
+    case CUsageRankKey::LARGEST : return ~uint64_t(size);
+    case CUsageRankKey::SMALLEST: return uint64_t(size);
+    case CUsageRankKey::OLDEST  : return time_key;
+    case CUsageRankKey::NEWEST  : return ~time_key;
+  }
+
+  return 0;
+}
+
+// Add file record (spilling the records if they exceed the memory limit)
+void
+CUsageRankList::
+add(const std::string &name, size_t size, time_t time)
+{
+  Record record;
+
+  record.key    = makeKey(size, time);
+  record.offset = data_.size();
+
+  uint64_t size1 = size;
+  int64_t  time1 = time;
+  uint32_t len   = uint32_t(name.size());
+
+  data_.resize(data_.size() + rank_data_header + len);
+
+  char *p = &data_[record.offset];
+
+  memcpy(p, &size1, sizeof(size1)); p += sizeof(size1);
+  memcpy(p, &time1, sizeof(time1)); p += sizeof(time1);
+  memcpy(p, &len  , sizeof(len  )); p += sizeof(len  );
+  memcpy(p, name.data(), len);
+
+  records_.push_back(record);
+
+  ++num_;
+
+  if (memUsed() >= mem_limit_ && isOk())
+    (void) spill();
+}
+
+// Add files of batch (entry indices) as add() does for each, but with the buffers
+// data buffer resized once and the memory limit checked once (after the batch)
+void
+CUsageRankList::
+addBatch(const CUsageEntryBatch &batch, const uint *inds, uint num_inds)
+{
+  if (num_inds == 0)
+    return;
+
+  size_t offset = data_.size();
+  size_t len    = 0;
+
+  for (uint j = 0; j < num_inds; ++j)
+    len += rank_data_header + batch.entries[inds[j]].filename.size();
+
+  data_.resize(offset + len);
+
+  for (uint j = 0; j < num_inds; ++j) {
+    uint i = inds[j];
+
+    const auto &name = batch.entries[i].filename;
+
+    Record record;
+
+    record.key    = makeKey(batch.sizes[i], batch.times[i]);
+    record.offset = offset;
+
+    uint64_t size1 = batch.sizes[i];
+    int64_t  time1 = batch.times[i];
+    uint32_t len1  = uint32_t(name.size());
+
+    char *p = &data_[offset];
+
+    memcpy(p, &size1, sizeof(size1)); p += sizeof(size1);
+    memcpy(p, &time1, sizeof(time1)); p += sizeof(time1);
+    memcpy(p, &len1 , sizeof(len1 )); p += sizeof(len1 );
+    memcpy(p, name.data(), len1);
+
+    offset += rank_data_header + len1;
+
+    records_.push_back(record);
+  }
+
+  num_ += num_inds;
+
+  if (memUsed() >= mem_limit_ && isOk())
+    (void) spill();
+}
+
+// Unpack record's size, time and name
+void
+CUsageRankList::
+getRecord(const Record &record, CUsageFileSpec &file) const
+{
+  const char *p = &data_[record.offset];
+
+  uint64_t size = 0;
+  int64_t  time = 0;
+  uint32_t len  = 0;
+
+  memcpy(&size, p, sizeof(size)); p += sizeof(size);
+  memcpy(&time, p, sizeof(time)); p += sizeof(time);
+  memcpy(&len , p, sizeof(len )); p += sizeof(len );
+
+  file.name.assign(p, len);
+  file.size = size_t(size);
+  file.time = time_t(time);
+}
+
+// Stable LSD radix sort of records on their 64 bit keys (8 bit digits). The digit
+// counts of all passes are made in one pass and passes whose digit is the same for
+// every record (e.g. the high bytes of sizes) are skipped.
+void
+CUsageRankList::
+sortRecords(Record *records, size_t n)
+{
+  if (n < rank_radix_min) {
+    std::stable_sort(records, records + n,
+      [](const Record &r1, const Record &r2) { return r1.key < r2.key; });
+    return;
+  }
+
+  std::vector<size_t> counts(8*256, 0);
+
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = records[i].key;
+
+    for (uint d = 0; d < 8; ++d)
+      ++counts[d*256 + ((key >> (8*d)) & 0xff)];
+  }
+
+  Records tmp(n);
+
+  Record *src = records;
+  Record *dst = tmp.data();
+
+  for (uint d = 0; d < 8; ++d) {
+    size_t *count = &counts[d*256];
+
+    if (count[(src[0].key >> (8*d)) & 0xff] == n)
+      continue;
+
+    size_t offset = 0;
+
+    for (uint b = 0; b < 256; ++b) {
+      size_t c = count[b];
+
+      count[b] = offset;
+
+      offset += c;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+      dst[count[(src[i].key >> (8*d)) & 0xff]++] = src[i];
+
+    std::swap(src, dst);
+  }
+
+  if (src != records)
+    std::copy(src, src + n, records);
+}
+
+// Create (unlinked) temporary file for a spilled run in the temporary directory (dir
+// is set to the directory used)
+FILE *
+CUsageRankList::
+createSpillFile(std::string &dir)
+{
+  dir = tmp_dir_;
+
+  if (dir == "") {
+    const char *env = getenv("TMPDIR");
+
+    dir = (env && *env ? env : "/tmp");
+  }
+
+  std::string path = dir + "/CUsageRankXXXXXX";
+
+  int fd = mkstemp(&path[0]);
+
+  FILE *fp = (fd >= 0 ? fdopen(fd, "w+b") : nullptr);
+
+  if (! fp) {
+    if (fd >= 0)
+      close(fd);
+
+    error_msg_ = "Failed to create ranked file spill in \'" + dir + "\'";
+
+    return nullptr;
+  }
+
+  // removed when closed
+  (void) unlink(path.c_str());
+
+  return fp;
+}
+
+// Sort records and write them (with their size, time and name) to a temporary file as
+// a sorted run, then release them
+bool
+CUsageRankList::
+spill()
+{
+  std::string dir;
+
+  FILE *fp = createSpillFile(dir);
+
+  if (! fp)
+    return false;
+
+  sortRecords(records_.data(), records_.size());
+
+  CUsageBinaryWriter writer(fp);
+
+  CUsageFileSpec file;
+
+  for (const auto &record : records_) {
+    getRecord(record, file);
+
+    writer.put(record.key);
+    writer.put(uint64_t(file.size));
+    writer.put(uint64_t(file.time));
+    writer.put(file.name);
+  }
+
+  if (! writer.isOk() || fflush(fp) != 0) {
+    fclose(fp);
+
+    error_msg_ = "Failed to write ranked file spill in \'" + dir + "\'";
+
+    return false;
+  }
+
+  Run run;
+
+  run.fp  = fp;
+  run.num = long(records_.size());
+
+  spills_.push_back(run);
+
+  // release buffers (their capacity counts against the memory limit)
+  Records          ().swap(records_);
+  std::vector<char>().swap(data_);
+
+  return mergeSpills();
+}
+
+// Merge the last rank_merge_fan_in spilled runs into one run of the next level while
+// they are all of the same level (runs are spilled in decreasing level order, so at
+// most rank_merge_fan_in - 1 runs of each level stay open)
+bool
+CUsageRankList::
+mergeSpills()
+{
+  while (spills_.size() >= rank_merge_fan_in) {
+    size_t begin = spills_.size() - rank_merge_fan_in;
+
+    uint level = spills_[begin].level;
+
+    if (spills_.back().level != level)
+      break;
+
+    std::string dir;
+
+    FILE *fp = createSpillFile(dir);
+
+    if (! fp)
+      return false;
+
+    CUsageBinaryWriter writer(fp);
+
+    std::vector<Cursor> cursors(rank_merge_fan_in);
+
+    using Entry = std::pair<uint64_t, size_t>; // key, cursor
+
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+
+    bool ok = true;
+
+    for (size_t i = 0; i < cursors.size(); ++i) {
+      auto &run = spills_[begin + i];
+
+      rewind(run.fp);
+
+      cursors[i].run  = &run;
+      cursors[i].left = run.num;
+
+      if      (cursors[i].next())
+        heap.emplace(cursors[i].key, i);
+      else if (cursors[i].failed)
+        ok = false;
+    }
+
+    Run run;
+
+    run.fp    = fp;
+    run.level = level + 1;
+
+    while (ok && ! heap.empty()) {
+      size_t i = heap.top().second;
+
+      heap.pop();
+
+      auto &cursor = cursors[i];
+
+      writer.put(cursor.key);
+      writer.put(uint64_t(cursor.file.size));
+      writer.put(uint64_t(cursor.file.time));
+      writer.put(cursor.file.name);
+
+      ++run.num;
+
+      if      (cursor.next())
+        heap.emplace(cursor.key, i);
+      else if (cursor.failed)
+        ok = false;
+    }
+
+    if (! ok || ! writer.isOk() || fflush(fp) != 0) {
+      fclose(fp);
+
+      error_msg_ = "Failed to merge ranked file spills in \'" + dir + "\'";
+
+      return false;
+    }
+
+    for (size_t i = begin; i < spills_.size(); ++i)
+      fclose(spills_[i].fp);
+
+    spills_.resize(begin);
+
+    spills_.push_back(run);
+  }
+
+  return true;
+}
+
+// Sort each list's records in chunks (one thread per chunk) and merge the chunks and
+// spilled runs of all lists, keeping the files in the rank range
+bool
+CUsageRankList::
+getRange(const Lists &lists, const CUsageRankRange &range, FileSpecs &files,
+         long &num_ranked, long &first_rank, std::string &msg)
+{
+  files.clear();
+
+  num_ranked = 0;
+  first_rank = 0;
+
+  for (const auto *list : lists) {
+    if (! list->isOk()) {
+      msg = list->errorMsg();
+      return false;
+    }
+
+    num_ranked += list->size();
+  }
+
+  long first = 0, last = 0;
+
+  range.getRanks(num_ranked, first, last);
+
+  if (first > last)
+    return true;
+
+  first_rank = first;
+
+  //------------
+
+  /* Split records in memory into chunks and sort them in parallel */
+
+  uint num_cpus = std::max(std::thread::hardware_concurrency(), 1U);
+
+  size_t num_records = 0;
+
+  for (const auto *list : lists)
+    num_records += list->records_.size();
+
+  size_t chunk_size = std::max(rank_chunk_min, (num_records + num_cpus - 1)/num_cpus);
+
+  Runs runs;
+
+  std::vector<std::pair<Record *, size_t>> chunks; // records and number to sort
+
+  for (auto *list : lists) {
+    size_t n = list->records_.size();
+
+    for (size_t begin = 0; begin < n; begin += chunk_size) {
+      Run run;
+
+      run.list  = list;
+      run.begin = begin;
+      run.end   = std::min(begin + chunk_size, n);
+
+      runs.push_back(run);
+
+      chunks.emplace_back(&list->records_[begin], run.end - run.begin);
+    }
+  }
+
+  if (chunks.size() > 1) {
+    std::vector<std::thread> threads;
+
+    for (const auto &chunk : chunks)
+      threads.emplace_back([chunk]() { sortRecords(chunk.first, chunk.second); });
+
+    for (auto &thread : threads)
+      thread.join();
+  }
+  else if (chunks.size() == 1)
+    sortRecords(chunks[0].first, chunks[0].second);
+
+  // spilled runs (read from start)
+  for (const auto *list : lists) {
+    for (const auto &run : list->spills_) {
+      rewind(run.fp);
+
+      runs.push_back(run);
+    }
+  }
+
+  //------------
+
+  /* Merge runs (smallest key first) until the last rank */
+
+  std::vector<Cursor> cursors(runs.size());
+
+  for (size_t i = 0; i < runs.size(); ++i) {
+    cursors[i].run  = &runs[i];
+    cursors[i].ind  = runs[i].begin;
+    cursors[i].left = runs[i].num;
+  }
+
+  using Entry = std::pair<uint64_t, size_t>; // key, cursor
+
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+
+  auto readFailed = [&]() {
+    msg = "Failed to read ranked file spill";
+    return false;
+  };
+
+  for (size_t i = 0; i < cursors.size(); ++i) {
+    if      (cursors[i].next())
+      heap.emplace(cursors[i].key, i);
+    else if (cursors[i].failed)
+      return readFailed();
+  }
+
+  long rank = 0;
+
+  while (! heap.empty() && rank < last) {
+    size_t i = heap.top().second;
+
+    heap.pop();
+
+    auto &cursor = cursors[i];
+
+    ++rank;
+
+    if (rank >= first) {
+      CUsageFileSpec file;
+
+      cursor.getFile(file);
+
+      files.push_back(file);
+    }
+
+    if      (cursor.next())
+      heap.emplace(cursor.key, i);
+    else if (cursor.failed)
+      return readFailed();
+  }
+
+  return true;
+}
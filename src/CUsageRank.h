@@ -0,0 +1,128 @@
+#ifndef CUsageRank_H
+#define CUsageRank_H
+
+#include <CUsageScan.h>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Rank range of a ranked listing.
+//
+// Parsed from '<from>-<to>', '<from>-', '-<to>' or '<rank>' where each rank is a rank
+// number (1 = first ranked file) or a percentage of the ranked files, e.g. '10000-20000'
+// or '-1%' (the first 1%, i.e. the files over the 99th percentile).
+class CUsageRankRange {
+ public:
+  bool parse(const std::string &str, std::string &msg);
+
+  // first and last rank (inclusive) of num ranked files (first > last if none)
+  void getRanks(long num, long &first, long &last) const;
+
+ private:
+  struct Bound {
+    bool   set     { false };
+    double value   { 0.0 };
+    bool   percent { false };
+  };
+
+  static bool parseBound(const std::string &str, Bound &bound);
+
+  static long boundRank(const Bound &bound, long num);
+
+  Bound from_;
+  Bound to_;
+};
+
+//---
+
+// Ranked file list.
+//
+// Collects a compact record (integer sort key and the offset of the file's size, time
+// and name in a packed buffer) of every file added by one scan thread. When the records
+// exceed the memory limit (counting the allocated capacity of its buffers) they are
+// sorted and spilled to an (unlinked) temporary file as a sorted run, and the buffers
+// are released. To bound the number of open spill files, once there are a fixed number
+// (fan-in) of runs of the same level they are merged into one run of the next level.
+//
+// The lists of all threads are combined by getRange() : the records still in memory are
+// radix sorted on their keys in chunks, one thread per chunk, and the sorted chunks and
+// spilled runs are k-way merged, keeping only the files in the rank range. Files with
+// the same key are ranked in an unspecified order.
+class CUsageRankList {
+ public:
+  using FileSpecs = CUsageScanResults::FileSpecs;
+  using Lists     = std::vector<CUsageRankList *>;
+
+ public:
+  CUsageRankList(CUsageRankKey key, size_t mem_limit, const std::string &tmp_dir);
+ ~CUsageRankList();
+
+  CUsageRankList(const CUsageRankList &) = delete;
+  CUsageRankList &operator=(const CUsageRankList &) = delete;
+
+  // number of files added
+  long size() const { return num_; }
+
+  void add(const std::string &name, size_t size, time_t time);
+
+  // add files of batch (entry indices) with one resize of the data buffer
+  void addBatch(const CUsageEntryBatch &batch, const uint *inds, uint num_inds);
+
+  // false if a spill failed
+  bool isOk() const { return error_msg_ == ""; }
+
+  const std::string &errorMsg() const { return error_msg_; }
+
+  // rank the files of all lists and return those in range (in rank order), the number
+  // of ranked files and the rank of the first returned file
+  static bool getRange(const Lists &lists, const CUsageRankRange &range, FileSpecs &files,
+                       long &num_ranked, long &first_rank, std::string &msg);
+
+ private:
+  // sort key and offset of size, time and name in data
+  struct Record {
+    uint64_t key    { 0 };
+    uint64_t offset { 0 };
+  };
+
+  // sorted run (records of list or spill file)
+  struct Run {
+    const CUsageRankList *list  { nullptr };
+    size_t                begin { 0 };
+    size_t                end   { 0 };
+    FILE*                 fp    { nullptr };
+    long                  num   { 0 };
+    uint                  level { 0 }; // number of merges (spilled run)
+  };
+
+  struct Cursor;
+
+  using Records = std::vector<Record>;
+  using Runs    = std::vector<Run>;
+
+  uint64_t makeKey(size_t size, time_t time) const;
+
+  size_t memUsed() const { return records_.capacity()*sizeof(Record) + data_.capacity(); }
+
+  void getRecord(const Record &record, CUsageFileSpec &file) const;
+
+  static void sortRecords(Record *records, size_t n);
+
+  FILE *createSpillFile(std::string &dir);
+
+  bool spill();
+
+  bool mergeSpills();
+
+  CUsageRankKey     key_       { CUsageRankKey::LARGEST };
+  size_t            mem_limit_ { 0 };
+  std::string       tmp_dir_;
+  Records           records_;
+  std::vector<char> data_;             // packed size, time, name length and name
+  Runs              spills_;           // spilled runs
+  long              num_       { 0 };
+  std::string       error_msg_;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef CUsageRingQueue_H
+#define CUsageRingQueue_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded lock free queue of pointers.
+//
+// A ring of cells, each with a sequence number which says whether it is free for the
+// producer or filled for the consumer at the current lap (D. Vyukov's bounded queue).
+// A producer claims the next enqueue position with a CAS and publishes the value by
+// advancing the cell's sequence (release), so any number of producers and consumers
+// can use it; the scan pipeline uses it multi producer/single consumer (walker threads
+// to the aggregator) and single producer/multi consumer (free batches back to the
+// walkers). Neither push nor pop ever blocks. The capacity is rounded up to a power
+// of 2.
+template<typename T>
+class CUsageRingQueue {
+ public:
+  explicit CUsageRingQueue(size_t capacity) {
+    size_t n = 2;
+
+    while (n < capacity)
+      n <<= 1;
+
+    cells_.reset(new Cell [n]);
+
+    mask_ = n - 1;
+
+    for (size_t i = 0; i < n; ++i)
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  CUsageRingQueue(const CUsageRingQueue &) = delete;
+  CUsageRingQueue &operator=(const CUsageRingQueue &) = delete;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // number of values queued (approximate while in use)
+  size_t size() const {
+    size_t enqueue_pos = enqueue_pos_.load(std::memory_order_relaxed);
+    size_t dequeue_pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+    return (enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0);
+  }
+
+  // add value (false if full)
+  bool push(T *value) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+    while (true) {
+      Cell &cell = cells_[pos & mask_];
+
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+
+      auto diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+
+      if      (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = value;
+
+          cell.seq.store(pos + 1, std::memory_order_release);
+
+          return true;
+        }
+      }
+      else if (diff < 0)
+        return false;
+      else
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  // remove oldest value (null if empty)
+  T *pop() {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+    while (true) {
+      Cell &cell = cells_[pos & mask_];
+
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+
+      auto diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+
+      if      (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          T *value = cell.value;
+
+          cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+
+          return value;
+        }
+      }
+      else if (diff < 0)
+        return nullptr;
+      else
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq   { 0 };
+    T*                  value { nullptr };
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t                  mask_ { 0 };
+
+  // positions on separate cache lines (written by producers and consumer)
+  alignas(64) std::atomic<size_t> enqueue_pos_ { 0 };
+  alignas(64) std::atomic<size_t> dequeue_pos_ { 0 };
+};
+
+#endif
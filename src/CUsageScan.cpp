@@ -0,0 +1,2173 @@
+#include <CUsageScan.h>
+#include <CUsageCheckpoint.h>
+#include <CUsagePathList.h>
+#include <CUsageProfile.h>
+#include <CUsageProgress.h>
+#include <CUsageRank.h>
+#include <CUsageRingQueue.h>
+#include <CFileUtil.h>
+#include <CRegExp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <unordered_map>
+
+namespace {
+
+// number of sample size buckets (zero size and one per power of 2)
+const uint num_sample_buckets = 65;
+
+// z value of 95% confidence interval
+const double sample_z = 1.96;
+
+// pipeline waits spin (yield) this many times before sleeping
+const int pipeline_spins = 64;
+
+// pipeline sleep when waited longer
+const auto pipeline_sleep = std::chrono::microseconds(50);
+
+// wait for other side of pipeline (spins then sleeps)
+void pipelineWait(int &spins) {
+  if (spins < pipeline_spins) {
+    ++spins;
+
+    std::this_thread::yield();
+  }
+  else
+    std::this_thread::sleep_for(pipeline_sleep);
+}
+
+// Remove later files with the same name from a sorted file list and trim it to num.
+// The lists of a resumed scan can hold a file twice (from the checkpoint and from
+// re-reading a directory which was being read when the checkpoint was written).
+void uniqueFileSpecs(CUsageScanResults::FileSpecs &files, uint num) {
+  std::set<std::string> names;
+
+  CUsageScanResults::FileSpecs files1;
+
+  for (auto &file : files) {
+    if (files1.size() >= num)
+      break;
+
+    if (names.insert(file.name).second)
+      files1.push_back(file);
+  }
+
+  files.swap(files1);
+}
+
+}
+
+CUsageScanData::
+CUsageScanData(const CUsageScanOptions &options, time_t current_time) :
+ options(options), current_time(current_time)
+{
+  // regular expressions are compiled per scan data (i.e. per thread) as matching
+  // may update state in the regexp object
+  if (options.match_pattern != "") {
+    match_regex = new CRegExp(options.match_pattern);
+
+    match_regex->setExtended(true);
+    match_regex->setMatchBOL(false);
+    match_regex->setMatchEOL(false);
+  }
+
+  if (options.no_match_pattern != "") {
+    no_match_regex = new CRegExp(options.no_match_pattern);
+
+    no_match_regex->setExtended(true);
+    no_match_regex->setMatchBOL(false);
+    no_match_regex->setMatchEOL(false);
+  }
+
+  // expression was checked by CUsageScan::checkOptions
+  if (options.where != "") {
+    std::string msg;
+
+    (void) where_filter.parse(options.where, current_time, msg);
+  }
+
+  if (options.cold_days >= 0)
+    cold_time = current_time - time_t(options.cold_days)*86400;
+
+  if (options.sample_fraction < 1.0 || options.sample_dir_fraction < 1.0) {
+    sample_buckets    .resize(num_sample_buckets);
+    sample_bucket_vars.resize(num_sample_buckets);
+  }
+}
+
+CUsageScanData::
+~CUsageScanData()
+{
+  for (auto &file : largest_file_list ) delete file;
+  for (auto &file : smallest_file_list) delete file;
+  for (auto &file : oldest_file_list  ) delete file;
+  for (auto &file : newest_file_list  ) delete file;
+  for (auto &file : cold_file_list    ) delete file;
+
+  delete match_regex;
+  delete no_match_regex;
+
+  delete rank_list;
+}
+
+void
+CUsageScanData::
+createRankList(size_t mem_limit)
+{
+  delete rank_list;
+
+  rank_list = new CUsageRankList(options.rank_key, mem_limit, options.rank_tmp_dir);
+}
+
+// Process a batch of entries (all from one directory) updating the total usage and the
+// largest, smallest, newest, oldest and cold file lists.
+//
+// One pass over the batch's arrays applies the filters, adds the directories and links
+// as they are found and selects the files (not older than specified days), summing
+// their sizes and collecting each file list's candidates, the files which beat the
+// list's last file at the start of the batch (a full list's threshold only gets tighter
+// as files are added so no file which would be added is skipped). Only the candidates
+// are then tried against the lists, and the cold, duplicate and ranked files are added
+// in bulk.
+void
+CUsageScanData::
+updateBatch(const CUsageEntryBatch &batch)
+{
+  enum { LARGEST, SMALLEST, OLDEST, NEWEST, COLD };
+
+  uint n = batch.size();
+
+  if (n == 0)
+    return;
+
+  const auto *sizes    = batch.sizes;
+  const auto *times    = batch.times;
+  const auto *modes    = batch.modes;
+  const auto *is_links = batch.is_links;
+
+  auto *parent = batch.parent;
+
+  parent->num_entries += n;
+
+  // where expression (not applied to directories)
+  bool where = ! where_filter.isEmpty();
+
+  if (where) {
+    CUSAGE_PROFILE_PHASE(WHERE);
+
+    where_filter.matchBatch(&batch.entries[0], n, batch_matches);
+  }
+
+  bool match_type   = (options.match_type != "");
+  bool name_filters = (match_regex || no_match_regex || match_type ||
+                       options.ignore_hidden);
+  bool check_days   = (options.num_days >= 0);
+
+  bool do_largest  = options.display_largest;
+  bool do_smallest = options.display_smallest;
+  bool do_oldest   = options.display_oldest;
+  bool do_newest   = options.display_newest;
+  bool do_cold     = (options.cold_days >= 0);
+
+  // list thresholds at start of batch (every file is a candidate of a list which is
+  // not full)
+  bool all_largest  = (largest_file_list .size() < options.num_largest );
+  bool all_smallest = (smallest_file_list.size() < options.num_smallest);
+  bool all_oldest   = (oldest_file_list  .size() < options.num_oldest  );
+  bool all_newest   = (newest_file_list  .size() < options.num_newest  );
+
+  size_t min_size = 0, max_size = 0;
+  time_t max_time = 0, min_time = 0;
+
+  if (do_largest  && ! all_largest ) min_size = largest_file_list .back()->size;
+  if (do_smallest && ! all_smallest) max_size = smallest_file_list.back()->size;
+  if (do_oldest   && ! all_oldest  ) max_time = oldest_file_list  .back()->time;
+  if (do_newest   && ! all_newest  ) min_time = newest_file_list  .back()->time;
+
+  time_t cold_time1 = cold_time;
+
+  auto *sel = batch_sel;
+
+  uint   num_sel      = 0;
+  uint   num_cands[5] = { 0, 0, 0, 0, 0 };
+  size_t sel_usage    = 0;
+
+  for (uint i = 0; i < n; ++i) {
+    bool is_dir = S_ISDIR(modes[i]);
+
+    if (where && ! is_dir && ! batch_matches[i])
+      continue;
+
+    if (name_filters) {
+      const auto &filename = batch.entries[i].filename;
+
+      if (! matchRegex(filename))
+        continue;
+
+      if (match_type && ! is_dir && ! matchType(filename.substr(batch.name_offsets[i])))
+        continue;
+
+      if (options.ignore_hidden && isHidden(filename))
+        continue;
+    }
+
+    // add directory
+    if (is_dir) {
+      addDir(batch.entries[i]);
+      continue;
+    }
+
+    // add link size but don't include in file lists
+    if (is_links[i]) {
+      addFileUsage(parent, size_t(batch.entries[i].link_stat.st_size));
+
+      ++num_files;
+
+      ++parent->num_files;
+
+      continue;
+    }
+
+    if (check_days && ! checkDays(batch.entries[i].stat.st_ctime))
+      continue;
+
+    // select file and add to candidates of each list (branch free)
+    size_t size = sizes[i];
+    time_t time = times[i];
+
+    sel[num_sel++] = i;
+
+    sel_usage += size;
+
+    if (do_largest) {
+      batch_cands[LARGEST][num_cands[LARGEST]] = i;
+
+      num_cands[LARGEST] += uint(all_largest | (size > min_size));
+    }
+
+    if (do_smallest) {
+      batch_cands[SMALLEST][num_cands[SMALLEST]] = i;
+
+      num_cands[SMALLEST] += uint(all_smallest | (size < max_size));
+    }
+
+    if (do_oldest) {
+      batch_cands[OLDEST][num_cands[OLDEST]] = i;
+
+      num_cands[OLDEST] += uint(all_oldest | (time < max_time));
+    }
+
+    if (do_newest) {
+      batch_cands[NEWEST][num_cands[NEWEST]] = i;
+
+      num_cands[NEWEST] += uint(all_newest | (time > min_time));
+    }
+
+    if (do_cold) {
+      batch_cands[COLD][num_cands[COLD]] = i;
+
+      num_cands[COLD] += uint(time < cold_time1);
+    }
+  }
+
+  if (num_sel == 0)
+    return;
+
+  //------------
+
+  // Update Totals for Ordinary Files
+  total_usage += sel_usage;
+  num_files   += num_sel;
+
+  parent->size       += sel_usage;
+  parent->num_usages += num_sel;
+  parent->num_files  += num_sel;
+
+  // Add Duplicate Candidates
+  if (options.display_dups)
+    addDupFiles(batch, sel, num_sel);
+
+  CUSAGE_PROFILE_PHASE(FILE_LISTS);
+
+  // Add Ranked Files
+  if (rank_list)
+    rank_list->addBatch(batch, sel, num_sel);
+
+  // Update Cold Files
+  if (do_cold)
+    addColdFiles(batch, batch_cands[COLD], num_cands[COLD]);
+
+  // Update Largest, Smallest, Oldest and Newest Files
+  if (do_largest)
+    addListFiles(CUsageRankKey::LARGEST, batch, batch_cands[LARGEST], num_cands[LARGEST]);
+
+  if (do_smallest)
+    addListFiles(CUsageRankKey::SMALLEST, batch, batch_cands[SMALLEST],
+                 num_cands[SMALLEST]);
+
+  if (do_oldest)
+    addListFiles(CUsageRankKey::OLDEST, batch, batch_cands[OLDEST], num_cands[OLDEST]);
+
+  if (do_newest)
+    addListFiles(CUsageRankKey::NEWEST, batch, batch_cands[NEWEST], num_cands[NEWEST]);
+}
+
+// Check filename against match and no match regular expressions
+bool
+CUsageScanData::
+matchRegex(const std::string &filename)
+{
+  if (match_regex == nullptr && no_match_regex == nullptr)
+    return true;
+
+  CUSAGE_PROFILE_PHASE(REGEX);
+
+  if (   match_regex != nullptr &&  ! match_regex->find(filename))
+    return false;
+
+  if (no_match_regex != nullptr && no_match_regex->find(filename))
+    return false;
+
+  return true;
+}
+
+// Check type of file (from its name) matches the match type
+bool
+CUsageScanData::
+matchType(const std::string &name) const
+{
+  CFileType file_type;
+
+  {
+  CUSAGE_PROFILE_PHASE(TYPE);
+
+  file_type = CFileUtil::getType(name);
+  }
+
+  if (options.match_type == "exe")
+    return (file_type & CFILE_TYPE_APP_EXEC);
+
+  if (options.match_type == "elf")
+    return (file_type & CFILE_TYPE_BIN && file_type & CFILE_TYPE_EXEC);
+
+  if (options.match_type == "image")
+    return (file_type & CFILE_TYPE_IMAGE);
+
+  if (options.match_type == "core")
+    return (file_type == CFILE_TYPE_APP_CORE);
+
+  return false;
+}
+
+// Check if any file or directory of path (after a '/') is hidden
+bool
+CUsageScanData::
+isHidden(const std::string &filename)
+{
+  auto pos = filename.rfind('/');
+
+  while (pos != std::string::npos) {
+    if (filename[pos + 1] == '.')
+      return true;
+
+    pos = (pos > 0 ? filename.rfind('/', pos - 1) : std::string::npos);
+  }
+
+  return false;
+}
+
+// Check file's change time against specified days
+bool
+CUsageScanData::
+checkDays(time_t ctime) const
+{
+  if (options.num_days < 0)
+    return true;
+
+  double cmp = difftime(current_time, ctime);
+
+  int num_days1 = int(cmp/86400);
+
+  if (! options.reverse)
+    return (num_days1 <= options.num_days);
+  else
+    return (num_days1 >= options.num_days);
+}
+
+// Add directory entry's size (link size if it is a link) and count it
+void
+CUsageScanData::
+addDir(const CUsageDirEntry &entry)
+{
+  // If link add link size and set link directory ...
+  if (entry.is_link)
+    addFileUsage(entry.parent, size_t(entry.link_stat.st_size));
+
+  // ... otherwise add directory node list size
+  else
+    addDirFileUsage(entry.node, size_t(entry.stat.st_size));
+
+  ++num_dirs;
+
+  ++entry.parent->num_dirs;
+}
+
+// Add regular files of batch (entry indices) as duplicate candidates
+void
+CUsageScanData::
+addDupFiles(const CUsageEntryBatch &batch, const uint *inds, uint num_inds)
+{
+  for (uint j = 0; j < num_inds; ++j) {
+    uint i = inds[j];
+
+    if (! S_ISREG(batch.modes[i]))
+      continue;
+
+    const auto &entry = batch.entries[i];
+
+    dup_files.emplace_back();
+
+    auto &dup_file = dup_files.back();
+
+    dup_file.name = entry.filename;
+    dup_file.size = batch.sizes[i];
+    dup_file.dev  = entry.stat.st_dev;
+    dup_file.ino  = entry.stat.st_ino;
+  }
+}
+
+// Add cold files of batch (entry indices, date type time older than cold days) to the
+// cold bytes of their directory and owner and to the cold file list (largest). The
+// totals are added once and consecutive files of the same owner (the common case in one
+// directory) share its lookup.
+void
+CUsageScanData::
+addColdFiles(const CUsageEntryBatch &batch, const uint *inds, uint num_inds)
+{
+  if (num_inds == 0)
+    return;
+
+  size_t           size_sum = 0;
+  CUsageColdOwner *owner    = nullptr;
+
+  for (uint j = 0; j < num_inds; ++j) {
+    uint i = inds[j];
+
+    size_t size = batch.sizes[i];
+    uid_t  uid  = batch.entries[i].stat.st_uid;
+
+    size_sum += size;
+
+    if (! owner || owner->uid != uid) {
+      owner = &cold_owners[uid];
+
+      owner->uid = uid;
+    }
+
+    owner->size      += size;
+    owner->num_files += 1;
+
+    if (cold_file_list.size() < options.num_cold || size > cold_file_list.back()->size)
+      addFileSpec(cold_file_list, options.num_cold, batch.entries[i].filename, size,
+                  batch.times[i], &CUsageScanData::addColdFileSpec);
+  }
+
+  cold_usage     += size_sum;
+  num_cold_files += num_inds;
+
+  batch.parent->cold_size      += size_sum;
+  batch.parent->num_cold_files += num_inds;
+}
+
+// Add candidate files of batch (entry indices) to the key's file list, each if the list
+// is not full or it beats the list's (current) last file
+void
+CUsageScanData::
+addListFiles(CUsageRankKey key, const CUsageEntryBatch &batch, const uint *inds,
+             uint num_inds)
+{
+  for (uint j = 0; j < num_inds; ++j) {
+    uint i = inds[j];
+
+    size_t size = batch.sizes[i];
+    time_t time = batch.times[i];
+
+    bool add = false;
+
+    switch (key) {
+      case CUsageRankKey::LARGEST:
+        add = (largest_file_list.size() < options.num_largest ||
+               size > largest_file_list.back()->size);
+        break;
+      case CUsageRankKey::SMALLEST:
+        add = (smallest_file_list.size() < options.num_smallest ||
+               size < smallest_file_list.back()->size);
+        break;
+      case CUsageRankKey::OLDEST:
+        add = (oldest_file_list.size() < options.num_oldest ||
+               time < oldest_file_list.back()->time);
+        break;
+      case CUsageRankKey::NEWEST:
+        add = (newest_file_list.size() < options.num_newest ||
+               time > newest_file_list.back()->time);
+        break;
+    }
+
+    if (add)
+      addListFile(key, batch.entries[i].filename, size, time);
+  }
+}
+
+void
+CUsageScanData::
+addListFile(CUsageRankKey key, const std::string &filename, size_t size, time_t time)
+{
+  switch (key) {
+    case CUsageRankKey::LARGEST:
+      addFileSpec(largest_file_list, options.num_largest, filename, size, time,
+                  &CUsageScanData::addLargestFileSpec);
+      break;
+    case CUsageRankKey::SMALLEST:
+      addFileSpec(smallest_file_list, options.num_smallest, filename, size, time,
+                  &CUsageScanData::addSmallestFileSpec);
+      break;
+    case CUsageRankKey::OLDEST:
+      addFileSpec(oldest_file_list, options.num_oldest, filename, size, time,
+                  &CUsageScanData::addOldestFileSpec);
+      break;
+    case CUsageRankKey::NEWEST:
+      addFileSpec(newest_file_list, options.num_newest, filename, size, time,
+                  &CUsageScanData::addNewestFileSpec);
+      break;
+  }
+}
+
+// Add new file spec to sorted list, removing the list's last file if it is full
+void
+CUsageScanData::
+addFileSpec(FileSpecList &list, uint num, const std::string &filename, size_t size,
+            time_t time, void (CUsageScanData::*addProc)(CUsageFileSpec *))
+{
+  if (list.size() >= num) {
+    delete list.back();
+
+    list.pop_back();
+  }
+
+  auto *file_spec = new CUsageFileSpec;
+
+  file_spec->name = filename;
+  file_spec->size = size;
+  file_spec->time = time;
+
+  (this->*addProc)(file_spec);
+}
+
+// Update estimates for entry in sample (sample mode).
+//
+// Each sampled file stands for 1/p files of its directory (Horvitz-Thompson) so its
+// size is added to the directory's estimated usage scaled by 1/p, with its variance
+// term for Bernoulli sampling. Scaling for sampled sub directories is applied when
+// the tree is rolled up. The size distribution is estimated directly with each file's
+// overall inclusion probability.
+void
+CUsageScanData::
+updateSample(const CUsageDirEntry &entry)
+{
+  auto *dir = entry.parent;
+
+  ++dir->num_entries;
+
+  if (entry.type == CUsageEntryType::DIR) {
+    addDirFileUsage(entry.node, size_t(entry.stat.st_size));
+
+    ++num_dirs;
+
+    ++dir->num_dirs;
+
+    return;
+  }
+
+  const auto *link_stat = entry.getLinkStat();
+
+  size_t size = size_t(link_stat ? link_stat->st_size : entry.stat.st_size);
+
+  double p  = options.sample_fraction;
+  double ds = double(size);
+
+  dir->sample_size += ds/p;
+  dir->sample_var  += (1.0 - p)*ds*ds/(p*p);
+
+  ++dir->num_files;
+
+  ++num_files;
+
+  total_usage += size;
+
+  // inclusion probability is p times sub directory fraction for each level below root
+  double pi = p*std::pow(options.sample_dir_fraction, dir->depth);
+
+  uint b = 0;
+
+  while (b < 64 && (size >> b) != 0)
+    ++b;
+
+  sample_buckets    [b] += 1.0/pi;
+  sample_bucket_vars[b] += (1.0 - pi)/(pi*pi);
+}
+
+struct IsLargerFileSpec {
+  CUsageFileSpec *spec_;
+
+  IsLargerFileSpec(CUsageFileSpec *spec) :
+   spec_(spec) {
+  }
+
+  bool operator()(CUsageFileSpec *spec) {
+    return (spec_->size > spec->size);
+  }
+};
+
+struct IsSmallerFileSpec {
+  CUsageFileSpec *spec_;
+
+  IsSmallerFileSpec(CUsageFileSpec *spec) :
+   spec_(spec) {
+  }
+
+  bool operator()(CUsageFileSpec *spec) {
+    return (spec_->size < spec->size);
+  }
+};
+
+struct IsOlderFileSpec {
+  CUsageFileSpec *spec_;
+
+  IsOlderFileSpec(CUsageFileSpec *spec) :
+   spec_(spec) {
+  }
+
+  bool operator()(CUsageFileSpec *spec) {
+    return (spec_->time < spec->time);
+  }
+};
+
+struct IsNewerFileSpec {
+  CUsageFileSpec *spec_;
+
+  IsNewerFileSpec(CUsageFileSpec *spec) :
+   spec_(spec) {
+  }
+
+  bool operator()(CUsageFileSpec *spec) {
+    return (spec_->time > spec->time);
+  }
+};
+
+void
+CUsageScanData::
+addLargestFileSpec(CUsageFileSpec *file_spec)
+{
+  auto p = find_if(largest_file_list.begin(), largest_file_list.end(),
+                   IsLargerFileSpec(file_spec));
+
+  if (p != largest_file_list.end())
+    largest_file_list.insert(p, file_spec);
+  else
+    largest_file_list.push_back(file_spec);
+}
+
+void
+CUsageScanData::
+addSmallestFileSpec(CUsageFileSpec *file_spec)
+{
+  auto p = find_if(smallest_file_list.begin(), smallest_file_list.end(),
+                   IsSmallerFileSpec(file_spec));
+
+  if (p != smallest_file_list.end())
+    smallest_file_list.insert(p, file_spec);
+  else
+    smallest_file_list.push_back(file_spec);
+}
+
+void
+CUsageScanData::
+addOldestFileSpec(CUsageFileSpec *file_spec)
+{
+  auto p = find_if(oldest_file_list.begin(), oldest_file_list.end(),
+                   IsOlderFileSpec(file_spec));
+
+  if (p != oldest_file_list.end())
+    oldest_file_list.insert(p, file_spec);
+  else
+    oldest_file_list.push_back(file_spec);
+}
+
+void
+CUsageScanData::
+addNewestFileSpec(CUsageFileSpec *file_spec)
+{
+  auto p = find_if(newest_file_list.begin(), newest_file_list.end(),
+                   IsNewerFileSpec(file_spec));
+
+  if (p != newest_file_list.end())
+    newest_file_list.insert(p, file_spec);
+  else
+    newest_file_list.push_back(file_spec);
+}
+
+void
+CUsageScanData::
+addColdFileSpec(CUsageFileSpec *file_spec)
+{
+  auto p = find_if(cold_file_list.begin(), cold_file_list.end(),
+                   IsLargerFileSpec(file_spec));
+
+  if (p != cold_file_list.end())
+    cold_file_list.insert(p, file_spec);
+  else
+    cold_file_list.push_back(file_spec);
+}
+
+// Add directory's own size to total (and its node's total), not to directory usages
+void
+CUsageScanData::
+addDirFileUsage(CUsageDirNode *node, size_t size)
+{
+  if (node)
+    node->dir_size += size;
+
+  total_usage += size;
+}
+
+// Add file size to total and to the usage of the directory containing it
+void
+CUsageScanData::
+addFileUsage(CUsageDirNode *dir, size_t size)
+{
+  if (dir) {
+    dir->size += size;
+
+    ++dir->num_usages;
+  }
+
+  total_usage += size;
+}
+
+// Get the required file date dependant on whether the user wishes to see Access,
+// Modified or Changed time.
+//
+// Uses the option 'date_type' to determine which time to return.
+time_t
+CUsageScanData::
+statTime(const struct stat *stat) const
+{
+  if      (options.date_type == CUsageDateType::LAST_ACCESSED)
+    return stat->st_atime;
+  else if (options.date_type == CUsageDateType::LAST_MODIFIED)
+    return stat->st_mtime;
+  else if (options.date_type == CUsageDateType::LAST_CHANGED)
+    return stat->st_ctime;
+  else
+    return stat->st_atime;
+}
+
+// Merge data from another scan thread into this one. The other data's file specs
+// are moved (or freed) so it is left empty.
+void
+CUsageScanData::
+merge(CUsageScanData &data)
+{
+  total_usage += data.total_usage;
+  num_files   += data.num_files;
+  num_dirs    += data.num_dirs;
+
+  data.total_usage = 0;
+  data.num_files   = 0;
+  data.num_dirs    = 0;
+
+  for (size_t i = 0; i < sample_buckets.size() && i < data.sample_buckets.size(); ++i) {
+    sample_buckets    [i] += data.sample_buckets    [i];
+    sample_bucket_vars[i] += data.sample_bucket_vars[i];
+
+    data.sample_buckets    [i] = 0.0;
+    data.sample_bucket_vars[i] = 0.0;
+  }
+
+  dup_files.insert(dup_files.end(), std::make_move_iterator(data.dup_files.begin()),
+                   std::make_move_iterator(data.dup_files.end()));
+
+  data.dup_files.clear();
+
+  cold_usage     += data.cold_usage;
+  num_cold_files += data.num_cold_files;
+
+  data.cold_usage     = 0;
+  data.num_cold_files = 0;
+
+  for (const auto &owner : data.cold_owners) {
+    auto &owner1 = cold_owners[owner.first];
+
+    owner1.uid        = owner.first;
+    owner1.size      += owner.second.size;
+    owner1.num_files += owner.second.num_files;
+  }
+
+  data.cold_owners.clear();
+
+  mergeFileSpecs(largest_file_list , options.num_largest , data.largest_file_list ,
+                 &CUsageScanData::addLargestFileSpec);
+  mergeFileSpecs(smallest_file_list, options.num_smallest, data.smallest_file_list,
+                 &CUsageScanData::addSmallestFileSpec);
+  mergeFileSpecs(oldest_file_list  , options.num_oldest  , data.oldest_file_list  ,
+                 &CUsageScanData::addOldestFileSpec);
+  mergeFileSpecs(newest_file_list  , options.num_newest  , data.newest_file_list  ,
+                 &CUsageScanData::addNewestFileSpec);
+  mergeFileSpecs(cold_file_list    , options.num_cold    , data.cold_file_list    ,
+                 &CUsageScanData::addColdFileSpec);
+}
+
+// Add the file specs of list1 to the (sorted) list and trim it to the maximum size
+void
+CUsageScanData::
+mergeFileSpecs(FileSpecList &list, uint num, FileSpecList &list1,
+               void (CUsageScanData::*addProc)(CUsageFileSpec *))
+{
+  for (auto &file_spec : list1)
+    (this->*addProc)(file_spec);
+
+  list1.clear();
+
+  while (list.size() > num) {
+    delete list.back();
+
+    list.pop_back();
+  }
+}
+
+// Copy totals and file lists to results
+void
+CUsageScanData::
+getResults(CUsageScanResults &results) const
+{
+  results.total_usage = total_usage;
+  results.num_files   = num_files;
+  results.num_dirs    = num_dirs;
+
+  results.largest_files .clear();
+  results.smallest_files.clear();
+  results.oldest_files  .clear();
+  results.newest_files  .clear();
+
+  for (const auto &file : largest_file_list ) results.largest_files .push_back(*file);
+  for (const auto &file : smallest_file_list) results.smallest_files.push_back(*file);
+  for (const auto &file : oldest_file_list  ) results.oldest_files  .push_back(*file);
+  for (const auto &file : newest_file_list  ) results.newest_files  .push_back(*file);
+
+  results.cold_files .clear();
+  results.cold_owners.clear();
+
+  for (const auto &file : cold_file_list) results.cold_files.push_back(*file);
+
+  for (const auto &owner : cold_owners)
+    results.cold_owners.push_back(owner.second);
+
+  // most cold bytes first (then uid)
+  std::stable_sort(results.cold_owners.begin(), results.cold_owners.end(),
+                   [](const CUsageColdOwner &owner1, const CUsageColdOwner &owner2) {
+                     return (owner1.size > owner2.size);
+                   });
+
+  results.cold_usage     = cold_usage;
+  results.num_cold_files = num_cold_files;
+
+  results.sample.size_buckets.clear();
+
+  for (uint i = 0; i < sample_buckets.size(); ++i) {
+    if (sample_buckets[i] <= 0.0)
+      continue;
+
+    CUsageSampleBucket bucket;
+
+    bucket.min_size        = (i > 0 ? size_t(1) << (i - 1) : 0);
+    bucket.max_size        = (i == 0 ? 1 : (i < 64 ? size_t(1) << i : SIZE_MAX));
+    bucket.num_files.value = sample_buckets[i];
+    bucket.num_files.error = sample_z*std::sqrt(sample_bucket_vars[i]);
+
+    results.sample.size_buckets.push_back(bucket);
+  }
+}
+
+// Set totals and add file lists from results (e.g. of a checkpoint)
+void
+CUsageScanData::
+setResults(const CUsageScanResults &results)
+{
+  total_usage = results.total_usage;
+  num_files   = results.num_files;
+  num_dirs    = results.num_dirs;
+
+  auto addFileSpecs = [&](const CUsageScanResults::FileSpecs &files,
+                          void (CUsageScanData::*addProc)(CUsageFileSpec *)) {
+    for (const auto &file : files)
+      (this->*addProc)(new CUsageFileSpec(file));
+  };
+
+  addFileSpecs(results.largest_files , &CUsageScanData::addLargestFileSpec );
+  addFileSpecs(results.smallest_files, &CUsageScanData::addSmallestFileSpec);
+  addFileSpecs(results.oldest_files  , &CUsageScanData::addOldestFileSpec  );
+  addFileSpecs(results.newest_files  , &CUsageScanData::addNewestFileSpec  );
+}
+
+bool
+CUsageDirUsageCmp::
+operator()(const CUsageDirUsage &dir_usage1, const CUsageDirUsage &dir_usage2)
+{
+  return (dir_usage1.size > dir_usage2.size);
+}
+
+//------------
+
+// Pipeline of batches from walker threads to aggregator thread. Full batches are queued
+// to the aggregator and emptied ones returned through the free queue, so the number of
+// batches (and memory) is fixed by the depth.
+struct CUsageScan::Pipeline {
+  using BatchQueue = CUsageRingQueue<CUsageEntryBatch>;
+  using Batches    = std::vector<std::unique_ptr<CUsageEntryBatch>>;
+
+  Pipeline(uint depth) :
+   full_queue(depth), free_queue(depth) {
+    for (uint i = 0; i < depth; ++i) {
+      batches.push_back(std::make_unique<CUsageEntryBatch>());
+
+      (void) free_queue.push(batches.back().get());
+    }
+  }
+
+  BatchQueue          full_queue;
+  BatchQueue          free_queue;
+  Batches             batches;
+  std::thread         thread;
+  std::atomic<bool>   done             { false };
+
+  std::atomic<long>   num_batches      { 0 };
+  std::atomic<long>   num_entries      { 0 };
+  std::atomic<size_t> max_depth        { 0 };
+  std::atomic<long>   depth_sum        { 0 };
+  std::atomic<long>   walker_stalls    { 0 };
+  long                aggregator_waits { 0 }; // only used by aggregator
+};
+
+//------------
+
+CUsageScan::
+CUsageScan(const CUsageScanOptions &options) :
+ options_(options)
+{
+}
+
+CUsageScan::
+~CUsageScan()
+{
+  clearData();
+}
+
+// Check options are valid (returns false with error message if not)
+bool
+CUsageScan::
+checkOptions(std::string &msg) const
+{
+  auto checkNum = [&](uint num, const char *name) {
+    if (num <= 0 || num > MAX_NUM_FILES) {
+      msg = "Invalid value for number of " + std::string(name) + " files - " +
+            std::to_string(num);
+      return false;
+    }
+
+    return true;
+  };
+
+  if (! checkNum(options_.num_largest , "largest" )) return false;
+  if (! checkNum(options_.num_smallest, "smallest")) return false;
+  if (! checkNum(options_.num_oldest  , "oldest"  )) return false;
+  if (! checkNum(options_.num_newest  , "newest"  )) return false;
+  if (! checkNum(options_.num_cold    , "cold"    )) return false;
+
+  if (options_.num_dir_times <= 0 || options_.num_dir_times > MAX_NUM_FILES) {
+    msg = "Invalid value for number of directories - " +
+          std::to_string(options_.num_dir_times);
+    return false;
+  }
+
+  if (options_.num_inode_dirs <= 0 || options_.num_inode_dirs > MAX_NUM_FILES) {
+    msg = "Invalid value for number of inode directories - " +
+          std::to_string(options_.num_inode_dirs);
+    return false;
+  }
+
+  if (options_.num_dups <= 0 || options_.num_dups > MAX_NUM_FILES) {
+    msg = "Invalid value for number of duplicate groups - " +
+          std::to_string(options_.num_dups);
+    return false;
+  }
+
+  if (options_.num_threads <= 0) {
+    msg = "Invalid number of threads - " + std::to_string(options_.num_threads);
+    return false;
+  }
+
+  if (options_.checkpoint_interval <= 0) {
+    msg = "Invalid checkpoint interval - " + std::to_string(options_.checkpoint_interval);
+    return false;
+  }
+
+  if (options_.sample_fraction     <= 0.0 || options_.sample_fraction     > 1.0 ||
+      options_.sample_dir_fraction <= 0.0 || options_.sample_dir_fraction > 1.0) {
+    msg = "Invalid sample fraction (must be > 0 and <= 1)";
+    return false;
+  }
+
+  if (options_.pipeline_depth > MAX_PIPELINE_DEPTH) {
+    msg = "Invalid pipeline depth - " + std::to_string(options_.pipeline_depth);
+    return false;
+  }
+
+  // checkpoint cut would include directories whose batches are still queued
+  if (options_.pipeline_depth > 0 &&
+      (options_.checkpoint_file != "" || options_.resume_file != "")) {
+    msg = "Checkpoints can't be used with pipeline mode";
+    return false;
+  }
+
+  if (options_.rank_range != "") {
+    CUsageRankRange range;
+
+    if (! range.parse(options_.rank_range, msg))
+      return false;
+
+    if (options_.rank_mem_limit < MIN_RANK_MEM_LIMIT) {
+      msg = "Invalid ranked listing memory limit - " +
+            std::to_string(options_.rank_mem_limit);
+      return false;
+    }
+
+    // records of every file are not saved in checkpoints
+    if (options_.checkpoint_file != "" || options_.resume_file != "") {
+      msg = "Ranked listings can't be used with checkpoints";
+      return false;
+    }
+  }
+
+  // directories walked through links are not saved in checkpoints
+  if (options_.follow_links && (options_.checkpoint_file != "" || options_.resume_file != "")) {
+    msg = "Following links can't be used with checkpoints";
+    return false;
+  }
+
+  // list paths are stat'ed, not walked from the directory
+  if (options_.from_list != "") {
+    if (options_.checkpoint_file != "" || options_.resume_file != "") {
+      msg = "File lists can't be used with checkpoints";
+      return false;
+    }
+
+    if (options_.one_file_system) {
+      msg = "File lists can't be used with one file system mode";
+      return false;
+    }
+  }
+
+  if (options_.where != "") {
+    CUsageFilter filter;
+
+    if (! filter.parse(options_.where, time(nullptr), msg))
+      return false;
+  }
+
+  // duplicate candidates (every file) are not saved in checkpoints
+  if (options_.display_dups && (options_.checkpoint_file != "" || options_.resume_file != "")) {
+    msg = "Duplicate files can't be used with checkpoints";
+    return false;
+  }
+
+  // cold directory and owner totals are not saved in checkpoints
+  if (options_.cold_days >= 0 && (options_.checkpoint_file != "" || options_.resume_file != "")) {
+    msg = "Cold files can't be used with checkpoints";
+    return false;
+  }
+
+  if (isSample()) {
+    // only totals can be estimated from a sample
+    if (options_.display_largest || options_.display_smallest || options_.display_oldest ||
+        options_.display_newest  || options_.display_dups || options_.cold_days >= 0 ||
+        options_.rank_range != "" || needDirResults()) {
+      msg = "Sample mode can't be used with file lists or directory results";
+      return false;
+    }
+
+    if (options_.match_pattern != "" || options_.no_match_pattern != "" ||
+        options_.match_type != "" || options_.where != "" || options_.ignore_hidden ||
+        options_.num_days >= 0) {
+      msg = "Sample mode can't be used with file filters";
+      return false;
+    }
+
+    if (options_.checkpoint_file != "" || options_.resume_file != "") {
+      msg = "Sample mode can't be used with checkpoints";
+      return false;
+    }
+
+    if (options_.from_list != "") {
+      msg = "Sample mode can't be used with file lists";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Scan all files below the specified directory and return the total space usage and
+// lists of oldest, newest, largest and smallest files and directory usages (if
+// requested by the options).
+//
+// If a path list is set the paths of the list are scanned instead (dirname only names
+// the results).
+//
+// Returns false if the options are invalid or the directory could not be read (the
+// results are still filled in), or if the scan was stopped by the visitor (in which
+// case results.complete is false).
+bool
+CUsageScan::
+scan(const std::string &dirname, CUsageScanResults &results)
+{
+  error_msg_ = "";
+  scanned_   = false;
+
+  results = CUsageScanResults();
+
+  results.directory = dirname;
+
+  if (! checkOptions(error_msg_))
+    return false;
+
+  //------------
+
+  clearData();
+
+  /* Read checkpoint to resume from (only used for the checkpoint's directory) */
+
+  CUsageCheckpoint checkpoint;
+
+  bool resume = false;
+
+  if (options_.resume_file != "") {
+    if (! checkpoint.read(options_.resume_file, error_msg_))
+      return false;
+
+    if (checkpoint.directory == dirname) {
+      if (checkpoint.options != optionsSignature()) {
+        error_msg_ = "Checkpoint \'" + options_.resume_file +
+                     "\' was written with different options";
+        return false;
+      }
+
+      resume = true;
+    }
+  }
+
+  /* Read list of paths to scan instead of the directory */
+
+  CUsagePathList path_list;
+
+  if (options_.from_list != "" && ! path_list.read(options_.from_list, error_msg_))
+    return false;
+
+  //------------
+
+  directory_ = dirname;
+
+  if      (resume)
+    current_time_ = checkpoint.current_time;
+  else if (options_.current_time)
+    current_time_ = options_.current_time;
+  else
+    current_time_ = time(nullptr);
+
+  //------------
+
+  // file lists of a resumed scan can contain duplicates (removed at the end) so
+  // keep twice as many files
+  data_options_ = options_;
+
+  if (resume) {
+    data_options_.num_largest  *= 2;
+    data_options_.num_smallest *= 2;
+    data_options_.num_oldest   *= 2;
+    data_options_.num_newest   *= 2;
+  }
+
+  for (uint i = 0; i < options_.num_threads; ++i)
+    data_list_.push_back(new CUsageScanData(data_options_, current_time_));
+
+  // ranked records are kept by the data updated with entries (each thread's, or only the
+  // aggregator's in pipeline mode) which share the memory limit
+  if (options_.rank_range != "") {
+    uint num_ranked = (options_.pipeline_depth > 0 ? 1U : options_.num_threads);
+
+    for (uint i = 0; i < num_ranked; ++i)
+      data_list_[i]->createRankList(options_.rank_mem_limit/num_ranked);
+  }
+
+  //------------
+
+  CUsageDirWalk walk(this, dirname);
+
+  walk.setNumThreads    (options_.num_threads);
+  walk.setFollowLinks  (options_.follow_links);
+  walk.setOneFileSystem(options_.one_file_system);
+  walk.setDevThreads   (options_.dev_threads);
+  walk.setTimeDirs     (options_.display_dir_times);
+  walk.setBackground   (options_.background);
+  walk.setInodeOrder   (options_.inode_order);
+  walk.setLeafNlink    (options_.leaf_nlink);
+  walk.setProgress     (progress_);
+  walk.setThrottle     (throttle_);
+
+  if      (options_.date_type == CUsageDateType::LAST_MODIFIED)
+    walk.setBatchTimeField(CUsageEntryBatch::TimeField::MODIFY);
+  else if (options_.date_type == CUsageDateType::LAST_CHANGED)
+    walk.setBatchTimeField(CUsageEntryBatch::TimeField::CHANGE);
+  else
+    walk.setBatchTimeField(CUsageEntryBatch::TimeField::ACCESS);
+
+  if (isSample())
+    walk.setSample(options_.sample_fraction, options_.sample_dir_fraction,
+                   options_.sample_seed);
+
+  startPipeline();
+
+  scanned_ = true;
+
+  bool rc = false;
+
+  if (resume) {
+    std::vector<CUsageDirNode *> pending;
+
+    restoreCheckpoint(checkpoint, walk, pending);
+
+    startCheckpoints(walk);
+
+    rc = walk.resume(pending, checkpoint.results.skipped_mounts,
+                     checkpoint.results.link_loops);
+  }
+  else if (options_.from_list != "")
+    rc = walk.walkList(path_list, options_.from_list_sort);
+  else {
+    startCheckpoints(walk);
+
+    rc = walk.walk();
+  }
+
+  stopCheckpoints();
+
+  stopPipeline(results.pipeline);
+
+  if (! rc)
+    error_msg_ = "Failed to read directory \'" + dirname + "\'";
+
+  //------------
+
+  // merge thread data into first
+  for (uint i = 1; i < options_.num_threads; ++i)
+    data_list_[0]->merge(*data_list_[i]);
+
+  data_list_[0]->getResults(results);
+
+  if (options_.rank_range != "" && ! getRankResults(results))
+    rc = false;
+
+  if (resume) {
+    uniqueFileSpecs(results.largest_files , options_.num_largest );
+    uniqueFileSpecs(results.smallest_files, options_.num_smallest);
+    uniqueFileSpecs(results.oldest_files  , options_.num_oldest  );
+    uniqueFileSpecs(results.newest_files  , options_.num_newest  );
+  }
+
+  if (needDirResults())
+    getDirResults(walk.tree(), results);
+
+  if (options_.display_dups)
+    getDupResults(data_list_[0]->dupFiles(), results);
+
+  if (isSample())
+    getSampleResults(walk.tree(), results);
+
+  // a resumed walk finds those of directories re-read after the checkpoint again
+  auto sortUnique = [](CUsageScanResults::DirNames &names) {
+    std::sort(names.begin(), names.end());
+
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+  };
+
+  results.skipped_mounts = walk.skippedMounts();
+
+  sortUnique(results.skipped_mounts);
+
+  results.link_loops = walk.linkLoops();
+
+  sortUnique(results.link_loops);
+
+  results.complete = ! walk.isStopped();
+
+  clearData();
+
+  // checkpoint is no longer needed once the scan is complete
+  if (rc && results.complete && options_.checkpoint_file != "")
+    (void) remove(options_.checkpoint_file.c_str());
+
+  return (rc && results.complete);
+}
+
+// Process batch of entries read by walker thread. The visitor is called for each
+// entry (the batch is cut short at the entry it stops the scan at).
+bool
+CUsageScan::
+processBatch(uint thread, CUsageEntryBatch &batch)
+{
+  uint n = batch.size();
+
+  if (progress_) {
+    size_t size = 0;
+
+    for (uint i = 0; i < n; ++i)
+      size += batch.sizes[i];
+
+    progress_->addEntries(thread, long(n), size);
+  }
+
+  bool rc = true;
+
+  if (visitor_) {
+    for (uint i = 0; i < n; ++i) {
+      if (! visitor_(thread, batch.entries[i])) {
+        batch.num = i;
+
+        rc = false;
+
+        break;
+      }
+    }
+  }
+
+  if (pipeline_)
+    queueBatch(batch);
+  else
+    updateData(data_list_[thread], batch);
+
+  return rc;
+}
+
+// Add batch of entries to thread data
+void
+CUsageScan::
+updateData(CUsageScanData *data, const CUsageEntryBatch &batch)
+{
+  if (isSample()) {
+    for (uint i = 0; i < batch.size(); ++i)
+      data->updateSample(batch.entries[i]);
+  }
+  else
+    data->updateBatch(batch);
+}
+
+// Start aggregator thread (if pipeline depth set)
+void
+CUsageScan::
+startPipeline()
+{
+  if (options_.pipeline_depth == 0)
+    return;
+
+  pipeline_ = std::make_unique<Pipeline>(options_.pipeline_depth);
+
+  pipeline_->thread = std::thread([this]() { runAggregator(); });
+}
+
+// Wait for aggregator to process queued batches and return pipeline counters
+void
+CUsageScan::
+stopPipeline(CUsagePipelineStats &stats)
+{
+  if (! pipeline_)
+    return;
+
+  pipeline_->done.store(true, std::memory_order_release);
+
+  if (pipeline_->thread.joinable())
+    pipeline_->thread.join();
+
+  stats = CUsagePipelineStats();
+
+  stats.num_batches      = pipeline_->num_batches;
+  stats.num_entries      = pipeline_->num_entries;
+  stats.max_depth        = pipeline_->max_depth;
+  stats.walker_stalls    = pipeline_->walker_stalls;
+  stats.aggregator_waits = pipeline_->aggregator_waits;
+
+  if (stats.num_batches > 0)
+    stats.mean_depth = double(pipeline_->depth_sum)/double(stats.num_batches);
+
+  pipeline_.reset();
+}
+
+// Pass batch to aggregator : its entries are swapped into a free batch (waiting if
+// the aggregator has none free) which is queued, and the walker keeps the empty one
+void
+CUsageScan::
+queueBatch(CUsageEntryBatch &batch)
+{
+  auto *pipeline = pipeline_.get();
+
+  CUsageEntryBatch *batch1 = pipeline->free_queue.pop();
+
+  if (! batch1) {
+    ++pipeline->walker_stalls;
+
+    int spins = 0;
+
+    while (! (batch1 = pipeline->free_queue.pop()))
+      pipelineWait(spins);
+  }
+
+  batch1->swapEntries(batch);
+
+  batch1->time_field = batch.time_field;
+  batch1->parent     = batch.parent;
+
+  size_t depth = pipeline->full_queue.size();
+
+  pipeline->depth_sum   += long(depth);
+  pipeline->num_entries += long(batch1->size());
+
+  ++pipeline->num_batches;
+
+  size_t max_depth = pipeline->max_depth.load(std::memory_order_relaxed);
+
+  while (depth > max_depth &&
+         ! pipeline->max_depth.compare_exchange_weak(max_depth, depth,
+                                                     std::memory_order_relaxed))
+    ;
+
+  // can't be full (queue holds all batches)
+  (void) pipeline->full_queue.push(batch1);
+}
+
+// Aggregator thread : add queued batches to the first thread data (until walk is done
+// and the queue is empty) and return them to the free queue
+void
+CUsageScan::
+runAggregator()
+{
+  auto *pipeline = pipeline_.get();
+
+  auto *data = data_list_[0];
+
+  bool waiting = false;
+  int  spins   = 0;
+
+  while (true) {
+    CUsageEntryBatch *batch = pipeline->full_queue.pop();
+
+    if (! batch) {
+      // done is set after the last push so the queue is checked again
+      if (pipeline->done.load(std::memory_order_acquire)) {
+        batch = pipeline->full_queue.pop();
+
+        if (! batch)
+          break;
+      }
+      else {
+        if (! waiting) {
+          ++pipeline->aggregator_waits;
+
+          waiting = true;
+          spins   = 0;
+        }
+
+        pipelineWait(spins);
+
+        continue;
+      }
+    }
+
+    waiting = false;
+
+    updateData(data, *batch);
+
+    batch->clear();
+
+    (void) pipeline->free_queue.push(batch);
+  }
+}
+
+void
+CUsageScan::
+clearData()
+{
+  for (auto &data : data_list_)
+    delete data;
+
+  data_list_.clear();
+}
+
+// Find duplicate groups of candidate files and add the most wasted to results
+void
+CUsageScan::
+getDupResults(CUsageDupFinder::Files &files, CUsageScanResults &results) const
+{
+  CUsageDupFinder finder(options_.num_threads);
+
+  finder.find(files, results.dup_groups);
+
+  results.num_dup_groups = long(results.dup_groups.size());
+  results.dup_wasted     = 0;
+
+  for (const auto &group : results.dup_groups)
+    results.dup_wasted += group.wasted();
+
+  if (results.dup_groups.size() > options_.num_dups)
+    results.dup_groups.resize(options_.num_dups);
+}
+
+// Rank the files of all threads and add those in the rank range to results
+bool
+CUsageScan::
+getRankResults(CUsageScanResults &results)
+{
+  CUsageRankRange range;
+
+  // range was checked by checkOptions
+  (void) range.parse(options_.rank_range, error_msg_);
+
+  CUsageRankList::Lists lists;
+
+  for (auto *data : data_list_) {
+    if (data->rankList())
+      lists.push_back(data->rankList());
+  }
+
+  return CUsageRankList::getRange(lists, range, results.ranked_files, results.num_ranked,
+                                  results.first_rank, error_msg_);
+}
+
+// Directory tree needed for directory usages, totals, times or inodes
+bool
+CUsageScan::
+needDirResults() const
+{
+  return (options_.display_dirs || options_.max_depth >= 0 || options_.display_dir_times ||
+          options_.display_inodes || options_.cold_days >= 0);
+}
+
+// Only stat (and read) a fraction of files (and sub directories)
+bool
+CUsageScan::
+isSample() const
+{
+  return (options_.sample_fraction < 1.0 || options_.sample_dir_fraction < 1.0);
+}
+
+// Options which change the totals, file lists or directory results (must be the same
+// to resume from a checkpoint)
+std::string
+CUsageScan::
+optionsSignature() const
+{
+  std::string str;
+
+  auto addInt = [&](long i) { str += std::to_string(i) + ";"; };
+  auto addStr = [&](const std::string &s) { addInt(long(s.size())); str += s + ";"; };
+
+  addInt(int(options_.date_type));
+  addInt(options_.display_largest);
+  addInt(options_.display_smallest);
+  addInt(options_.display_oldest);
+  addInt(options_.display_newest);
+  addInt(options_.display_dirs);
+  addInt(options_.display_dir_times);
+  addInt(options_.ignore_hidden);
+  addInt(options_.reverse);
+  addInt(options_.num_largest);
+  addInt(options_.num_smallest);
+  addInt(options_.num_oldest);
+  addInt(options_.num_newest);
+  addStr(options_.match_pattern);
+  addStr(options_.no_match_pattern);
+  addStr(options_.match_type);
+  addStr(options_.where);
+  addInt(options_.num_days);
+  addInt(options_.max_depth);
+  addInt(options_.one_file_system);
+
+  return str;
+}
+
+// Filter options as options of the command line in canonical form. The where
+// expression is parsed with relative times kept as offsets (from time 0) and printed
+// with sorted operands, and reverse is only included when days are checked.
+std::string
+CUsageScan::
+filterSignature() const
+{
+  std::string str;
+
+  auto addOpt = [&](const std::string &opt) {
+    if (str != "")
+      str += " ";
+
+    str += opt;
+  };
+
+  auto addStr = [&](const std::string &opt, const std::string &value) {
+    if (value != "")
+      addOpt(opt + " \'" + value + "\'");
+  };
+
+  if (options_.where != "") {
+    CUsageFilter filter;
+
+    std::string msg;
+
+    std::string where = options_.where;
+
+    if (filter.parse(options_.where, 0, msg))
+      where = filter.canonicalString();
+
+    addStr("-where", where);
+  }
+
+  addStr("-mp", options_.match_pattern);
+  addStr("-mn", options_.no_match_pattern);
+  addStr("-mt", options_.match_type);
+
+  if (options_.ignore_hidden)
+    addOpt("-H");
+
+  if (options_.num_days >= 0) {
+    addOpt("-p " + std::to_string(options_.num_days));
+
+    if (options_.reverse)
+      addOpt("-r");
+  }
+
+  return str;
+}
+
+// Restore directory tree and first thread's totals and file lists from checkpoint and
+// return the pending directories
+void
+CUsageScan::
+restoreCheckpoint(const CUsageCheckpoint &checkpoint, CUsageDirWalk &walk,
+                  std::vector<CUsageDirNode *> &pending)
+{
+  auto &tree = walk.tree();
+
+  std::vector<CUsageDirNode *> nodes;
+
+  for (const auto &dir : checkpoint.dirs) {
+    CUsageDirNode *node = nullptr;
+
+    if (dir.parent < 0)
+      node = tree.root();
+    else
+      node = tree.addChild(nodes[size_t(dir.parent)], dir.name);
+
+    node->depth       = dir.depth;
+    node->dev         = dir.dev;
+    node->size        = dir.size;
+    node->dir_size    = dir.dir_size;
+    node->num_usages  = dir.num_usages;
+    node->num_files   = dir.num_files;
+    node->num_dirs    = dir.num_dirs;
+    node->num_entries = dir.num_entries;
+    node->readdir_ns  = dir.readdir_ns;
+    node->stat_ns     = dir.stat_ns;
+
+    if (dir.pending)
+      pending.push_back(node);
+    else
+      node->read_seq = 1;
+
+    nodes.push_back(node);
+  }
+
+  data_list_[0]->setResults(checkpoint.results);
+}
+
+// Start thread writing checkpoint every interval (if checkpoint file set)
+void
+CUsageScan::
+startCheckpoints(CUsageDirWalk &walk)
+{
+  if (options_.checkpoint_file == "")
+    return;
+
+  checkpointing_ = true;
+
+  checkpoint_thread_ = std::thread([this, &walk]() {
+    std::unique_lock<std::mutex> lock(checkpoint_mutex_);
+
+    while (checkpointing_) {
+      checkpoint_cond_.wait_for(lock, std::chrono::seconds(options_.checkpoint_interval));
+
+      if (! checkpointing_)
+        break;
+
+      lock.unlock();
+
+      // failures are ignored (the previous checkpoint is kept)
+      std::string msg;
+
+      (void) writeCheckpoint(walk, msg);
+
+      lock.lock();
+    }
+  });
+}
+
+void
+CUsageScan::
+stopCheckpoints()
+{
+  {
+  std::unique_lock<std::mutex> lock(checkpoint_mutex_);
+
+  checkpointing_ = false;
+  }
+
+  checkpoint_cond_.notify_all();
+
+  if (checkpoint_thread_.joinable())
+    checkpoint_thread_.join();
+}
+
+// Write checkpoint of running walk.
+//
+// The walk is not stopped. Directories with a read sequence up to the walker's current
+// one are complete (their counts and children no longer change) and are saved with
+// their unread sub directories as the pending list. Each thread's file lists are then
+// copied while it is between directories. The copies can include files of directories
+// read after the cut, these are re-read on resume and the duplicates removed.
+//
+// Cost is bounded by the number of read directories (only the pending directories if
+// no directory results are needed) plus the file list sizes.
+bool
+CUsageScan::
+writeCheckpoint(CUsageDirWalk &walk, std::string &msg)
+{
+  CUsageCheckpoint checkpoint;
+
+  checkpoint.directory    = directory_;
+  checkpoint.options      = optionsSignature();
+  checkpoint.current_time = current_time_;
+
+  uint64_t read_seq = walk.readSeq();
+
+  auto isRead = [&](const CUsageDirNode *node) {
+    uint64_t seq = node->read_seq.load(std::memory_order_acquire);
+
+    return (seq > 0 && seq <= read_seq);
+  };
+
+  auto *root = walk.tree().root();
+
+  if (! isRead(root)) {
+    msg = "Directory \'" + directory_ + "\' not read";
+    return false;
+  }
+
+  /* Add read directories and pending directories (parents before children) */
+
+  bool save_dirs = needDirResults();
+
+  auto addCounts = [](CUsageCheckpointDir &dir, const CUsageDirNode *node) {
+    dir.size        += node->size;
+    dir.dir_size    += node->dir_size;
+    dir.num_usages  += node->num_usages;
+    dir.num_files   += node->num_files;
+    dir.num_dirs    += node->num_dirs;
+    dir.num_entries += node->num_entries;
+    dir.readdir_ns  += node->readdir_ns;
+    dir.stat_ns     += node->stat_ns;
+  };
+
+  std::vector<std::pair<CUsageDirNode *, long>> stack;
+
+  stack.emplace_back(root, -1);
+
+  while (! stack.empty()) {
+    auto *node   = stack.back().first;
+    long  parent = stack.back().second;
+
+    stack.pop_back();
+
+    CUsageCheckpointDir dir;
+
+    dir.name  = node->name;
+    dir.depth = node->depth;
+    dir.dev   = node->dev;
+
+    // pending directory (own size was added when parent was read)
+    if (! isRead(node)) {
+      dir.parent   = (save_dirs ? parent : 0);
+      dir.pending  = true;
+      dir.dir_size = node->dir_size;
+
+      checkpoint.dirs.push_back(dir);
+
+      continue;
+    }
+
+    // read directory (counts added to root if directories are not needed)
+    long ind = 0;
+
+    if (save_dirs || node == root) {
+      dir.parent = parent;
+
+      addCounts(dir, node);
+
+      checkpoint.dirs.push_back(dir);
+
+      ind = long(checkpoint.dirs.size()) - 1;
+    }
+    else
+      addCounts(checkpoint.dirs[0], node);
+
+    for (auto p = node->children.rbegin(); p != node->children.rend(); ++p)
+      stack.emplace_back(*p, ind);
+  }
+
+  auto &results = checkpoint.results;
+
+  for (const auto &dir : checkpoint.dirs) {
+    results.total_usage += dir.size + dir.dir_size;
+    results.num_files   += dir.num_files;
+    results.num_dirs    += dir.num_dirs;
+  }
+
+  /* Copy skipped mounts and link loops found so far */
+
+  // those found in directories read after the cut are found again when they are
+  // re-read on resume (and the duplicates removed)
+  walk.copyFound(results.skipped_mounts, results.link_loops);
+
+  /* Copy file lists of each thread (waiting until it is between directories) */
+
+  std::vector<CUsageScanResults> thread_results(data_list_.size());
+
+  walk.syncThreads([&](uint thread) {
+    data_list_[thread]->getResults(thread_results[thread]);
+  });
+
+  auto append = [](CUsageScanResults::FileSpecs &files,
+                   const CUsageScanResults::FileSpecs &files1) {
+    files.insert(files.end(), files1.begin(), files1.end());
+  };
+
+  for (const auto &thread_results1 : thread_results) {
+    append(results.largest_files , thread_results1.largest_files );
+    append(results.smallest_files, thread_results1.smallest_files);
+    append(results.oldest_files  , thread_results1.oldest_files  );
+    append(results.newest_files  , thread_results1.newest_files  );
+  }
+
+  std::stable_sort(results.largest_files.begin(), results.largest_files.end(),
+    [](const CUsageFileSpec &f1, const CUsageFileSpec &f2) { return (f1.size > f2.size); });
+  std::stable_sort(results.smallest_files.begin(), results.smallest_files.end(),
+    [](const CUsageFileSpec &f1, const CUsageFileSpec &f2) { return (f1.size < f2.size); });
+  std::stable_sort(results.oldest_files.begin(), results.oldest_files.end(),
+    [](const CUsageFileSpec &f1, const CUsageFileSpec &f2) { return (f1.time < f2.time); });
+  std::stable_sort(results.newest_files.begin(), results.newest_files.end(),
+    [](const CUsageFileSpec &f1, const CUsageFileSpec &f2) { return (f1.time > f2.time); });
+
+  uniqueFileSpecs(results.largest_files , options_.num_largest );
+  uniqueFileSpecs(results.smallest_files, options_.num_smallest);
+  uniqueFileSpecs(results.oldest_files  , options_.num_oldest  );
+  uniqueFileSpecs(results.newest_files  , options_.num_newest  );
+
+  return checkpoint.write(options_.checkpoint_file, msg);
+}
+
+// Roll up directory tree and add directory usages (directories containing files, largest
+// first), directory totals (to max depth, sub directories before parent), slowest
+// and most entries directories and cold directories to results
+void
+CUsageScan::
+getDirResults(CUsageDirTree &tree, CUsageScanResults &results) const
+{
+  CUSAGE_PROFILE_PHASE(DIR_USAGE);
+
+  tree.rollUp();
+
+  //---
+
+  if (options_.display_dirs) {
+    std::vector<CUsageDirNode *> nodes;
+
+    tree.getNodes(nodes);
+
+    results.dir_usages.clear();
+
+    for (const auto &node : nodes) {
+      if (node->total_num_usages == 0)
+        continue;
+
+      CUsageDirUsage dir_usage;
+
+      dir_usage.name = node->name;
+      dir_usage.len  = int(node->name.size());
+      dir_usage.size = node->total_usage;
+      dir_usage.leaf = (node->total_num_usages == node->num_usages);
+
+      results.dir_usages.push_back(dir_usage);
+    }
+
+    // sort by usage (largest first, then name)
+    std::sort(results.dir_usages.begin(), results.dir_usages.end(),
+              [](const CUsageDirUsage &dir_usage1, const CUsageDirUsage &dir_usage2) {
+                return (dir_usage1.name < dir_usage2.name);
+              });
+
+    std::stable_sort(results.dir_usages.begin(), results.dir_usages.end(),
+                     CUsageDirUsageCmp());
+  }
+
+  //---
+
+  if (options_.max_depth >= 0) {
+    std::vector<CUsageDirNode *> nodes;
+
+    tree.getNodes(nodes, options_.max_depth, /*children_first*/true);
+
+    results.dir_totals.clear();
+
+    for (const auto &node : nodes) {
+      CUsageDirTotal dir_total;
+
+      dir_total.name        = node->name;
+      dir_total.depth       = node->depth;
+      dir_total.size        = node->total_size;
+      dir_total.num_files   = node->total_num_files;
+      dir_total.num_entries = node->total_num_entries;
+
+      results.dir_totals.push_back(dir_total);
+    }
+  }
+
+  //---
+
+  if (options_.display_dir_times) {
+    std::vector<CUsageDirNode *> nodes;
+
+    tree.getNodes(nodes);
+
+    // keep top num_dir_times of each (partial sort)
+    auto addDirTimes = [&](CUsageScanResults::DirTimes &dir_times, auto cmp) {
+      size_t num = std::min(size_t(options_.num_dir_times), nodes.size());
+
+      std::partial_sort(nodes.begin(), nodes.begin() + long(num), nodes.end(), cmp);
+
+      dir_times.clear();
+
+      for (size_t i = 0; i < num; ++i) {
+        CUsageDirTime dir_time;
+
+        dir_time.name        = nodes[i]->name;
+        dir_time.readdir_ns  = nodes[i]->readdir_ns;
+        dir_time.stat_ns     = nodes[i]->stat_ns;
+        dir_time.num_entries = nodes[i]->num_entries;
+
+        dir_times.push_back(dir_time);
+      }
+    };
+
+    addDirTimes(results.slowest_dirs,
+      [](const CUsageDirNode *node1, const CUsageDirNode *node2) {
+        return (node1->readdir_ns + node1->stat_ns > node2->readdir_ns + node2->stat_ns);
+      });
+
+    addDirTimes(results.most_entries_dirs,
+      [](const CUsageDirNode *node1, const CUsageDirNode *node2) {
+        if (node1->num_entries != node2->num_entries)
+          return (node1->num_entries > node2->num_entries);
+
+        return (node1->name < node2->name);
+      });
+  }
+
+  //---
+
+  // entry counts are rolled up with the sizes so ranking them needs no extra pass
+  // over the files
+  if (options_.display_inodes) {
+    std::vector<CUsageDirNode *> nodes;
+
+    tree.getNodes(nodes);
+
+    // root's total counts the entries below it, + 1 counts the root itself (so the
+    // total is one more than the root's row in the most entries below list)
+    results.total_entries = tree.root()->total_num_entries + 1;
+
+    // keep top num_inode_dirs of each (partial sort, then name)
+    auto addDirInodes = [&](CUsageScanResults::DirInodes &dir_inodes, auto count) {
+      size_t num = std::min(size_t(options_.num_inode_dirs), nodes.size());
+
+      std::partial_sort(nodes.begin(), nodes.begin() + long(num), nodes.end(),
+        [&](const CUsageDirNode *node1, const CUsageDirNode *node2) {
+          if (count(node1) != count(node2))
+            return (count(node1) > count(node2));
+
+          return (node1->name < node2->name);
+        });
+
+      dir_inodes.clear();
+
+      for (size_t i = 0; i < num; ++i) {
+        CUsageDirInodes dir_inodes1;
+
+        dir_inodes1.name              = nodes[i]->name;
+        dir_inodes1.num_entries       = nodes[i]->num_entries;
+        dir_inodes1.total_num_entries = nodes[i]->total_num_entries;
+
+        dir_inodes.push_back(dir_inodes1);
+      }
+    };
+
+    addDirInodes(results.inode_dirs,
+      [](const CUsageDirNode *node) { return long(node->num_entries); });
+
+    addDirInodes(results.inode_total_dirs,
+      [](const CUsageDirNode *node) { return long(node->total_num_entries); });
+  }
+
+  //---
+
+  if (options_.cold_days >= 0) {
+    std::vector<CUsageDirNode *> nodes;
+
+    tree.getNodes(nodes);
+
+    nodes.erase(std::remove_if(nodes.begin(), nodes.end(),
+                  [](const CUsageDirNode *node) { return (node->cold_size == 0); }),
+                nodes.end());
+
+    // keep top num_cold directories by direct cold bytes (then name)
+    size_t num = std::min(size_t(options_.num_cold), nodes.size());
+
+    std::partial_sort(nodes.begin(), nodes.begin() + long(num), nodes.end(),
+      [](const CUsageDirNode *node1, const CUsageDirNode *node2) {
+        if (node1->cold_size != node2->cold_size)
+          return (node1->cold_size > node2->cold_size);
+
+        return (node1->name < node2->name);
+      });
+
+    results.cold_dirs.clear();
+
+    for (size_t i = 0; i < num; ++i) {
+      CUsageColdDir cold_dir;
+
+      cold_dir.name       = nodes[i]->name;
+      cold_dir.size       = nodes[i]->cold_size;
+      cold_dir.num_files  = nodes[i]->num_cold_files;
+      cold_dir.total_size = nodes[i]->total_cold_size;
+
+      results.cold_dirs.push_back(cold_dir);
+    }
+  }
+}
+
+// Roll up sample estimates from the tree (children first).
+//
+// Sub directories are read with probability d so each read sub directory's estimated
+// total (its own size plus everything below it) is scaled by 1/d. The variance of a
+// directory's estimate is its files' variance plus, for each read sub directory,
+// (1 - d)/d^2 y^2 + var(y)/d (unbiased for two stage Bernoulli sampling).
+void
+CUsageScan::
+getSampleResults(CUsageDirTree &tree, CUsageScanResults &results) const
+{
+  struct Estimate {
+    double size      { 0.0 };
+    double size_var  { 0.0 };
+    double files     { 0.0 };
+    double files_var { 0.0 };
+    double dirs      { 0.0 };
+    double dirs_var  { 0.0 };
+  };
+
+  std::vector<CUsageDirNode *> nodes;
+
+  tree.getNodes(nodes, -1, /*children_first*/true);
+
+  std::unordered_map<const CUsageDirNode *, Estimate> estimates;
+
+  double d = options_.sample_dir_fraction;
+
+  auto addScaled = [&](double y, double var, double &py, double &pvar) {
+    py   += y/d;
+    pvar += (1.0 - d)*y*y/(d*d) + var/d;
+  };
+
+  auto &sample = results.sample;
+
+  Estimate root;
+
+  for (const auto &node : nodes) {
+    auto &estimate = estimates[node];
+
+    estimate.size     += node->sample_size;
+    estimate.size_var += node->sample_var;
+    estimate.files    += double(node->num_files + node->num_unsampled);
+
+    sample.num_stats += node->num_files;
+
+    ++sample.num_dirs;
+
+    if (! node->parent) {
+      root = estimate;
+      continue;
+    }
+
+    auto &parent_estimate = estimates[node->parent];
+
+    addScaled(double(node->dir_size) + estimate.size, estimate.size_var,
+              parent_estimate.size, parent_estimate.size_var);
+    addScaled(estimate.files, estimate.files_var,
+              parent_estimate.files, parent_estimate.files_var);
+    addScaled(1.0 + estimate.dirs, estimate.dirs_var,
+              parent_estimate.dirs, parent_estimate.dirs_var);
+
+    estimates.erase(node);
+  }
+
+  results.sampled = true;
+
+  sample.fraction     = options_.sample_fraction;
+  sample.dir_fraction = options_.sample_dir_fraction;
+  sample.seed         = options_.sample_seed;
+
+  sample.total_usage.value = root.size;
+  sample.total_usage.error = sample_z*std::sqrt(root.size_var);
+  sample.num_files  .value = root.files;
+  sample.num_files  .error = sample_z*std::sqrt(root.files_var);
+  sample.total_dirs .value = root.dirs;
+  sample.total_dirs .error = sample_z*std::sqrt(root.dirs_var);
+}
@@ -0,0 +1,479 @@
+#ifndef CUsageScan_H
+#define CUsageScan_H
+
+#include <CUsageDirWalk.h>
+#include <CUsageDupFinder.h>
+#include <CUsageFilter.h>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class CRegExp;
+struct CUsageCheckpoint;
+class CUsageProgress;
+class CUsageRankList;
+class CUsageThrottle;
+
+#define DEFAULT_NUM_FILES 40
+#define MAX_NUM_FILES     1000
+
+#define MAX_PIPELINE_DEPTH 4096
+
+#define DEFAULT_RANK_MEM_LIMIT (size_t(256) << 20)
+#define MIN_RANK_MEM_LIMIT     (size_t(1) << 20)
+
+enum class CUsageDateType {
+  LAST_ACCESSED = 1,
+  LAST_MODIFIED = 2,
+  LAST_CHANGED  = 3
+};
+
+// Order of ranked listing
+enum class CUsageRankKey {
+  LARGEST,
+  SMALLEST,
+  OLDEST,
+  NEWEST
+};
+
+//---
+
+// Scan options
+struct CUsageScanOptions {
+  CUsageDateType date_type         { CUsageDateType::LAST_MODIFIED };
+  bool           display_largest   { false };
+  bool           display_smallest  { false };
+  bool           display_oldest    { false };
+  bool           display_newest    { false };
+  bool           display_dirs      { false };
+  bool           display_dir_times { false };
+  bool           display_dups      { false };
+  bool           display_inodes    { false };
+  bool           ignore_hidden     { false };
+  bool           follow_links      { false }; // follow symbolic links
+  bool           reverse           { false };
+  uint           num_largest       { DEFAULT_NUM_FILES };
+  uint           num_smallest      { DEFAULT_NUM_FILES };
+  uint           num_oldest        { DEFAULT_NUM_FILES };
+  uint           num_newest        { DEFAULT_NUM_FILES };
+  uint           num_dir_times     { DEFAULT_NUM_FILES };
+  uint           num_dups          { DEFAULT_NUM_FILES };
+  uint           num_cold          { DEFAULT_NUM_FILES };
+  uint           num_inode_dirs    { DEFAULT_NUM_FILES };
+  std::string    match_pattern;
+  std::string    no_match_pattern;
+  std::string    match_type;
+  std::string    where;                        // filter expression (see CUsageFilter)
+  int            num_days          { -1 };
+  int            cold_days         { -1 };    // days since date type time of cold files
+                                              // (-1 = no cold report)
+  time_t         current_time      { 0 };     // time for day comparison (0 = time of scan)
+  uint           num_threads       { 1 };
+  int            max_depth         { -1 };    // depth of directory totals (-1 = none)
+  bool           one_file_system   { false }; // don't cross into other devices (mounts)
+  uint           dev_threads       { 0 };     // max threads per device (0 = no limit)
+  bool           background        { false }; // idle io priority and nice walk threads
+  bool           inode_order       { false }; // stat directory entries in inode order
+  bool           leaf_nlink        { false }; // use directory link counts to skip
+                                              // stats of files (sample mode)
+  std::string    checkpoint_file;              // periodic checkpoint file (empty = none)
+  int            checkpoint_interval { 60 };   // seconds between checkpoints
+  std::string    resume_file;                  // checkpoint to resume from (empty = none)
+  double         sample_fraction     { 1.0 };  // fraction of files stat'ed (1 = all)
+  double         sample_dir_fraction { 1.0 };  // fraction of sub directories read (1 = all)
+  uint64_t       sample_seed         { 0 };    // seed of sample selection
+  uint           pipeline_depth      { 0 };    // batches queued for aggregator thread
+                                              // (0 = entries processed by walkers)
+  std::string    rank_range;                   // ranks of ranked listing (empty = none,
+                                              // see CUsageRankRange)
+  CUsageRankKey  rank_key          { CUsageRankKey::LARGEST };
+  size_t         rank_mem_limit    { DEFAULT_RANK_MEM_LIMIT }; // bytes of ranked records
+                                                              // kept before spilling
+  std::string    rank_tmp_dir;                 // spill directory (empty = $TMPDIR or /tmp)
+  std::string    from_list;                    // NUL separated list of paths scanned
+                                              // instead of directory ('-' = stdin)
+  bool           from_list_sort    { false };  // stat list paths grouped by directory
+};
+
+//---
+
+struct CUsageFileSpec {
+  std::string name;
+  size_t      size { 0 };
+  time_t      time { };
+};
+
+struct CUsageDirUsage {
+  std::string name;
+  int         len  { 0 };
+  size_t      size { 0 };
+  bool        leaf { true };
+};
+
+struct CUsageDirTotal {
+  std::string name;
+  int         depth       { 0 };
+  size_t      size        { 0 };
+  long        num_files   { 0 };
+  long        num_entries { 0 };
+};
+
+struct CUsageDirTime {
+  std::string name;
+  uint64_t    readdir_ns  { 0 };
+  uint64_t    stat_ns     { 0 };
+  long        num_entries { 0 };
+
+  uint64_t totalNs() const { return readdir_ns + stat_ns; }
+};
+
+// Entries (inodes) of a directory
+struct CUsageDirInodes {
+  std::string name;
+  long        num_entries       { 0 }; // entries directly in directory
+  long        total_num_entries { 0 }; // entries of directory and all directories below it
+};
+
+// Sample estimate with 95% confidence interval (value +/- error)
+struct CUsageSampleEstimate {
+  double value { 0.0 };
+  double error { 0.0 };
+};
+
+// Estimated number of files with size in [min_size, max_size)
+struct CUsageSampleBucket {
+  size_t               min_size { 0 };
+  size_t               max_size { 0 };
+  CUsageSampleEstimate num_files;
+};
+
+// Bytes of cold files directly in a directory
+struct CUsageColdDir {
+  std::string name;
+  size_t      size       { 0 };
+  long        num_files  { 0 };
+  size_t      total_size { 0 }; // cold bytes of directory and all directories below it
+};
+
+// Bytes of cold files owned by a user
+struct CUsageColdOwner {
+  uid_t       uid       { 0 };
+  size_t      size      { 0 };
+  long        num_files { 0 };
+};
+
+// Sample mode results
+struct CUsageSampleResults {
+  using Buckets = std::vector<CUsageSampleBucket>;
+
+  double               fraction     { 0.0 };
+  double               dir_fraction { 1.0 };
+  uint64_t             seed         { 0 };
+  long                 num_stats    { 0 };  // files stat'ed
+  long                 num_dirs     { 0 };  // directories read
+  CUsageSampleEstimate total_usage;
+  CUsageSampleEstimate num_files;
+  CUsageSampleEstimate total_dirs;
+  Buckets              size_buckets;       // powers of 2 (non empty only)
+};
+
+//---
+
+struct CUsageDirUsageCmp {
+  bool operator()(const CUsageDirUsage &a, const CUsageDirUsage &b);
+};
+
+//---
+
+// Pipeline counters (pipeline mode)
+struct CUsagePipelineStats {
+  long   num_batches      { 0 };   // batches passed to aggregator
+  long   num_entries      { 0 };   // entries of batches
+  size_t max_depth        { 0 };   // most batches queued (seen by a walker)
+  double mean_depth       { 0.0 }; // mean batches queued (seen by each walker push)
+  long   walker_stalls    { 0 };   // waits of walkers for a free batch (aggregator behind)
+  long   aggregator_waits { 0 };   // waits of aggregator for a batch (walkers behind)
+};
+
+//---
+
+// Scan results
+struct CUsageScanResults {
+  using FileSpecs = std::vector<CUsageFileSpec>;
+  using DirUsages = std::vector<CUsageDirUsage>;
+  using DirTotals = std::vector<CUsageDirTotal>;
+  using DirNames  = std::vector<std::string>;
+  using DirTimes  = std::vector<CUsageDirTime>;
+  using Sample    = CUsageSampleResults;
+  using DupGroups = std::vector<CUsageDupGroup>;
+  using ColdDirs   = std::vector<CUsageColdDir>;
+  using ColdOwners = std::vector<CUsageColdOwner>;
+  using DirInodes  = std::vector<CUsageDirInodes>;
+
+  std::string directory;
+  size_t      total_usage { 0 };
+  long        num_files   { 0 };
+  long        num_dirs    { 0 };
+  FileSpecs   largest_files;      // largest first
+  FileSpecs   smallest_files;     // smallest first
+  FileSpecs   oldest_files;       // oldest first
+  FileSpecs   newest_files;       // newest first
+  DirUsages   dir_usages;         // largest first
+  DirTotals   dir_totals;         // to max depth, sub directories before parent
+  DirNames    skipped_mounts;     // mount points skipped (one file system), sorted
+  DirNames    link_loops;         // links to a directory containing them (following
+                                  // links), sorted
+  DirTimes    slowest_dirs;       // slowest first (readdir + stat time)
+  DirTimes    most_entries_dirs;  // most entries first
+  DupGroups   dup_groups;         // most wasted first
+  long        num_dup_groups { 0 }; // all duplicate groups
+  size_t      dup_wasted     { 0 }; // bytes wasted by all duplicate groups
+  FileSpecs   cold_files;         // largest first
+  ColdDirs    cold_dirs;          // most cold bytes first
+  ColdOwners  cold_owners;        // most cold bytes first
+  size_t      cold_usage     { 0 }; // bytes of all cold files
+  long        num_cold_files { 0 }; // all cold files
+  long        total_entries  { 0 }; // names below root and root (hard links per name)
+  DirInodes   inode_dirs;         // most entries first
+  DirInodes   inode_total_dirs;   // most entries (with all directories below) first
+  FileSpecs   ranked_files;       // files in rank range, in rank order
+  long        num_ranked     { 0 }; // all ranked files
+  long        first_rank     { 0 }; // rank of first ranked file
+  bool        sampled     { false };
+  Sample      sample;             // estimates (if sampled)
+  CUsagePipelineStats pipeline;   // counters (if pipelined)
+  bool        complete    { true };
+};
+
+//---
+
+// Scan data.
+//
+// Totals and file lists accumulated from the entries processed by one scan thread.
+// The data of all threads is merged at the end of the scan. Per directory usage is
+// added to the entry's directory node (which only this thread is updating).
+class CUsageScanData {
+ public:
+  CUsageScanData(const CUsageScanOptions &options, time_t current_time);
+ ~CUsageScanData();
+
+  CUsageScanData(const CUsageScanData &) = delete;
+  CUsageScanData &operator=(const CUsageScanData &) = delete;
+
+  // update from batch of entries (all from one directory)
+  void updateBatch(const CUsageEntryBatch &batch);
+
+  void updateSample(const CUsageDirEntry &entry);
+
+  void addLargestFileSpec(CUsageFileSpec *file_spec);
+  void addSmallestFileSpec(CUsageFileSpec *file_spec);
+  void addOldestFileSpec(CUsageFileSpec *file_spec);
+  void addNewestFileSpec(CUsageFileSpec *file_spec);
+  void addColdFileSpec(CUsageFileSpec *file_spec);
+
+  // add file to the largest, smallest, oldest or newest list (kept to the list's size)
+  // without the filter checks of updateBatch
+  void addListFile(CUsageRankKey key, const std::string &filename, size_t size,
+                   time_t time);
+
+  void addDirFileUsage(CUsageDirNode *, size_t);
+  void addFileUsage   (CUsageDirNode *, size_t);
+
+  time_t statTime(const struct stat *) const;
+
+  void merge(CUsageScanData &data);
+
+  void getResults(CUsageScanResults &results) const;
+
+  // set totals and file lists from (checkpoint) results
+  void setResults(const CUsageScanResults &results);
+
+  // duplicate candidates (regular files)
+  CUsageDupFinder::Files &dupFiles() { return dup_files; }
+
+  // create list of ranked listing records (kept in at most mem_limit bytes)
+  void createRankList(size_t mem_limit);
+
+  // records of ranked listing (null if none)
+  CUsageRankList *rankList() const { return rank_list; }
+
+ private:
+  using FileSpecList = std::list<CUsageFileSpec *>;
+  using SizeBuckets  = std::vector<double>;
+  using ColdOwners   = std::map<uid_t, CUsageColdOwner>;
+
+  void mergeFileSpecs(FileSpecList &list, uint num, FileSpecList &list1,
+                      void (CUsageScanData::*addProc)(CUsageFileSpec *));
+
+  bool matchRegex(const std::string &filename);
+  bool matchType(const std::string &name) const;
+
+  static bool isHidden(const std::string &filename);
+
+  bool checkDays(time_t ctime) const;
+
+  void addDir(const CUsageDirEntry &entry);
+
+  void addDupFiles (const CUsageEntryBatch &batch, const uint *inds, uint num_inds);
+  void addColdFiles(const CUsageEntryBatch &batch, const uint *inds, uint num_inds);
+  void addListFiles(CUsageRankKey key, const CUsageEntryBatch &batch, const uint *inds,
+                    uint num_inds);
+
+  void addFileSpec(FileSpecList &list, uint num, const std::string &filename, size_t size,
+                   time_t time, void (CUsageScanData::*addProc)(CUsageFileSpec *));
+
+  const CUsageScanOptions &options;
+  time_t                   current_time   { };
+  CRegExp*                 match_regex    { nullptr };
+  CRegExp*                 no_match_regex { nullptr };
+  CUsageFilter             where_filter;
+  FileSpecList             largest_file_list;
+  FileSpecList             smallest_file_list;
+  FileSpecList             oldest_file_list;
+  FileSpecList             newest_file_list;
+  FileSpecList             cold_file_list;
+  size_t                   total_usage    { 0 };
+  long                     num_files      { 0 };
+  long                     num_dirs       { 0 };
+  time_t                   cold_time      { 0 };  // files with earlier time are cold
+  size_t                   cold_usage     { 0 };
+  long                     num_cold_files { 0 };
+  ColdOwners               cold_owners;
+  SizeBuckets              sample_buckets;     // estimated files per size bucket
+  SizeBuckets              sample_bucket_vars; // variance of estimates
+  CUsageDupFinder::Files   dup_files;
+  CUsageRankList*          rank_list      { nullptr };
+  uint                     batch_sel[CUsageEntryBatch::MAX_ENTRIES]; // selected files
+  // candidates of largest, smallest, oldest, newest and cold lists
+  uint                     batch_cands[5][CUsageEntryBatch::MAX_ENTRIES];
+  CUsageFilter::Matches    batch_matches;
+};
+
+//---
+
+// Scan engine.
+//
+// Scans a directory tree (with one or more threads) and returns the totals, largest,
+// smallest, oldest and newest file lists, directory usages and directory totals
+// selected by the options.
+//
+// The engine has no global state and never prints or exits, errors are returned from
+// scan() with a message available from errorMsg(). Separate CUsageScan objects can be
+// used concurrently from different threads.
+//
+// In pipeline mode the walker threads only read directories: each full batch of
+// entries is swapped with a free one from a pool and passed through a bounded lock free
+// queue to one aggregator thread, which updates the totals, file lists and directory
+// nodes, so system call latency and aggregation overlap. The queue depth and the
+// stalls of either side are counted for tuning.
+//
+// If a checkpoint file is set the state of the scan is written to it periodically (by
+// a separate thread, the walker threads are only held while their file lists are
+// copied) and removed when the scan completes. A scan of the checkpoint's directory
+// can be resumed from the file, only the unread directories are then read.
+//
+// If a path list is set its paths are stat'ed (by the walker threads, in batches of
+// one directory's paths) instead of walking the directory, and totalled the same way.
+class CUsageScan {
+ public:
+  // Visitor called for each entry on the thread which read it (so must be thread safe
+  // if more than one thread is used). Return false to stop the scan.
+  using Visitor = std::function<bool(uint thread, const CUsageDirEntry &entry)>;
+
+ public:
+  CUsageScan(const CUsageScanOptions &options=CUsageScanOptions());
+ ~CUsageScan();
+
+  CUsageScan(const CUsageScan &) = delete;
+  CUsageScan &operator=(const CUsageScan &) = delete;
+
+  const CUsageScanOptions &options() const { return options_; }
+
+  void setVisitor(const Visitor &visitor) { visitor_ = visitor; }
+
+  void setProgress(CUsageProgress *progress) { progress_ = progress; }
+
+  void setThrottle(CUsageThrottle *throttle) { throttle_ = throttle; }
+
+  // check options are valid
+  bool checkOptions(std::string &msg) const;
+
+  // filter options in canonical form (same for scans which select the same files
+  // whenever they are run, empty if none)
+  std::string filterSignature() const;
+
+  // scan directory tree into results
+  bool scan(const std::string &dirname, CUsageScanResults &results);
+
+  // whether last scan walked the directory (false if it failed before, e.g. the
+  // checkpoint to resume from couldn't be read, so the results are empty)
+  bool isScanned() const { return scanned_; }
+
+  const std::string &errorMsg() const { return error_msg_; }
+
+  // process batch of entries (called by walker)
+  bool processBatch(uint thread, CUsageEntryBatch &batch);
+
+ private:
+  void clearData();
+
+  bool needDirResults() const;
+
+  std::string optionsSignature() const;
+
+  void restoreCheckpoint(const CUsageCheckpoint &checkpoint, CUsageDirWalk &walk,
+                         std::vector<CUsageDirNode *> &pending);
+
+  void startCheckpoints(CUsageDirWalk &walk);
+  void stopCheckpoints();
+
+  bool writeCheckpoint(CUsageDirWalk &walk, std::string &msg);
+
+  void getDirResults(CUsageDirTree &tree, CUsageScanResults &results) const;
+
+  void getDupResults(CUsageDupFinder::Files &files, CUsageScanResults &results) const;
+
+  bool isSample() const;
+
+  void getSampleResults(CUsageDirTree &tree, CUsageScanResults &results) const;
+
+  bool getRankResults(CUsageScanResults &results);
+
+  void updateData(CUsageScanData *data, const CUsageEntryBatch &batch);
+
+  void startPipeline();
+  void stopPipeline(CUsagePipelineStats &stats);
+
+  void queueBatch(CUsageEntryBatch &batch);
+
+  void runAggregator();
+
+ private:
+  struct Pipeline;
+
+  using ScanDataList = std::vector<CUsageScanData *>;
+
+  CUsageScanOptions       options_;
+  CUsageScanOptions       data_options_;            // options used by scan data
+  Visitor                 visitor_;
+  CUsageProgress*         progress_     { nullptr };
+  CUsageThrottle*         throttle_     { nullptr };
+  ScanDataList            data_list_;
+  std::string             error_msg_;
+  bool                    scanned_      { false };
+  std::string             directory_;               // directory being scanned
+  time_t                  current_time_ { 0 };      // current time of scan
+  std::thread             checkpoint_thread_;
+  std::mutex              checkpoint_mutex_;
+  std::condition_variable checkpoint_cond_;
+  bool                    checkpointing_ { false };
+  std::unique_ptr<Pipeline> pipeline_;               // pipeline state (if pipelined)
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include <CUsageThrottle.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+std::atomic<int> CUsageThrottle::adjust_ { 0 };
+
+CUsageThrottle::
+CUsageThrottle()
+{
+  ops_  .last = Clock::now();
+  bytes_.last = ops_.last;
+}
+
+void
+CUsageThrottle::
+setOpsRate(double rate)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  setRate(ops_, rate*share_);
+}
+
+void
+CUsageThrottle::
+setBytesRate(double rate)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  setRate(bytes_, rate*share_);
+}
+
+// Scale limits already set to the new share
+void
+CUsageThrottle::
+setShare(double share)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  share = std::max(share, 0.0);
+
+  if (share_ > 0.0) {
+    setRate(ops_  , ops_  .rate*share/share_);
+    setRate(bytes_, bytes_.rate*share/share_);
+  }
+
+  share_ = share;
+}
+
+// Take n tokens from bucket. If there are not enough the tokens are still taken (so
+// the bucket goes negative and later callers wait behind this one) and the caller
+// sleeps until the debt would be refilled.
+void
+CUsageThrottle::
+acquire(Bucket &bucket, double n)
+{
+  double wait = 0.0;
+
+  {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  auto now = Clock::now();
+
+  update(now);
+
+  if (bucket.rate <= 0.0)
+    return;
+
+  // refill (allow at most one second of burst)
+  double dt = std::chrono::duration<double>(now - bucket.last).count();
+
+  bucket.last   = now;
+  bucket.tokens = std::min(bucket.tokens + dt*bucket.rate, bucket.rate);
+
+  bucket.tokens -= n;
+
+  if (bucket.tokens < 0.0)
+    wait = -bucket.tokens/bucket.rate;
+  }
+
+  if (wait > 0.0)
+    std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+}
+
+// Apply pending signal adjustments and re-read control file (once a second).
+// Called with mutex locked.
+void
+CUsageThrottle::
+update(TimePoint now)
+{
+  int adjust = takeAdjust();
+
+  if (shared_adjust_) {
+    int level = shared_adjust_->load(std::memory_order_relaxed);
+
+    adjust += level - shared_level_;
+
+    shared_level_ = level;
+  }
+
+  if (adjust != 0) {
+    double scale = std::pow(2.0, adjust);
+
+    setRate(ops_  , ops_  .rate*scale);
+    setRate(bytes_, bytes_.rate*scale);
+  }
+
+  if (control_file_ != "" && now - control_time_ >= std::chrono::seconds(1)) {
+    control_time_ = now;
+
+    readControlFile();
+  }
+}
+
+// Read '<ops_per_sec> [<bytes_per_sec>]' from control file (ignored if missing or
+// invalid)
+void
+CUsageThrottle::
+readControlFile()
+{
+  FILE *fp = fopen(control_file_.c_str(), "r");
+
+  if (! fp)
+    return;
+
+  double ops_rate = 0.0, bytes_rate = 0.0;
+
+  int n = fscanf(fp, "%lf %lf", &ops_rate, &bytes_rate);
+
+  fclose(fp);
+
+  if (n >= 1 && ops_rate >= 0.0)
+    setRate(ops_, ops_rate*share_);
+
+  if (n >= 2 && bytes_rate >= 0.0)
+    setRate(bytes_, bytes_rate*share_);
+}
+
+void
+CUsageThrottle::
+setRate(Bucket &bucket, double rate)
+{
+  rate = std::max(rate, 0.0);
+
+  // start full when limit is first set, otherwise keep any debt but don't carry more
+  // than one second of tokens at the new rate
+  if (bucket.rate <= 0.0)
+    bucket.tokens = rate;
+  else
+    bucket.tokens = std::min(bucket.tokens, rate);
+
+  bucket.rate = rate;
+}
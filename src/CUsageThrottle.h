@@ -0,0 +1,86 @@
+#ifndef CUsageThrottle_H
+#define CUsageThrottle_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+// Scan rate limiter.
+//
+// Token buckets limiting the walker's metadata operations (opendir, lstat, stat) per
+// second and, optionally, the directory entry bytes read per second. Walker threads
+// take tokens before each operation and sleep when the bucket is empty.
+//
+// The limits can be changed while a scan is running: the control file (if set) is
+// re-read once a second and should contain '<ops_per_sec> [<bytes_per_sec>]', and
+// slower()/faster() (safe to call from a signal handler) halve or double both limits.
+//
+// A throttle copied into each of several worker processes is given a share of the
+// limits (including those read from the control file), and the adjustments made by
+// signals to the parent are passed to the workers through a shared counter.
+class CUsageThrottle {
+ public:
+  CUsageThrottle();
+
+  CUsageThrottle(const CUsageThrottle &) = delete;
+  CUsageThrottle &operator=(const CUsageThrottle &) = delete;
+
+  // metadata operations per second (0 = no limit)
+  void setOpsRate(double rate);
+
+  // directory entry bytes per second (0 = no limit)
+  void setBytesRate(double rate);
+
+  // fraction of the limits used by this throttle (e.g. 1/n for each of n workers)
+  void setShare(double share);
+
+  const std::string &controlFile() const { return control_file_; }
+  void setControlFile(const std::string &filename) { control_file_ = filename; }
+
+  // take tokens (sleeps until available)
+  void acquireOps(double n=1.0) { acquire(ops_, n); }
+  void acquireBytes(double n) { acquire(bytes_, n); }
+
+  // halve/double limits (async signal safe)
+  static void slower() { adjust_.fetch_sub(1, std::memory_order_relaxed); }
+  static void faster() { adjust_.fetch_add(1, std::memory_order_relaxed); }
+
+  // take pending adjustments (e.g. to pass them to workers)
+  static int takeAdjust() { return adjust_.exchange(0, std::memory_order_relaxed); }
+
+  // sum of adjustments made by another process (applied as it changes)
+  void setSharedAdjust(const std::atomic<int> *adjust) { shared_adjust_ = adjust; }
+
+ private:
+  using Clock     = std::chrono::steady_clock;
+  using TimePoint = Clock::time_point;
+
+  struct Bucket {
+    double    rate   { 0.0 };
+    double    tokens { 0.0 };
+    TimePoint last;
+  };
+
+  void acquire(Bucket &bucket, double n);
+
+  void update(TimePoint now);
+
+  void readControlFile();
+
+  static void setRate(Bucket &bucket, double rate);
+
+ private:
+  static std::atomic<int> adjust_;
+
+  std::mutex              mutex_;
+  Bucket                  ops_;
+  Bucket                  bytes_;
+  double                  share_         { 1.0 };
+  std::string             control_file_;
+  TimePoint               control_time_;
+  const std::atomic<int>* shared_adjust_ { nullptr };
+  int                     shared_level_  { 0 };    // shared adjustments applied
+};
+
+#endif